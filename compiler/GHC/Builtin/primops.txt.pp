@@ -3080,11 +3080,9 @@ primop CompactAdd "compactAdd#" GenPrimOp
    Compact# -> a -> State# RealWorld -> (# State# RealWorld, a #)
    { Recursively add a closure and its transitive closure to a
      {\texttt Compact\#} (a CNF), evaluating any unevaluated components
-     at the same time. Note: {\texttt compactAdd\#} is not thread-safe, so
-     only one thread may call {\texttt compactAdd\#} with a particular
-     {\texttt Compact\#} at any given time. The primop does not
-     enforce any mutual exclusion; the caller is expected to
-     arrange this. }
+     at the same time. Several threads may call {\texttt compactAdd\#} with
+     the same {\texttt Compact\#} at once, and will copy their data in
+     parallel. }
    with
    has_side_effects = True
    out_of_line      = True
@@ -3092,7 +3090,12 @@ primop CompactAdd "compactAdd#" GenPrimOp
 primop CompactAddWithSharing "compactAddWithSharing#" GenPrimOp
    Compact# -> a -> State# RealWorld -> (# State# RealWorld, a #)
    { Like {\texttt compactAdd\#}, but retains sharing and cycles
-   during compaction. }
+   during compaction. Unlike {\texttt compactAdd\#}, it is not
+   thread-safe: only one thread may call {\texttt compactAddWithSharing\#}
+   with a particular {\texttt Compact\#} at any given time, although
+   calls to {\texttt compactAdd\#} may run alongside it. The primop does
+   not enforce any mutual exclusion; the caller is expected to arrange
+   this. }
    with
    has_side_effects = True
    out_of_line      = True
@@ -79,9 +79,13 @@ module GHC.Compact (
   -- * Internal operations
   mkCompact,
   compactSized,
+  CompactLock,
+  withCompactLock,
   ) where
 
 import Control.Concurrent.MVar
+import Control.Exception (finally, mask)
+import Control.Monad (when)
 import GHC.Prim
 import GHC.Types
 
@@ -136,11 +140,28 @@ import GHC.Types
 -- If compaction encounters any of the above, a 'Control.Exception.CompactionFailed'
 -- exception will be thrown by the compaction operation.
 --
-data Compact a = Compact Compact# a !(MVar ())
-    -- we can *read* from a Compact without taking a lock, but only
-    -- one thread can be writing to the compact at any given time.
-    -- The MVar here is to enforce mutual exclusion among writers.
-    -- Note: the MVar protects the Compact# only, not the pure value 'a'
+data Compact a = Compact Compact# a !CompactLock
+    -- we can *read* from a Compact without taking a lock, and any number
+    -- of threads can be running 'compactAdd' at the same time, but the
+    -- other operations that write to the compact, or need it to stay
+    -- unchanged, must run one at a time (see 'CompactLock').
+    -- Note: the lock protects the Compact# only, not the pure value 'a'
+
+-- | The lock of a 'Compact'.  'compactAdd's share it with each other, and
+-- every other operation that writes to the region, or needs it to stay
+-- unchanged, takes it alone ('withCompactLock').
+data CompactLock = CompactLock
+  { lockExclusive :: !(MVar ())
+    -- ^ held by an exclusive operation, or by the running 'compactAdd's
+    -- between them: the first one in takes it and the last one out puts
+    -- it back
+  , lockAdders :: !(MVar Int)
+    -- ^ the number of running 'compactAdd's
+  , lockTurnstile :: !(MVar ())
+    -- ^ held by an exclusive operation from the moment it starts waiting,
+    -- so that new 'compactAdd's queue up behind it instead of keeping
+    -- 'lockExclusive' away from it for ever
+  }
 
 -- | Make a new 'Compact' object, given a pointer to the true
 -- underlying region.  You must uphold the invariant that @a@ lives
@@ -149,11 +170,21 @@ data Compact a = Compact Compact# a !(MVar ())
 mkCompact
   :: Compact# -> a -> State# RealWorld -> (# State# RealWorld, Compact a #)
 mkCompact compact# a s =
-  case unIO (newMVar ()) s of { (# s1, lock #) ->
-  (# s1, Compact compact# a lock #) }
+  case unIO (newMVar ()) s of { (# s1, exclusive #) ->
+  case unIO (newMVar 0) s1 of { (# s2, adders #) ->
+  case unIO (newMVar ()) s2 of { (# s3, turnstile #) ->
+  (# s3, Compact compact# a (CompactLock exclusive adders turnstile) #) }}}
  where
   unIO (IO a) = a
 
+-- | Run an operation on a 'Compact' that must not overlap with any other
+-- operation on it, 'compactAdd' included.  Once it is waiting, new
+-- 'compactAdd's wait for it to finish.
+withCompactLock :: CompactLock -> IO b -> IO b
+withCompactLock lock act =
+  withMVar (lockTurnstile lock) $ \_ ->
+    withMVar (lockExclusive lock) $ \_ -> act
+
 -- | Transfer @a@ into a new compact region, with a preallocated size (in
 -- bytes), possibly preserving sharing or not.  If you know how big the data
 -- structure in question is, you can save time by picking an appropriate block
@@ -220,10 +251,30 @@ compactWithSharing = compactSized 31268 True
 -- Behaves exactly like 'compact' with respect to sharing and what data
 -- it accepts.
 --
+-- Several threads can add to the same 'Compact' at once; with the threaded
+-- RTS they copy their data in parallel. Other operations on the 'Compact',
+-- such as 'compactAddWithSharing' or serializing it, wait for them to
+-- finish, and new adds wait for those operations in turn.
+--
 compactAdd :: Compact b -> a -> IO (Compact a)
-compactAdd (Compact compact# _ lock) a = withMVar lock $ \_ -> IO $ \s ->
-  case compactAdd# compact# a s of { (# s1, pk #) ->
-  (# s1, Compact compact# pk lock #) }
+compactAdd (Compact compact# _ lock) a =
+  withAddLock lock $ IO $ \s ->
+    case compactAdd# compact# a s of { (# s1, pk #) ->
+    (# s1, Compact compact# pk lock #) }
+
+-- | Run a 'compactAdd', which may run alongside other 'compactAdd's but
+-- not while an exclusive operation holds, or waits for, the lock of the
+-- 'Compact'.
+withAddLock :: CompactLock -> IO b -> IO b
+withAddLock (CompactLock exclusive adders turnstile) act = mask $ \restore -> do
+  -- let a waiting exclusive operation go first
+  withMVar turnstile $ \_ ->
+    modifyMVar_ adders $ \n -> do
+      when (n == 0) $ takeMVar exclusive
+      return (n + 1)
+  restore act `finally` modifyMVar_ adders (\n -> do
+    when (n == 1) $ putMVar exclusive ()
+    return (n - 1))
 
 -- | Add a value to an existing 'Compact', like 'compactAdd',
 -- but behaving exactly like 'compactWithSharing' with respect to sharing and
@@ -231,7 +282,7 @@ compactAdd (Compact compact# _ lock) a = withMVar lock $ \_ -> IO $ \s ->
 --
 compactAddWithSharing :: Compact b -> a -> IO (Compact a)
 compactAddWithSharing (Compact compact# _ lock) a =
-  withMVar lock $ \_ -> IO $ \s ->
+  withCompactLock lock $ IO $ \s ->
     case compactAddWithSharing# compact# a s of { (# s1, pk #) ->
     (# s1, Compact compact# pk lock #) }
 
@@ -254,7 +305,7 @@ isCompact !val =
 -- | Returns the size in bytes of the compact region.
 --
 compactSize :: Compact a -> IO Word
-compactSize (Compact buffer _ lock) = withMVar lock $ \_ -> IO $ \s0 ->
+compactSize (Compact buffer _ lock) = withCompactLock lock $ IO $ \s0 ->
    case compactSize# buffer s0 of (# s1, sz #) -> (# s1, W# sz #)
 
 -- | __Experimental__  This function doesn't actually resize a compact
@@ -264,6 +315,6 @@ compactSize (Compact buffer _ lock) = withMVar lock $ \_ -> IO $ \s0 ->
 --
 compactResize :: Compact a -> Word -> IO ()
 compactResize (Compact oldBuffer _ lock) (W# new_size) =
-  withMVar lock $ \_ -> IO $ \s ->
+  withCompactLock lock $ IO $ \s ->
     case compactResize# oldBuffer new_size s of
       s' -> (# s', () #)
@@ -24,6 +24,14 @@ module GHC.Compact.Serialized(
   withSerializedCompact,
   importCompact,
   importCompactByteStrings,
+  writeCompactFile,
+  mapCompactFile,
+  writeCompactFd,
+  readCompactFd,
+  CompactStream,
+  newCompactStream,
+  flushCompactStream,
+  finishCompactStream,
 ) where
 
 import GHC.Prim
@@ -33,12 +41,21 @@ import GHC.IO (unIO)
 
 import GHC.Ptr (Ptr(..), plusPtr)
 
-import Control.Concurrent
 import qualified Data.ByteString as ByteString
 import Data.ByteString.Internal(toForeignPtr)
 import Data.IORef(newIORef, readIORef, writeIORef)
-import Foreign.ForeignPtr(withForeignPtr)
+import Foreign.C.Error(throwErrnoIfMinus1_, throwErrnoIfNull,
+                       throwErrnoPathIfMinus1_, throwErrnoPathIfNull)
+import Foreign.C.String(CString)
+import Foreign.C.Types(CInt(..))
+import Foreign.ForeignPtr(FinalizerPtr, ForeignPtr, newForeignPtr,
+                          withForeignPtr)
+import Foreign.Marshal.Alloc(alloca)
 import Foreign.Marshal.Utils(copyBytes)
+import Foreign.Storable(peek)
+import GHC.Foreign(withCString)
+import GHC.IO.Encoding(getFileSystemEncoding)
+import System.Posix.Types(Fd(..))
 
 import GHC.Compact
 
@@ -86,7 +103,7 @@ mkBlockList buffer = compactGetFirstBlock buffer >>= go
 --
 withSerializedCompact :: Compact a ->
                          (SerializedCompact a -> IO c) -> IO c
-withSerializedCompact (Compact buffer root lock) func = withMVar lock $ \_ -> do
+withSerializedCompact (Compact buffer root lock) func = withCompactLock lock $ do
   rootPtr <- IO (\s -> case anyToAddr# root s of
                     (# s', rootAddr #) -> (# s', Ptr rootAddr #) )
   blockList <- mkBlockList buffer
@@ -200,3 +217,156 @@ importCompactByteStrings serialized stringList =
             copyBytes to (from `plusPtr` off) (fromIntegral size)
           writeIORef state rest
     importCompact serialized filler
+
+foreign import ccall safe "compactWriteFile"
+  c_compactWriteFile :: Ptr a -> Ptr () -> CString -> IO CInt
+
+foreign import ccall safe "compactMapFile"
+  c_compactMapFile :: CString -> Ptr (Ptr ()) -> IO (Ptr ())
+
+foreign import ccall safe "compactWriteStream"
+  c_compactWriteStream :: Ptr a -> Ptr () -> CInt -> IO CInt
+
+foreign import ccall safe "compactReadStream"
+  c_compactReadStream :: CInt -> Ptr (Ptr ()) -> IO (Ptr ())
+
+foreign import ccall safe "compactStreamOpen"
+  c_compactStreamOpen :: CInt -> IO (Ptr CompactStreamWriter)
+
+foreign import ccall safe "compactStreamFlush"
+  c_compactStreamFlush :: Ptr CompactStreamWriter -> Ptr a -> IO CInt
+
+foreign import ccall safe "compactStreamFinish"
+  c_compactStreamFinish :: Ptr CompactStreamWriter -> Ptr a -> Ptr ()
+                        -> IO CInt
+
+foreign import ccall unsafe "&compactStreamFree"
+  p_compactStreamFree :: FinalizerPtr CompactStreamWriter
+
+withFilePath :: FilePath -> (CString -> IO a) -> IO a
+withFilePath path act = do
+  enc <- getFileSystemEncoding
+  withCString enc path act
+
+-- | Save the 'Compact' to a file, from which 'mapCompactFile' can load it
+-- again.  As with 'withSerializedCompact', only the same binary can load
+-- the file.
+--
+writeCompactFile :: FilePath -> Compact a -> IO ()
+writeCompactFile path c =
+  withSerializedCompact c $ \(SerializedCompact blocks root) ->
+    case blocks of
+      [] -> return ()   -- a Compact always has a block
+      (firstBlock, _) : _ ->
+        withFilePath path $ \cpath ->
+          throwErrnoPathIfMinus1_ "writeCompactFile" path $
+            c_compactWriteFile firstBlock root cpath
+
+-- | Load a 'Compact' saved by 'writeCompactFile'.  Where the platform
+-- allows it, the file is mapped into the heap instead of being copied, and
+-- if the 'Compact' can be put back at the address it was saved from, it
+-- is not even read until it is used.  Processes mapping the same file
+-- share the memory holding it.
+--
+-- Like 'importCompact', 'mapCompactFile' returns Nothing if the 'Compact'
+-- had pointers that could not be adjusted.  It throws an 'IOError' if the
+-- file cannot be read or was not saved by this binary.
+--
+mapCompactFile :: FilePath -> IO (Maybe (Compact a))
+mapCompactFile path =
+  withFilePath path $ \cpath -> alloca $ \proot -> do
+    Ptr firstBlock <- throwErrnoPathIfNull "mapCompactFile" path $
+      c_compactMapFile cpath proot
+    Ptr rootAddr <- peek proot
+    IO (fixupPointers firstBlock rootAddr)
+
+-- | Write the 'Compact' to a file descriptor, from which 'readCompactFd'
+-- can read it back.  The blocks of the 'Compact' are written straight from
+-- the heap, each with its address, its size and a checksum, and the
+-- descriptor is never seeked, so it may be a pipe or a socket.  As with
+-- 'withSerializedCompact', only the same binary can read the 'Compact'.
+--
+-- The descriptor must be in blocking mode.  The 'Compact' is written as it
+-- stands when 'writeCompactFd' is called: adds to it wait until
+-- 'writeCompactFd' returns.  To start writing a 'Compact' while it is
+-- still being built, use 'newCompactStream' instead.
+--
+writeCompactFd :: Fd -> Compact a -> IO ()
+writeCompactFd (Fd fd) c =
+  withSerializedCompact c $ \(SerializedCompact blocks root) ->
+    case blocks of
+      [] -> return ()   -- a Compact always has a block
+      (firstBlock, _) : _ ->
+        throwErrnoIfMinus1_ "writeCompactFd" $
+          c_compactWriteStream firstBlock root fd
+
+-- | Read a 'Compact' written by 'writeCompactFd', or through a
+-- 'CompactStream', from a file descriptor.  Each block is read straight
+-- into the heap as it arrives, at the address it was written from if that
+-- is free, and checked against its checksum.  Nothing after the end of the
+-- 'Compact' is read from the descriptor.
+--
+-- Like 'importCompact', 'readCompactFd' returns Nothing if the 'Compact'
+-- had pointers that could not be adjusted.  It throws an 'IOError' if the
+-- descriptor cannot be read, or if what it holds is damaged or was not
+-- written by this binary.  The descriptor must be in blocking mode.
+--
+readCompactFd :: Fd -> IO (Maybe (Compact a))
+readCompactFd (Fd fd) =
+  alloca $ \proot -> do
+    Ptr firstBlock <- throwErrnoIfNull "readCompactFd" $
+      c_compactReadStream fd proot
+    Ptr rootAddr <- peek proot
+    IO (fixupPointers firstBlock rootAddr)
+
+data CompactStreamWriter
+
+-- | A 'Compact' being written to a file descriptor while it is built: see
+-- 'newCompactStream'.
+data CompactStream =
+  CompactStream Compact# CompactLock (ForeignPtr CompactStreamWriter)
+
+-- | Start writing the 'Compact' to a file descriptor, in the format
+-- 'writeCompactFd' uses.  Add to the 'Compact' as usual, and call
+-- 'flushCompactStream' now and then to write the blocks which have filled
+-- up so far; 'finishCompactStream' writes the rest.  'readCompactFd' reads
+-- the 'Compact' back.
+--
+-- The descriptor must be in blocking mode, and nothing else may be written
+-- to it until the stream is finished.
+--
+newCompactStream :: Fd -> Compact a -> IO CompactStream
+newCompactStream (Fd fd) (Compact buffer _ lock) = do
+  w <- throwErrnoIfNull "newCompactStream" $ c_compactStreamOpen fd
+  fp <- newForeignPtr p_compactStreamFree w
+  return (CompactStream buffer lock fp)
+
+-- | Write the blocks of the 'Compact' which have filled up since the
+-- stream was started or last flushed.  Adds to the 'Compact' wait while
+-- the blocks are written, and go on in new blocks afterwards.
+--
+flushCompactStream :: CompactStream -> IO ()
+flushCompactStream (CompactStream buffer lock fp) =
+  withCompactLock lock $ withForeignPtr fp $ \w -> do
+    (firstBlock, _) <- compactGetFirstBlock buffer
+    throwErrnoIfMinus1_ "flushCompactStream" $ IO $ \s ->
+      keepAlive# buffer s (unIO $ c_compactStreamFlush w firstBlock)
+
+-- | Write the rest of the 'Compact', and end the stream with the value
+-- 'readCompactFd' is to return, which must be in the 'Compact' of the
+-- stream (for instance, the result of a 'compactAdd' to it).  The stream
+-- must not be used afterwards.
+--
+finishCompactStream :: CompactStream -> Compact a -> IO ()
+finishCompactStream (CompactStream buffer lock fp) (Compact _ !root _) = do
+  inside <- IO (\s -> case compactContains# buffer root s of
+                  (# s', v #) -> (# s', isTrue# v #) )
+  if not inside
+    then ioError (userError "finishCompactStream: the root is not in the \
+                            \Compact being written")
+    else withCompactLock lock $ withForeignPtr fp $ \w -> do
+      (firstBlock, _) <- compactGetFirstBlock buffer
+      rootPtr <- IO (\s -> case anyToAddr# root s of
+                        (# s', rootAddr #) -> (# s', Ptr rootAddr #) )
+      throwErrnoIfMinus1_ "finishCompactStream" $ IO $ \s ->
+        keepAlive# buffer s (unIO $ c_compactStreamFinish w firstBlock rootPtr)
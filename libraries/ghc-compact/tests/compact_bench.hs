@@ -1,5 +1,8 @@
 import Control.Exception
 import GHC.Compact
+import GHC.Compact.Serialized
+import Data.ByteString (packCStringLen)
+import Foreign.Ptr
 import qualified Data.Map as Map
 import Data.Time.Clock
 import Text.Printf
@@ -7,7 +10,8 @@ import System.Environment
 import System.Mem
 import Control.DeepSeq
 
--- Benchmark compact against compactWithSharing. e.g.
+-- Benchmark compact against compactWithSharing, and importing a compact
+-- at a different address (which has to fix up every pointer in it). e.g.
 --   ./compact_bench 1000000
 
 main = do
@@ -16,6 +20,16 @@ main = do
   evaluate (force m)
   timeIt "compact" $ compact m >>= compactSize >>= print
   timeIt "compactWithSharing" $ compactWithSharing m >>= compactSize >>= print
+  c <- compact m
+  (sc, bss) <- withSerializedCompact c $ \sc -> do
+    bss <- mapM (\(p, size) -> packCStringLen (castPtr p, fromIntegral size))
+                (serializedCompactBlockList sc)
+    return (sc, bss)
+  -- c is still alive, so the import can't reuse its addresses
+  timeIt "importCompactByteStrings" $ do
+    Just c' <- importCompactByteStrings sc bss
+    print (Map.size (getCompact c'))
+  print (Map.size (getCompact c))
 
 timeIt :: String -> IO a -> IO a
 timeIt str io = do
@@ -0,0 +1,50 @@
+import Control.Concurrent
+import Control.Monad
+import Data.List (findIndex, nub)
+import GHC.Compact
+import GHC.Compact.Serialized
+import GHC.Ptr (Ptr, plusPtr)
+import qualified Data.Map as Map
+import System.Mem
+
+-- Several threads on different capabilities adding large values to one
+-- compact at once, with a sharing-preserving add which has to wait for them.
+
+value :: Int -> Map.Map Int [Int]
+value i = Map.fromList [(x, [x, i]) | x <- [i * 10000 .. i * 10000 + 5000]]
+
+add :: Compact () -> Int -> IO (Compact (Map.Map Int [Int], Map.Map Int [Int]))
+add c 1 = compactAddWithSharing c (let x = value 1 in (x, x))
+add c i = compactAdd c (value i, value i)
+
+rootOf :: Compact a -> IO (Ptr ())
+rootOf r = withSerializedCompact r (return . serializedCompactRoot)
+
+main :: IO ()
+main = do
+  c <- compact ()
+  ms <- forM [1..8] $ \i -> do
+    m <- newEmptyMVar
+    _ <- forkOn i $ do
+      r <- add c i
+      (cap, _) <- threadCapability =<< myThreadId
+      putMVar m (r, cap)
+    return m
+  (rs, caps) <- unzip <$> mapM takeMVar ms
+  performMajorGC
+  forM_ (zip [1..] rs) $ \(i, r) -> do
+    let (a, b) = getCompact r
+    ok <- inCompact c a
+    when (not ok || a /= value i || b /= value i) $
+      putStrLn ("wrong value " ++ show i)
+  print (length rs)
+
+  -- the adds ran on several capabilities, and their values went into
+  -- several different blocks of the region
+  blocks <- withSerializedCompact c (return . serializedCompactBlockList)
+  roots <- mapM rootOf rs
+  let blockOf p = findIndex (\(start, size) ->
+                    p >= start && p < start `plusPtr` fromIntegral size)
+                    blocks
+  print (length (nub caps) > 1)
+  print (length (nub (map blockOf roots)) > 1)
@@ -0,0 +1,65 @@
+module Main where
+
+import Control.Exception
+import System.Mem
+
+import qualified Data.Map as Map
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+load :: FilePath -> IO (Compact (Map.Map Int String))
+load path = do
+  mcnf <- mapCompactFile path
+  case mcnf of
+    Nothing -> throwIO $ AssertionFailed "mapCompactFile failed"
+    Just cnf -> return cnf
+
+-- Write a compact of val which is garbage once we return
+{-# NOINLINE save #-}
+save :: FilePath -> Map.Map Int String -> IO ()
+save path val = do
+  cnf <- compactSized 4096 False val
+  writeCompactFile path cnf
+
+main = do
+  let path = "compact_mmap.cnf"
+      val = Map.fromList [ (i, show i) | i <- [1..20000] ]
+
+  -- once the original is gone its blocks are free, so the file is mapped
+  -- back at the addresses it was written from and needs no fixup
+  save "compact_mmap_same.cnf" val
+  performMajorGC
+  same <- load "compact_mmap_same.cnf"
+  assertEquals val (getCompact same)
+  performMajorGC
+  assertEquals val (getCompact same)
+
+  -- small blocks, so that several of them share a megablock
+  cnf <- compactSized 4096 False val
+  writeCompactFile path cnf
+
+  -- the original is still alive, so the blocks have to move
+  moved <- load path
+  assertEquals val (getCompact moved)
+  assertEquals val (getCompact cnf)
+
+  performMajorGC
+  assertEquals val (getCompact moved)
+
+  -- a file from another binary, or not a compact at all, is rejected
+  writeFile "compact_mmap.txt" (replicate 100 'x')
+  r <- try (mapCompactFile "compact_mmap.txt")
+          :: IO (Either IOException (Maybe (Compact ())))
+  case r of
+    Left _ -> return ()
+    Right _ -> assertFail "loaded a file which is not a compact"
@@ -0,0 +1,86 @@
+module Main where
+
+import Control.Exception
+import Control.Monad
+import System.IO (IOMode(..))
+import System.Mem
+import System.Posix.Types (Fd(..))
+
+import qualified Data.ByteString as B
+import qualified Data.Map as Map
+import qualified GHC.IO.Device as Device
+import qualified GHC.IO.FD as FD
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+withFd :: FilePath -> IOMode -> (Fd -> IO a) -> IO a
+withFd path mode act =
+  bracket (fst <$> FD.openFile path mode False) Device.close $ \fd ->
+    act (Fd (FD.fdFD fd))
+
+load :: FilePath -> IO (Compact (Map.Map Int String))
+load path = do
+  mcnf <- withFd path ReadMode readCompactFd
+  case mcnf of
+    Nothing -> throwIO $ AssertionFailed "readCompactFd failed"
+    Just cnf -> return cnf
+
+main = do
+  let path = "compact_stream.cnf"
+      val = Map.fromList [ (i, show i) | i <- [1..20000] ]
+
+  cnf <- compactSized 4096 False val
+  withFd path WriteMode $ \fd -> writeCompactFd fd cnf
+
+  -- the original is still alive, so the blocks have to move
+  moved <- load path
+  assertEquals val (getCompact moved)
+  assertEquals val (getCompact cnf)
+
+  performMajorGC
+  assertEquals val (getCompact moved)
+
+  -- a region written out while it is built
+  let chunks = [ Map.fromList [ (i, show i) | i <- [j + 1 .. j + 1000] ]
+               | j <- [0, 1000 .. 19000] ]
+  building <- compactSized 4096 False ()
+  sizes <- withFd path WriteMode $ \fd -> do
+    stream <- newCompactStream fd building
+    parts <- forM chunks $ \chunk -> do
+      part <- compactAdd building chunk
+      flushCompactStream stream
+      return (getCompact part)
+    written <- B.length <$> B.readFile path
+    root <- compactAdd building parts
+    finishCompactStream stream root
+    total <- B.length <$> B.readFile path
+    return (written, total)
+  -- most of the region was written before it was finished
+  when (2 * fst sizes < snd sizes) $
+    assertFail ("only " ++ show sizes ++ " bytes written while building")
+  streamed <- withFd path ReadMode readCompactFd
+  case streamed of
+    Nothing -> assertFail "readCompactFd failed on a stream"
+    Just c -> assertEquals chunks (getCompact c)
+
+  -- a damaged stream is rejected
+  bytes <- B.readFile path
+  let i = B.length bytes - 100
+      damaged = B.concat [ B.take i bytes
+                         , B.singleton (B.index bytes i + 1)
+                         , B.drop (i + 1) bytes ]
+  B.writeFile path damaged
+  r <- try (load path)
+  case r of
+    Left e -> let _ = e :: IOException in return ()
+    Right _ -> assertFail "read a damaged stream"
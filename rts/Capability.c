@@ -88,13 +88,108 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+/* Note [Spark steal policies]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   When a Capability has no sparks of its own, findSpark() visits the other
+   Capabilities and tries to steal from their spark pools. The order in which
+   the victims are visited is chosen by --spark-steal=<policy>:
+
+     sequential: visit capabilities 0..n-1 in turn. On a large machine every
+       idle capability then starts by hammering the pools of the same few
+       low-numbered capabilities, and crosses NUMA nodes needlessly.
+
+     random: start at a pseudo-random capability and wrap around, so thieves
+       spread themselves over the victims.
+
+     numa: like random, but first visit the capabilities on our own NUMA node
+       (cap->node), and only then the remote ones, so that stolen sparks (and
+       the data they refer to) tend to stay node-local.
+
+     last: start at the capability we last stole from successfully, on the
+       grounds that a pool that had sparks recently probably still has some.
+
+   Every policy visits each other capability at most once per round, so the
+   retry logic (we lost a race with another thief) is the same for all of
+   them. The random state is per-capability and only touched by the owner,
+   so victim selection needs no synchronisation.
+
+   Per-capability counters (SparkStealCounters) are emitted alongside the
+   spark counters as EVENT_SPARK_STEAL_COUNTERS, tagged with the policy, and
+   summarised by +RTS -s.
+*/
+
+STATIC_INLINE uint32_t
+sparkStealRandom (Capability *cap)
+{
+    // xorshift32
+    uint32_t x = cap->spark_steal_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cap->spark_steal_seed = x;
+    return x;
+}
+
+// The capability at which findSpark() starts looking for a victim.
+static uint32_t
+sparkStealStart (Capability *cap)
+{
+    switch (RtsFlags.ParFlags.sparkStealPolicy) {
+    case SPARK_STEAL_RANDOM:
+    case SPARK_STEAL_NUMA:
+        return sparkStealRandom(cap) % n_capabilities;
+    case SPARK_STEAL_LAST_VICTIM:
+        // n_capabilities may have shrunk since the last steal
+        return cap->spark_steal_victim % n_capabilities;
+    case SPARK_STEAL_SEQUENTIAL:
+    default:
+        return 0;
+    }
+}
+
+// Try to steal a spark from robbed's pool, discarding fizzled sparks on the
+// way. Sets *retry if we conflicted with another thief.
+static StgClosure *
+stealSparkFrom (Capability *cap, Capability *robbed, bool *retry)
+{
+    StgClosure *spark;
+
+    cap->spark_steal_stats.attempts++;
+
+    spark = tryStealSpark(robbed->sparks);
+    while (spark != NULL && fizzledSpark(spark)) {
+        cap->spark_stats.fizzled++;
+        traceEventSparkFizzle(cap);
+        spark = tryStealSpark(robbed->sparks);
+    }
+    if (spark == NULL) {
+        if (!emptySparkPoolCap(robbed)) {
+            // we conflicted with another thread while trying to steal;
+            // try again later.
+            *retry = true;
+        }
+        return NULL;
+    }
+
+    cap->spark_stats.converted++;
+    cap->spark_steal_stats.stolen++;
+    if (robbed->node == cap->node) {
+        cap->spark_steal_stats.local++;
+    }
+    cap->spark_steal_victim = robbed->no;
+    traceEventSparkSteal(cap, robbed->no);
+
+    return spark;
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
   Capability *robbed;
   StgClosurePtr spark;
   bool retry;
-  uint32_t i = 0;
+  bool numa_first;
+  uint32_t i, n, start, pass;
 
   // This is an approximate check so relaxed load is acceptable here.
   if (!emptyRunQueue(cap) || RELAXED_LOAD(&cap->n_returning_tasks) != 0) {
@@ -104,6 +199,9 @@ findSpark (Capability *cap)
       return 0;
   }
 
+  numa_first = RtsFlags.ParFlags.sparkStealPolicy == SPARK_STEAL_NUMA
+               && n_numa_nodes > 1;
+
   do {
       retry = false;
 
@@ -131,44 +229,40 @@ findSpark (Capability *cap)
           retry = true;
       }
 
-      if (n_capabilities == 1) { return NULL; } // makes no sense...
+      n = n_capabilities;
+      if (n == 1) { return NULL; } // makes no sense...
 
       debugTrace(DEBUG_sched,
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
-      for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
-          if (cap == robbed)  // ourselves...
-              continue;
-
-          if (emptySparkPoolCap(robbed)) // nothing to steal here
-              continue;
-
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
+      // Visit the other capabilities in the order given by the steal
+      // policy until a theft succeeds. With the numa policy the first pass
+      // only considers our own node and the second pass the remote ones.
+      // See Note [Spark steal policies].
+      start = sparkStealStart(cap);
+      for (pass = numa_first ? 0 : 1; pass < 2; pass++) {
+          for (i = 0; i < n; i++) {
+              robbed = capabilities[(start + i) % n];
+              if (cap == robbed)  // ourselves...
+                  continue;
+
+              if (numa_first && (robbed->node == cap->node) != (pass == 0))
+                  continue;
+
+              if (emptySparkPoolCap(robbed)) // nothing to steal here
+                  continue;
+
+              spark = stealSparkFrom(cap, robbed, &retry);
+              if (spark != NULL) {
+                  return spark;
+              }
+              // otherwise: no success, try next one
           }
-          if (spark == NULL && !emptySparkPoolCap(robbed)) {
-              // we conflicted with another thread while trying to steal;
-              // try again later.
-              retry = true;
-          }
-
-          if (spark != NULL) {
-              cap->spark_stats.converted++;
-              traceEventSparkSteal(cap, robbed->no);
-
-              return spark;
-          }
-          // otherwise: no success, try next one
       }
   } while (retry);
 
+  cap->spark_steal_stats.failed++;
   debugTrace(DEBUG_sched, "No sparks stolen");
   return NULL;
 }
@@ -278,6 +372,17 @@ initCapability (Capability *cap, uint32_t i)
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->spark_steal_victim     = i;
+    cap->spark_steal_seed       = 2654435761u * (i + 1);
+    cap->spark_steal_stats.attempts = 0;
+    cap->spark_steal_stats.stolen   = 0;
+    cap->spark_steal_stats.local    = 0;
+    cap->spark_steal_stats.failed   = 0;
+    cap->stable_ptr_cache.n_free        = 0;
+    cap->stable_ptr_stats.allocs        = 0;
+    cap->stable_ptr_stats.frees         = 0;
+    cap->stable_ptr_stats.locked        = 0;
+    cap->stable_ptr_stats.contended     = 0;
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
 #endif
@@ -310,11 +415,27 @@ initCapability (Capability *cap, uint32_t i)
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
+    cap->stm_stats.commits = 0;
+    cap->stm_stats.snapshot_commits = 0;
+    cap->stm_stats.aborts = 0;
+    cap->stm_stats.validations = 0;
+    cap->stm_stats.deferred = 0;
+    cap->stm_stats.serialized = 0;
+    cap->stm_stats.max_aborts = 0;
+#if defined(THREADED_RTS)
+    cap->stm_restart_thread = 0;
+    cap->stm_restart_aborts = 0;
+    cap->stm_backoff_seed = 2246822519u * (i + 1);
+#endif
     cap->context_switch = 0;
     cap->interrupt = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
     cap->pinned_object_empty = NULL;
+    initBlockCache(&cap->block_cache, cap->node);
+    cap->compact_str = NULL;
+    cap->compact_bd = NULL;
+    cap->compact_lim = NULL;
 
 #if defined(PROFILING)
     cap->r.rCCCS = CCS_SYSTEM;
@@ -1233,6 +1354,7 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         }
 
         traceSparkCounters(cap);
+        traceStmCounters(cap);
         RELEASE_LOCK(&cap->lock);
         break;
     }
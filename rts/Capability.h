@@ -24,6 +24,9 @@
 #include "Task.h"
 #include "Sparks.h"
 #include "sm/NonMovingMark.h" // for MarkQueue
+#include "StablePtr.h"
+#include "sm/BlockAlloc.h"
+#include "STM.h"
 
 #include "BeginPrivate.h"
 
@@ -96,6 +99,17 @@ struct Capability_ {
     // empty pinned object blocks, to be allocated into
     bdescr *pinned_object_empty;
 
+    // free blocks owned by this capability, see
+    // Note [Per-capability block caches] in BlockAlloc.c
+    BlockCache block_cache;
+
+    // the compact region this capability is appending to, the block it
+    // claimed in it and the end of that block, see
+    // Note [Concurrent compactAdd] in sm/CNF.c
+    StgCompactNFData *compact_str;
+    bdescr *compact_bd;
+    StgPtr compact_lim;
+
     // per-capability weak pointer list associated with nursery (older
     // lists stored in generation object)
     StgWeak *weak_ptr_list_hd;
@@ -157,6 +171,16 @@ struct Capability_ {
 
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
+
+    // Spark stealing state, see Note [Spark steal policies]
+    uint32_t spark_steal_victim;   // last capability we stole from
+    uint32_t spark_steal_seed;     // xorshift state for victim selection
+    SparkStealCounters spark_steal_stats;
+
+    // Free stable pointer table entries owned by this capability, see
+    // Note [Per-capability stable pointer caches]
+    StablePtrCache stable_ptr_cache;
+    StablePtrStats stable_ptr_stats;
 #if !defined(mingw32_HOST_OS)
     // IO manager for this cap
     int io_manager_control_wr_fd;
@@ -168,6 +192,13 @@ struct Capability_ {
     StgTRecChunk *free_trec_chunks;
     StgTRecHeader *free_trec_headers;
     uint32_t transaction_tokens;
+    StmCounters stm_stats;
+#if defined(THREADED_RTS)
+    // See Note [STM contention management]
+    StgThreadID stm_restart_thread;   // thread restarting after an abort
+    StgWord stm_restart_aborts;       // ... and its number of aborts
+    uint32_t stm_backoff_seed;        // xorshift state for backoff delays
+#endif
 } // typedef Capability is defined in RtsAPI.h
   // We never want a Capability to overlap a cache line with anything
   // else, so round it up to a cache line size:
@@ -425,7 +456,7 @@ recordMutableCap (const StgClosure *p, Capability *cap, uint32_t gen)
     bd = cap->mut_lists[gen];
     if (RELAXED_LOAD(&bd->free) >= bd->start + BLOCK_SIZE_W) {
         bdescr *new_bd;
-        new_bd = allocBlockOnNode_lock(cap->node);
+        new_bd = allocBlockOnCap_lock(cap);
         new_bd->link = bd;
         new_bd->free = new_bd->start;
         bd = new_bd;
@@ -3,9 +3,8 @@
  * (c) The AQUA Project, Glasgow University, 1995-1998
  * (c) The GHC Team, 1999
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open addressing hash tables with Robin Hood hashing and backward shift
+ * deletion.  See Note [Robin Hood hash tables].
  * -------------------------------------------------------------------------- */
 
 #include "rts/PosixSource.h"
@@ -32,37 +31,82 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
-
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
-
-
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+#define HMINSIZE    64      /* Initial (and minimum) number of slots */
+#define HLOAD_NUM   3       /* Maximum load factor of the table is */
+#define HLOAD_DEN   4       /* HLOAD_NUM / HLOAD_DEN */
+
+/* Note [Robin Hood hash tables]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A HashTable is a single power-of-two sized array of HashEntry slots,
+   probed linearly.  Each occupied slot records the hash of its key and its
+   probe sequence length (psl): 1 if the entry sits in its home slot
+   (the top bits of the hash), 2 if it sits in the slot after that, and so on.  An empty
+   slot has psl 0.  Compared to the linear hash table with separate chaining
+   that we used to have, a lookup touches one or two cache lines instead of
+   chasing a list of HashList cells, and there is no per-entry allocation.
+
+   Insertion uses Robin Hood hashing: while probing for a free slot, an entry
+   that is further from its home than the occupant of the slot we are looking
+   at ("poorer") takes that slot, and the occupant continues the search
+   instead.  This keeps the variance of probe lengths small and gives us an
+   early-exit condition for lookups: as soon as we reach a slot whose psl is
+   smaller than the distance we have probed, the key cannot be in the table.
+
+   Deletion uses backward shift: the entries following the deleted one are
+   moved one slot back until we reach an empty slot or an entry that is in
+   its home slot.  So there are no tombstones and lookups never degrade.
+
+   The table is a multimap: inserting a key that is already present adds a
+   second entry rather than replacing the first, and removeHashTable() with a
+   non-NULL data argument removes the matching (key, data) pair.  Callers rely
+   on a newer entry shadowing an older one for the same key, so an insertion
+   also displaces an existing entry with the same hash and the same psl (i.e.
+   the same home slot); lookups then find the most recent entry first.
+   growTable() reinserts entries in probe order without that rule, which
+   preserves the order of entries with equal hashes.
+
+   Since we store the full hash with every entry, a lookup only calls the
+   CompareFunction (e.g. strcmp() for StrHashTables) on a hash match, and
+   growing the table does not need to rehash any keys.
+*/
+
+/* Note [Concurrent hash table reads]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A table allocated with allocConcurrentHashTable() may be read with
+   lookupHashTableConcurrent() without holding the lock that serialises its
+   writers.  We use a sequence lock: writers make table->seq odd for the
+   duration of an update, and a reader retries its lookup if it saw an odd
+   sequence number or if the sequence number changed while it was probing.
+
+   A reader might still be probing the old slot array while a writer grows
+   the table, so when a concurrent table grows its old slot array is kept on
+   the `retired` list of the new one and only freed by freeHashTable().  The
+   total size of the retired arrays is bounded by the size of the live one.
+
+   Only word keys are supported: with a torn view of the table a reader may
+   compare against a key that has since been removed, which is harmless for
+   a word but not for a string that the caller may already have freed.
+*/
+
+typedef struct {
     StgWord key;
     const void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
+    StgWord32 hash;         /* hash of the key, see Note [Robin Hood hash tables] */
+    StgWord32 psl;          /* probe sequence length; 0 <=> empty slot */
+} HashEntry;
 
-typedef struct chunklist {
-  struct chunklist *next;
-} HashListChunk;
+typedef struct hashslots {
+    StgWord mask;               /* Number of slots - 1 */
+    StgWord shift;              /* 32 - log2(number of slots) */
+    struct hashslots *retired;  /* See Note [Concurrent hash table reads] */
+    HashEntry slot[];
+} HashSlots;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
+    HashSlots *slots;
     int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;      /* list of HashListChunks so we can later free them */
+    bool concurrent;        /* Allocated by allocConcurrentHashTable() */
+    StgWord seq;            /* See Note [Concurrent hash table reads] */
 };
 
 /* Create an identical structure, but is distinct on a type level,
@@ -72,29 +116,26 @@ struct hashtable {
 struct strhashtable { struct hashtable table; };
 
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions.  These return a hash of the key, which is independent of
+ * the size of the table; the table argument is only there for backwards
+ * compatibility with custom HashFunctions, which call these.
  * -------------------------------------------------------------------------- */
 int
-hashWord(const HashTable *table, StgWord key)
+hashWord(const HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
-
-    /* Strip the boring zero bits */
-    key >>= sizeof(StgWord);
-
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+    /* Fibonacci hashing: the multiplication spreads the bits of the key
+       (whose low bits are usually zero for pointers) over the high bits of
+       the product, which we then use as the hash.  The table is indexed by
+       the top bits of the hash. */
+#if SIZEOF_VOID_P == 8
+    return (int) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+#else
+    return (int) (key * 0x9E3779B9U);
+#endif
 }
 
 int
-hashStr(const HashTable *table, StgWord w)
+hashStr(const HashTable *table STG_UNUSED, StgWord w)
 {
     const char *key = (char*) w;
 #if defined(x86_64_HOST_ARCH)
@@ -102,16 +143,7 @@ hashStr(const HashTable *table, StgWord w)
 #else
     StgWord h = XXH32 (key, strlen(key), 1048583);
 #endif
-
-    /* Mod the size of the hash table (a power of 2) */
-    int bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
-    }
-
-    return bucket;
+    return (int) h;
 }
 
 STATIC_INLINE int
@@ -126,102 +158,153 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
-
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Sequence lock for concurrent tables.
+ * See Note [Concurrent hash table reads].
  * -------------------------------------------------------------------------- */
 
 STATIC_INLINE void
-allocSegment(HashTable *table, int segment)
+beginUpdate(HashTable *table)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
+    if (table->concurrent) {
+        RELAXED_STORE(&table->seq, table->seq + 1);
+        write_barrier();
+    }
 }
 
+STATIC_INLINE void
+endUpdate(HashTable *table)
+{
+    if (table->concurrent) {
+        RELEASE_STORE(&table->seq, table->seq + 1);
+    }
+}
+
+/* The home slot of an entry.  We index by the top bits of the hash, which is
+   what Fibonacci hashing (see hashWord) needs, and means that doubling the
+   table maps home slot i to 2i or 2i+1. */
+#define HOME(slots, hash) ((StgWord) ((hash) >> (slots)->shift))
 
 /* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
+ * Allocate an array of n empty slots.  n must be a power of two.
+ * -------------------------------------------------------------------------- */
+
+static HashSlots *
+allocSlots(StgWord n)
+{
+    HashSlots *slots;
+
+    slots = stgMallocBytes(sizeof(HashSlots) + n * sizeof(HashEntry),
+                           "allocSlots");
+    slots->mask = n - 1;
+    slots->shift = 32;
+    while (n > 1) {
+        slots->shift--;
+        n >>= 1;
+    }
+    slots->retired = NULL;
+    memset(slots->slot, 0, (slots->mask + 1) * sizeof(HashEntry));
+    return slots;
+}
+
+static void
+freeSlots(HashSlots *slots)
+{
+    while (slots != NULL) {
+        HashSlots *retired = slots->retired;
+        stgFree(slots);
+        slots = retired;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Put an entry into the slot array, displacing richer entries on the way.
+ * If newest_first is set, the entry also displaces entries with the same
+ * hash.  An entry that has been displaced always goes before the entries with
+ * the same hash that follow it, so that their order is preserved.
+ * See Note [Robin Hood hash tables].
  * -------------------------------------------------------------------------- */
 
 STATIC_INLINE void
-expand(HashTable *table, HashFunction f)
+placeEntry(HashSlots *slots, StgWord key, const void *data, StgWord32 hash,
+           bool newest_first)
+{
+    HashEntry e = { .key = key, .data = data, .hash = hash, .psl = 1 };
+    StgWord i = HOME(slots, hash);
+    bool ahead = newest_first;
+
+    for (;;) {
+        HashEntry *s = &slots->slot[i];
+        if (s->psl == 0) {
+            *s = e;
+            return;
+        }
+        if (s->psl < e.psl ||
+            (ahead && s->psl == e.psl && s->hash == e.hash)) {
+            HashEntry tmp = *s;
+            *s = e;
+            e = tmp;
+            ahead = true;
+        }
+        e.psl++;
+        i = (i + 1) & slots->mask;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Double the size of the table.
+ * -------------------------------------------------------------------------- */
+
+static void
+growTable(HashTable *table)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-        allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+    HashSlots *old = table->slots;
+    HashSlots *new = allocSlots(2 * (old->mask + 1));
+    StgWord start = 0;
+
+    /* Start at the beginning of a cluster, so that we reinsert entries in
+       probe order and entries with equal hashes keep their order. There is
+       always an empty slot, so this terminates. */
+    while (old->slot[start].psl > 1) {
+        start++;
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (f(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+
+    for (StgWord j = 0; j <= old->mask; j++) {
+        HashEntry *e = &old->slot[(start + j) & old->mask];
+        if (e->psl != 0) {
+            placeEntry(new, e->key, e->data, e->hash, false);
         }
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
 
-    return;
+    if (table->concurrent) {
+        // Readers may still be looking at the old slots
+        new->retired = old;
+        RELEASE_STORE(&table->slots, new);
+    } else {
+        table->slots = new;
+        stgFree(old);
+    }
 }
 
 STATIC_INLINE void*
 lookupHashTable_inlined(const HashTable *table, StgWord key,
                         HashFunction f, CompareFunction cmp)
 {
-    int bucket;
-    int segment;
-    int index;
-
-    HashList *hl;
-
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key))
-            return (void *) hl->data;
+    const HashSlots *slots = table->slots;
+    StgWord32 hash = (StgWord32) f(table, key);
+    StgWord i = HOME(slots, hash);
+
+    for (StgWord32 psl = 1; ; psl++) {
+        const HashEntry *s = &slots->slot[i];
+        if (s->psl < psl) {
+            /* It's not there */
+            return NULL;
+        }
+        if (s->hash == hash && cmp(s->key, key)) {
+            return (void *) s->data;
+        }
+        i = (i + 1) & slots->mask;
     }
-
-    /* It's not there */
-    return NULL;
 }
 
 void *
@@ -244,114 +327,94 @@ lookupStrHashTable(const StrHashTable* table, const char* key)
                                    hashStr, compareStr);
 }
 
+/* -----------------------------------------------------------------------------
+ * Lookup without holding the writers' lock.
+ * See Note [Concurrent hash table reads].
+ * -------------------------------------------------------------------------- */
+
+void *
+lookupHashTableConcurrent(const HashTable *table, StgWord key)
+{
+    StgWord32 hash = (StgWord32) hashWord(table, key);
+
+    ASSERT(table->concurrent);
+
+    for (;;) {
+        StgWord seq = ACQUIRE_LOAD(&table->seq);
+        if (seq & 1) {
+            // a writer is updating the table
+#if defined(THREADED_RTS)
+            busy_wait_nop();
+#endif
+            continue;
+        }
+
+        const HashSlots *slots = ACQUIRE_LOAD(&table->slots);
+        StgWord i = HOME(slots, hash);
+        void *result = NULL;
+
+        // The psl bound stops us looping forever on a torn view of a full
+        // cluster; we will retry anyway in that case.
+        for (StgWord32 psl = 1; psl <= slots->mask + 1; psl++) {
+            const HashEntry *s = &slots->slot[i];
+            if (RELAXED_LOAD(&s->psl) < psl) {
+                break;
+            }
+            if (RELAXED_LOAD(&s->hash) == hash
+                && RELAXED_LOAD(&s->key) == key) {
+                result = (void *) RELAXED_LOAD(&s->data);
+                break;
+            }
+            i = (i + 1) & slots->mask;
+        }
+
+        load_load_barrier();
+        if (RELAXED_LOAD(&table->seq) == seq) {
+            return result;
+        }
+    }
+}
+
 // Puts up to szKeys keys of the hash table into the given array. Returns the
 // actual amount of keys that have been retrieved.
 //
 // If the table is modified concurrently, the function behavior is undefined.
 //
 int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
+    const HashSlots *slots = table->slots;
     int k = 0;
-    HashList *hl;
-
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
 
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
-            }
-            index--;
+    for (StgWord i = 0; i <= slots->mask && k < szKeys; i++) {
+        if (slots->slot[i].psl != 0) {
+            keys[k] = slots->slot[i].key;
+            k += 1;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
     return k;
 }
 
-/* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena. Eventually
- * they will all be freed when we free the HashListChunks.
- * -------------------------------------------------------------------------- */
-
-static HashList *
-allocHashList (HashTable *table)
-{
-    if (table->freeList != NULL) {
-        HashList *hl = table->freeList;
-        table->freeList = hl->next;
-        return hl;
-    } else {
-        /* We allocate one block of memory which contains:
-         *
-         *  1. A HashListChunk, which gets linked onto HashTable.chunks.
-         *     This forms a list of all chunks associated with the HashTable
-         *     and is what we will free when we free the HashTable.
-         *
-         *  2. Several HashLists. One of these will get returned. The rest are
-         *     placed on the freeList.
-         *
-         */
-        HashListChunk *cl = stgMallocBytes(sizeof(HashListChunk) + HCHUNK * sizeof(HashList), "allocHashList");
-        HashList *hl = (HashList *) &cl[1];
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        HashList *p = table->freeList;
-        for (; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
-        return hl;
-    }
-}
-
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    // We place the HashList on the freeList. We make no attempt to bound the
-    // size of the free list for the time being. The HashLists on the freeList
-    // are freed when the HashTable itself is freed as a result of freeing the
-    // HashListChunks.
-    hl->next = table->freeList;
-    table->freeList = hl;
-}
-
 STATIC_INLINE void
 insertHashTable_inlined(HashTable *table, StgWord key,
                         const void *data, HashFunction f)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    StgWord32 hash = (StgWord32) f(table, key);
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
-        expand(table, f);
+    beginUpdate(table);
 
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+    /* When the load gets too high, we expand the table */
+    if ((StgWord) (table->kcount + 1) * HLOAD_DEN
+          > (table->slots->mask + 1) * HLOAD_NUM) {
+        growTable(table);
+    }
 
-    hl = allocHashList(table);
+    placeEntry(table->slots, key, data, hash, true);
+    table->kcount++;
 
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
+    endUpdate(table);
 }
 
 void
@@ -377,32 +440,46 @@ STATIC_INLINE void*
 removeHashTable_inlined(HashTable *table, StgWord key, const void *data,
                         HashFunction f, CompareFunction cmp)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = f(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
-            table->kcount--;
-            return (void *) hl->data;
+    HashSlots *slots = table->slots;
+    StgWord32 hash = (StgWord32) f(table, key);
+    StgWord i = HOME(slots, hash);
+    HashEntry *s;
+
+    for (StgWord32 psl = 1; ; psl++) {
+        s = &slots->slot[i];
+        if (s->psl < psl) {
+            /* It's not there */
+            ASSERT(data == NULL);
+            return NULL;
+        }
+        if (s->hash == hash && cmp(s->key, key)
+              && (data == NULL || s->data == data)) {
+            break;
+        }
+        i = (i + 1) & slots->mask;
+    }
+
+    const void *removed = s->data;
+
+    beginUpdate(table);
+
+    /* Backward shift: pull the rest of the cluster one slot closer to home */
+    for (;;) {
+        StgWord next = (i + 1) & slots->mask;
+        HashEntry *n = &slots->slot[next];
+        if (n->psl <= 1) {
+            break;
         }
-        prev = hl;
+        slots->slot[i] = *n;
+        slots->slot[i].psl--;
+        i = next;
     }
+    slots->slot[i].psl = 0;
+    table->kcount--;
+
+    endUpdate(table);
 
-    /* It's not there */
-    ASSERT(data == NULL);
-    return NULL;
+    return (void *) removed;
 }
 
 void*
@@ -434,34 +511,17 @@ removeStrHashTable(StrHashTable *table, const char * key, const void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
-
-    /* Free table segments */
-    while (segment >= 0) {
-        while (index >= 0) {
-            HashList *next;
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)((void *) hl->data);
+    HashSlots *slots = table->slots;
+
+    if (freeDataFun != NULL) {
+        for (StgWord i = 0; i <= slots->mask; i++) {
+            if (slots->slot[i].psl != 0) {
+                (*freeDataFun)((void *) slots->slot[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
-    }
-
-    /* Free chunks */
-    HashListChunk *cl = table->chunks;
-    while (cl != NULL) {
-        HashListChunk *old = cl;
-        cl = cl->next;
-        stgFree(old);
     }
 
+    freeSlots(slots);
     stgFree(table);
 }
 
@@ -472,89 +532,67 @@ freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 void
 mapHashTable(HashTable *table, void *data, MapHashFn fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, hl->key, hl->data);
-            }
-            index--;
+    HashSlots *slots = table->slots;
+
+    for (StgWord i = 0; i <= slots->mask; i++) {
+        if (slots->slot[i].psl != 0) {
+            fn(data, slots->slot[i].key, slots->slot[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
+// The keys may be modified by fn, but as we don't recompute their hashes
+// the table can then only be traversed (e.g. by mapHashTable) or freed.
 void
 mapHashTableKeys(HashTable *table, void *data, MapHashFnKeys fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, &hl->key, hl->data);
-            }
-            index--;
+    HashSlots *slots = table->slots;
+
+    for (StgWord i = 0; i <= slots->mask; i++) {
+        if (slots->slot[i].psl != 0) {
+            fn(data, &slots->slot[i].key, slots->slot[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
 void
 iterHashTable(HashTable *table, void *data, IterHashFn fn)
 {
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    long segment = (table->max + table->split - 1) / HSEGSIZE;
-    long index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (HashList *hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                if (!fn(data, hl->key, hl->data)) {
-                    return;
-                }
+    HashSlots *slots = table->slots;
+
+    for (StgWord i = 0; i <= slots->mask; i++) {
+        if (slots->slot[i].psl != 0) {
+            if (!fn(data, slots->slot[i].key, slots->slot[i].data)) {
+                return;
             }
-            index--;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
 /* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
+ * When we initialize a hash table, we allocate HMINSIZE empty slots.
  * -------------------------------------------------------------------------- */
 
 HashTable *
 allocHashTable(void)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
+    table->slots = allocSlots(HMINSIZE);
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
+    table->concurrent = false;
+    table->seq = 0;
+
+    return table;
+}
 
+HashTable *
+allocConcurrentHashTable(void)
+{
+    HashTable *table = allocHashTable();
+    table->concurrent = true;
     return table;
 }
 
@@ -26,6 +26,14 @@ void *      removeHashTable ( HashTable *table, StgWord key, const void *data );
 
 int keyCountHashTable (HashTable *table);
 
+/* A table that may be read with lookupHashTableConcurrent() while another
+ * thread modifies it. Writers must still be serialised by the caller.
+ * Only word keys are supported. See Note [Concurrent hash table reads] in
+ * Hash.c.
+ */
+HashTable * allocConcurrentHashTable  ( void );
+void *      lookupHashTableConcurrent ( const HashTable *table, StgWord key );
+
 // Puts up to szKeys keys of the hash table into the given array. Returns the
 // actual amount of keys that have been retrieved.
 //
@@ -66,6 +74,10 @@ void *      removeStrHashTable ( StrHashTable *table, const char * key,
  * it's not guaranteed. Either way, the functions are parameters
  * as the types should be statically known and thus
  * storing them is unnecessary.
+ *
+ * A HashFunction returns a hash of the key, not a bucket; the table
+ * argument is unused and only kept so custom hash functions may call
+ * hashWord/hashStr.
  */
 typedef int HashFunction(const HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
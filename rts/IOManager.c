@@ -23,6 +23,7 @@
 
 #if !defined(mingw32_HOST_OS)
 #include "posix/Signals.h"
+#include "posix/Select.h"
 #endif
 
 #if defined(mingw32_HOST_OS)
@@ -54,9 +55,10 @@ initIOManager(void)
     }
 
 #else
-    /* The other implementation is the non-threaded Posix select() one.
-     * It does not need any initialisation.
+    /* The other implementation is the non-threaded Posix one in
+     * posix/Select.c, which waits with select() or epoll.
      */
+    initIOPoller();
 #endif
 
 }
@@ -69,8 +71,7 @@ initIOManagerAfterFork(Capability **pcap USED_IF_THREADS_AND_NOT_MINGW32)
 #if defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
     /* Posix implementation in posix/Signals.c
      *
-     * No non-threaded impl because the non-threaded Posix select() I/O manager
-     * does not need any initialisation.
+     * The non-threaded Posix implementation is below.
      *
      * No Windows impl since no forking.
      *
@@ -82,6 +83,11 @@ initIOManagerAfterFork(Capability **pcap USED_IF_THREADS_AND_NOT_MINGW32)
      * (forkProcess), there is only a single cap available.
      */
     ioManagerStartCap(pcap);
+#elif !defined(mingw32_HOST_OS)
+    /* The non-threaded Posix implementation must not share its epoll
+     * instance with the parent process.
+     */
+    initIOPollerAfterFork();
 #endif
 }
 
@@ -114,6 +120,8 @@ exitIOManager(bool wait_threads USED_IF_NOT_THREADS_AND_MINGW32)
     } else {
         shutdownAsyncIO(wait_threads);
     }
+#elif !defined(THREADED_RTS)
+    exitIOPoller();
 #endif
 
 }
@@ -50,6 +50,10 @@ Building the hash map is done lazily, i.e. on first lookup or traversal. For
 this all IPE lists of all IpeBufferListNode are traversed to insert all IPEs.
 
 After the content of a IpeBufferListNode has been inserted, it's freed.
+
+lookupIPE() does not take ipeMapLock when there is nothing left to insert, so
+it may run concurrently with another thread's updateIpeMap(). Hence ipeMap is
+a concurrent hash table (see Note [Concurrent hash table reads] in Hash.c).
 */
 
 static HashTable *ipeMap = NULL;
@@ -157,7 +161,7 @@ void registerInfoProvList(InfoProvEnt **ent_list) {
 
 InfoProvEnt *lookupIPE(const StgInfoTable *info) {
     updateIpeMap();
-    return lookupHashTable(ipeMap, (StgWord)info);
+    return lookupHashTableConcurrent(ipeMap, (StgWord)info);
 }
 
 void updateIpeMap() {
@@ -170,7 +174,7 @@ void updateIpeMap() {
     ACQUIRE_LOCK(&ipeMapLock);
 
     if (ipeMap == NULL) {
-        ipeMap = allocHashTable();
+        ipeMap = allocConcurrentHashTable();
     }
 
     while (ipeBufferList != NULL) {
@@ -173,6 +173,9 @@ Mutex linker_mutex;
 /* Generic wrapper function to try and Resolve and RunInit oc files */
 int ocTryLoad( ObjectCode* oc );
 
+/* Set while the relocation workers run, see Note [Parallel relocation] */
+static bool relocating_in_parallel = false;
+
 static void ghciRemoveSymbolTable(StrHashTable *table, const SymbolName* key,
     ObjectCode *owner)
 {
@@ -803,7 +806,11 @@ SymbolAddr* lookupDependentSymbol (SymbolName* lbl, ObjectCode *dependent)
 
 SymbolAddr* lookupDependentSymbol (SymbolName* lbl, ObjectCode *dependent)
 {
-    ASSERT_LOCK_HELD(&linker_mutex);
+    // The relocation workers run while the thread which started them holds
+    // linker_mutex, see Note [Parallel relocation]
+    if (!relocating_in_parallel) {
+        ASSERT_LOCK_HELD(&linker_mutex);
+    }
     IF_DEBUG(linker_verbose, debugBelch("lookupSymbol: looking up '%s'\n", lbl));
 
     ASSERT(symhash != NULL);
@@ -901,6 +908,14 @@ SymbolAddr* loadSymbol(SymbolName *lbl, RtsSymbolInfo *pinfo) {
     /* Symbol can be found during linking, but hasn't been relocated. Do so now.
         See Note [runtime-linker-phases] */
     if (oc && lbl && oc->status == OBJECT_LOADED) {
+        if (relocating_in_parallel) {
+            // ocLoadDependencies_ELF should have loaded it already, see
+            // Note [Parallel relocation]
+            errorBelch("lookupSymbol: cannot load %" PATH_FMT " for symbol "
+                       "'%s' during parallel relocation",
+                       OC_INFORMATIVE_FILENAME(oc), lbl);
+            return NULL;
+        }
         oc->status = OBJECT_NEEDED;
         IF_DEBUG(linker, debugBelch("lookupSymbol: on-demand "
                                     "loading symbol '%s'\n", lbl));
@@ -1430,8 +1445,10 @@ HsInt loadObj (pathchar *path)
 HsInt loadOc (ObjectCode* oc)
 {
    int r;
+   StgWord64 t0 USED_IF_DEBUG, t1 USED_IF_DEBUG;
 
    IF_DEBUG(linker, debugBelch("loadOc: start (%s)\n", oc->fileName));
+   t0 = getMonotonicNSec();
 
    /* verify the in-memory image */
 #  if defined(OBJFORMAT_ELF)
@@ -1447,6 +1464,7 @@ HsInt loadOc (ObjectCode* oc)
        IF_DEBUG(linker, debugBelch("loadOc: ocVerifyImage_* failed\n"));
        return r;
    }
+   t1 = getMonotonicNSec();
 
    /* Note [loadOc orderings]
       ~~~~~~~~~~~~~~~~~~~~~~~
@@ -1516,23 +1534,20 @@ HsInt loadOc (ObjectCode* oc)
            oc->status = OBJECT_LOADED;
        }
    }
-   IF_DEBUG(linker, debugBelch("loadOc: done (%s).\n", oc->fileName));
+   IF_DEBUG(linker, debugBelch("loadOc: done (%s): verify %.3fms, "
+                               "sections and symbols %.3fms.\n",
+                               oc->fileName, (double)(t1 - t0) / 1e6,
+                               (double)(getMonotonicNSec() - t1) / 1e6));
 
    return 1;
 }
 
 /* -----------------------------------------------------------------------------
-* try to load and initialize an ObjectCode into memory
-*
-* Returns: 1 if ok, 0 on error.
-*/
-int ocTryLoad (ObjectCode* oc) {
-    int r;
-
-    if (oc->status != OBJECT_NEEDED) {
-        return 1;
-    }
+ * The steps of ocTryLoad
+ */
 
+static int ocInsertSymbols (ObjectCode* oc)
+{
     /*  Check for duplicate symbols by looking into `symhash`.
         Duplicate symbols are any symbols which exist
         in different ObjectCodes that have both been loaded, or
@@ -1555,17 +1570,27 @@ int ocTryLoad (ObjectCode* oc) {
             return 0;
         }
     }
+    return 1;
+}
 
+static int ocResolve (ObjectCode* oc)
+{
 #   if defined(OBJFORMAT_ELF)
-    r = ocResolve_ELF ( oc );
+    return ocResolve_ELF ( oc );
 #   elif defined(OBJFORMAT_PEi386)
-    r = ocResolve_PEi386 ( oc );
+    return ocResolve_PEi386 ( oc );
 #   elif defined(OBJFORMAT_MACHO)
-    r = ocResolve_MachO ( oc );
+    return ocResolve_MachO ( oc );
 #   else
     barf("ocTryLoad: not implemented on this platform");
 #   endif
-    if (!r) { return r; }
+}
+
+/* Finish loading a relocated ObjectCode: protect its memory and run its
+ * initializers. */
+static int ocFinishLoad (ObjectCode* oc)
+{
+    int r;
 
 #if defined(NEED_SYMBOL_EXTRAS)
     ocProtectExtras(oc);
@@ -1602,6 +1627,205 @@ int ocTryLoad (ObjectCode* oc) {
     return 1;
 }
 
+/* -----------------------------------------------------------------------------
+* try to load and initialize an ObjectCode into memory
+*
+* Returns: 1 if ok, 0 on error.
+*/
+int ocTryLoad (ObjectCode* oc) {
+    int r;
+
+    if (oc->status != OBJECT_NEEDED) {
+        return 1;
+    }
+
+    r = ocInsertSymbols(oc);
+    if (!r) { return r; }
+
+    r = ocResolve(oc);
+    if (!r) { return r; }
+
+    return ocFinishLoad(oc);
+}
+
+/* Note [Parallel relocation]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Loading a large set of objects (GHCi with many packages, or a set of
+   plugins in iserv) spends most of its time in resolveObjs(), processing
+   the relocations of one object after another.  But the relocations of an
+   object only write to its own sections, symbol extras and GOT, so with
+   the threaded RTS on ELF platforms resolveObjs() resolves the objects
+   which need it in three phases:
+
+   1. Symbols, sequentially.  For each object, ocInsertSymbols checks its
+      symbols for duplicates as ocTryLoad does, and ocLoadDependencies_ELF
+      looks up all of its global symbols.  Looking a symbol up is what
+      loads the archive member defining it on demand (see Note
+      [runtime-linker-phases]), so every member which the relocations will
+      need is loaded here, and nothing writes to `symhash` until phase 3.
+
+   2. Relocation, in parallel.  ocResolve_ELF runs on up to one thread per
+      processor, which claim the objects one at a time.  Their lookups only
+      read `symhash` and the status of the objects owning the symbols, and
+      add to the dependencies of the object being relocated, which no other
+      thread touches.  A lookup which would still have to load an object
+      fails instead of racing (see loadSymbol).  The workers run while the
+      calling thread holds linker_mutex, so lookupDependentSymbol does not
+      check for it meanwhile.
+
+   3. Initialisation, sequentially and in the original order.  ocFinishLoad
+      protects the memory of each object and runs its initializers, which
+      may call into any of the objects, and so must wait for all of them to
+      be relocated.
+
+   With +RTS -Dl, resolveObjs() reports the time spent in each phase, and
+   loadOc() the time spent verifying each object and mapping its sections.
+   Verification and mapping stay sequential: loadObj() and loadArchive()
+   do them as each object is read, and ocGetNames_* allocates sections from
+   allocators shared by all objects, and inserts the symbols as it goes.
+
+   Fewer than PARALLEL_RELOC_MIN_OBJECTS objects, and objects in other
+   formats, are resolved one at a time by ocTryLoad.
+*/
+
+#if defined(THREADED_RTS) && defined(OBJFORMAT_ELF)
+
+#define PARALLEL_RELOC_MIN_OBJECTS 8
+
+// The objects of one resolveObjs(), shared by the relocation workers.
+typedef struct {
+    ObjectCode **objs;
+    int *ok;                // the result of ocResolve for each object
+    uint32_t n_objs;
+    StgWord next;           // the next object to claim
+} RelocWork;
+
+static void *
+reloc_worker (void *data)
+{
+    RelocWork *work = data;
+    StgWord i;
+
+    for (;;) {
+        i = atomic_inc(&work->next, 1) - 1;
+        if (i >= work->n_objs)
+            break;
+        work->ok[i] = ocResolve_ELF(work->objs[i]);
+    }
+    return NULL;
+}
+
+// Relocate the objects of work on up to n_threads threads, including the
+// calling one.
+static void
+run_relocation (RelocWork *work, uint32_t n_threads)
+{
+    OSThreadId *threads =
+        stgMallocBytes((n_threads - 1) * sizeof(OSThreadId), "run_relocation");
+    uint32_t i, n_started = 0;
+    int r;
+
+    relocating_in_parallel = true;
+    for (i = 0; i < n_threads - 1; i++) {
+        // if we cannot have another thread, relocate on those we have
+        r = createAttachedOSThread(&threads[i], "ghc_linker", reloc_worker,
+                                   work);
+        if (r != 0) {
+            IF_DEBUG(linker, debugBelch("run_relocation: failed to spawn "
+                                        "worker: %s\n", strerror(r)));
+            break;
+        }
+        n_started++;
+    }
+    reloc_worker(work);
+    for (i = 0; i < n_started; i++) {
+        joinOSThread(threads[i]);
+    }
+    relocating_in_parallel = false;
+    stgFree(threads);
+}
+
+/* Resolve the objects which need it in phases, relocating them in parallel.
+ * See Note [Parallel relocation].  Does nothing if there are too few
+ * objects for it to pay off.
+ *
+ * Returns: 1 if ok, 0 on error, with *failed set to the object which could
+ * not be loaded.
+ */
+static HsInt resolveObjsParallel (ObjectCode **failed)
+{
+    ObjectCode **objs;
+    RelocWork work;
+    uint32_t n_objs = 0, n_threads, i;
+    StgWord64 t0 USED_IF_DEBUG, t1 USED_IF_DEBUG, t2 USED_IF_DEBUG;
+    HsInt r = 0;
+
+    for (ObjectCode *oc = objects; oc; oc = oc->next) {
+        if (oc->status == OBJECT_NEEDED) {
+            n_objs++;
+        }
+    }
+    n_threads = stg_min(getNumberOfProcessors(), n_objs);
+    if (n_objs < PARALLEL_RELOC_MIN_OBJECTS || n_threads < 2) {
+        return 1;
+    }
+
+    objs = stgMallocBytes(n_objs * sizeof(ObjectCode *), "resolveObjsParallel");
+    i = 0;
+    for (ObjectCode *oc = objects; oc; oc = oc->next) {
+        if (oc->status == OBJECT_NEEDED) {
+            objs[i++] = oc;
+        }
+    }
+
+    work.objs = objs;
+    work.ok = stgCallocBytes(n_objs, sizeof(int), "resolveObjsParallel");
+    work.n_objs = n_objs;
+    work.next = 0;
+
+    t0 = getMonotonicNSec();
+    for (i = 0; i < n_objs; i++) {
+        if (!ocInsertSymbols(objs[i]) || !ocLoadDependencies_ELF(objs[i])) {
+            *failed = objs[i];
+            goto out;
+        }
+    }
+
+    t1 = getMonotonicNSec();
+    run_relocation(&work, n_threads);
+
+    t2 = getMonotonicNSec();
+    for (i = 0; i < n_objs; i++) {
+        if (!work.ok[i] || !ocFinishLoad(objs[i])) {
+            *failed = objs[i];
+            goto out;
+        }
+    }
+
+    IF_DEBUG(linker,
+             debugBelch("resolveObjs: %" FMT_Word32 " objects: symbols %.3fms, "
+                        "relocation %.3fms on %" FMT_Word32 " threads, "
+                        "initialisation %.3fms\n",
+                        n_objs, (double)(t1 - t0) / 1e6,
+                        (double)(t2 - t1) / 1e6, n_threads,
+                        (double)(getMonotonicNSec() - t2) / 1e6));
+    r = 1;
+
+out:
+    stgFree(work.ok);
+    stgFree(objs);
+    return r;
+}
+
+#endif /* THREADED_RTS && OBJFORMAT_ELF */
+
+static void resolveFailed (ObjectCode *oc)
+{
+    errorBelch("Could not load Object Code %" PATH_FMT ".\n", OC_INFORMATIVE_FILENAME(oc));
+    IF_DEBUG(linker, printLoadedObjects());
+    fflush(stderr);
+}
+
 /* -----------------------------------------------------------------------------
  * resolve all the currently unlinked objects in memory
  *
@@ -1611,13 +1835,19 @@ static HsInt resolveObjs_ (void)
 {
     IF_DEBUG(linker, debugBelch("resolveObjs: start\n"));
 
+#if defined(THREADED_RTS) && defined(OBJFORMAT_ELF)
+    ObjectCode *failed = NULL;
+    if (!resolveObjsParallel(&failed)) {
+        resolveFailed(failed);
+        return 0;
+    }
+#endif
+
     for (ObjectCode *oc = objects; oc; oc = oc->next) {
         int r = ocTryLoad(oc);
         if (!r)
         {
-            errorBelch("Could not load Object Code %" PATH_FMT ".\n", OC_INFORMATIVE_FILENAME(oc));
-            IF_DEBUG(linker, printLoadedObjects());
-            fflush(stderr);
+            resolveFailed(oc);
             return r;
         }
     }
@@ -717,9 +717,11 @@ removeFromQueues(Capability *cap, StgTSO *tso)
 #endif
       goto done;
 
+#if !defined(mingw32_HOST_OS)
   case BlockedOnDelay:
-        removeThreadFromQueue(cap, &sleeping_queue, tso);
+        removeSleepingThread(cap, tso);
         goto done;
+#endif
 #endif
 
   default:
@@ -107,6 +107,9 @@ static double parseDouble (
 
 static void bad_option (const char *s);
 
+static bool read_huge_pages_flag(const char *arg);
+static bool read_pause_target(const char *arg, Time *target);
+
 #if defined(DEBUG)
 static void read_debug_flags(const char *arg);
 #endif
@@ -119,6 +122,11 @@ static bool read_heap_profiling_flag(const char *arg);
 static void read_trace_flags(const char *arg);
 #endif
 
+#if defined(THREADED_RTS)
+static bool read_spark_steal_policy(const char *arg);
+static bool read_stm_contention_policy(const char *arg);
+#endif
+
 static void errorUsage (void) GNU_ATTRIBUTE(__noreturn__);
 
 #if defined(mingw32_HOST_OS)
@@ -182,6 +190,12 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.allocLimitGrace    = (100*1024) / BLOCK_SIZE;
     RtsFlags.GcFlags.numa               = false;
     RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.hugePages          = HUGE_PAGES_NONE;
+    RtsFlags.GcFlags.nonmovingLazySweep = false;
+    RtsFlags.GcFlags.scavPrefetchDepth  = 0;
+    RtsFlags.GcFlags.pauseTarget        = 0;    /* off */
+    RtsFlags.GcFlags.pretenureSurvival  = 0;    /* off */
+    RtsFlags.GcFlags.decommitRate       = 0;    /* off */
     RtsFlags.GcFlags.ringBell           = false;
     RtsFlags.GcFlags.longGCSync         = 0; /* detection turned off */
 
@@ -241,6 +255,9 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.trace_output  = NULL;
     RtsFlags.TraceFlags.eventlogFlushTime = 0;
     RtsFlags.TraceFlags.nullWriter = false;
+    RtsFlags.TraceFlags.eventlogAsync = false;
+    RtsFlags.TraceFlags.eventlogOverflow = EVENTLOG_OVERFLOW_BLOCK;
+    RtsFlags.TraceFlags.eventlogAsyncBuffers = 2;
 #endif
 
 #if defined(PROFILING)
@@ -265,6 +282,7 @@ void initRtsFlagsDefaults(void)
 #else
     RtsFlags.MiscFlags.ioManager               = IO_MNGR_POSIX;
 #endif
+    RtsFlags.MiscFlags.ioPoller                = IO_POLLER_SELECT;
 #if defined(THREADED_RTS) && defined(mingw32_HOST_OS)
     RtsFlags.MiscFlags.numIoWorkerThreads      = getNumberOfProcessors();
 #else
@@ -281,6 +299,12 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ParFlags.parGcNoSyncWithIdle   = 0;
     RtsFlags.ParFlags.parGcThreads      = 0; /* defaults to -N */
     RtsFlags.ParFlags.setAffinity       = 0;
+    RtsFlags.ParFlags.sparkStealPolicy  = SPARK_STEAL_SEQUENTIAL;
+    RtsFlags.ParFlags.stmContention     = STM_CONTENTION_NONE;
+    RtsFlags.ParFlags.stmSerializeAfter = 8;
+    RtsFlags.ParFlags.nonmovingMarkWorkers = 1;
+    RtsFlags.ParFlags.nonmovingSweepWorkers = 1;
+    RtsFlags.ParFlags.compactWorkers    = 1;
 #endif
 
 #if defined(THREADED_RTS)
@@ -313,8 +337,28 @@ usage_text[] = {
 "  --nonmoving-gc",
 "            Selects the non-moving mark-and-sweep garbage collector to",
 "            manage the oldest generation.",
+"  --nonmoving-lazy-sweep",
+"            Let the allocator sweep non-moving segments on demand instead",
+"            of sweeping them all at the end of each collection.",
 "  --copying-gc",
 "            Selects the copying garbage collector to manage all generations.",
+"  --huge-pages[=<transparent|explicit>]",
+"            Back the heap with huge pages, either transparent huge pages",
+"            (the default) or pages from the hugetlbfs pool (Linux only)",
+"  --scav-prefetch-depth=<n>",
+"            Prefetch the objects referenced by the next <n> objects to be",
+"            scavenged by the copying collector (default: 0, off)",
+"  --gc-pause-target=<time>",
+"            Size the allocation area so that minor GCs take about <time>",
+"            (e.g. 5ms; a plain number is in seconds)",
+"  --pretenure-survival=<n>",
+"            Copy objects from allocation sites (with IPE info) of which at",
+"            least <n>% of the survivors survive again straight into the",
+"            oldest generation (requires -G3 or more; default: 0, off)",
+"  --decommit-rate=<size>",
+"            Return free memory to the OS from a background thread, at most",
+"            <size> bytes per second (threaded RTS only; default: 0, during",
+"            the GC)",
 "",
 "  -K<size>  Sets the maximum stack size (default: 80% of the heap)",
 "            e.g.: -K32k -K512k -K8M",
@@ -433,6 +477,15 @@ usage_text[] = {
 "             the initial enabled event classes are 'sgpu'",
 " --eventlog-flush-interval=<secs>",
 "             Periodically flush the eventlog at the specified interval.",
+#if defined(THREADED_RTS)
+" --eventlog-async[=<block|drop>]",
+"             Write the eventlog from a dedicated thread. When it falls",
+"             behind, capabilities wait for it (block, the default) or",
+"             discard their events (drop).",
+" --eventlog-async-buffers=<n>",
+"             Eventlog buffers per capability with --eventlog-async",
+"             (default: 2)",
+#endif
 #endif
 
 "",
@@ -494,6 +547,24 @@ usage_text[] = {
 "             (0 disables,  default: 0)",
 "  --numa[=<node_mask>]",
 "             Use NUMA, nodes given by <node_mask> (default: off)",
+"  --spark-steal=<sequential|random|numa|last>",
+"             Order in which idle capabilities try to steal sparks from",
+"             other capabilities (default: sequential)",
+"  --stm-contention=<none|backoff|serialize>",
+"             What an STM transaction does after failing to commit",
+"             (default: none)",
+"  --stm-serialize-after=<n>",
+"             Consecutive aborts after which a transaction runs alone",
+"             with --stm-contention=serialize (default: 8)",
+"  --nonmoving-mark-workers=<n>",
+"             Use <n> threads to mark the heap of the non-moving",
+"             collector (default: 1)",
+"  --nonmoving-sweep-workers=<n>",
+"             Use <n> threads to sweep the heap of the non-moving",
+"             collector (default: 1)",
+"  --compact-workers=<n>",
+"             Use <n> threads to compact the oldest generation with the",
+"             compacting collector (default: 1)",
 #if defined(DEBUG)
 "  --debug-numa[=<num_nodes>]",
 "             Pretend NUMA: like --numa, but without the system calls.",
@@ -517,6 +588,11 @@ usage_text[] = {
 #endif
 "  --io-manager=<native|posix>",
 "             The I/O manager subsystem to use. (default: posix)",
+#if !defined(mingw32_HOST_OS)
+"  --io-poller=<select|epoll>",
+"             How the non-threaded RTS waits for I/O. epoll has no limit on",
+"             the number of file descriptors. (default: select)",
+#endif
 #if defined(THREADED_RTS)
 #if defined(mingw32_HOST_OS)
 "  --io-manager-threads=<num>",
@@ -996,6 +1072,24 @@ error = true;
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.ioManager = IO_MNGR_POSIX;
                   }
+#if !defined(mingw32_HOST_OS)
+                  else if (strequal("io-poller=select",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.ioPoller = IO_POLLER_SELECT;
+                  }
+                  else if (strequal("io-poller=epoll",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+#if defined(HAVE_SYS_EPOLL_H)
+                      RtsFlags.MiscFlags.ioPoller = IO_POLLER_EPOLL;
+#else
+                      errorBelch("%s: epoll is not available on this platform",
+                                 rts_argv[arg]);
+                      error = true;
+#endif
+                  }
+#endif
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -1012,6 +1106,47 @@ error = true;
                       RtsFlags.TraceFlags.eventlogFlushTime =
                           fsecondsToTime(intervalSeconds);
                   }
+                  else if (strequal("eventlog-async",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogAsync = true;
+                          RtsFlags.TraceFlags.eventlogOverflow =
+                              EVENTLOG_OVERFLOW_BLOCK;
+                      ) break;
+                  }
+                  else if (strequal("eventlog-async=block",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogAsync = true;
+                          RtsFlags.TraceFlags.eventlogOverflow =
+                              EVENTLOG_OVERFLOW_BLOCK;
+                      ) break;
+                  }
+                  else if (strequal("eventlog-async=drop",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.TraceFlags.eventlogAsync = true;
+                          RtsFlags.TraceFlags.eventlogOverflow =
+                              EVENTLOG_OVERFLOW_DROP;
+                      ) break;
+                  }
+                  else if (!strncmp("eventlog-async-buffers=",
+                               &rts_argv[arg][2], 23)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          int n = strtol(rts_argv[arg]+25, (char **) NULL, 10);
+                          if (n < 2) {
+                              errorBelch("bad value for --eventlog-async-buffers"
+                                         " (must be at least 2)");
+                              error = true;
+                          } else {
+                              RtsFlags.TraceFlags.eventlogAsyncBuffers = n;
+                          }
+                      ) break;
+                  }
                   else if (strequal("copying-gc",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -1022,6 +1157,50 @@ error = true;
                       OPTION_SAFE;
                       RtsFlags.GcFlags.useNonmoving = true;
                   }
+                  else if (strequal("nonmoving-lazy-sweep",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.nonmovingLazySweep = true;
+                  }
+                  else if (!strncmp("huge-pages", &rts_argv[arg][2], 10)) {
+                      OPTION_SAFE;
+                      if (!read_huge_pages_flag(&rts_argv[arg][12])) {
+                          errorBelch("%s: unknown flag", rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                      if (!osHugePagesSupported(RtsFlags.GcFlags.hugePages)) {
+                          errorBelch("%s: huge pages of this kind are not "
+                                     "supported on this platform",
+                                     rts_argv[arg]);
+                          error = true;
+                          break;
+                      }
+                  }
+                  else if (!strncmp("scav-prefetch-depth=",
+                               &rts_argv[arg][2], 20)) {
+                      OPTION_SAFE;
+                      int n = strtol(rts_argv[arg]+22, (char **) NULL, 10);
+                      if (n < 0 || n > 64) {
+                          errorBelch("bad value for --scav-prefetch-depth"
+                                     " (must be between 0 and 64)");
+                          error = true;
+                      } else {
+                          RtsFlags.GcFlags.scavPrefetchDepth = n;
+                      }
+                  }
+                  else if (!strncmp("pretenure-survival=",
+                               &rts_argv[arg][2], 19)) {
+                      OPTION_SAFE;
+                      int n = strtol(rts_argv[arg]+21, (char **) NULL, 10);
+                      if (n < 0 || n > 100) {
+                          errorBelch("bad value for --pretenure-survival"
+                                     " (must be between 0 and 100)");
+                          error = true;
+                      } else {
+                          RtsFlags.GcFlags.pretenureSurvival = n;
+                      }
+                  }
 #if defined(THREADED_RTS)
 #if defined(mingw32_HOST_OS)
                   else if (!strncmp("io-manager-threads",
@@ -1079,6 +1258,90 @@ error = true;
                       RtsFlags.GcFlags.numaMask = mask;
                   }
 #endif
+                  else if (!strncmp("spark-steal=", &rts_argv[arg][2], 12)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          if (!read_spark_steal_policy(&rts_argv[arg][14])) {
+                              errorBelch("%s: unknown spark steal policy",
+                                         rts_argv[arg]);
+                              error = true;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("stm-contention=", &rts_argv[arg][2], 15)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          if (!read_stm_contention_policy(&rts_argv[arg][17])) {
+                              errorBelch("%s: unknown STM contention policy",
+                                         rts_argv[arg]);
+                              error = true;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("stm-serialize-after=",
+                               &rts_argv[arg][2], 20)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          int n = strtol(rts_argv[arg]+22, (char **) NULL, 10);
+                          if (n < 1) {
+                              errorBelch("bad value for --stm-serialize-after"
+                                         " (must be at least 1)");
+                              error = true;
+                          } else {
+                              RtsFlags.ParFlags.stmSerializeAfter = n;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("nonmoving-mark-workers=",
+                               &rts_argv[arg][2], 23)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          int n = strtol(rts_argv[arg]+25, (char **) NULL, 10);
+                          if (n < 1) {
+                              errorBelch("bad value for --nonmoving-mark-workers"
+                                         " (must be at least 1)");
+                              error = true;
+                          } else {
+                              RtsFlags.ParFlags.nonmovingMarkWorkers = n;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("nonmoving-sweep-workers=",
+                               &rts_argv[arg][2], 24)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          int n = strtol(rts_argv[arg]+26, (char **) NULL, 10);
+                          if (n < 1) {
+                              errorBelch("bad value for --nonmoving-sweep-workers"
+                                         " (must be at least 1)");
+                              error = true;
+                          } else {
+                              RtsFlags.ParFlags.nonmovingSweepWorkers = n;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("compact-workers=",
+                               &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          int n = strtol(rts_argv[arg]+18, (char **) NULL, 10);
+                          if (n < 1) {
+                              errorBelch("bad value for --compact-workers"
+                                         " (must be at least 1)");
+                              error = true;
+                          } else {
+                              RtsFlags.ParFlags.compactWorkers = n;
+                          }
+                      ) break;
+                  }
+                  else if (!strncmp("decommit-rate=",
+                               &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.GcFlags.decommitRate =
+                              decodeSize(rts_argv[arg], 16, 0, HS_WORD64_MAX);
+                      ) break;
+                  }
 #if defined(DEBUG) && defined(THREADED_RTS)
                   else if (!strncmp("debug-numa", &rts_argv[arg][2], 10)) {
                       OPTION_SAFE;
@@ -1105,6 +1368,17 @@ error = true;
                       }
                   }
 #endif
+                  else if (!strncmp("gc-pause-target=",
+                               &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      if (!read_pause_target(rts_argv[arg]+18,
+                                             &RtsFlags.GcFlags.pauseTarget)) {
+                          errorBelch("bad value for --gc-pause-target: %s",
+                                     rts_argv[arg]+18);
+                          error = true;
+                      }
+                      break;
+                  }
                   else if (!strncmp("long-gc-sync=", &rts_argv[arg][2], 13)) {
                       OPTION_SAFE;
                       if (rts_argv[arg][2] == '\0') {
@@ -1908,6 +2182,37 @@ static void normaliseRtsOpts (void)
         barf("The non-moving collector doesn't support -G1");
     }
 
+    // Megablocks are bound to NUMA nodes one at a time, which cannot be
+    // done for a piece of a hugetlbfs page.
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT &&
+            RtsFlags.GcFlags.numa) {
+        errorBelch("--huge-pages=explicit cannot be combined with --numa");
+        errorUsage();
+    }
+
+    // Both size the allocation area, see Note [GC pause target] in sm/GC.c.
+    if (RtsFlags.GcFlags.pauseTarget != 0 &&
+            (RtsFlags.GcFlags.heapSizeSuggestion != 0 ||
+             RtsFlags.GcFlags.heapSizeSuggestionAuto ||
+             RtsFlags.GcFlags.generations == 1)) {
+        errorBelch("--gc-pause-target cannot be combined with -H or -G1");
+        errorUsage();
+    }
+
+    // See Note [Pretenuring by allocation site] in sm/Pretenure.c.
+    if (RtsFlags.GcFlags.pretenureSurvival != 0 &&
+            RtsFlags.GcFlags.generations < 3) {
+        errorBelch("--pretenure-survival requires -G3 or more");
+        errorUsage();
+    }
+
+    // See Note [Background decommit] in sm/MBlock.c.
+    if (RtsFlags.GcFlags.decommitRate != 0 &&
+            RtsFlags.GcFlags.hugePages != HUGE_PAGES_NONE) {
+        errorBelch("--decommit-rate cannot be combined with --huge-pages");
+        errorUsage();
+    }
+
 #if !defined(PROFILING) && !defined(DEBUG)
     // The mark-region collector is incompatible with heap census unless
     // we zero slop of blackhole'd thunks, which doesn't happen in the
@@ -2105,6 +2410,74 @@ parseDouble(const char *arg, bool *error)
     return out;
 }
 
+#if defined(THREADED_RTS)
+static bool read_spark_steal_policy(const char *arg)
+{
+    // Already parsed "--spark-steal="
+    if (strequal(arg, "sequential")) {
+        RtsFlags.ParFlags.sparkStealPolicy = SPARK_STEAL_SEQUENTIAL;
+    } else if (strequal(arg, "random")) {
+        RtsFlags.ParFlags.sparkStealPolicy = SPARK_STEAL_RANDOM;
+    } else if (strequal(arg, "numa")) {
+        RtsFlags.ParFlags.sparkStealPolicy = SPARK_STEAL_NUMA;
+    } else if (strequal(arg, "last")) {
+        RtsFlags.ParFlags.sparkStealPolicy = SPARK_STEAL_LAST_VICTIM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool read_stm_contention_policy(const char *arg)
+{
+    // Already parsed "--stm-contention="
+    if (strequal(arg, "none")) {
+        RtsFlags.ParFlags.stmContention = STM_CONTENTION_NONE;
+    } else if (strequal(arg, "backoff")) {
+        RtsFlags.ParFlags.stmContention = STM_CONTENTION_BACKOFF;
+    } else if (strequal(arg, "serialize")) {
+        RtsFlags.ParFlags.stmContention = STM_CONTENTION_SERIALIZE;
+    } else {
+        return false;
+    }
+    return true;
+}
+#endif
+
+static bool read_huge_pages_flag(const char *arg)
+{
+    // Already parsed "--huge-pages"
+    if (*arg == '\0' || strequal(arg, "=transparent")) {
+        RtsFlags.GcFlags.hugePages = HUGE_PAGES_TRANSPARENT;
+    } else if (strequal(arg, "=explicit")) {
+        RtsFlags.GcFlags.hugePages = HUGE_PAGES_EXPLICIT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parse the argument of --gc-pause-target: a positive number of seconds,
+// optionally given in milliseconds or microseconds, e.g. "0.005", "5ms".
+static bool read_pause_target(const char *arg, Time *target)
+{
+    char *end;
+    double t = strtod(arg, &end);
+
+    if (end == arg || t <= 0) {
+        return false;
+    }
+    if (strequal(end, "ms")) {
+        t /= 1e3;
+    } else if (strequal(end, "us")) {
+        t /= 1e6;
+    } else if (*end != '\0' && !strequal(end, "s")) {
+        return false;
+    }
+    *target = fsecondsToTime(t);
+    return *target > 0;
+}
+
 #if defined(DEBUG)
 static void read_debug_flags(const char* arg)
 {
@@ -651,6 +651,14 @@ extern char **environ;
       SymI_HasProto(stg_compactAllocateBlockzh)                         \
       SymI_HasProto(stg_compactFixupPointerszh)                         \
       SymI_HasProto(stg_compactSizzezh)                                 \
+      SymI_HasProto(compactWriteFile)                                   \
+      SymI_HasProto(compactMapFile)                                     \
+      SymI_HasProto(compactStreamOpen)                                  \
+      SymI_HasProto(compactStreamFlush)                                 \
+      SymI_HasProto(compactStreamFinish)                                \
+      SymI_HasProto(compactStreamFree)                                  \
+      SymI_HasProto(compactWriteStream)                                 \
+      SymI_HasProto(compactReadStream)                                  \
       SymI_HasProto(closure_flags)                                      \
       SymI_HasProto(eq_thread)                                          \
       SymI_HasProto(cmp_thread)                                         \
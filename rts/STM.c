@@ -931,6 +931,260 @@ static void getToken(Capability *cap STG_UNUSED) {
 
 /*......................................................................*/
 
+/* Note [STM version clock]
+   ~~~~~~~~~~~~~~~~~~~~~~~~
+   With STM_FG_LOCKS a transaction which only reads TVars still has to walk
+   its whole TRec at commit time: validate_and_acquire_ownership and
+   check_read_only compare every entry against the TVar, which is expensive
+   for long read-mostly transactions.  Following TL2 (Dice, Shalev and Shavit,
+   "Transactional Locking II", DISC 2006) we keep a global version clock:
+
+    - An updating commit increments stm_version_clock while it holds the
+      locks on the TVars it writes, and stamps each of them with the new
+      value of the clock (in num_updates) before unlocking it.
+
+    - A top-level transaction samples the clock into trec->read_version when
+      it starts; nested transactions inherit their parent's sample.
+
+    - Each first read of a TVar checks that its stamp is no later than
+      read_version, re-reading current_value afterwards to make sure that the
+      stamp belongs to the value we saw.  A writer stamped at or before
+      read_version has locked the TVar before we sampled the clock, so such a
+      read sees the value the TVar held at read_version.
+
+   As long as every read passes this check and nothing has been written,
+   trec->snapshot stays set: the read set is a consistent snapshot of the
+   heap at read_version, so stmCommitTransaction can commit the transaction
+   without validating or locking anything.  Otherwise we fall back to the
+   usual validation.  Stamps are unique and increasing, so check_read_only's
+   equality test on num_updates is unaffected.
+
+   Stamps are compared modulo the word size.  On 32-bit platforms the clock
+   can wrap, so we only trust a snapshot whose read_version is less than
+   VERSION_CLOCK_HORIZON ticks old at commit time; every stamp we saw is then
+   within that distance of read_version too.
+*/
+
+#define VERSION_CLOCK_HORIZON ((StgWord)1 << (sizeof(StgWord) * 8 - 2))
+
+#if defined(STM_FG_LOCKS)
+static volatile StgWord stm_version_clock = 0;
+#endif
+
+static void start_snapshot(StgTRecHeader *trec, StgTRecHeader *outer) {
+  if (outer == NO_TREC) {
+#if defined(STM_FG_LOCKS)
+    trec -> read_version = ACQUIRE_LOAD(&stm_version_clock);
+    trec -> snapshot = true;
+#else
+    trec -> read_version = 0;
+    trec -> snapshot = false;
+#endif
+  } else {
+    trec -> read_version = outer -> read_version;
+    trec -> snapshot = outer -> snapshot;
+  }
+}
+
+// check_read_version : called after the first read of "value" from "tvar"
+// in "trec"; clears trec->snapshot unless the read is part of the snapshot
+// at trec->read_version.
+static void check_read_version(StgTRecHeader *trec STG_UNUSED,
+                               StgTVar *tvar STG_UNUSED,
+                               StgClosure *value STG_UNUSED) {
+#if defined(STM_FG_LOCKS)
+  if (trec -> snapshot) {
+    StgWord stamp = (StgWord) SEQ_CST_LOAD(&tvar->num_updates);
+    if ((StgInt) (stamp - trec -> read_version) > 0 ||
+        SEQ_CST_LOAD(&tvar->current_value) != value) {
+      TRACE("%p : read of %p (version %" FMT_Word ") is not in snapshot %" FMT_Word,
+            trec, tvar, stamp, trec -> read_version);
+      trec -> snapshot = false;
+    }
+  }
+#endif
+}
+
+// commit_from_snapshot : true if "trec" is a read-only transaction that
+// saw a consistent snapshot and may commit without validation.
+static StgBool commit_from_snapshot(StgTRecHeader *trec STG_UNUSED) {
+#if defined(STM_FG_LOCKS)
+  return trec -> snapshot &&
+         trec -> state == TREC_ACTIVE &&
+         ACQUIRE_LOAD(&stm_version_clock) - trec -> read_version < VERSION_CLOCK_HORIZON &&
+         !shake();
+#else
+  return false;
+#endif
+}
+
+/*......................................................................*/
+
+/* Note [STM contention management]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A transaction which fails to commit is restarted straight away by
+   stg_atomically_frame.  Under contention this lets a long transaction
+   starve: each attempt is invalidated by short transactions which commit
+   while it runs.  The contention manager, selected with --stm-contention,
+   decides what happens before the restart:
+
+    - none: nothing.
+
+    - backoff: the capability spins for a random number of iterations below
+      2^k, where k is the number of consecutive aborts of the transaction
+      (at most STM_BACKOFF_MAX_SHIFT), giving the transactions it conflicts
+      with time to commit.
+
+    - serialize: once a transaction has aborted --stm-serialize-after times
+      in a row it tries to take the serialization token, stm_serial_owner.
+      While one thread owns the token, top-level transactions of other
+      threads which write TVars fail to commit ("deferred") and give up
+      their capability, so nothing can invalidate the serialized transaction.
+      The token is released when the transaction commits, blocks in retry or
+      is aborted by an exception.  A transaction which has been deferred or
+      aborted twice the threshold commits regardless, which bounds the cost
+      should the owner be descheduled for a long time.
+
+   TRecs don't survive a restart, so the number of consecutive aborts is
+   handed from the failed commit to the following stmStartTransaction through
+   the capability (stm_restart_thread and stm_restart_aborts): both happen on
+   the same capability without the scheduler running in between.  The count
+   lives in trec->aborts, and trec->serial is set when the transaction owns
+   the token.  A restart caused by a nested transaction failing to commit
+   (stg_abort) starts counting from zero again, but keeps the token.
+*/
+
+#if defined(THREADED_RTS)
+
+#define STM_BACKOFF_MAX_SHIFT 16
+
+static volatile StgWord stm_serial_owner = 0; // thread id, 0 if none
+
+static StgWord current_thread_id(Capability *cap) {
+  StgTSO *tso = cap -> r.rCurrentTSO;
+  return tso == NULL ? 0 : (StgWord) tso -> id;
+}
+
+static StgBool trec_has_updates(StgTRecHeader *trec) {
+  StgBool result = false;
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_update(e)) {
+      result = true;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
+static void backoff(Capability *cap, StgWord aborts) {
+  uint32_t x = cap -> stm_backoff_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  cap -> stm_backoff_seed = x;
+
+  StgWord spins = x & (((StgWord) 1 << stg_min(aborts, STM_BACKOFF_MAX_SHIFT)) - 1);
+  TRACE("backing off for %" FMT_Word " iterations after %" FMT_Word " aborts",
+        spins, aborts);
+  for (StgWord i = 0; i < spins; i++) {
+    busy_wait_nop();
+  }
+}
+
+// start_contention : called as a top-level transaction starts, see
+// Note [STM contention management].
+static void start_contention(Capability *cap, StgTRecHeader *trec) {
+  StgWord me = current_thread_id(cap);
+
+  trec -> aborts = 0;
+  trec -> serial = false;
+  if (me != 0 && cap -> stm_restart_thread == me) {
+    trec -> aborts = cap -> stm_restart_aborts;
+  }
+  cap -> stm_restart_thread = 0;
+
+  switch (RtsFlags.ParFlags.stmContention) {
+  case STM_CONTENTION_BACKOFF:
+    if (trec -> aborts > 0) {
+      backoff(cap, trec -> aborts);
+    }
+    break;
+  case STM_CONTENTION_SERIALIZE:
+    if (me == 0) {
+      break;
+    }
+    if (RELAXED_LOAD(&stm_serial_owner) == me) {
+      trec -> serial = true;
+    } else if (trec -> aborts >= RtsFlags.ParFlags.stmSerializeAfter &&
+               cas(&stm_serial_owner, 0, me) == 0) {
+      TRACE("%p : serializing after %" FMT_Word " aborts", trec, trec -> aborts);
+      trec -> serial = true;
+      cap -> stm_stats.serialized++;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void end_serial(StgTRecHeader *trec) {
+  if (trec -> serial) {
+    TRACE("%p : releasing serialization token", trec);
+    trec -> serial = false;
+    RELEASE_STORE(&stm_serial_owner, 0);
+  }
+}
+
+// must_defer : true if the top-level "trec" should fail its commit to let
+// a serialized transaction run.
+static StgBool must_defer(Capability *cap, StgTRecHeader *trec) {
+  if (RtsFlags.ParFlags.stmContention != STM_CONTENTION_SERIALIZE ||
+      trec -> serial) {
+    return false;
+  }
+  StgWord owner = ACQUIRE_LOAD(&stm_serial_owner);
+  if (owner == 0 || owner == current_thread_id(cap) ||
+      trec -> aborts >= 2 * RtsFlags.ParFlags.stmSerializeAfter) {
+    return false;
+  }
+  return trec_has_updates(trec);
+}
+
+// note_abort : the top-level "trec" failed to commit and is about to be
+// restarted by the current thread.
+static void note_abort(Capability *cap, StgTRecHeader *trec) {
+  StgWord aborts = trec -> aborts + 1;
+  cap -> stm_restart_thread = current_thread_id(cap);
+  cap -> stm_restart_aborts = aborts;
+  if (aborts > cap -> stm_stats.max_aborts) {
+    cap -> stm_stats.max_aborts = aborts;
+  }
+}
+
+#else
+
+static void start_contention(Capability *cap STG_UNUSED, StgTRecHeader *trec) {
+  trec -> aborts = 0;
+  trec -> serial = false;
+}
+
+static void end_serial(StgTRecHeader *trec STG_UNUSED) {
+  // Nothing
+}
+
+static StgBool must_defer(Capability *cap STG_UNUSED,
+                          StgTRecHeader *trec STG_UNUSED) {
+  return false;
+}
+
+static void note_abort(Capability *cap STG_UNUSED,
+                       StgTRecHeader *trec STG_UNUSED) {
+  // Nothing
+}
+#endif
+
+/*......................................................................*/
+
 StgTRecHeader *stmStartTransaction(Capability *cap,
                                    StgTRecHeader *outer) {
   StgTRecHeader *t;
@@ -941,6 +1195,13 @@ StgTRecHeader *stmStartTransaction(Capability *cap,
   getToken(cap);
 
   t = alloc_stg_trec_header(cap, outer);
+  start_snapshot(t, outer);
+  if (outer == NO_TREC) {
+    start_contention(cap, t);
+  } else {
+    t -> aborts = outer -> aborts;
+    t -> serial = false;
+  }
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
@@ -963,6 +1224,7 @@ void stmAbortTransaction(Capability *cap,
     // We're a top-level transaction: remove any watch queue entries that
     // we may have.
     TRACE("%p : aborting top-level transaction", trec);
+    end_serial(trec);
 
     if (trec -> state == TREC_WAITING) {
       ASSERT(trec -> enclosing_trec == NO_TREC);
@@ -978,6 +1240,7 @@ void stmAbortTransaction(Capability *cap,
       StgTVar *s = e -> tvar;
       merge_read_into(cap, et, s, e -> expected_value);
     });
+    et -> snapshot = et -> snapshot && trec -> snapshot;
   }
 
   trec -> state = TREC_ABORTED;
@@ -1039,6 +1302,7 @@ StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
   StgBool result = true;
   while (t != NO_TREC) {
     result &= validate_and_acquire_ownership(cap, t, true, false);
+    cap -> stm_stats.validations++;
     t = t -> enclosing_trec;
   }
 
@@ -1080,6 +1344,7 @@ static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeade
 
 StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   StgInt64 max_commits_at_start = getMaxCommits();
+  StgWord write_version STG_UNUSED = 0;
 
   TRACE("%p : stmCommitTransaction()", trec);
   ASSERT(trec != NO_TREC);
@@ -1090,56 +1355,86 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   ASSERT((trec -> state == TREC_ACTIVE) ||
          (trec -> state == TREC_CONDEMNED));
 
-  // Use a read-phase (i.e. don't lock TVars we've read but not updated) if
-  // the configuration lets us use a read phase.
-
-  bool result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), true);
-  if (result) {
-    // We now know that all the updated locations hold their expected values.
-    ASSERT(trec -> state == TREC_ACTIVE);
+  bool result;
+  if (must_defer(cap, trec)) {
+    // Give way to a serialized transaction, and let it have our capability
+    // if it is waiting for it.  See Note [STM contention management].
+    TRACE("%p : deferring to serialized transaction", trec);
+    cap -> stm_stats.deferred++;
+    cap -> context_switch = 1;
+    result = false;
+  } else if (commit_from_snapshot(trec)) {
+    // Nothing to write back, and every TVar we read held the value we saw
+    // at trec->read_version: the transaction linearizes there.  See
+    // Note [STM version clock].
+    TRACE("%p : committing from snapshot %" FMT_Word, trec, trec -> read_version);
+    cap -> stm_stats.snapshot_commits++;
+    result = true;
+  } else {
+    // Use a read-phase (i.e. don't lock TVars we've read but not updated) if
+    // the configuration lets us use a read phase.
 
-    if (config_use_read_phase) {
-      StgInt64 max_commits_at_end;
-      StgInt64 max_concurrent_commits;
-      TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
-      TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
+    cap -> stm_stats.validations++;
+    result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), true);
+    if (result) {
+      // We now know that all the updated locations hold their expected values.
+      ASSERT(trec -> state == TREC_ACTIVE);
+
+      if (config_use_read_phase) {
+        StgInt64 max_commits_at_end;
+        StgInt64 max_concurrent_commits;
+        TRACE("%p : doing read check", trec);
+        result = check_read_only(trec);
+        TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
+
+        max_commits_at_end = getMaxCommits();
+        max_concurrent_commits = ((max_commits_at_end - max_commits_at_start) +
+                                  (n_capabilities * TOKEN_BATCH_SIZE));
+        if (((max_concurrent_commits >> 32) > 0) || shake()) {
+          result = false;
+        }
+      }
 
-      max_commits_at_end = getMaxCommits();
-      max_concurrent_commits = ((max_commits_at_end - max_commits_at_start) +
-                                (n_capabilities * TOKEN_BATCH_SIZE));
-      if (((max_concurrent_commits >> 32) > 0) || shake()) {
-        result = false;
+      if (result) {
+        // We now know that all of the read-only locations held their expected values
+        // at the end of the call to validate_and_acquire_ownership.  This forms the
+        // linearization point of the commit.
+
+        // Make the updates required by the transaction.
+        FOR_EACH_ENTRY(trec, e, {
+          StgTVar *s;
+          s = e -> tvar;
+          if ((!config_use_read_phase) || (e -> new_value != e -> expected_value)) {
+            // Either the entry is an update or we're not using a read phase:
+            // write the value back to the TVar, unlocking it if necessary.
+
+            ACQ_ASSERT(tvar_is_locked(s, trec));
+            TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
+            unpark_waiters_on(cap,s);
+            IF_STM_FG_LOCKS({
+              // We have locked the TVar, so it is enough to stamp it before
+              // unlock_tvar publishes the new value.
+              if (write_version == 0) {
+                write_version = atomic_inc(&stm_version_clock, 1);
+              }
+              RELAXED_STORE(&s->num_updates, (StgInt) write_version);
+            });
+            unlock_tvar(cap, trec, s, e -> new_value, true);
+          }
+          ACQ_ASSERT(!tvar_is_locked(s, trec));
+        });
+      } else {
+          revert_ownership(cap, trec, false);
       }
     }
+  }
 
-    if (result) {
-      // We now know that all of the read-only locations held their expected values
-      // at the end of the call to validate_and_acquire_ownership.  This forms the
-      // linearization point of the commit.
-
-      // Make the updates required by the transaction.
-      FOR_EACH_ENTRY(trec, e, {
-        StgTVar *s;
-        s = e -> tvar;
-        if ((!config_use_read_phase) || (e -> new_value != e -> expected_value)) {
-          // Either the entry is an update or we're not using a read phase:
-          // write the value back to the TVar, unlocking it if necessary.
-
-          ACQ_ASSERT(tvar_is_locked(s, trec));
-          TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
-          unpark_waiters_on(cap,s);
-          IF_STM_FG_LOCKS({
-            // We have locked the TVar therefore nonatomic addition is sufficient
-            NONATOMIC_ADD(&s->num_updates, 1);
-          });
-          unlock_tvar(cap, trec, s, e -> new_value, true);
-        }
-        ACQ_ASSERT(!tvar_is_locked(s, trec));
-      });
-    } else {
-        revert_ownership(cap, trec, false);
-    }
+  if (result) {
+    cap -> stm_stats.commits++;
+    end_serial(trec);
+  } else {
+    cap -> stm_stats.aborts++;
+    note_abort(cap, trec);
   }
 
   unlock_stm(trec);
@@ -1188,6 +1483,7 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
         merge_update_into(cap, et, s, e -> expected_value, e -> new_value);
         ACQ_ASSERT(s -> current_value != (StgClosure *)trec);
       });
+      et -> snapshot = et -> snapshot && trec -> snapshot;
     } else {
         revert_ownership(cap, trec, false);
     }
@@ -1224,6 +1520,7 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
     build_watch_queue_entries_for_trec(cap, tso, trec);
     park_tso(tso);
     trec -> state = TREC_WAITING;
+    end_serial(trec);
 
     // We haven't released ownership of the transaction yet.  The TSO
     // has been put on the wait queue for the TVars it is waiting for,
@@ -1330,6 +1627,7 @@ StgClosure *stmReadTVar(Capability *cap,
   } else {
     // No entry found
     StgClosure *current_value = read_current_value(trec, tvar);
+    check_read_version(trec, tvar, current_value);
     TRecEntry *new_entry = get_new_entry(cap, trec);
     new_entry -> tvar = tvar;
     new_entry -> expected_value = current_value;
@@ -1355,6 +1653,9 @@ void stmWriteTVar(Capability *cap,
   ASSERT(trec -> state == TREC_ACTIVE ||
          trec -> state == TREC_CONDEMNED);
 
+  // The transaction is no longer read-only
+  trec -> snapshot = false;
+
   entry = get_entry_for(trec, tvar, &entry_in);
 
   if (entry != NULL) {
@@ -23,8 +23,10 @@
                   non-conflicting transactions to commit in parallel.
                   The implementation treats reads optimisitcally --
                   extra versioning information is retained in the 
-                  saw_update_by field of the TVars so that they do not 
-                  need to be locked for reading.
+                  num_updates field of the TVars so that they do not 
+                  need to be locked for reading.  Read-only
+                  transactions which saw a consistent snapshot commit
+                  without revalidation (see Note [STM version clock]).
 
   STM.C contains more details about the locking schemes used.
 
@@ -41,6 +43,26 @@
 
 #include "BeginPrivate.h"
 
+/*----------------------------------------------------------------------
+
+   Statistics
+   ----------
+
+   Each capability counts the outcome of the top-level transactions it
+   commits.  These are reported in the eventlog by traceStmCounters and
+   by +RTS -s.
+*/
+
+typedef struct {
+    StgWord64 commits;            // top-level transactions committed
+    StgWord64 snapshot_commits;   // ... without validating their read set
+    StgWord64 aborts;             // top-level commits which failed
+    StgWord64 validations;        // walks of a TRec to validate its entries
+    StgWord64 deferred;           // aborts to let a serialized transaction run
+    StgWord64 serialized;         // transactions which ran serialized
+    StgWord64 max_aborts;         // longest run of aborts of one transaction
+} StmCounters;
+
 /*----------------------------------------------------------------------
 
    GC interaction
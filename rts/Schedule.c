@@ -75,7 +75,6 @@
 // Blocked/sleeping threads
 StgTSO *blocked_queue_hd = NULL;
 StgTSO *blocked_queue_tl = NULL;
-StgTSO *sleeping_queue = NULL;    // perhaps replace with a hash table?
 #endif
 
 // Bytes allocated since the last time a HeapOverflow exception was thrown by
@@ -911,7 +910,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !EMPTY_BLOCKED_QUEUE() || !EMPTY_SLEEPING_QUEUE() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
@@ -1867,6 +1866,7 @@ delete_threads_and_gc:
     }
 
     traceSparkCounters(cap);
+    traceStmCounters(cap);
 
     switch (SEQ_CST_LOAD(&recent_activity)) {
     case ACTIVITY_INACTIVE:
@@ -2091,6 +2091,8 @@ forkProcess(HsStablePtr *entry
         }
 
         initMutex(&all_tasks_mutex);
+
+        resetDecommitThread();
 #endif
 
 #if defined(TRACING)
@@ -2276,6 +2278,14 @@ setNumCapabilities (uint32_t new_n_capabilities USED_IF_THREADS)
         //
         for (n = new_n_capabilities; n < enabled_capabilities; n++) {
             capabilities[n]->disabled = true;
+            // give back the free stable pointers and blocks it has cached
+            flushStablePtrCache(capabilities[n]);
+            if (capabilities[n]->block_cache.n_blocks > 0) {
+                ACQUIRE_SM_LOCK;
+                flushBlockCache(&capabilities[n]->block_cache,
+                                capabilities[n]->block_cache.n_blocks);
+                RELEASE_SM_LOCK;
+            }
             traceCapDisable(capabilities[n]);
         }
         enabled_capabilities = new_n_capabilities;
@@ -2365,7 +2375,7 @@ deleteAllThreads ()
 
 #if !defined(THREADED_RTS)
     ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(EMPTY_SLEEPING_QUEUE());
 #endif
 }
 
@@ -2698,7 +2708,9 @@ initScheduler(void)
 #if !defined(THREADED_RTS)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
-  sleeping_queue    = END_TSO_QUEUE;
+#if !defined(mingw32_HOST_OS)
+  initSleepingQueue();
+#endif
 #endif
 
   sched_state    = SCHED_RUNNING;
@@ -2791,7 +2803,9 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
 #if !defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
-    evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markSleepingThreads(evac, user);
+#endif
 #endif
 }
 
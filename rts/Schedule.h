@@ -13,6 +13,10 @@
 #include "Capability.h"
 #include "Trace.h"
 
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+#include "posix/Select.h" // for emptySleepingQueue
+#endif
+
 #include "BeginPrivate.h"
 
 /* initScheduler(), exitScheduler()
@@ -110,7 +114,6 @@ extern volatile StgWord recent_activity;
  */
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
-extern  StgTSO *sleeping_queue;
 #endif
 
 extern bool heap_overflow;
@@ -252,7 +255,11 @@ truncateRunQueue(Capability *cap)
 
 #if !defined(THREADED_RTS)
 #define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
+#if defined(mingw32_HOST_OS)
+#define EMPTY_SLEEPING_QUEUE() true
+#else
+#define EMPTY_SLEEPING_QUEUE() (emptySleepingQueue())
+#endif
 #endif
 
 INLINE_HEADER bool
@@ -24,6 +24,14 @@ typedef struct {
     StgWord fizzled;
 } SparkCounters;
 
+/* Stats on spark stealing, see findSpark() */
+typedef struct {
+    StgWord attempts;   // steals attempted from a non-empty pool
+    StgWord stolen;     // successful steals
+    StgWord local;      // ... of which from a capability on our NUMA node
+    StgWord failed;     // searches of all other pools that found nothing
+} SparkStealCounters;
+
 #if defined(THREADED_RTS)
 
 typedef WSDeque SparkPool;
@@ -16,6 +16,8 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "StablePtr.h"
+#include "Capability.h"
+#include "Task.h"
 
 #include <string.h>
 
@@ -112,10 +114,57 @@ static uint32_t n_old_SPTs = 0;
 
 #if defined(THREADED_RTS)
 Mutex stable_ptr_mutex;
+
+/* Set while enlargeStablePtrTable() copies the table; see Note
+ * [Per-capability stable pointer caches].
+ */
+static bool stable_ptr_table_enlarging = false;
 #endif
 
+/* Counters for the calls that don't go through a capability's cache.
+ * Protected by stable_ptr_mutex.
+ */
+static StablePtrStats stable_ptr_stats;
+
 static void enlargeStablePtrTable(void);
 
+/* Note [Per-capability stable pointer caches]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Programs making heavy use of the FFI can allocate and free stable pointers
+ * at a high rate from many capabilities, and taking stable_ptr_mutex for
+ * every getStablePtr() and freeStablePtr() made it a point of contention.
+ *
+ * So in the threaded RTS every capability keeps a cache of up to
+ * STABLE_PTR_CACHE_SIZE free entries of the table (cap->stable_ptr_cache).
+ * When the calling thread owns a capability, getStablePtr() pops an entry
+ * from its cache and freeStablePtr() pushes the entry back, without taking
+ * the lock. An empty cache is refilled with half a cache's worth of entries
+ * from the global free list, and a full cache returns half of its entries to
+ * the global free list, both under stable_ptr_mutex. Threads that don't own a
+ * capability (e.g. foreign threads calling hs_free_stable_ptr()) use the
+ * global free list as before.
+ *
+ * Free entries on the global free list point to the next free entry, so that
+ * the GC can tell them apart from live entries (see FOR_EACH_STABLE_PTR).
+ * Cached entries instead hold NULL, which the GC ignores too, and the cache
+ * itself records their indices. That way nothing in the table refers to the
+ * entries a capability owns, and so enlargeStablePtrTable() can copy the table
+ * while capabilities are using their caches.
+ *
+ * What we must be careful about is that a capability doesn't write an entry in
+ * the old copy of the table after enlargeStablePtrTable() has copied it,
+ * because that write would be lost. setStablePtrEntry() therefore re-checks
+ * after the write (and a full fence) that no enlargement is in progress and
+ * that the table has not moved, and if it has, writes the entry again.
+ * Because enlargeStablePtrTable() sets stable_ptr_table_enlarging (followed by
+ * a full fence) before it starts copying, either the copy sees the write or
+ * the writer sees the flag.
+ *
+ * When setNumCapabilities() disables a capability, its cache goes back to the
+ * global free list (flushStablePtrCache()), since a disabled capability
+ * rarely runs anything and would otherwise keep those entries to itself.
+ */
+
 /* -----------------------------------------------------------------------------
  * We must lock the StablePtr table during GC, to prevent simultaneous
  * calls to freeStablePtr().
@@ -128,6 +177,25 @@ stablePtrLock(void)
     ACQUIRE_LOCK(&stable_ptr_mutex);
 }
 
+#if defined(THREADED_RTS)
+/* Take stable_ptr_mutex and count the acquisition, and whether we had to wait
+ * for it, in the given stats.
+ */
+static void
+stablePtrLockCounting(StablePtrStats *stats)
+{
+    initStablePtrTable();
+    bool contended = TRY_ACQUIRE_LOCK(&stable_ptr_mutex) != 0;
+    if (contended) {
+        ACQUIRE_LOCK(&stable_ptr_mutex);
+    }
+    stats->locked++;
+    if (contended) {
+        stats->contended++;
+    }
+}
+#endif
+
 void
 stablePtrUnlock(void)
 {
@@ -183,6 +251,12 @@ enlargeStablePtrTable(void)
     new_stable_ptr_table =
         stgMallocBytes(SPT_size * sizeof(spEntry),
                        "enlargeStablePtrTable");
+
+#if defined(THREADED_RTS)
+    // See Note [Per-capability stable pointer caches]
+    RELAXED_STORE(&stable_ptr_table_enlarging, true);
+    SEQ_CST_FENCE();
+#endif
     memcpy(new_stable_ptr_table,
            stable_ptr_table,
            old_SPT_size * sizeof(spEntry));
@@ -195,6 +269,9 @@ enlargeStablePtrTable(void)
      * that the new table is visible to others.
      */
     RELEASE_STORE(&stable_ptr_table, new_stable_ptr_table);
+#if defined(THREADED_RTS)
+    RELEASE_STORE(&stable_ptr_table_enlarging, false);
+#endif
 
     initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
 }
@@ -257,12 +334,127 @@ freeStablePtrUnsafe(StgStablePtr sp)
 {
     ASSERT((StgWord)sp < SPT_size);
     freeSpEntry(&stable_ptr_table[(StgWord)sp]);
+    stable_ptr_stats.frees++;
+}
+
+/* -----------------------------------------------------------------------------
+ * Per-capability caches of free entries.
+ * See Note [Per-capability stable pointer caches].
+ * -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+/* The capability owned by the calling thread, or NULL if it doesn't own one. */
+STATIC_INLINE Capability *
+stablePtrCapability(void)
+{
+    Task *task = myTask();
+    if (task != NULL && task->cap != NULL
+        && RELAXED_LOAD(&task->cap->running_task) == task) {
+        return task->cap;
+    }
+    return NULL;
+}
+
+/* Write an entry owned by a capability's cache, without holding
+ * stable_ptr_mutex.
+ */
+STATIC_INLINE void
+setStablePtrEntry(StgWord sp, StgPtr p)
+{
+    for (;;) {
+        spEntry *spt = ACQUIRE_LOAD(&stable_ptr_table);
+        // release store to ensure that the object is visible to
+        // deRefStablePtr.
+        RELEASE_STORE(&spt[sp].addr, p);
+        SEQ_CST_FENCE();
+        if (!ACQUIRE_LOAD(&stable_ptr_table_enlarging)
+            && ACQUIRE_LOAD(&stable_ptr_table) == spt) {
+            return;
+        }
+        busy_wait_nop();
+    }
+}
+
+static void
+refillStablePtrCache(Capability *cap)
+{
+    StablePtrCache *cache = &cap->stable_ptr_cache;
+
+    ASSERT(cache->n_free == 0);
+    stablePtrLockCounting(&cap->stable_ptr_stats);
+    while (cache->n_free < STABLE_PTR_CACHE_SIZE / 2) {
+        if (!stable_ptr_free) enlargeStablePtrTable();
+        spEntry *p = stable_ptr_free;
+        stable_ptr_free = (spEntry*)(p->addr);
+        RELAXED_STORE(&p->addr, NULL);
+        cache->free[cache->n_free++] = p - stable_ptr_table;
+    }
+    stablePtrUnlock();
+}
+
+static void
+returnStablePtrCache(Capability *cap)
+{
+    StablePtrCache *cache = &cap->stable_ptr_cache;
+    const uint32_t n = STABLE_PTR_CACHE_SIZE / 2;
+
+    ASSERT(cache->n_free == STABLE_PTR_CACHE_SIZE);
+    stablePtrLockCounting(&cap->stable_ptr_stats);
+    for (uint32_t i = 0; i < n; i++) {
+        freeSpEntry(&stable_ptr_table[cache->free[i]]);
+    }
+    stablePtrUnlock();
+
+    // keep the most recently freed entries, they are likely still in cache
+    memmove(&cache->free[0], &cache->free[n],
+            (cache->n_free - n) * sizeof(StgWord));
+    cache->n_free -= n;
+}
+
+/* Give all the entries in the cache of cap back to the global free list.
+ * Used when setNumCapabilities() disables cap, whose cache would otherwise
+ * hold on to them.  The caller must own cap.
+ */
+void
+flushStablePtrCache(Capability *cap)
+{
+    StablePtrCache *cache = &cap->stable_ptr_cache;
+
+    if (cache->n_free == 0) {
+        return;
+    }
+    stablePtrLockCounting(&cap->stable_ptr_stats);
+    for (uint32_t i = 0; i < cache->n_free; i++) {
+        freeSpEntry(&stable_ptr_table[cache->free[i]]);
+    }
+    stablePtrUnlock();
+    cache->n_free = 0;
 }
 
+#endif /* THREADED_RTS */
+
 void
 freeStablePtr(StgStablePtr sp)
 {
+#if defined(THREADED_RTS)
+    Capability *cap = stablePtrCapability();
+    if (cap != NULL) {
+        StablePtrCache *cache = &cap->stable_ptr_cache;
+        ASSERT((StgWord)sp < SPT_size);
+        if (cache->n_free == STABLE_PTR_CACHE_SIZE) {
+            returnStablePtrCache(cap);
+        }
+        setStablePtrEntry((StgWord)sp, NULL);
+        cache->free[cache->n_free++] = (StgWord)sp;
+        cap->stable_ptr_stats.frees++;
+        return;
+    }
+
+    stablePtrLockCounting(&stable_ptr_stats);
+#else
     stablePtrLock();
+#endif
     freeStablePtrUnsafe(sp);
     stablePtrUnlock();
 }
@@ -276,15 +468,51 @@ getStablePtr(StgPtr p)
 {
   StgWord sp;
 
+#if defined(THREADED_RTS)
+  Capability *cap = stablePtrCapability();
+  if (cap != NULL) {
+      StablePtrCache *cache = &cap->stable_ptr_cache;
+      if (cache->n_free == 0) {
+          refillStablePtrCache(cap);
+      }
+      sp = cache->free[--cache->n_free];
+      setStablePtrEntry(sp, p);
+      cap->stable_ptr_stats.allocs++;
+      return (StgStablePtr)(sp);
+  }
+
+  stablePtrLockCounting(&stable_ptr_stats);
+#else
   stablePtrLock();
+#endif
   if (!stable_ptr_free) enlargeStablePtrTable();
   sp = stable_ptr_free - stable_ptr_table;
   stable_ptr_free  = (spEntry*)(stable_ptr_free->addr);
   RELAXED_STORE(&stable_ptr_table[sp].addr, p);
+  stable_ptr_stats.allocs++;
   stablePtrUnlock();
   return (StgStablePtr)(sp);
 }
 
+/* -----------------------------------------------------------------------------
+ * Statistics
+ * -------------------------------------------------------------------------- */
+
+void
+getStablePtrStats(StablePtrStats *stats)
+{
+    *stats = stable_ptr_stats;
+#if defined(THREADED_RTS)
+    for (uint32_t i = 0; i < n_capabilities; i++) {
+        const StablePtrStats *s = &capabilities[i]->stable_ptr_stats;
+        stats->allocs    += s->allocs;
+        stats->frees     += s->frees;
+        stats->locked    += s->locked;
+        stats->contended += s->contended;
+    }
+#endif
+}
+
 /* -----------------------------------------------------------------------------
  * Treat stable pointers as roots for the garbage collector.
  * -------------------------------------------------------------------------- */
@@ -43,4 +43,28 @@ void    stablePtrUnlock       ( void );
 extern Mutex stable_ptr_mutex;
 #endif
 
+/* Counters for getStablePtr/freeStablePtr, reported by +RTS -s. */
+typedef struct {
+    StgWord allocs;     // entries handed out by getStablePtr()
+    StgWord frees;      // entries released by freeStablePtr()
+    StgWord locked;     // acquisitions of stable_ptr_mutex
+    StgWord contended;  // ... which found it held by another thread
+} StablePtrStats;
+
+void    getStablePtrStats     ( StablePtrStats *stats );
+
+#if defined(THREADED_RTS)
+/* Each capability keeps a small cache of free entries of the stable pointer
+ * table. See Note [Per-capability stable pointer caches] in StablePtr.c.
+ */
+#define STABLE_PTR_CACHE_SIZE 64
+
+typedef struct {
+    uint32_t n_free;
+    StgWord free[STABLE_PTR_CACHE_SIZE];  // indices into stable_ptr_table
+} StablePtrCache;
+
+void    flushStablePtrCache   ( Capability *cap );
+#endif
+
 #include "EndPrivate.h"
@@ -18,6 +18,9 @@
 #include "sm/Storage.h"
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/NonMovingSweep.h"
+#include "sm/Compact.h"
+#include "sm/Pretenure.h"
 
 // for spin/yield counters
 #include "sm/GC.h"
@@ -50,6 +53,10 @@ static Time
     start_nonmoving_gc_cpu, start_nonmoving_gc_elapsed,
     start_nonmoving_gc_sync_elapsed;
 
+// See Note [GC pause target] in sm/GC.c
+static GcRates gc_rates;
+static Time gc_rates_last_end = 0;
+
 #if defined(PROFILING)
 static Time RP_start_time  = 0, RP_tot_time  = 0;  // retainer prof user time
 static Time RPe_start_time = 0, RPe_tot_time = 0;  // retainer prof elap time
@@ -180,6 +187,8 @@ initStats0(void)
         .nonmoving_gc_max_elapsed_ns = 0,
         .nonmoving_gc_sync_elapsed_ns = 0,
         .nonmoving_gc_sync_max_elapsed_ns = 0,
+        .mem_retained_bytes = 0,
+        .mem_released_bytes = 0,
         .gc = {
             .gen = 0,
             .threads = 0,
@@ -459,6 +468,58 @@ stat_startGC (Capability *cap, gc_thread *gct)
     updateNurseriesStats();
 }
 
+/* -----------------------------------------------------------------------------
+   Measurements for --gc-pause-target
+   -------------------------------------------------------------------------- */
+
+static double
+gc_rate_average (double avg, double sample)
+{
+    return avg == 0 ? sample : 0.7 * avg + 0.3 * sample;
+}
+
+// Called with stats_mutex held, once stats.gc has been filled in.
+static void
+update_gc_rates (gc_thread *initiating_gct, uint32_t gen)
+{
+    Time now = getProcessElapsedTime();
+    Time pause = now - initiating_gct->gc_start_elapsed;
+
+    if (gc_rates_last_end != 0 &&
+            initiating_gct->gc_start_elapsed > gc_rates_last_end) {
+        Time mut = initiating_gct->gc_start_elapsed - gc_rates_last_end;
+        gc_rates.alloc_rate =
+            gc_rate_average(gc_rates.alloc_rate,
+                            stats.gc.allocated_bytes / TimeToSecondsDbl(mut));
+    }
+    gc_rates_last_end = now;
+
+    if (gen == 0 && pause > 0) {
+        gc_rates.minor_pause =
+            (Time) gc_rate_average((double) gc_rates.minor_pause,
+                                   (double) pause);
+        if (stats.gc.copied_bytes > 0) {
+            gc_rates.copy_rate =
+                gc_rate_average(gc_rates.copy_rate,
+                                stats.gc.copied_bytes / TimeToSecondsDbl(pause));
+        }
+        if (stats.gc.allocated_bytes > 0) {
+            gc_rates.survival =
+                gc_rate_average(gc_rates.survival,
+                                (double) stats.gc.copied_bytes
+                                / stats.gc.allocated_bytes);
+        }
+    }
+}
+
+void
+stat_getGcRates (GcRates *rates)
+{
+    ACQUIRE_LOCK(&stats_mutex);
+    *rates = gc_rates;
+    RELEASE_LOCK(&stats_mutex);
+}
+
 /* -----------------------------------------------------------------------------
    Called at the end of each GC
    -------------------------------------------------------------------------- */
@@ -553,6 +614,10 @@ stat_endGC (Capability *cap, gc_thread *initiating_gct, W_ live, W_ copied, W_ s
     stats.gc_cpu_ns += stats.gc.cpu_ns;
     stats.gc_elapsed_ns += stats.gc.elapsed_ns;
 
+    if (RtsFlags.GcFlags.pauseTarget != 0) {
+        update_gc_rates(initiating_gct, gen);
+    }
+
     if (gen == RtsFlags.GcFlags.generations-1) { // major GC?
         stats.major_gcs++;
         if (stats.gc.live_bytes > stats.max_live_bytes) {
@@ -813,14 +878,56 @@ static void init_RTSSummaryStats(RTSSummaryStats* sum)
       stgMallocBytes(sizeof_gc_summary_stats,
                      "alloc_RTSSummaryStats.gc_summary_stats");
     memset(sum->gc_summary_stats, 0, sizeof_gc_summary_stats);
+    sum->numa_blocks =
+      stgCallocBytes(n_numa_nodes, sizeof(NumaBlockStats),
+                     "alloc_RTSSummaryStats.numa_blocks");
+    sum->nonmoving_sweep =
+      stgCallocBytes(NONMOVING_ALLOCA_CNT, sizeof(struct NonmovingSweepTotals),
+                     "alloc_RTSSummaryStats.nonmoving_sweep");
+#if defined(THREADED_RTS)
+    sum->stm_caps =
+      stgCallocBytes(n_capabilities, sizeof(StmCounters),
+                     "alloc_RTSSummaryStats.stm_caps");
+#endif
 }
 
 static void free_RTSSummaryStats(RTSSummaryStats * sum)
 {
     stgFree(sum->gc_summary_stats);
     sum->gc_summary_stats = NULL;
+    stgFree(sum->numa_blocks);
+    sum->numa_blocks = NULL;
+    stgFree(sum->nonmoving_sweep);
+    sum->nonmoving_sweep = NULL;
+#if defined(THREADED_RTS)
+    stgFree(sum->stm_caps);
+    sum->stm_caps = NULL;
+#endif
 }
 
+#if defined(THREADED_RTS)
+static const char *sparkStealPolicyName(SPARK_STEAL_POLICY policy)
+{
+    switch (policy) {
+    case SPARK_STEAL_SEQUENTIAL:  return "sequential";
+    case SPARK_STEAL_RANDOM:      return "random";
+    case SPARK_STEAL_NUMA:        return "numa";
+    case SPARK_STEAL_LAST_VICTIM: return "last";
+    default:                      return "unknown";
+    }
+}
+
+static const char *stmContentionPolicyName(STM_CONTENTION_POLICY policy)
+{
+    switch (policy) {
+    case STM_CONTENTION_NONE:      return "none";
+    case STM_CONTENTION_BACKOFF:   return "backoff";
+    case STM_CONTENTION_SERIALIZE: return "serialize";
+    default:                       return "unknown";
+    }
+}
+#endif
+
 // Must hold stats_mutex.
 static void report_summary(const RTSSummaryStats* sum)
 {
@@ -884,10 +991,52 @@ static void report_summary(const RTSSummaryStats* sum)
                     TimeToSecondsDbl(stats.nonmoving_gc_elapsed_ns),
                     TimeToSecondsDbl(stats.nonmoving_gc_elapsed_ns) / n_major_colls,
                     TimeToSecondsDbl(stats.nonmoving_gc_max_elapsed_ns));
+
+        // See Note [Parallel and lazy nonmoving sweep]
+        for (int i = 0; i < NONMOVING_ALLOCA_CNT; i++) {
+            const struct NonmovingSweepTotals *sweep = &sum->nonmoving_sweep[i];
+            if (sweep->n_segs == 0) {
+                continue;
+            }
+            statsPrintf("  Gen %2d sweep %5d byte blocks: %8" FMT_Word64
+                        " segments, %6.3fs\n",
+                        nonmoving_gen, 1 << (i + NONMOVING_ALLOCA0),
+                        sweep->n_segs, TimeToSecondsDbl(sweep->sweep_time));
+        }
+    }
+
+    if (sum->scav_prefetched > 0) {
+        // See Note [Scavenge prefetching]
+        statsPrintf("  Scavenge prefetch: %" FMT_Word " objects prefetched "
+                    "ahead, depth %" FMT_Word32 "\n",
+                    sum->scav_prefetched,
+                    RtsFlags.GcFlags.scavPrefetchDepth);
+    }
+
+    if (RtsFlags.GcFlags.pretenureSurvival != 0) {
+        // See Note [Pretenuring by allocation site]
+        statsPrintf("  Pretenured: %" FMT_Word " objects copied straight to "
+                    "the oldest generation, %" FMT_Word32 " sites\n",
+                    sum->pretenured_objects, sum->pretenured_sites);
     }
 
     statsPrintf("\n");
 
+    if (n_numa_nodes > 1) {
+        // See Note [NUMA block allocation]
+        for (uint32_t n = 0; n < n_numa_nodes; n++) {
+            const NumaBlockStats *numa = &sum->numa_blocks[n];
+            statsPrintf("  NUMA node %2d: %8" FMT_Word " blocks in use (%"
+                        FMT_Word " peak), %" FMT_Word " free megablocks, %"
+                        FMT_Word64 " blocks allocated locally, %" FMT_Word64
+                        " remotely\n",
+                        n, numa->alloc_blocks, numa->hw_alloc_blocks,
+                        numa->free_mblocks, numa->local_blocks,
+                        numa->remote_blocks);
+        }
+        statsPrintf("\n");
+    }
+
 #if defined(THREADED_RTS)
     if (RtsFlags.ParFlags.parGcEnabled && sum->work_balance > 0) {
         // See Note [Work Balance]
@@ -896,6 +1045,14 @@ static void report_summary(const RTSSummaryStats* sum)
                     sum->work_balance * 100);
     }
 
+    if (sum->parallel_compactions > 0) {
+        // See Note [Parallel compaction]
+        statsPrintf("  Parallel compaction: %" FMT_Word32 " collections, "
+                    "up to %" FMT_Word32 " of %" FMT_Word32 " workers busy\n\n",
+                    sum->parallel_compactions, sum->compact_workers_used,
+                    RtsFlags.ParFlags.compactWorkers);
+    }
+
     statsPrintf("  TASKS: %d "
                 "(%d bound, %d peak workers (%d total), using -N%d)\n\n",
                 taskCount, sum->bound_task_count,
@@ -909,6 +1066,72 @@ static void report_summary(const RTSSummaryStats* sum)
                 sum->sparks.converted, sum->sparks.overflowed,
                 sum->sparks.dud, sum->sparks.gcd,
                 sum->sparks.fizzled);
+
+    if (sum->spark_steals.attempts > 0) {
+        statsPrintf("  SPARK STEALS: %" FMT_Word
+                    " (%" FMT_Word " attempts, %" FMT_Word " node-local, %"
+                    FMT_Word " failed searches, policy %s)\n\n",
+                    sum->spark_steals.stolen,
+                    sum->spark_steals.attempts,
+                    sum->spark_steals.local,
+                    sum->spark_steals.failed,
+                    sparkStealPolicyName(RtsFlags.ParFlags.sparkStealPolicy));
+    }
+
+    if (sum->stable_ptrs.allocs > 0) {
+        statsPrintf("  STABLE PTRS: %" FMT_Word " created, %" FMT_Word
+                    " freed (%" FMT_Word " table lock acquisitions, %"
+                    FMT_Word " contended)\n\n",
+                    sum->stable_ptrs.allocs, sum->stable_ptrs.frees,
+                    sum->stable_ptrs.locked, sum->stable_ptrs.contended);
+    }
+
+    if (sum->block_alloc.allocs > 0) {
+        statsPrintf("  BLOCK CACHES: %" FMT_Word " blocks allocated, %"
+                    FMT_Word " refills, %" FMT_Word " flushes\n",
+                    sum->block_alloc.allocs, sum->block_alloc.refills,
+                    sum->block_alloc.flushes);
+        statsPrintf("  BLOCK ALLOC LOCKS: sm_mutex %" FMT_Word " (%" FMT_Word
+                    " contended), gc_alloc_block_sync %" FMT_Word " (%"
+                    FMT_Word " contended)\n\n",
+                    sum->block_alloc.sm_locked, sum->block_alloc.sm_contended,
+                    sum->block_alloc.gc_locked, sum->block_alloc.gc_contended);
+    }
+
+    if (sum->stm.commits + sum->stm.aborts > 0) {
+        statsPrintf("  STM: %" FMT_Word64 " commits (%" FMT_Word64
+                    " without validation), %" FMT_Word64 " aborts (%"
+                    FMT_Word64 " deferred, %" FMT_Word64 " serialized, "
+                    "at most %" FMT_Word64 " in a row), contention manager %s\n",
+                    sum->stm.commits, sum->stm.snapshot_commits,
+                    sum->stm.aborts, sum->stm.deferred,
+                    sum->stm.serialized, sum->stm.max_aborts,
+                    stmContentionPolicyName(RtsFlags.ParFlags.stmContention));
+        if (n_capabilities > 1 && sum->stm.aborts > 0) {
+            for (uint32_t i = 0; i < n_capabilities; i++) {
+                const StmCounters *c = &sum->stm_caps[i];
+                if (c->commits + c->aborts == 0) continue;
+                statsPrintf("    cap %2d: %" FMT_Word64 " commits, %"
+                            FMT_Word64 " aborts (%" FMT_Word64
+                            " deferred, at most %" FMT_Word64 " in a row)\n",
+                            i, c->commits, c->aborts, c->deferred,
+                            c->max_aborts);
+            }
+        }
+        statsPrintf("\n");
+    }
+
+#if defined(TRACING)
+    if (RtsFlags.TraceFlags.eventlogAsync && eventlog_enabled) {
+        statsPrintf("  EVENTLOG WRITER: %" FMT_Word " buffers written, %"
+                    FMT_Word " waits, %" FMT_Word " buffers (%" FMT_Word64
+                    " bytes) dropped\n\n",
+                    sum->eventlog_writer.bufs_written,
+                    sum->eventlog_writer.blocked,
+                    sum->eventlog_writer.dropped_bufs,
+                    sum->eventlog_writer.dropped_bytes);
+    }
+#endif
 #endif
 
     statsPrintf("  INIT    time  %7.3fs  (%7.3fs elapsed)\n",
@@ -1122,6 +1345,8 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("gc_wall_percent", "f", sum->gc_cpu_percent);
 #endif
     MR_STAT("fragmentation_bytes", FMT_Word64, sum->fragmentation_bytes);
+    MR_STAT("scav_prefetched_objects", FMT_Word, sum->scav_prefetched);
+    MR_STAT("pretenured_objects", FMT_Word, sum->pretenured_objects);
     // average_bytes_used is done above
     MR_STAT("alloc_rate", FMT_Word64, sum->alloc_rate);
     MR_STAT("productivity_cpu_percent", "f", sum->productivity_cpu_percent);
@@ -1138,7 +1363,45 @@ static void report_machine_readable (const RTSSummaryStats * sum)
     MR_STAT("sparks_dud ", FMT_Word, sum->sparks.dud);
     MR_STAT("sparks_gcd", FMT_Word, sum->sparks.gcd);
     MR_STAT("sparks_fizzled", FMT_Word, sum->sparks.fizzled);
+    MR_STAT("spark_steals", FMT_Word, sum->spark_steals.stolen);
+    MR_STAT("spark_steal_attempts", FMT_Word, sum->spark_steals.attempts);
+    MR_STAT("spark_steals_local", FMT_Word, sum->spark_steals.local);
+    MR_STAT("spark_steal_failed_searches", FMT_Word,
+            sum->spark_steals.failed);
+    MR_STAT("stable_ptrs_created", FMT_Word, sum->stable_ptrs.allocs);
+    MR_STAT("stable_ptrs_freed", FMT_Word, sum->stable_ptrs.frees);
+    MR_STAT("stable_ptr_lock_acquisitions", FMT_Word,
+            sum->stable_ptrs.locked);
+    MR_STAT("stable_ptr_lock_contended", FMT_Word,
+            sum->stable_ptrs.contended);
+    MR_STAT("block_cache_allocs", FMT_Word, sum->block_alloc.allocs);
+    MR_STAT("block_cache_refills", FMT_Word, sum->block_alloc.refills);
+    MR_STAT("block_cache_flushes", FMT_Word, sum->block_alloc.flushes);
+    MR_STAT("sm_lock_acquisitions", FMT_Word, sum->block_alloc.sm_locked);
+    MR_STAT("sm_lock_contended", FMT_Word, sum->block_alloc.sm_contended);
+    MR_STAT("gc_alloc_block_lock_acquisitions", FMT_Word,
+            sum->block_alloc.gc_locked);
+    MR_STAT("gc_alloc_block_lock_contended", FMT_Word,
+            sum->block_alloc.gc_contended);
+    MR_STAT("stm_commits", FMT_Word64, sum->stm.commits);
+    MR_STAT("stm_snapshot_commits", FMT_Word64, sum->stm.snapshot_commits);
+    MR_STAT("stm_aborts", FMT_Word64, sum->stm.aborts);
+    MR_STAT("stm_validations", FMT_Word64, sum->stm.validations);
+    MR_STAT("stm_deferred", FMT_Word64, sum->stm.deferred);
+    MR_STAT("stm_serialized", FMT_Word64, sum->stm.serialized);
+    MR_STAT("stm_max_consecutive_aborts", FMT_Word64, sum->stm.max_aborts);
+#if defined(TRACING)
+    MR_STAT("eventlog_buffers_written", FMT_Word,
+            sum->eventlog_writer.bufs_written);
+    MR_STAT("eventlog_writer_waits", FMT_Word, sum->eventlog_writer.blocked);
+    MR_STAT("eventlog_buffers_dropped", FMT_Word,
+            sum->eventlog_writer.dropped_bufs);
+    MR_STAT("eventlog_bytes_dropped", FMT_Word64,
+            sum->eventlog_writer.dropped_bytes);
+#endif
     MR_STAT("work_balance", "f", sum->work_balance);
+    MR_STAT("parallel_compactions", FMT_Word32, sum->parallel_compactions);
+    MR_STAT("compact_workers_used", FMT_Word32, sum->compact_workers_used);
 
     // next, globals (other than internal counters)
     MR_STAT("n_capabilities", FMT_Word32, n_capabilities);
@@ -1353,6 +1616,18 @@ stat_exitReport (void)
 
         // We populate the remainder (non-time elements) of sum
         {
+            ACQUIRE_SM_LOCK;
+            for (uint32_t n = 0; n < n_numa_nodes; n++) {
+                getNumaBlockStats(n, &sum.numa_blocks[n]);
+            }
+            RELEASE_SM_LOCK;
+
+            if (RtsFlags.GcFlags.useNonmoving) {
+                getNonmovingSweepTotals(sum.nonmoving_sweep);
+            }
+            sum.scav_prefetched = RELAXED_LOAD(&scav_prefetched_objects);
+            getPretenureTotals(&sum.pretenured_objects, &sum.pretenured_sites);
+
     #if defined(THREADED_RTS)
             sum.bound_task_count = taskCount - workerCount;
 
@@ -1365,12 +1640,38 @@ stat_exitReport (void)
                   capabilities[i]->spark_stats.converted;
                 sum.sparks.gcd       += capabilities[i]->spark_stats.gcd;
                 sum.sparks.fizzled   += capabilities[i]->spark_stats.fizzled;
+
+                sum.spark_steals.attempts +=
+                  capabilities[i]->spark_steal_stats.attempts;
+                sum.spark_steals.stolen   +=
+                  capabilities[i]->spark_steal_stats.stolen;
+                sum.spark_steals.local    +=
+                  capabilities[i]->spark_steal_stats.local;
+                sum.spark_steals.failed   +=
+                  capabilities[i]->spark_steal_stats.failed;
+
+                const StmCounters *stm = &capabilities[i]->stm_stats;
+                sum.stm_caps[i] = *stm;
+                sum.stm.commits          += stm->commits;
+                sum.stm.snapshot_commits += stm->snapshot_commits;
+                sum.stm.aborts           += stm->aborts;
+                sum.stm.validations      += stm->validations;
+                sum.stm.deferred         += stm->deferred;
+                sum.stm.serialized       += stm->serialized;
+                sum.stm.max_aborts =
+                  stg_max(sum.stm.max_aborts, stm->max_aborts);
             }
 
             sum.sparks_count = sum.sparks.created
                 + sum.sparks.dud
                 + sum.sparks.overflowed;
 
+            getStablePtrStats(&sum.stable_ptrs);
+            getBlockAllocStats(&sum.block_alloc);
+#if defined(TRACING)
+            getEventLogWriterStats(&sum.eventlog_writer);
+#endif
+
             if (RtsFlags.ParFlags.parGcEnabled && stats.par_copied_bytes > 0) {
                 // See Note [Work Balance]
                 sum.work_balance =
@@ -1379,6 +1680,8 @@ stat_exitReport (void)
             } else {
                 sum.work_balance = 0;
             }
+            getParallelCompactStats(&sum.parallel_compactions,
+                                    &sum.compact_workers_used);
 
 
     #else // THREADED_RTS
@@ -1721,6 +2024,8 @@ void getRTSStats( RTSStats *s )
         stats.nonmoving_gc_cpu_ns;
     s->mutator_elapsed_ns = current_elapsed - end_init_elapsed -
         stats.gc_elapsed_ns;
+
+    getMBlockReleaseStats(&s->mem_retained_bytes, &s->mem_released_bytes);
 }
 
 /* -----------------------------------------------------------------------------
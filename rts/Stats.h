@@ -10,7 +10,11 @@
 
 #include "GetTime.h"
 #include "sm/GC.h"
+#include "sm/BlockAlloc.h"
 #include "Sparks.h"
+#include "StablePtr.h"
+#include "STM.h"
+#include "eventlog/EventLog.h"
 
 #include "BeginPrivate.h"
 
@@ -60,6 +64,17 @@ void      statDescribeGens( void );
 Time      stat_getElapsedGCTime(void);
 Time      stat_getElapsedTime(void);
 
+/* Smoothed measurements driving --gc-pause-target.
+ * See Note [GC pause target] in sm/GC.c. */
+typedef struct GcRates_ {
+    double copy_rate;     // bytes copied per second of minor GC
+    double alloc_rate;    // bytes allocated per second of mutator time
+    double survival;      // fraction of the allocated bytes copied by minor GCs
+    Time   minor_pause;   // elapsed time of a minor GC
+} GcRates;
+
+void      stat_getGcRates(GcRates *rates);
+
 typedef struct GenerationSummaryStats_ {
     uint32_t collections;
     uint32_t par_collections;
@@ -90,11 +105,24 @@ typedef struct RTSSummaryStats_ {
     uint32_t bound_task_count;
     uint64_t sparks_count;
     SparkCounters sparks;
+    SparkStealCounters spark_steals;
+    StablePtrStats stable_ptrs;
+    BlockAllocStats block_alloc;
+    StmCounters stm;
+    StmCounters *stm_caps;       // one for each capability
+#if defined(TRACING)
+    EventLogWriterStats eventlog_writer;
+#endif
     double work_balance;
+    uint32_t parallel_compactions; // see Note [Parallel compaction]
+    uint32_t compact_workers_used;
 #else // THREADED_RTS
     double gc_cpu_percent;
     double gc_elapsed_percent;
 #endif
+    StgWord scav_prefetched;     // see Note [Scavenge prefetching]
+    StgWord pretenured_objects;  // see Note [Pretenuring by allocation site]
+    uint32_t pretenured_sites;
     uint64_t fragmentation_bytes;
     uint64_t average_bytes_used; // This is not shown in the '+RTS -s' report
     uint64_t alloc_rate;
@@ -103,6 +131,13 @@ typedef struct RTSSummaryStats_ {
 
     // one for each generation, 0 first
     GenerationSummaryStats* gc_summary_stats;
+
+    // one for each NUMA node, see Note [NUMA block allocation]
+    NumaBlockStats* numa_blocks;
+
+    // one for each nonmoving allocator, see Note [Parallel and lazy nonmoving
+    // sweep]
+    struct NonmovingSweepTotals* nonmoving_sweep;
 } RTSSummaryStats;
 
 #include "EndPrivate.h"
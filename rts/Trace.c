@@ -404,6 +404,36 @@ void traceEventMemReturn_ (Capability *cap,
     }
 }
 
+void traceEventGcPauseControl_ (Capability *cap,
+                                Time        target,
+                                Time        minor_pause,
+                                W_          copy_rate,
+                                W_          alloc_rate,
+                                uint32_t    survival_permille,
+                                W_          nursery_bytes,
+                                W_          gen_max_bytes)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        traceCap_stderr(cap, "GC pause control (target: %" FMT_Word64 "ns) "
+                        "(minor pause: %" FMT_Word64 "ns) "
+                        "(copy rate: %" FMT_Word "B/s) "
+                        "(alloc rate: %" FMT_Word "B/s) "
+                        "(survival: %u/1000) (nursery: %" FMT_Word "B) "
+                        "(gen max: %" FMT_Word "B)",
+                        (StgWord64) TimeToNS(target),
+                        (StgWord64) TimeToNS(minor_pause),
+                        copy_rate, alloc_rate, survival_permille,
+                        nursery_bytes, gen_max_bytes);
+    } else
+#endif
+    {
+        postEventGcPauseControl(cap, CAPSET_HEAP_DEFAULT, target, minor_pause,
+                                copy_rate, alloc_rate, survival_permille,
+                                nursery_bytes, gen_max_bytes);
+    }
+}
+
 void traceCapEvent_ (Capability   *cap,
                      EventTypeNum  tag)
 {
@@ -592,6 +622,36 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+void traceSparkStealCounters_ (Capability *cap,
+                               SparkStealCounters counters)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* as for traceSparkCounters_ */
+    } else
+#endif
+    {
+        postSparkStealCountersEvent(cap, counters);
+    }
+}
+
+void traceStmCounters_ (Capability *cap,
+                        StmCounters counters)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: STM commits: %" FMT_Word64 " (%" FMT_Word64
+                   " from snapshot), aborts: %" FMT_Word64
+                   ", validations: %" FMT_Word64 "\n",
+                   cap->no, counters.commits, counters.snapshot_commits,
+                   counters.aborts, counters.validations);
+    } else
+#endif
+    {
+        postStmCountersEvent(cap, counters);
+    }
+}
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap)
 {
@@ -883,6 +943,19 @@ void traceConcMarkEnd(StgWord32 marked_obj_count)
         postConcMarkEnd(marked_obj_count);
 }
 
+void traceConcMarkWorkerBegin(uint32_t worker)
+{
+    if (eventlog_enabled)
+        postConcMarkWorkerBegin(worker);
+}
+
+void traceConcMarkWorkerEnd(uint32_t worker, StgWord32 marked_obj_count,
+                            StgWord32 steals)
+{
+    if (eventlog_enabled)
+        postConcMarkWorkerEnd(worker, marked_obj_count, steals);
+}
+
 void traceConcSyncBegin()
 {
     if (eventlog_enabled)
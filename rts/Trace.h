@@ -167,6 +167,15 @@ void traceEventMemReturn_  (Capability *cap,
                           uint32_t    needed_mblocks,
                           uint32_t    returned_mblocks );
 
+void traceEventGcPauseControl_ (Capability *cap,
+                                Time        target,
+                                Time        minor_pause,
+                                W_          copy_rate,
+                                W_          alloc_rate,
+                                uint32_t    survival_permille,
+                                W_          nursery_bytes,
+                                W_          gen_max_bytes);
+
 /*
  * Record a spark event
  */
@@ -290,6 +299,12 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+void traceSparkStealCounters_ (Capability *cap,
+                               SparkStealCounters counters);
+
+void traceStmCounters_ (Capability *cap,
+                        StmCounters counters);
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap);
 
@@ -321,6 +336,9 @@ void traceProfBegin(void);
 
 void traceConcMarkBegin(void);
 void traceConcMarkEnd(StgWord32 marked_obj_count);
+void traceConcMarkWorkerBegin(uint32_t worker);
+void traceConcMarkWorkerEnd(uint32_t worker, StgWord32 marked_obj_count,
+                            StgWord32 steals);
 void traceConcSyncBegin(void);
 void traceConcSyncEnd(void);
 void traceConcSweepBegin(void);
@@ -350,6 +368,9 @@ void flushTrace(void);
                            par_n_threads, par_max_copied, \
                            par_tot_copied, par_balanced_copied) /* nothing */
 #define traceEventMemReturn_(cap, current, needed, returned) /* nothing */
+#define traceEventGcPauseControl_(cap, target, minor_pause, copy_rate, \
+                                  alloc_rate, survival_permille, \
+                                  nursery_bytes, gen_max_bytes) /* nothing */
 #define traceHeapEvent(cap, tag, heap_capset, info1) /* nothing */
 #define traceEventHeapInfo_(heap_capset, gens, \
                             maxHeapSize, allocAreaSize, \
@@ -367,6 +388,8 @@ void flushTrace(void);
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_()  /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceSparkStealCounters_(cap, counters) /* nothing */
+#define traceStmCounters_(cap, counters) /* nothing */
 #define traceTaskCreate_(taskID, cap) /* nothing */
 #define traceTaskMigrate_(taskID, cap, new_cap) /* nothing */
 #define traceTaskDelete_(taskID) /* nothing */
@@ -381,6 +404,8 @@ void flushTrace(void);
 
 #define traceConcMarkBegin() /* nothing */
 #define traceConcMarkEnd(marked_obj_count) /* nothing */
+#define traceConcMarkWorkerBegin(worker) /* nothing */
+#define traceConcMarkWorkerEnd(worker, marked_obj_count, steals) /* nothing */
 #define traceConcSyncBegin() /* nothing */
 #define traceConcSyncEnd() /* nothing */
 #define traceConcSweepBegin() /* nothing */
@@ -771,6 +796,22 @@ INLINE_HEADER void traceEventMemReturn(Capability *cap            STG_UNUSED,
     dtraceEventMemReturn(current_mblocks, needed_mblocks, returned_mblocks);
 }
 
+INLINE_HEADER void traceEventGcPauseControl(Capability *cap STG_UNUSED,
+                                            Time   target        STG_UNUSED,
+                                            Time   minor_pause   STG_UNUSED,
+                                            W_     copy_rate     STG_UNUSED,
+                                            W_     alloc_rate    STG_UNUSED,
+                                            uint32_t survival_permille STG_UNUSED,
+                                            W_     nursery_bytes STG_UNUSED,
+                                            W_     gen_max_bytes STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcPauseControl_(cap, target, minor_pause, copy_rate,
+                                  alloc_rate, survival_permille,
+                                  nursery_bytes, gen_max_bytes);
+    }
+}
+
 INLINE_HEADER void traceEventHeapInfo(CapsetID    heap_capset   STG_UNUSED,
                                       uint32_t  gens          STG_UNUSED,
                                       W_        maxHeapSize   STG_UNUSED,
@@ -867,11 +908,20 @@ INLINE_HEADER void traceEventCreateSparkThread(Capability  *cap      STG_UNUSED,
     dtraceCreateSparkThread((EventCapNo)cap->no, (EventThreadID)spark_tid);
 }
 
+INLINE_HEADER void traceStmCounters(Capability *cap STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched) &&
+        cap->stm_stats.commits + cap->stm_stats.aborts > 0) {
+        traceStmCounters_(cap, cap->stm_stats);
+    }
+}
+
 INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
 {
 #if defined(THREADED_RTS)
     if (RTS_UNLIKELY(TRACE_spark_sampled)) {
         traceSparkCounters_(cap, cap->spark_stats, sparkPoolSize(cap->sparks));
+        traceSparkStealCounters_(cap, cap->spark_steal_stats);
     }
     dtraceSparkCounters((EventCapNo)cap->no,
                         cap->spark_stats.created,
@@ -106,8 +106,85 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+#if defined(THREADED_RTS)
+  struct _EventsRing *ring; // see Note [Eventlog writer thread], or NULL
+#endif
 } EventsBuf;
 
+#if defined(THREADED_RTS)
+/* Note [Eventlog writer thread]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Normally a capability whose event buffer is full writes it out itself (in
+ * printAndClearEventBuf), which stalls the capability for as long as the
+ * EventLogWriter takes, e.g. on a slow disk. With +RTS --eventlog-async we
+ * instead start a dedicated writer thread, and every EventsBuf (each
+ * capability's and the global eventBuf) gets an EventsRing of
+ * --eventlog-async-buffers buffers of EVENT_LOG_SIZE bytes:
+ *
+ *  - The EventsBuf always points to the buffer at index `head` of its ring.
+ *    When it is full, or flushed, handOffEventsBuf() records its length,
+ *    increments `head` and carries on in the next buffer.
+ *
+ *  - The writer thread writes out buffers from `tail` to `head` and increments
+ *    `tail` as it goes.
+ *
+ * Each ring has a single producer (whoever may post to the EventsBuf: the
+ * owner of the capability or the holder of eventBufMutex) and a single
+ * consumer (the writer thread), so `head` and `tail` are simply published
+ * with release stores. writer_mutex is only taken to sleep and wake up: by
+ * the writer thread when there is nothing to write, and by a producer when
+ * it has handed off a buffer or needs to wait for one.
+ *
+ * If a producer fills its current buffer while all the other buffers of its
+ * ring are still waiting to be written, the --eventlog-async policy decides
+ * whether it waits for the writer thread (block) or discards the events in
+ * the full buffer and reuses it (drop). In the latter case we post an
+ * EVENTLOG_DROPPED event at the start of the reused buffer so that consumers
+ * of the eventlog know about the gap. Explicit flushes always wait.
+ *
+ * Since blocks from different rings may be written in any order, the header
+ * is written synchronously before the writer thread is started, and the
+ * writer thread is stopped (after writing out everything) before we post
+ * EVENT_DATA_END. Once the thread has stopped, printAndClearEventBuf writes
+ * the current buffer of a ring synchronously again. A producer that hands off
+ * a buffer while the thread is stopping (writer_stop is set) cannot rely on
+ * it being written, so it waits for its ring to drain and writes the buffer
+ * itself.
+ */
+typedef struct _EventsRing {
+  StgInt8 **bufs;           // n_bufs buffers of EVENT_LOG_SIZE bytes
+  size_t *lens;             // bytes to write from each handed off buffer
+  uint32_t n_bufs;
+  StgWord head;             // buffers handed off, written by the producer
+  StgWord tail;             // buffers written, written by the writer thread
+  // Statistics, written by the producer
+  StgWord blocked;          // times the producer waited for the writer
+  StgWord dropped_bufs;
+  StgWord64 dropped_bytes;
+} EventsRing;
+
+static bool writer_running = false;   // protected by state_change_mutex
+static bool writer_stop;              // protected by writer_mutex
+static OSThreadId writer_thread;
+static Mutex writer_mutex;
+static Condition writer_wakeup;       // a buffer was handed off, or stop
+static Condition writer_progress;     // buffers have been written
+static EventsRing **writer_rings = NULL;  // protected by writer_mutex
+static uint32_t n_writer_rings = 0;
+static StgWord writer_bufs_written = 0;   // protected by writer_mutex
+// Statistics of the rings that have been detached, protected by writer_mutex
+static StgWord writer_detached_blocked = 0;
+static StgWord writer_detached_dropped_bufs = 0;
+static StgWord64 writer_detached_dropped_bytes = 0;
+
+static void startEventLogWriterThread(void);
+static void stopEventLogWriterThread(void);
+static void drainEventLogWriterThread(void);
+static void attachEventsRing(EventsBuf *eb);
+static void detachEventsRing(EventsBuf *eb);
+static void handOffEventsBuf(EventsBuf *eb, bool may_drop);
+#endif
+
 static EventsBuf *capEventBuf; // one EventsBuf for each Capability
 
 static EventsBuf eventBuf; // an EventsBuf not associated with any Capability
@@ -142,6 +219,8 @@ static void freeEventLoggingBuffer(void);
 
 static void ensureRoomForEvent(EventsBuf *eb, EventTypeNum tag);
 static int ensureRoomForVariableEvent(EventsBuf *eb, StgWord16 size);
+static void flushFullEventBuf(EventsBuf *eb);
+static void freeEventsBuf(EventsBuf *eb);
 
 static inline void postWord8(EventsBuf *eb, StgWord8 i)
 {
@@ -376,6 +455,9 @@ initEventLogging()
 #if defined(THREADED_RTS)
     initMutex(&eventBufMutex);
     initMutex(&state_change_mutex);
+    initMutex(&writer_mutex);
+    initCondition(&writer_wakeup);
+    initCondition(&writer_progress);
 #endif
 }
 
@@ -405,6 +487,12 @@ startEventLogging_(void)
 
     RELEASE_LOCK(&eventBufMutex);
 
+#if defined(THREADED_RTS)
+    if (RtsFlags.TraceFlags.eventlogAsync) {
+        startEventLogWriterThread();
+    }
+#endif
+
     return true;
 }
 
@@ -434,6 +522,15 @@ startEventLogging(const EventLogWriter *ev_writer)
 void
 restartEventLogging(void)
 {
+#if defined(THREADED_RTS)
+    // The writer thread did not survive the fork. The parent drained it in
+    // flushAllCapsEventsBufs, so we just forget about its rings (which leaks
+    // them, like the buffers themselves).
+    writer_running = false;
+    stgFree(writer_rings);
+    writer_rings = NULL;
+    n_writer_rings = 0;
+#endif
     freeEventLoggingBuffer();
     stopEventLogWriter();
     initEventLogging();  // allocate new per-capability buffers
@@ -453,7 +550,14 @@ finishCapEventLogging(void)
         for (uint32_t c = 0; c < n_capabilities; ++c) {
             if (capEventBuf[c].begin != NULL) {
                 printAndClearEventBuf(&capEventBuf[c]);
-                stgFree(capEventBuf[c].begin);
+            }
+        }
+#if defined(THREADED_RTS)
+        drainEventLogWriterThread();
+#endif
+        for (uint32_t c = 0; c < n_capabilities; ++c) {
+            if (capEventBuf[c].begin != NULL) {
+                freeEventsBuf(&capEventBuf[c]);
             }
         }
     }
@@ -478,6 +582,12 @@ endEventLogging(void)
         flushEventLog(NULL);
     }
 
+#if defined(THREADED_RTS)
+    // Write out everything before the end of data marker, see
+    // Note [Eventlog writer thread].
+    stopEventLogWriterThread();
+#endif
+
     ACQUIRE_LOCK(&eventBufMutex);
 
     // Mark end of events (data).
@@ -509,6 +619,11 @@ moreCapEventBufs (uint32_t from, uint32_t to)
     // Initialize buffers for new capabilities
     for (uint32_t c = from; c < to; ++c) {
         initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+#if defined(THREADED_RTS)
+        if (writer_running) {
+            attachEventsRing(&capEventBuf[c]);
+        }
+#endif
     }
 
     // The from == 0 already covered in initEventLogging, so we are interested
@@ -644,6 +759,37 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postSparkStealCountersEvent (Capability *cap,
+                             SparkStealCounters counters)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_SPARK_STEAL_COUNTERS);
+
+    postEventHeader(eb, EVENT_SPARK_STEAL_COUNTERS);
+    /* EVENT_SPARK_STEAL_COUNTERS (policy,att,stl,loc,fail) */
+    postWord8(eb,RtsFlags.ParFlags.sparkStealPolicy);
+    postWord64(eb,counters.attempts);
+    postWord64(eb,counters.stolen);
+    postWord64(eb,counters.local);
+    postWord64(eb,counters.failed);
+}
+
+void
+postStmCountersEvent (Capability *cap,
+                      StmCounters counters)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_STM_COUNTERS);
+
+    postEventHeader(eb, EVENT_STM_COUNTERS);
+    /* EVENT_STM_COUNTERS (commits,snapshot,aborts,validations) */
+    postWord64(eb,counters.commits);
+    postWord64(eb,counters.snapshot_commits);
+    postWord64(eb,counters.aborts);
+    postWord64(eb,counters.validations);
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -920,6 +1066,30 @@ void postEventMemReturn  (Capability    *cap,
     postWord32(eb, returned_mblocks);
 }
 
+void postEventGcPauseControl (Capability   *cap,
+                              EventCapsetID heap_capset,
+                              Time          target,
+                              Time          minor_pause,
+                              W_            copy_rate,
+                              W_            alloc_rate,
+                              uint32_t      survival_permille,
+                              W_            nursery_bytes,
+                              W_            gen_max_bytes)
+{
+    EventsBuf *eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_GC_PAUSE_CONTROL);
+
+    postEventHeader(eb, EVENT_GC_PAUSE_CONTROL);
+    postCapsetID(eb, heap_capset);
+    postWord64(eb, TimeToNS(target));
+    postWord64(eb, TimeToNS(minor_pause));
+    postWord64(eb, copy_rate);
+    postWord64(eb, alloc_rate);
+    postWord32(eb, survival_permille);
+    postWord64(eb, nursery_bytes);
+    postWord64(eb, gen_max_bytes);
+}
+
 void postTaskCreateEvent (EventTaskId taskId,
                           EventCapNo capno,
                           EventKernelThreadId tid)
@@ -1116,6 +1286,27 @@ void postConcMarkEnd(StgWord32 marked_obj_count)
     RELEASE_LOCK(&eventBufMutex);
 }
 
+void postConcMarkWorkerBegin(uint32_t worker)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+    ensureRoomForEvent(&eventBuf, EVENT_CONC_MARK_WORKER_BEGIN);
+    postEventHeader(&eventBuf, EVENT_CONC_MARK_WORKER_BEGIN);
+    postWord16(&eventBuf, (StgWord16)worker);
+    RELEASE_LOCK(&eventBufMutex);
+}
+
+void postConcMarkWorkerEnd(uint32_t worker, StgWord32 marked_obj_count,
+                           StgWord32 steals)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+    ensureRoomForEvent(&eventBuf, EVENT_CONC_MARK_WORKER_END);
+    postEventHeader(&eventBuf, EVENT_CONC_MARK_WORKER_END);
+    postWord16(&eventBuf, (StgWord16)worker);
+    postWord32(&eventBuf, marked_obj_count);
+    postWord32(&eventBuf, steals);
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void postNonmovingHeapCensus(int log_blk_size,
                              const struct NonmovingAllocCensus *census)
 {
@@ -1443,6 +1634,12 @@ void printAndClearEventBuf (EventsBuf *ebuf)
 
     if (ebuf->begin != NULL && ebuf->pos != ebuf->begin)
     {
+#if defined(THREADED_RTS)
+        if (ebuf->ring != NULL && writer_running) {
+            handOffEventsBuf(ebuf, false);
+            return;
+        }
+#endif
         size_t elog_size = ebuf->pos - ebuf->begin;
         if (!writeEventLog(ebuf->begin, elog_size)) {
             debugBelch(
@@ -1466,6 +1663,9 @@ void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
     eb->size = size;
     eb->marker = NULL;
     eb->capno = capno;
+#if defined(THREADED_RTS)
+    eb->ring = NULL;
+#endif
     postBlockMarker(eb);
 }
 
@@ -1475,6 +1675,19 @@ void resetEventsBuf(EventsBuf* eb)
     eb->marker = NULL;
 }
 
+// Free the memory of an EventsBuf, including its ring if it has one. The ring
+// must have been drained.
+void freeEventsBuf(EventsBuf *eb)
+{
+#if defined(THREADED_RTS)
+    if (eb->ring != NULL) {
+        detachEventsRing(eb);
+    }
+#endif
+    stgFree(eb->begin);
+    eb->begin = eb->pos = NULL;
+}
+
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
 {
   uint32_t size = sizeof(EventTypeNum) + sizeof(EventTimestamp) + eventTypes[eNum].size;
@@ -1498,11 +1711,25 @@ StgBool hasRoomForVariableEvent(EventsBuf *eb, uint32_t payload_bytes)
   }
 }
 
+// The buffer has no room for the next event: write it out, or hand it to the
+// writer thread, which may drop it. See Note [Eventlog writer thread].
+void flushFullEventBuf(EventsBuf *eb)
+{
+#if defined(THREADED_RTS)
+    if (eb->ring != NULL && writer_running) {
+        closeBlockMarker(eb);
+        handOffEventsBuf(eb, true);
+        return;
+    }
+#endif
+    printAndClearEventBuf(eb);
+}
+
 void ensureRoomForEvent(EventsBuf *eb, EventTypeNum tag)
 {
     if (!hasRoomForEvent(eb, tag)) {
         // Flush event buffer to make room for new event.
-        printAndClearEventBuf(eb);
+        flushFullEventBuf(eb);
     }
 }
 
@@ -1510,7 +1737,7 @@ int ensureRoomForVariableEvent(EventsBuf *eb, StgWord16 size)
 {
     if (!hasRoomForVariableEvent(eb, size)) {
         // Flush event buffer to make room for new event.
-        printAndClearEventBuf(eb);
+        flushFullEventBuf(eb);
         if (!hasRoomForVariableEvent(eb, size))
             return 1; // Not enough space
     }
@@ -1549,6 +1776,9 @@ void flushAllCapsEventsBufs()
     for (unsigned int i=0; i < n_capabilities; i++) {
         flushLocalEventsBuf(capabilities[i]);
     }
+#if defined(THREADED_RTS)
+    drainEventLogWriterThread();
+#endif
     flushEventLogWriter();
 }
 
@@ -1569,6 +1799,257 @@ void flushEventLog(Capability **cap USED_IF_THREADS)
     flushEventLogWriter();
 }
 
+#if defined(THREADED_RTS)
+/* -----------------------------------------------------------------------------
+ * The eventlog writer thread, see Note [Eventlog writer thread]
+ * -------------------------------------------------------------------------- */
+
+static void
+writeEventsRingBuf(StgInt8 *buf, size_t len)
+{
+    if (!writeEventLog(buf, len)) {
+        debugBelch("eventLogWriterThread: could not flush event log\n");
+        flushEventLogWriter();
+    }
+}
+
+static void * OSThreadProcAttr
+eventLogWriterThread(void *arg STG_UNUSED)
+{
+    ACQUIRE_LOCK(&writer_mutex);
+    for (;;) {
+        bool wrote = false;
+        for (uint32_t i = 0; i < n_writer_rings; i++) {
+            EventsRing *ring = writer_rings[i];
+            StgWord tail = ring->tail;
+            while (tail != ACQUIRE_LOAD(&ring->head)) {
+                uint32_t slot = tail % ring->n_bufs;
+                StgInt8 *buf = ring->bufs[slot];
+                size_t len = ring->lens[slot];
+                RELEASE_LOCK(&writer_mutex);
+                writeEventsRingBuf(buf, len);
+                ACQUIRE_LOCK(&writer_mutex);
+                tail++;
+                RELEASE_STORE(&ring->tail, tail);
+                writer_bufs_written++;
+                wrote = true;
+            }
+        }
+        if (wrote) {
+            broadcastCondition(&writer_progress);
+        } else if (writer_stop) {
+            break;
+        } else {
+            waitCondition(&writer_wakeup, &writer_mutex);
+        }
+    }
+    RELEASE_LOCK(&writer_mutex);
+    return NULL;
+}
+
+static void
+attachEventsRing(EventsBuf *eb)
+{
+    const uint32_t n = RtsFlags.TraceFlags.eventlogAsyncBuffers;
+    EventsRing *ring = stgMallocBytes(sizeof(EventsRing), "attachEventsRing");
+
+    ring->bufs = stgMallocBytes(n * sizeof(StgInt8 *), "attachEventsRing");
+    ring->lens = stgMallocBytes(n * sizeof(size_t), "attachEventsRing");
+    ring->n_bufs = n;
+    // The buffer in use becomes the first buffer of the ring
+    ring->bufs[0] = eb->begin;
+    for (uint32_t i = 1; i < n; i++) {
+        ring->bufs[i] = stgMallocBytes(eb->size, "attachEventsRing");
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->blocked = 0;
+    ring->dropped_bufs = 0;
+    ring->dropped_bytes = 0;
+    eb->ring = ring;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    writer_rings = stgReallocBytes(writer_rings,
+                                   (n_writer_rings + 1) * sizeof(EventsRing *),
+                                   "attachEventsRing");
+    writer_rings[n_writer_rings++] = ring;
+    RELEASE_LOCK(&writer_mutex);
+}
+
+// Free the ring of eb, except for the buffer in use, which eb keeps. The ring
+// must have been drained.
+static void
+detachEventsRing(EventsBuf *eb)
+{
+    EventsRing *ring = eb->ring;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    ASSERT(ring->head == ring->tail);
+    for (uint32_t i = 0; i < n_writer_rings; i++) {
+        if (writer_rings[i] == ring) {
+            writer_rings[i] = writer_rings[--n_writer_rings];
+            break;
+        }
+    }
+    writer_detached_blocked       += ring->blocked;
+    writer_detached_dropped_bufs  += ring->dropped_bufs;
+    writer_detached_dropped_bytes += ring->dropped_bytes;
+    RELEASE_LOCK(&writer_mutex);
+
+    for (uint32_t i = 0; i < ring->n_bufs; i++) {
+        if (ring->bufs[i] != eb->begin) {
+            stgFree(ring->bufs[i]);
+        }
+    }
+    stgFree(ring->bufs);
+    stgFree(ring->lens);
+    stgFree(ring);
+    eb->ring = NULL;
+}
+
+// Hand the current buffer of eb to the writer thread and continue in the next
+// buffer of its ring. The block marker must have been closed.
+static void
+handOffEventsBuf(EventsBuf *eb, bool may_drop)
+{
+    EventsRing *ring = eb->ring;
+    const StgWord head = ring->head;
+    const size_t len = eb->pos - eb->begin;
+
+    // Is there a buffer to continue in, once we have handed this one off?
+    if (head + 1 - ACQUIRE_LOAD(&ring->tail) >= ring->n_bufs) {
+        if (may_drop
+            && RtsFlags.TraceFlags.eventlogOverflow == EVENTLOG_OVERFLOW_DROP) {
+            ring->dropped_bufs++;
+            ring->dropped_bytes += len;
+            resetEventsBuf(eb);
+            postBlockMarker(eb);
+            postEventHeader(eb, EVENT_EVENTLOG_DROPPED);
+            postWord64(eb, ring->dropped_bufs);
+            postWord64(eb, ring->dropped_bytes);
+            return;
+        }
+
+        ring->blocked++;
+        ACQUIRE_LOCK(&writer_mutex);
+        while (head + 1 - ring->tail >= ring->n_bufs) {
+            waitCondition(&writer_progress, &writer_mutex);
+        }
+        RELEASE_LOCK(&writer_mutex);
+    }
+
+    ACQUIRE_LOCK(&writer_mutex);
+    if (writer_stop) {
+        // The writer thread may already have exited, so write the buffer out
+        // ourselves, after the buffers handed off before it.
+        while (ring->tail != head) {
+            waitCondition(&writer_progress, &writer_mutex);
+        }
+        RELEASE_LOCK(&writer_mutex);
+        writeEventsRingBuf(eb->begin, len);
+        resetEventsBuf(eb);
+        postBlockMarker(eb);
+        return;
+    }
+    ring->lens[head % ring->n_bufs] = len;
+    RELEASE_STORE(&ring->head, head + 1);
+    signalCondition(&writer_wakeup);
+    RELEASE_LOCK(&writer_mutex);
+
+    eb->begin = ring->bufs[(head + 1) % ring->n_bufs];
+    resetEventsBuf(eb);
+    postBlockMarker(eb);
+}
+
+// Wait until the writer thread has written all the buffers handed to it.
+static void
+drainEventLogWriterThread(void)
+{
+    if (!writer_running) {
+        return;
+    }
+
+    ACQUIRE_LOCK(&writer_mutex);
+    for (uint32_t i = 0; i < n_writer_rings; i++) {
+        EventsRing *ring = writer_rings[i];
+        while (ring->tail != RELAXED_LOAD(&ring->head)) {
+            waitCondition(&writer_progress, &writer_mutex);
+        }
+    }
+    RELEASE_LOCK(&writer_mutex);
+}
+
+// Must hold state_change_mutex.
+static void
+startEventLogWriterThread(void)
+{
+    if (eventBuf.ring == NULL) {
+        attachEventsRing(&eventBuf);
+    }
+    for (uint32_t c = 0; c < get_n_capabilities(); c++) {
+        if (capEventBuf[c].ring == NULL) {
+            attachEventsRing(&capEventBuf[c]);
+        }
+    }
+
+    writer_stop = false;
+    int r = createAttachedOSThread(&writer_thread, "ghc_eventlog",
+                                   eventLogWriterThread, NULL);
+    if (r != 0) {
+        errorBelch("could not create the eventlog writer thread (%s); "
+                   "writing the eventlog synchronously", strerror(r));
+        return;
+    }
+    writer_running = true;
+}
+
+// Must hold state_change_mutex. The writer thread writes out all buffers
+// handed to it before it exits. The global eventBuf goes back to a single
+// buffer; the capabilities keep their rings, which are freed with them.
+static void
+stopEventLogWriterThread(void)
+{
+    if (!writer_running) {
+        return;
+    }
+
+    ACQUIRE_LOCK(&writer_mutex);
+    writer_stop = true;
+    signalCondition(&writer_wakeup);
+    RELEASE_LOCK(&writer_mutex);
+
+    joinOSThread(writer_thread);
+    writer_running = false;
+
+    ACQUIRE_LOCK(&eventBufMutex);
+    if (eventBuf.ring != NULL) {
+        detachEventsRing(&eventBuf);
+    }
+    RELEASE_LOCK(&eventBufMutex);
+}
+
+void
+getEventLogWriterStats(EventLogWriterStats *stats)
+{
+    stats->bufs_written = 0;
+    stats->blocked = 0;
+    stats->dropped_bufs = 0;
+    stats->dropped_bytes = 0;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    stats->bufs_written  = writer_bufs_written;
+    stats->blocked       = writer_detached_blocked;
+    stats->dropped_bufs  = writer_detached_dropped_bufs;
+    stats->dropped_bytes = writer_detached_dropped_bytes;
+    for (uint32_t i = 0; i < n_writer_rings; i++) {
+        stats->blocked       += writer_rings[i]->blocked;
+        stats->dropped_bufs  += writer_rings[i]->dropped_bufs;
+        stats->dropped_bytes += writer_rings[i]->dropped_bytes;
+    }
+    RELEASE_LOCK(&writer_mutex);
+}
+#endif /* THREADED_RTS */
+
 #else
 
 enum EventLogStatus eventLogStatus(void)
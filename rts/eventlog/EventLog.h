@@ -29,6 +29,18 @@ void flushLocalEventsBuf(Capability *cap);
 void flushAllCapsEventsBufs(void);
 void flushAllEventsBufs(Capability *cap);
 
+#if defined(THREADED_RTS)
+// Statistics of the eventlog writer thread (+RTS --eventlog-async)
+typedef struct {
+    StgWord bufs_written;   // buffers written by the writer thread
+    StgWord blocked;        // times a capability waited for the writer
+    StgWord dropped_bufs;   // buffers discarded with --eventlog-async=drop
+    StgWord64 dropped_bytes;
+} EventLogWriterStats;
+
+void getEventLogWriterStats(EventLogWriterStats *stats);
+#endif
+
 typedef void (*EventlogInitPost)(void);
 
 // Events which are emitted during program start-up should be wrapped with
@@ -112,6 +124,18 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post an event with the spark stealing counters of a capability
+ */
+void postSparkStealCountersEvent (Capability *cap,
+                                  SparkStealCounters counters);
+
+/*
+ * Post an event with the STM counters of a capability
+ */
+void postStmCountersEvent (Capability *cap,
+                           StmCounters counters);
+
 /*
  * Post an event to annotate a thread with a label
  */
@@ -152,6 +176,16 @@ void postEventMemReturn (Capability *cap,
                          uint32_t returned_mblocks
                         );
 
+void postEventGcPauseControl (Capability   *cap,
+                              EventCapsetID heap_capset,
+                              Time          target,
+                              Time          minor_pause,
+                              W_            copy_rate,
+                              W_            alloc_rate,
+                              uint32_t      survival_permille,
+                              W_            nursery_bytes,
+                              W_            gen_max_bytes);
+
 void postTaskCreateEvent (EventTaskId taskId,
                           EventCapNo cap,
                           EventKernelThreadId tid);
@@ -199,6 +233,9 @@ void postIPE(StgWord64 info,
 
 void postConcUpdRemSetFlush(Capability *cap);
 void postConcMarkEnd(StgWord32 marked_obj_count);
+void postConcMarkWorkerBegin(uint32_t worker);
+void postConcMarkWorkerEnd(uint32_t worker, StgWord32 marked_obj_count,
+                           StgWord32 steals);
 void postNonmovingHeapCensus(int log_blk_size,
                              const struct NonmovingAllocCensus *census);
 
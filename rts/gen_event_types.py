@@ -100,6 +100,10 @@ event_types = [
 
     EventType(90, 'MEM_RETURN',       [CapsetId, Word32, Word32, Word32],    'The RTS attempted to return heap memory to the OS'),
     EventType(91, 'BLOCKS_SIZE',      [CapsetId, Word64],                 'Report the size of the heap in blocks'),
+    EventType(92, 'SPARK_STEAL_COUNTERS', [Word8] + 4*[Word64],           'Spark steal counters'),
+    EventType(93, 'EVENTLOG_DROPPED', [Word64, Word64],               'Eventlog buffers dropped'),
+    EventType(94, 'STM_COUNTERS',     4*[Word64],                     'STM counters'),
+    EventType(95, 'GC_PAUSE_CONTROL', [CapsetId] + 4*[Word64] + [Word32] + 2*[Word64], 'Allocation area resized for the GC pause target'),
 
     # Range 100 - 139 is reserved for Mercury.
 
@@ -131,6 +135,8 @@ event_types = [
     EventType(205, 'CONC_SWEEP_END',               [],                    'End concurrent sweep phase'),
     EventType(206, 'CONC_UPD_REM_SET_FLUSH',       [CapNo],               'Update remembered set flushed'),
     EventType(207, 'NONMOVING_HEAP_CENSUS',        [Word8, Word32, Word32, Word32], 'Nonmoving heap census'),
+    EventType(208, 'CONC_MARK_WORKER_BEGIN',       [Word16],              'Begin marking by a concurrent mark worker'),
+    EventType(209, 'CONC_MARK_WORKER_END',         [Word16, Word32, Word32], 'End marking by a concurrent mark worker'),
 
     # Ticky-ticky profiling
     EventType(210, 'TICKY_COUNTER_DEF',            VariableLength,        'Ticky-ticky entry counter definition'),
@@ -255,6 +255,7 @@ void _warnFail(const char *filename, unsigned int linenum);
 #include "rts/Hpc.h"
 #include "rts/Adjustor.h"
 #include "rts/FileLock.h"
+#include "rts/CompactFile.h"
 #include "rts/GetTime.h"
 #include "rts/Globals.h"
 #include "rts/IOInterface.h"
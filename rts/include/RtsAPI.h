@@ -279,6 +279,15 @@ typedef struct _RTSStats {
     // The maximum time elapsed during the post-mark pause phase of the
     // concurrent nonmoving GC.
   Time nonmoving_gc_max_elapsed_ns;
+
+  // -----------------------------------
+  // Memory returned to the OS
+
+    // Free memory which the RTS no longer uses but has not returned to the
+    // OS yet, see +RTS --decommit-rate
+  uint64_t mem_retained_bytes;
+    // Total memory returned to the OS
+  uint64_t mem_released_bytes;
 } RTSStats;
 
 void getRTSStats (RTSStats *s);
@@ -0,0 +1,32 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2022
+ *
+ * Saving compact regions to files, and mapping them back into the heap, or
+ * streaming them through file descriptors.  Used by GHC.Compact.Serialized
+ * in the ghc-compact package.
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   https://gitlab.haskell.org/ghc/ghc/wikis/commentary/source-tree/includes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+/* See Note [Mapped compact regions] in rts/sm/CNF.c */
+int   compactWriteFile(void *first_block, void *root, const char *path);
+void *compactMapFile(const char *path, void **root);
+
+/* See Note [Streaming compact regions] in rts/sm/CNF.c */
+typedef struct CompactStreamWriter_ CompactStreamWriter;
+
+CompactStreamWriter *compactStreamOpen(int fd);
+int   compactStreamFlush(CompactStreamWriter *w, void *first_block);
+int   compactStreamFinish(CompactStreamWriter *w, void *first_block,
+                          void *root);
+void  compactStreamFree(CompactStreamWriter *w);
+
+int   compactWriteStream(void *first_block, void *root, int fd);
+void *compactReadStream(int fd, void **root);
@@ -27,6 +27,14 @@
  * The API should be updated whenever RTS flags are modified.
  */
 
+/* Whether the heap is backed by huge pages, see Note [Huge page backed
+ * megablocks] in rts/sm/MBlock.c. */
+typedef enum _HUGE_PAGES {
+    HUGE_PAGES_NONE,             /* ordinary pages */
+    HUGE_PAGES_TRANSPARENT,      /* madvise(MADV_HUGEPAGE) */
+    HUGE_PAGES_EXPLICIT          /* mmap(MAP_HUGETLB), i.e. hugetlbfs */
+} HUGE_PAGES;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _GC_FLAGS {
     FILE   *statsFile;
@@ -88,6 +96,16 @@ typedef struct _GC_FLAGS {
 
     bool numa;                   /* Use NUMA */
     StgWord numaMask;
+
+    HUGE_PAGES hugePages;        /* '--huge-pages' */
+    bool nonmovingLazySweep;     /* '--nonmoving-lazy-sweep' */
+    uint32_t scavPrefetchDepth;  /* '--scav-prefetch-depth' */
+
+    Time    pauseTarget;        /* '--gc-pause-target', 0 = off
+                                 * units: TIME_RESOLUTION */
+    uint32_t pretenureSurvival; /* '--pretenure-survival', percent, 0 = off */
+    StgWord64 decommitRate;     /* '--decommit-rate', bytes per second,
+                                 * 0 = release memory during the GC */
 } GC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -168,6 +186,13 @@ typedef struct _PROFILING_FLAGS {
 #define TRACE_EVENTLOG  1
 #define TRACE_STDERR    2
 
+/* What a capability does when all of its eventlog buffers are waiting for the
+ * eventlog writer thread. See Note [Eventlog writer thread] in EventLog.c. */
+typedef enum _EVENTLOG_OVERFLOW {
+    EVENTLOG_OVERFLOW_BLOCK,    /* wait for the writer thread */
+    EVENTLOG_OVERFLOW_DROP      /* discard the full buffer and count it */
+} EVENTLOG_OVERFLOW;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _TRACE_FLAGS {
     int tracing;
@@ -183,6 +208,9 @@ typedef struct _TRACE_FLAGS {
     int eventlogFlushTicks;
     char *trace_output;  /* output filename for eventlog */
     bool nullWriter; /* use null writer instead of file writer */
+    bool eventlogAsync;  /* write the eventlog from a dedicated thread */
+    EVENTLOG_OVERFLOW eventlogOverflow; /* when that thread falls behind */
+    uint32_t eventlogAsyncBuffers; /* eventlog buffers per capability */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -216,6 +244,9 @@ typedef struct _CONCURRENT_FLAGS {
 /* Which I/O Manager to use in the target program.  */
 typedef enum _IO_MANAGER { IO_MNGR_NATIVE, IO_MNGR_POSIX } IO_MANAGER;
 
+/* How the non-threaded POSIX I/O manager waits for file descriptors.  */
+typedef enum _IO_POLLER { IO_POLLER_SELECT, IO_POLLER_EPOLL } IO_POLLER;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _MISC_FLAGS {
     Time    tickInterval;        /* units: TIME_RESOLUTION */
@@ -236,8 +267,26 @@ typedef struct _MISC_FLAGS {
                                   * for the linker, NULL ==> off */
     IO_MANAGER ioManager;        /* The I/O manager to use.  */
     uint32_t numIoWorkerThreads; /* Number of I/O worker threads to use.  */
+    IO_POLLER ioPoller;          /* See Note [awaitEvent with epoll] */
 } MISC_FLAGS;
 
+/* How findSpark() picks the capabilities to steal sparks from.
+ * See Note [Spark steal policies] in Capability.c.  */
+typedef enum _SPARK_STEAL_POLICY {
+    SPARK_STEAL_SEQUENTIAL,      /* visit capabilities 0..n-1 in order */
+    SPARK_STEAL_RANDOM,          /* start at a random capability */
+    SPARK_STEAL_NUMA,            /* same NUMA node first, then the rest */
+    SPARK_STEAL_LAST_VICTIM      /* start at the last successful victim */
+} SPARK_STEAL_POLICY;
+
+/* What a transaction does after failing to commit.
+ * See Note [STM contention management] in STM.c.  */
+typedef enum _STM_CONTENTION_POLICY {
+    STM_CONTENTION_NONE,         /* restart immediately */
+    STM_CONTENTION_BACKOFF,      /* randomised exponential backoff */
+    STM_CONTENTION_SERIALIZE     /* run alone after repeated aborts */
+} STM_CONTENTION_POLICY;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _PAR_FLAGS {
   uint32_t       nCapabilities;  /* number of threads to run simultaneously */
@@ -265,6 +314,26 @@ typedef struct _PAR_FLAGS {
                                   * GC (default: use all nNodes). */
 
   bool           setAffinity;    /* force thread affinity with CPUs */
+
+  SPARK_STEAL_POLICY sparkStealPolicy;
+                                 /* victim selection when stealing
+                                  * sparks (--spark-steal) */
+
+  STM_CONTENTION_POLICY stmContention;
+                                 /* --stm-contention */
+  uint32_t       stmSerializeAfter;
+                                 /* consecutive aborts before a transaction
+                                  * is serialized (--stm-serialize-after) */
+
+  uint32_t       nonmovingMarkWorkers;
+                                 /* threads marking the nonmoving heap
+                                  * (--nonmoving-mark-workers) */
+  uint32_t       nonmovingSweepWorkers;
+                                 /* threads sweeping the nonmoving heap
+                                  * (--nonmoving-sweep-workers) */
+  uint32_t       compactWorkers;
+                                 /* threads compacting the oldest generation
+                                  * (--compact-workers) */
 } PAR_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -175,6 +175,9 @@ typedef void* OSThreadProcAttr OSThreadProc(void *);
 
 extern int  createOSThread        ( OSThreadId* tid, char *name,
                                     OSThreadProc *startProc, void *param);
+// Like createOSThread, but the thread must be waited for with joinOSThread
+extern int  createAttachedOSThread( OSThreadId* tid, char *name,
+                                    OSThreadProc *startProc, void *param);
 extern bool osThreadIsAlive       ( OSThreadId id );
 extern void interruptOSThread     ( OSThreadId id );
 extern void joinOSThread          ( OSThreadId id );
@@ -49,6 +49,12 @@ INLINE_HEADER void ACQUIRE_SPIN_LOCK(SpinLock * p)
         acquire_spin_lock_slow_path(p);
 }
 
+// acquire spin lock if it is free, without spinning; true on success
+INLINE_HEADER bool TRY_ACQUIRE_SPIN_LOCK(SpinLock * p)
+{
+    return cas((StgVolatilePtr)&(p->lock), 1, 0) != 0;
+}
+
 // release spin lock
 INLINE_HEADER void RELEASE_SPIN_LOCK(SpinLock * p)
 {
@@ -67,6 +73,7 @@ INLINE_HEADER void initSpinLock(SpinLock * p)
 
 // Using macros here means we don't have to ensure the argument is in scope
 #define ACQUIRE_SPIN_LOCK(p) /* nothing */
+#define TRY_ACQUIRE_SPIN_LOCK(p) true
 #define RELEASE_SPIN_LOCK(p) /* nothing */
 
 INLINE_HEADER void initSpinLock(void * p STG_UNUSED)
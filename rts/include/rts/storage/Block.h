@@ -173,6 +173,15 @@ typedef struct bdescr_ {
  * onto nonmoving_large_objects. The mark phase ignores objects which aren't
  * so-flagged */
 #define BF_NONMOVING_SWEEPING 2048
+/* A compact block mapped from a file (see Note [Mapped compact regions] in
+ * CNF.c) */
+#define BF_MAPPED    4096
+/* A compact block a capability is appending to (see Note [Concurrent
+ * compactAdd] in CNF.c) */
+#define BF_APPENDING 8192
+/* A compact block which has been written to a stream and must not be
+ * appended to any more (see Note [Streaming compact regions] in CNF.c) */
+#define BF_SEALED    16384
 /* Maximum flag value (do not define anything higher than this!) */
 #define BF_FLAG_MAX  (1 << 15)
 
@@ -330,6 +339,10 @@ bdescr *allocBlock_lock(void);
 bdescr *allocGroupOnNode_lock(uint32_t node, W_ n);
 bdescr *allocBlockOnNode_lock(uint32_t node);
 
+// a single block from the capability's cache of free blocks, taking the
+// storage manager lock only to refill the cache:
+bdescr *allocBlockOnCap_lock(Capability *cap);
+
 /* De-Allocation ----------------------------------------------------------- */
 
 void freeGroup(bdescr *p);
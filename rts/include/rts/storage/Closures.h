@@ -456,7 +456,7 @@ typedef struct {
   StgHeader                  header;
   StgClosure                *current_value; /* accessed via atomics */
   StgTVarWatchQueue         *first_watch_queue_entry; /* accessed via atomics */
-  StgInt                     num_updates; /* accessed via atomics */
+  StgInt                     num_updates; /* version stamp, accessed via atomics */
 } StgTVar;
 
 /* new_value == expected_value for read-only accesses */
@@ -492,6 +492,12 @@ struct StgTRecHeader_ {
   struct StgTRecHeader_     *enclosing_trec;
   StgTRecChunk              *current_chunk;
   TRecState                  state;
+  /* See Note [STM version clock] in rts/STM.c */
+  StgWord                    read_version;
+  StgWord                    snapshot;
+  /* See Note [STM contention management] in rts/STM.c */
+  StgWord                    aborts;
+  StgWord                    serial;
 };
 
 typedef struct {
@@ -593,21 +599,15 @@ typedef struct StgCompactNFData_ {
       // Total number of words in all blocks in the compact
     StgWord autoBlockW;
       // size of automatically appended blocks
-    StgPtr hp, hpLim;
-      // the beginning and end of the free area in the nursery block.  This is
-      // just a convenience so that we can avoid multiple indirections through
-      // the nursery pointer below during compaction.
     StgCompactNFDataBlock *nursery;
-      // where to (try to) allocate from when appending
+      // where to start looking for a block with room when appending; the
+      // blocks before it are full
     StgCompactNFDataBlock *last;
       // the last block of the chain (to know where to append new
       // blocks for resize)
     struct hashtable *hash;
       // the hash table for the current compaction, or NULL if
       // there's no (sharing-preserved) compaction in progress.
-    StgClosure *result;
-      // Used temporarily to store the result of compaction.  Doesn't need to be
-      // a GC root.
     struct StgCompactNFData_ *link;
       // Used by compacting GC for linking CNFs with threaded hash tables.
       // See Note [CNFs in compacting GC] in Compact.c for details.
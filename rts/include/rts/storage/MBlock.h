@@ -19,10 +19,17 @@ extern void * getMBlock(void);
 extern void * getMBlocks(uint32_t n);
 extern void * getMBlockOnNode(uint32_t node);
 extern void * getMBlocksOnNode(uint32_t node, uint32_t n);
+extern void * getMBlocksAt(void *addr, uint32_t n);
+extern void * getMBlocksAtOnNode(uint32_t node, void *addr, uint32_t n);
 extern void freeMBlocks(void *addr, uint32_t n);
 extern void releaseFreeMemory(void);
 extern void freeAllMBlocks(void);
 
+// See Note [Background decommit] in rts/sm/MBlock.c
+extern void stopDecommitThread(void);
+extern void resetDecommitThread(void);
+extern void getMBlockReleaseStats(StgWord64 *retained, StgWord64 *released);
+
 extern void *getFirstMBlock(void **state);
 extern void *getNextMBlock(void **state, void *mblock);
 
@@ -312,7 +312,7 @@ void dirty_STACK (Capability *cap, StgStack *stack);
 
         BlockedOnRead          NULL                 blocked_queue
         BlockedOnWrite         NULL                 blocked_queue
-        BlockedOnDelay         NULL                 blocked_queue
+        BlockedOnDelay         target time          sleeping threads
 
       tso->link == END_TSO_QUEUE, if the thread is currently running.
 
@@ -1833,6 +1833,39 @@ ocMprotect_Elf( ObjectCode *oc )
     return true;
 }
 
+/* Look up every global symbol of the object, so that the archive members
+ * defining them are loaded before ocResolve_ELF runs on a relocation
+ * worker, which must not load anything.  See Note [Parallel relocation] in
+ * Linker.c.  Symbols which are not known at all are left for ocResolve_ELF
+ * to report, if a relocation uses them.
+ *
+ * Returns 0 if an object defining one of the symbols failed to load.
+ */
+int
+ocLoadDependencies_ELF ( ObjectCode* oc )
+{
+    for(ElfSymbolTable *symTab = oc->info->symbolTables;
+        symTab != NULL; symTab = symTab->next) {
+        for (size_t i = 0; i < symTab->n_symbols; i++) {
+            ElfSymbol *symbol = &symTab->symbols[i];
+            RtsSymbolInfo *pinfo;
+
+            if (ELF_ST_BIND(symbol->elf_sym->st_info) == STB_LOCAL
+                || ELF_ST_TYPE(symbol->elf_sym->st_info) == STT_SECTION
+                || symbol->name == NULL || symbol->name[0] == '\0') {
+                continue;
+            }
+            if (lookupDependentSymbol(symbol->name, oc) == NULL
+                && ghciLookupSymbolInfo(symhash, symbol->name, &pinfo)) {
+                errorBelch("%s: symbol `%s' could not be loaded",
+                           oc->fileName, symbol->name);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
 int
 ocResolve_ELF ( ObjectCode* oc )
 {
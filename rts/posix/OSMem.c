@@ -166,6 +166,14 @@ post_mmap_madvise(int operation, W_ size, void *ret)
         madvise(ret, size, MADV_WILLNEED);
 # if defined(MADV_DODUMP)
         madvise(ret, size, MADV_DODUMP);
+# endif
+# if defined(MADV_HUGEPAGE)
+        // With --huge-pages=explicit we only get here if the hugetlbfs
+        // pool has run dry, in which case transparent huge pages are the
+        // next best thing.
+        if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_NONE) {
+            madvise(ret, size, MADV_HUGEPAGE);
+        }
 # endif
     } else {
         madvise(ret, size, MADV_DONTNEED);
@@ -477,32 +485,28 @@ osTryReserveHeapMemory (W_ len, void *hint)
 {
     void *base, *top;
     void *start, *end;
+    W_ align = stg_max(osHugePageSize(), (W_)MBLOCK_SIZE);
 
     ASSERT((len & ~MBLOCK_MASK) == len);
 
-    /* We try to allocate len + MBLOCK_SIZE,
-       because we need memory which is MBLOCK_SIZE aligned,
-       and then we discard what we don't need */
+    /* We try to allocate len + align, because we need memory which is
+       MBLOCK_SIZE aligned (or huge page aligned, see Note [Huge page
+       backed megablocks] in sm/MBlock.c), and then we discard what we
+       don't need */
 
-    base = my_mmap(hint, len + MBLOCK_SIZE, MEM_RESERVE);
+    base = my_mmap(hint, len + align, MEM_RESERVE);
     if (base == NULL)
         return NULL;
 
-    top = (void*)((W_)base + len + MBLOCK_SIZE);
+    top = (void*)((W_)base + len + align);
+    start = (void*)roundUpToAlign((W_)base, align);
+    end = (void*)((W_)start + len);
 
-    if (((W_)base & MBLOCK_MASK) != 0) {
-        start = MBLOCK_ROUND_UP(base);
-        end = MBLOCK_ROUND_DOWN(top);
-        ASSERT(((W_)end - (W_)start) == len);
-
-        if (munmap(base, (W_)start-(W_)base) < 0) {
-            sysErrorBelch("unable to release slop before heap");
-        }
-        if (munmap(end, (W_)top-(W_)end) < 0) {
-            sysErrorBelch("unable to release slop after heap");
-        }
-    } else {
-        start = base;
+    if (start != base && munmap(base, (W_)start-(W_)base) < 0) {
+        sysErrorBelch("unable to release slop before heap");
+    }
+    if (end != top && munmap(end, (W_)top-(W_)end) < 0) {
+        sysErrorBelch("unable to release slop after heap");
     }
 
     return start;
@@ -641,9 +645,43 @@ void *osReserveHeapMemory(void *startAddressPtr, W_ *len)
     return at;
 }
 
+#if defined(MAP_HUGETLB)
+// Set once the hugetlbfs pool could not satisfy a request; from then on
+// --huge-pages=explicit behaves like --huge-pages=transparent.
+static bool hugetlb_exhausted = false;
+
+static void *
+my_mmap_hugetlb (void *at, W_ size)
+{
+    void *r;
+
+    if (hugetlb_exhausted) {
+        return NULL;
+    }
+    r = mmap(at, size, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (r == MAP_FAILED) {
+        sysErrorBelch("warning: --huge-pages=explicit: cannot map %"
+                      FMT_Word " bytes of huge pages, falling back to "
+                      "transparent huge pages", size);
+        hugetlb_exhausted = true;
+        return NULL;
+    }
+    return r;
+}
+#endif
+
 void osCommitMemory(void *at, W_ size)
 {
-    void *r = my_mmap(at, size, MEM_COMMIT);
+    void *r = NULL;
+#if defined(MAP_HUGETLB)
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT) {
+        r = my_mmap_hugetlb(at, size);
+    }
+#endif
+    if (r == NULL) {
+        r = my_mmap(at, size, MEM_COMMIT);
+    }
     if (r == NULL) {
         errorBelch("Unable to commit %" FMT_Word " bytes of memory", size);
         errorBelch("Exiting. The system might be out of memory.");
@@ -681,9 +719,13 @@ void osDecommitMemory(void *at, W_ size)
     // all MMU entries for this page range, and there is no reason
     // to do so unless there is memory pressure
 #if defined(DEBUG)
-    r = mprotect(at, size, PROT_NONE);
-    if(r < 0)
-        sysErrorBelch("unable to make released memory unaccessible");
+    // ... but not with huge pages, where the block allocator does not
+    // commit decommitted memory again before reusing it.
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_NONE) {
+        r = mprotect(at, size, PROT_NONE);
+        if(r < 0)
+            sysErrorBelch("unable to make released memory unaccessible");
+    }
 #endif
 
 #if defined(MADV_FREE)
@@ -710,10 +752,58 @@ void osDecommitMemory(void *at, W_ size)
 #endif
 
     r = madvise(at, size, MADV_DONTNEED);
+#if defined(MAP_HUGETLB)
+    if (r < 0 && errno == EINVAL &&
+        RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT) {
+        // Linux only accepts MADV_DONTNEED for hugetlbfs pages since 5.18.
+        // Instead we unmap the huge pages by mapping ordinary memory over
+        // the range, in one step so that nothing else can be mapped there
+        // in between. It must not come from the hugetlbfs pool again: that
+        // might be empty by the time the range is reused. The new memory
+        // is only allocated when it is touched, and the block allocator
+        // reuses the range without committing it, see Note [Huge page
+        // backed megablocks] in sm/MBlock.c.
+        void *p = mmap(at, size, PROT_READ | PROT_WRITE,
+                       MAP_FIXED | MAP_ANON | MAP_PRIVATE | MAP_NORESERVE,
+                       -1, 0);
+        if (p == MAP_FAILED) {
+            sysErrorBelch("unable to decommit memory");
+            stg_exit(EXIT_FAILURE);
+        }
+        return;
+    }
+#endif
     if(r < 0)
         sysErrorBelch("unable to decommit memory");
 }
 
+bool osMapFileMemory(void *at, W_ size, int fd, StgWord64 off)
+{
+    void *r;
+
+    r = mmap(at, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE,
+             fd, (off_t)off);
+    if (r == MAP_FAILED) {
+        // A failed MAP_FIXED mapping may already have discarded the old
+        // one, so commit the memory again.
+        osCommitMemory(at, size);
+        return false;
+    }
+    return true;
+}
+
+void osUnmapFileMemory(void *at, W_ size)
+{
+    void *r;
+
+    r = mmap(at, size, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (r == MAP_FAILED) {
+        sysErrorBelch("unable to unmap file from the heap");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
 void osReleaseHeapMemory(void)
 {
     int r;
@@ -768,3 +858,74 @@ uint64_t osNumaMask(void)
     return 1;
 #endif
 }
+
+bool osHugePagesSupported(HUGE_PAGES kind)
+{
+    switch (kind) {
+    case HUGE_PAGES_NONE:
+        return true;
+    case HUGE_PAGES_TRANSPARENT:
+#if defined(MADV_HUGEPAGE)
+        return true;
+#else
+        return false;
+#endif
+    case HUGE_PAGES_EXPLICIT:
+        // Explicit huge pages can only be committed into a heap reserved
+        // up front, hence USE_LARGE_ADDRESS_SPACE.
+#if defined(MAP_HUGETLB) && defined(USE_LARGE_ADDRESS_SPACE)
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* Read the kernel's huge page size: the PMD size for transparent huge
+ * pages, and the default hugetlbfs page size for explicit ones. Returns 0
+ * if it cannot be determined. */
+static W_
+readHugePageSize (HUGE_PAGES kind)
+{
+    FILE *f;
+    unsigned long long n = 0;
+
+    if (kind == HUGE_PAGES_TRANSPARENT) {
+        f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+        if (f == NULL) return 0;
+        if (fscanf(f, "%llu", &n) != 1) n = 0;
+    } else {
+        char line[128];
+        f = fopen("/proc/meminfo", "r");
+        if (f == NULL) return 0;
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "Hugepagesize: %llu kB", &n) == 1) {
+                n *= 1024;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return (W_)n;
+}
+
+W_ osHugePageSize(void)
+{
+    static W_ hugePageSize = 0;
+
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_NONE) {
+        return 0;
+    }
+    if (hugePageSize == 0) {
+        W_ size = readHugePageSize(RtsFlags.GcFlags.hugePages);
+        if (size == 0 || (size & (size - 1)) != 0) {
+            size = 2 * 1024 * 1024;
+        }
+        // Megablocks are never split, so there is no point in managing
+        // memory at a finer granularity than that.
+        hugePageSize = stg_max(size, (W_)MBLOCK_SIZE);
+    }
+    return hugePageSize;
+}
@@ -187,12 +187,22 @@ shutdownThread(void)
 }
 
 int
-createOSThread (OSThreadId* pId, char *name STG_UNUSED,
+createOSThread (OSThreadId* pId, char *name,
                 OSThreadProc *startProc, void *param)
 {
-  int result = pthread_create(pId, NULL, startProc, param);
+  int result = createAttachedOSThread(pId, name, startProc, param);
   if (!result) {
     pthread_detach(*pId);
+  }
+  return result;
+}
+
+int
+createAttachedOSThread (OSThreadId* pId, char *name STG_UNUSED,
+                        OSThreadProc *startProc, void *param)
+{
+  int result = pthread_create(pId, NULL, startProc, param);
+  if (!result) {
 #if defined(HAVE_PTHREAD_SET_NAME_NP)
     pthread_set_name_np(*pId, name);
 #elif defined(HAVE_PTHREAD_SETNAME_NP)
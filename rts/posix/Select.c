@@ -18,6 +18,7 @@
 #include "RaiseAsync.h"
 #include "RtsUtils.h"
 #include "Capability.h"
+#include "Threads.h"
 #include "Select.h"
 #include "AwaitEvent.h"
 #include "Stats.h"
@@ -31,6 +32,12 @@
 #  include <sys/types.h>
 # endif
 
+# if defined(HAVE_SYS_EPOLL_H)
+#  include <sys/epoll.h>
+#  include <limits.h>
+#  include <unistd.h>
+# endif
+
 #include <errno.h>
 #include <string.h>
 
@@ -82,7 +89,232 @@ LowResTime getDelayTarget (HsInt us)
     }
 }
 
-/* There's a clever trick here to avoid problems when the time wraps
+/* -----------------------------------------------------------------------------
+ * Sleeping threads
+ *
+ * Note [Timer wheel for sleeping threads]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Threads blocked in threadDelay used to be kept in a list sorted by their
+ * target time, which made every threadDelay O(n) in the number of sleeping
+ * threads. Instead they are kept in a hierarchical timer wheel, in which
+ * inserting and removing a thread takes constant time.
+ *
+ * Time is divided into ticks of about a millisecond (WHEEL_TICK_SHIFT). The
+ * wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each, and each slot is a
+ * list of TSOs, linked through tso->_link. Digit l of a tick is bits
+ * [l*WHEEL_BITS, (l+1)*WHEEL_BITS) of the tick. A thread whose target tick t
+ * is after the current tick wheel_base is kept
+ *
+ *   - at the level l of the highest digit in which t and wheel_base differ,
+ *   - in the slot given by digit l of t,
+ *
+ * and in slot (wheel_base mod WHEEL_SLOTS) of level 0 otherwise. If t and
+ * wheel_base differ in a digit beyond the wheel, the thread is on
+ * wheel_overflow. So the place of a thread only depends on its target and
+ * on wheel_base (see wheelSlotFor), which lets removeSleepingThread find it
+ * without searching the wheel.
+ *
+ * When wheel_base moves to a tick whose lowest l digits are all zero, the
+ * slot of level l given by digit l of wheel_base holds exactly the threads
+ * whose target now agrees with wheel_base in digits l and above. They are
+ * put back at lower levels ("cascading"). wheel_overflow is cascaded when
+ * all digits of the wheel are zero. Level 0 slot (wheel_base mod
+ * WHEEL_SLOTS) then holds the threads that are due in the current tick.
+ *
+ * wakeUpSleepingThreads does not step through every tick: wheel_occupied
+ * records which slots are non-empty, so that nextWheelEvent can find the
+ * next tick at which there is something to do. A thread is cascaded at most
+ * WHEEL_LEVELS times, which also bounds the number of times awaitEvent wakes
+ * up early on its behalf (see nextSleepingTarget).
+ *
+ * Threads due in the same tick are woken in no particular order.
+ *
+ * The slots are GC roots (markSleepingThreads), and tso->_link is written
+ * with setTSOLink, as for the other thread queues.
+ */
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+
+#if SIZEOF_VOID_P == 4
+#define WHEEL_TICK_SHIFT 0      // LowResTime is in milliseconds already
+#else
+#define WHEEL_TICK_SHIFT 20     // ~1.05ms
+#endif
+
+#define LowResTimeToTick(t) ((StgWord)(t) >> WHEEL_TICK_SHIFT)
+
+#if SIZEOF_VOID_P == SIZEOF_LONG
+#define CLZW(n) (__builtin_clzl(n))
+#else
+#define CLZW(n) (__builtin_clzll(n))
+#endif
+
+static StgTSO *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static StgWord64 wheel_occupied[WHEEL_LEVELS];  // bitmaps of non-empty slots
+static StgTSO *wheel_overflow;
+static StgWord wheel_base;                      // the current tick
+static StgWord n_sleeping;
+
+/* The list that holds (or is to hold) a thread with the given target tick,
+ * see Note [Timer wheel for sleeping threads]. Sets *level to WHEEL_LEVELS
+ * for wheel_overflow.
+ */
+static StgTSO **wheelSlotFor (StgWord tick, uint32_t *level, uint32_t *slot)
+{
+    uint32_t l;
+
+    if ((StgInt)(tick - wheel_base) <= 0) {
+        *level = 0;
+        *slot = wheel_base & WHEEL_MASK;
+        return &wheel[0][*slot];
+    }
+
+    l = (sizeof(StgWord) * 8 - 1 - CLZW(tick ^ wheel_base)) / WHEEL_BITS;
+    *level = l;
+    if (l >= WHEEL_LEVELS) {
+        return &wheel_overflow;
+    }
+    *slot = (tick >> (l * WHEEL_BITS)) & WHEEL_MASK;
+    return &wheel[l][*slot];
+}
+
+static void placeSleepingThread (Capability *cap, StgTSO *tso)
+{
+    uint32_t level, slot;
+    StgTSO **list;
+
+    list = wheelSlotFor(LowResTimeToTick(tso->block_info.target),
+                        &level, &slot);
+    setTSOLink(cap, tso, *list);
+    *list = tso;
+    if (level < WHEEL_LEVELS) {
+        wheel_occupied[level] |= (StgWord64)1 << slot;
+    }
+}
+
+/* Put a thread to sleep until the given target, called from stg_delayzh.
+ */
+void insertSleepingThread (Capability *cap, StgTSO *tso, LowResTime target)
+{
+    if (n_sleeping == 0) {
+        // Nothing to cascade, so we can catch up with the clock for free
+        wheel_base = LowResTimeToTick(getLowResTimeOfDay());
+    }
+    tso->block_info.target = target;
+    placeSleepingThread(cap, tso);
+    n_sleeping++;
+}
+
+/* Remove a sleeping thread that is not due yet, when it receives an
+ * asynchronous exception.
+ */
+void removeSleepingThread (Capability *cap, StgTSO *tso)
+{
+    uint32_t level, slot;
+    StgTSO **list;
+
+    list = wheelSlotFor(LowResTimeToTick(tso->block_info.target),
+                        &level, &slot);
+    removeThreadFromQueue(cap, list, tso);
+    if (level < WHEEL_LEVELS && *list == END_TSO_QUEUE) {
+        wheel_occupied[level] &= ~((StgWord64)1 << slot);
+    }
+    n_sleeping--;
+}
+
+bool emptySleepingQueue (void)
+{
+    return n_sleeping == 0;
+}
+
+void initSleepingQueue (void)
+{
+    for (uint32_t l = 0; l < WHEEL_LEVELS; l++) {
+        for (uint32_t s = 0; s < WHEEL_SLOTS; s++) {
+            wheel[l][s] = END_TSO_QUEUE;
+        }
+        wheel_occupied[l] = 0;
+    }
+    wheel_overflow = END_TSO_QUEUE;
+    wheel_base = 0;
+    n_sleeping = 0;
+}
+
+void markSleepingThreads (evac_fn evac, void *user)
+{
+    for (uint32_t l = 0; l < WHEEL_LEVELS; l++) {
+        for (uint32_t s = 0; s < WHEEL_SLOTS; s++) {
+            evac(user, (StgClosure **)(void *)&wheel[l][s]);
+        }
+    }
+    evac(user, (StgClosure **)(void *)&wheel_overflow);
+}
+
+/* The number of ticks from wheel_base to the next tick at which a slot is
+ * due or has to be cascaded, or 0 if there is none. Sets *level and *slot to
+ * that slot (*level is WHEEL_LEVELS for wheel_overflow).
+ */
+static StgWord nextWheelEvent (uint32_t *level, uint32_t *slot)
+{
+    // The threads at level l are in slots after digit l of wheel_base, as
+    // their target is later, so the first level with any is the next event.
+    for (uint32_t l = 0; l < WHEEL_LEVELS; l++) {
+        uint32_t shift = l * WHEEL_BITS;
+        uint32_t idx = (wheel_base >> shift) & WHEEL_MASK;
+        StgWord64 later = wheel_occupied[l] & ~(((StgWord64)2 << idx) - 1);
+
+        if (later != 0) {
+            uint32_t hi = shift + WHEEL_BITS;
+            *level = l;
+            *slot = __builtin_ctzll(later);
+            return (((wheel_base >> hi) << hi) | ((StgWord)*slot << shift))
+                   - wheel_base;
+        }
+    }
+
+    if (wheel_overflow != END_TSO_QUEUE) {
+        const uint32_t hi = WHEEL_LEVELS * WHEEL_BITS;
+        *level = WHEEL_LEVELS;
+        *slot = 0;
+        return (((wheel_base >> hi) + 1) << hi) - wheel_base;
+    }
+    return 0;
+}
+
+/* Move the threads of the slots due at wheel_base down the wheel.
+ */
+static void cascadeWheel (void)
+{
+    for (uint32_t l = 1; l <= WHEEL_LEVELS; l++) {
+        StgTSO **list, *tso, *next;
+
+        if ((wheel_base & (((StgWord)1 << (l * WHEEL_BITS)) - 1)) != 0) {
+            break;
+        }
+        if (l < WHEEL_LEVELS) {
+            uint32_t slot = (wheel_base >> (l * WHEEL_BITS)) & WHEEL_MASK;
+            list = &wheel[l][slot];
+            wheel_occupied[l] &= ~((StgWord64)1 << slot);
+        } else {
+            list = &wheel_overflow;
+        }
+
+        tso = *list;
+        *list = END_TSO_QUEUE;
+        for (; tso != END_TSO_QUEUE; tso = next) {
+            next = tso->_link;
+            // MainCapability: this code is !THREADED_RTS
+            placeSleepingThread(&MainCapability, tso);
+        }
+    }
+}
+
+/* Wake up the threads of the current tick that are due.
+ *
+ * There's a clever trick here to avoid problems when the time wraps
  * around.  Since our maximum delay is smaller than 31 bits of ticks
  * (it's actually 31 bits of microseconds), we can safely check
  * whether a timer has expired even if our timer will wrap around
@@ -93,37 +325,174 @@ LowResTime getDelayTarget (HsInt us)
  * if this is true, then our time has expired.
  * (idea due to Andy Gill).
  */
-static bool wakeUpSleepingThreads (LowResTime now)
+static bool wakeUpDueThreads (LowResTime now)
 {
-    StgTSO *tso;
+    const uint32_t slot = wheel_base & WHEEL_MASK;
+    StgTSO *tso, *next, *prev = NULL;
     bool flag = false;
 
-    while (sleeping_queue != END_TSO_QUEUE) {
-        tso = sleeping_queue;
+    for (tso = wheel[0][slot]; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
         if (((long)now - (long)tso->block_info.target) < 0) {
-            break;
+            if (prev == NULL)
+                wheel[0][slot] = tso;
+            else
+                setTSOLink(&MainCapability, prev, tso);
+            prev = tso;
+            continue;
         }
-        sleeping_queue = tso->_link;
         tso->why_blocked = NotBlocked;
         tso->_link = END_TSO_QUEUE;
         IF_DEBUG(scheduler, debugBelch("Waking up sleeping thread %"
                                        FMT_StgThreadID "\n", tso->id));
         // MainCapability: this code is !THREADED_RTS
         pushOnRunQueue(&MainCapability,tso);
+        n_sleeping--;
         flag = true;
     }
+
+    if (prev == NULL) {
+        wheel[0][slot] = END_TSO_QUEUE;
+        wheel_occupied[0] &= ~((StgWord64)1 << slot);
+    } else {
+        prev->_link = END_TSO_QUEUE;
+    }
+    return flag;
+}
+
+static bool wakeUpSleepingThreads (LowResTime now)
+{
+    const StgWord now_tick = LowResTimeToTick(now);
+    bool flag = false;
+
+    while (n_sleeping > 0) {
+        uint32_t level, slot;
+        StgWord ticks;
+
+        flag = wakeUpDueThreads(now) || flag;
+        if (wheel_base == now_tick) {
+            break;
+        }
+        // Catch up with now, stopping at the ticks that have work to do
+        ticks = nextWheelEvent(&level, &slot);
+        if (ticks == 0 || ticks > now_tick - wheel_base) {
+            ticks = now_tick - wheel_base;
+        }
+        wheel_base += ticks;
+        cascadeWheel();
+    }
     return flag;
 }
 
+static LowResTime earliestTarget (StgTSO *tso)
+{
+    LowResTime next = tso->block_info.target;
+
+    for (tso = tso->_link; tso != END_TSO_QUEUE; tso = tso->_link) {
+        if (((long)tso->block_info.target - (long)next) < 0) {
+            next = tso->block_info.target;
+        }
+    }
+    return next;
+}
+
+/* When the next sleeping thread may be due, for the timeout of awaitEvent.
+ * Must only be called when there are sleeping threads, after
+ * wakeUpSleepingThreads has brought wheel_base up to date.
+ */
+static LowResTime nextSleepingTarget (void)
+{
+    StgTSO *current = wheel[0][wheel_base & WHEEL_MASK];
+    uint32_t level, slot;
+    StgWord ticks;
+
+    if (current != END_TSO_QUEUE) {
+        return earliestTarget(current);
+    }
+
+    ticks = nextWheelEvent(&level, &slot);
+    ASSERT(ticks != 0);
+    if (level == 0) {
+        return earliestTarget(wheel[0][slot]);
+    } else {
+        // We wake up to cascade, and then wait again
+        return (LowResTime)((wheel_base + ticks) << WHEEL_TICK_SHIFT);
+    }
+}
+
 static void GNUC3_ATTRIBUTE(__noreturn__)
 fdOutOfRange (int fd)
 {
+#if defined(HAVE_SYS_EPOLL_H)
+    errorBelch("file descriptor %d out of range for select (0--%d).\n"
+               "Use +RTS --io-poller=epoll or recompile with -threaded to "
+               "work around this.",
+               fd, (int)FD_SETSIZE);
+#else
     errorBelch("file descriptor %d out of range for select (0--%d).\n"
                "Recompile with -threaded to work around this.",
                fd, (int)FD_SETSIZE);
+#endif
     stg_exit(EXIT_FAILURE);
 }
 
+/* Called when waiting for I/O was interrupted by a signal. Returns true if
+ * awaitEvent should return to the scheduler straight away.
+ */
+static bool waitInterrupted (void)
+{
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return true; /* still hold the lock */
+    }
+#endif
+
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return true; /* still hold the lock */
+    }
+
+    /* check for threads that need waking up
+     */
+    wakeUpSleepingThreads(getLowResTimeOfDay());
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    return !emptyRunQueue(&MainCapability);
+}
+
+/* Unblock a thread whose file descriptor is ready.
+ */
+static void wakeUpBlockedThread (StgTSO *tso)
+{
+    IF_DEBUG(scheduler,
+        debugBelch("Waking up blocked thread %" FMT_StgThreadID "\n",
+                   tso->id));
+    tso->why_blocked = NotBlocked;
+    tso->_link = END_TSO_QUEUE;
+    pushOnRunQueue(&MainCapability,tso);
+}
+
+/* Pass an IOError to a thread blocked on an invalid file descriptor, rather
+ * than letting the RTS loop on it (#4934).
+ */
+static void killBlockedThread (StgTSO *tso)
+{
+    IF_DEBUG(scheduler,
+        debugBelch("Killing blocked thread %" FMT_StgThreadID
+                   " on bad fd=%i\n", tso->id, (int)tso->block_info.fd));
+    raiseAsync(&MainCapability, tso,
+        (StgClosure *)blockedOnBadFD_closure, false, NULL);
+}
+
 /*
  * State of individual file descriptor after a 'select()' poll.
  */
@@ -216,8 +585,8 @@ static enum FdState fdPollWriteState (int fd)
  * not write handles.
  *
  */
-void
-awaitEvent(bool wait)
+static void
+awaitEventSelect(bool wait)
 {
     StgTSO *tso, *prev, *next;
     fd_set rfd,wfd;
@@ -298,7 +667,7 @@ awaitEvent(bool wait)
           tv.tv_sec  = 0;
           tv.tv_usec = 0;
           ptv = &tv;
-      } else if (sleeping_queue != END_TSO_QUEUE) {
+      } else if (n_sleeping > 0) {
           /* SUSv2 allows implementations to have an implementation defined
            * maximum timeout for select(2). The standard requires
            * implementations to silently truncate values exceeding this maximum
@@ -317,7 +686,7 @@ awaitEvent(bool wait)
            */
           const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
 
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
+          Time min = LowResTimeToTime(nextSleepingTarget() - now);
           tv.tv_sec  = TimeToSeconds(min);
           if (tv.tv_sec < max_seconds) {
               tv.tv_usec = TimeToUS(min) % 1000000;
@@ -343,32 +712,7 @@ awaitEvent(bool wait)
             }
           }
 
-          /* We got a signal; could be one of ours.  If so, we need
-           * to start up the signal handler straight away, otherwise
-           * we could block for a long time before the signal is
-           * serviced.
-           */
-#if defined(RTS_USER_SIGNALS)
-          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-              startSignalHandlers(&MainCapability);
-              return; /* still hold the lock */
-          }
-#endif
-
-          /* we were interrupted, return to the scheduler immediately.
-           */
-          if (sched_state >= SCHED_INTERRUPTING) {
-              return; /* still hold the lock */
-          }
-
-          /* check for threads that need waking up
-           */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-          /* If new runnable threads have arrived, stop waiting for
-           * I/O and run them.
-           */
-          if (!emptyRunQueue(&MainCapability)) {
+          if (waitInterrupted()) {
               return; /* still hold the lock */
           }
       }
@@ -415,23 +759,10 @@ awaitEvent(bool wait)
 
               switch (fd_state) {
               case RTS_FD_IS_INVALID:
-                  /*
-                   * Don't let RTS loop on such descriptors,
-                   * pass an IOError to blocked threads (#4934)
-                   */
-                  IF_DEBUG(scheduler,
-                      debugBelch("Killing blocked thread %" FMT_StgThreadID
-                                 " on bad fd=%i\n", tso->id, fd));
-                  raiseAsync(&MainCapability, tso,
-                      (StgClosure *)blockedOnBadFD_closure, false, NULL);
+                  killBlockedThread(tso);
                   break;
               case RTS_FD_IS_READY:
-                  IF_DEBUG(scheduler,
-                      debugBelch("Waking up blocked thread %" FMT_StgThreadID "\n",
-                                 tso->id));
-                  tso->why_blocked = NotBlocked;
-                  tso->_link = END_TSO_QUEUE;
-                  pushOnRunQueue(&MainCapability,tso);
+                  wakeUpBlockedThread(tso);
                   break;
               case RTS_FD_IS_BLOCKING:
                   if (prev == NULL)
@@ -455,4 +786,393 @@ awaitEvent(bool wait)
              && emptyRunQueue(&MainCapability));
 }
 
+#if defined(HAVE_SYS_EPOLL_H)
+
+/* Note [awaitEvent with epoll]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * select() limits the non-threaded RTS to file descriptors below FD_SETSIZE
+ * (see fdOutOfRange), and the kernel has to look at every descriptor of the
+ * fd_sets on every call, even though the set of threads blocked on I/O
+ * usually changes very little between two calls. With +RTS --io-poller=epoll
+ * awaitEvent instead keeps the descriptors of blocked threads registered with
+ * an epoll instance, so that a wait only costs in proportion to the number of
+ * descriptors that became ready.
+ *
+ * Threads blocked on I/O still live on blocked_queue_hd: the primops append
+ * them there, and the GC and throwTo know how to find them. As we cannot keep
+ * pointers to TSOs outside the heap, each call of awaitEventEpoll
+ *
+ *  1. walks the blocked queue and records in epoll_fds which events each
+ *     descriptor is wanted for,
+ *  2. brings the epoll instance up to date with epoll_ctl, for the
+ *     descriptors whose wanted events changed since the previous call,
+ *  3. waits with epoll_wait, and
+ *  4. walks the blocked queue again to wake up the threads whose descriptor
+ *     is ready.
+ *
+ * The walks do not make any system calls, and in the common case of a thread
+ * that waits on the same descriptor again and again (say, a loop reading from
+ * a socket) the descriptor stays registered and step 2 has nothing to do.
+ *
+ * Registrations are level-triggered, and a descriptor is deregistered as soon
+ * as no thread waits on it, so that epoll_wait never returns for descriptors
+ * nobody is interested in.
+ *
+ * There are a couple of differences to select():
+ *
+ *  - epoll refuses regular files and directories (EPERM). select() always
+ *    reports them ready, so we do the same without registering them.
+ *
+ *  - The kernel drops a descriptor from the epoll instance when it is closed,
+ *    without telling us. select() fails with EBADF when it is handed a closed
+ *    descriptor, which awaitEventSelect uses to kill the threads waiting on it
+ *    with blockedOnBadFD. With epoll, threads waiting on a descriptor that is
+ *    closed underneath them remain blocked, as they do with the threaded RTS.
+ *    Descriptors that are already invalid when a thread starts waiting on
+ *    them are still detected, as epoll_ctl fails with EBADF.
+ *
+ *  - After forkProcess the child must not share the epoll instance with its
+ *    parent, so initIOPollerAfterFork creates a new one.
+ */
+
+#define FD_WANT_READ  1
+#define FD_WANT_WRITE 2
+
+// The maximum number of events we get from a single epoll_wait. Any further
+// ready descriptors are reported by the next call.
+#define EPOLL_MAX_EVENTS 256
+
+typedef struct {
+    uint8_t registered;  // FD_WANT_* registered with the epoll instance
+    uint8_t wanted;      // FD_WANT_* of the threads blocked on this fd
+    uint8_t ready;       // FD_WANT_* that are ready
+    bool bad;            // epoll_ctl says the fd is invalid
+    uint32_t reg_ix;     // index in registered_fds, if registered != 0
+} EpollFdState;
+
+static int epoll_fd = -1;
+
+// State for each file descriptor, indexed by the descriptor
+static EpollFdState *epoll_fds = NULL;
+static uint32_t epoll_fds_size = 0;
+
+// The descriptors registered with the epoll instance
+static int *registered_fds = NULL;
+static uint32_t n_registered_fds = 0;
+
+// The descriptors wanted by the current call of awaitEventEpoll
+static int *wanted_fds = NULL;
+static uint32_t n_wanted_fds = 0;
+
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+
+static void growEpollFds (int fd)
+{
+    uint32_t old_size = epoll_fds_size;
+    uint32_t new_size = old_size == 0 ? 64 : old_size;
+
+    while (new_size <= (uint32_t)fd) {
+        new_size *= 2;
+    }
+    epoll_fds = stgReallocBytes(epoll_fds, new_size * sizeof(EpollFdState),
+                                "growEpollFds");
+    memset(&epoll_fds[old_size], 0,
+           (new_size - old_size) * sizeof(EpollFdState));
+    // Each descriptor appears at most once in registered_fds and wanted_fds
+    registered_fds = stgReallocBytes(registered_fds, new_size * sizeof(int),
+                                     "growEpollFds");
+    wanted_fds = stgReallocBytes(wanted_fds, new_size * sizeof(int),
+                                 "growEpollFds");
+    epoll_fds_size = new_size;
+}
+
+static uint32_t epollEvents (uint8_t want)
+{
+    return ((want & FD_WANT_READ)  ? EPOLLIN  : 0)
+         | ((want & FD_WANT_WRITE) ? EPOLLOUT : 0);
+}
+
+/* Register the wanted events of fd with the epoll instance. */
+static void updateEpollFd (int fd)
+{
+    EpollFdState *st = &epoll_fds[fd];
+    struct epoll_event ev;
+    int op = st->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int r;
+
+    ev.events = epollEvents(st->wanted);
+    ev.data.fd = fd;
+
+    r = epoll_ctl(epoll_fd, op, fd, &ev);
+    if (r != 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+        // The fd was closed and the number reused since we registered it
+        op = EPOLL_CTL_ADD;
+        st->registered = 0;
+        registered_fds[st->reg_ix] = registered_fds[--n_registered_fds];
+        epoll_fds[registered_fds[st->reg_ix]].reg_ix = st->reg_ix;
+        r = epoll_ctl(epoll_fd, op, fd, &ev);
+    }
+
+    if (r == 0) {
+        if (op == EPOLL_CTL_ADD) {
+            st->reg_ix = n_registered_fds;
+            registered_fds[n_registered_fds++] = fd;
+        }
+        st->registered = st->wanted;
+        return;
+    }
+
+    switch (errno) {
+    case EPERM:
+        // A regular file or a directory, which is always ready
+        st->ready = st->wanted;
+        break;
+    case EBADF:
+        st->bad = true;
+        break;
+    default:
+        sysErrorBelch("epoll_ctl");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+/* Steps 1 and 2 of Note [awaitEvent with epoll]. Returns true if the
+ * state of some thread is known without waiting.
+ */
+static bool collectEpollFds (void)
+{
+    bool known = false;
+
+    for (StgTSO *tso = blocked_queue_hd; tso != END_TSO_QUEUE;
+         tso = tso->_link) {
+        int fd = tso->block_info.fd;
+        uint8_t want;
+
+        switch (tso->why_blocked) {
+        case BlockedOnRead:
+            want = FD_WANT_READ;
+            break;
+        case BlockedOnWrite:
+            want = FD_WANT_WRITE;
+            break;
+        default:
+            barf("collectEpollFds");
+        }
+
+        if (fd < 0) {
+            known = true;  // killed by wakeUpEpollThreads
+            continue;
+        }
+        if ((uint32_t)fd >= epoll_fds_size) {
+            growEpollFds(fd);
+        }
+        if (epoll_fds[fd].wanted == 0) {
+            wanted_fds[n_wanted_fds++] = fd;
+        }
+        epoll_fds[fd].wanted |= want;
+    }
+
+    // Forget the descriptors nobody waits on any more. They may have been
+    // closed already, so we ignore errors.
+    for (uint32_t i = 0; i < n_registered_fds; ) {
+        int fd = registered_fds[i];
+        if (epoll_fds[fd].wanted == 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            epoll_fds[fd].registered = 0;
+            registered_fds[i] = registered_fds[--n_registered_fds];
+            epoll_fds[registered_fds[i]].reg_ix = i;
+        } else {
+            i++;
+        }
+    }
+
+    for (uint32_t i = 0; i < n_wanted_fds; i++) {
+        int fd = wanted_fds[i];
+        EpollFdState *st = &epoll_fds[fd];
+        if (st->registered != st->wanted) {
+            updateEpollFd(fd);
+        }
+        known = known || st->ready != 0 || st->bad;
+    }
+
+    return known;
+}
+
+/* Step 4 of Note [awaitEvent with epoll]. */
+static void wakeUpEpollThreads (void)
+{
+    StgTSO *tso, *prev, *next;
+
+    /* As in awaitEventSelect, the queue is rebuilt as we go. */
+    prev = NULL;
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
+        int fd = tso->block_info.fd;
+        uint8_t want = tso->why_blocked == BlockedOnRead
+                       ? FD_WANT_READ : FD_WANT_WRITE;
+        next = tso->_link;
+
+        if (fd < 0 || epoll_fds[fd].bad) {
+            killBlockedThread(tso);
+        } else if (epoll_fds[fd].ready & want) {
+            wakeUpBlockedThread(tso);
+        } else {
+            if (prev == NULL)
+                blocked_queue_hd = tso;
+            else
+                setTSOLink(&MainCapability, prev, tso);
+            prev = tso;
+        }
+    }
+
+    if (prev == NULL)
+        blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
+    else {
+        prev->_link = END_TSO_QUEUE;
+        blocked_queue_tl = prev;
+    }
+}
+
+static void resetWantedEpollFds (void)
+{
+    for (uint32_t i = 0; i < n_wanted_fds; i++) {
+        EpollFdState *st = &epoll_fds[wanted_fds[i]];
+        st->wanted = 0;
+        st->ready = 0;
+        st->bad = false;
+    }
+    n_wanted_fds = 0;
+}
+
+static void
+awaitEventEpoll(bool wait)
+{
+    LowResTime now;
+    int timeout, n;
+
+    IF_DEBUG(scheduler,
+             debugBelch("scheduler: checking for threads blocked on I/O "
+                        "with epoll");
+             if (wait) {
+                 debugBelch(" (waiting)");
+             }
+             debugBelch("\n");
+             );
+
+    /* loop until we've woken up some threads, see awaitEventSelect */
+    do {
+
+      now = getLowResTimeOfDay();
+      if (wakeUpSleepingThreads(now)) {
+          return;
+      }
+
+      if (collectEpollFds() || !wait) {
+          timeout = 0;
+      } else if (n_sleeping > 0) {
+          // Round up, we never want to sleep less than requested. Longer
+          // timeouts are truncated, which is harmless: we just wait again.
+          Time min = LowResTimeToTime(nextSleepingTarget() - now);
+          Time ms = TimeToMS(min + MSToTime(1) - 1);
+          timeout = ms < INT_MAX ? (int)ms : INT_MAX;
+      } else {
+          timeout = -1;
+      }
+
+      while ((n = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS,
+                             timeout)) < 0) {
+          if (errno != EINTR) {
+              sysErrorBelch("epoll_wait");
+              stg_exit(EXIT_FAILURE);
+          }
+          if (waitInterrupted()) {
+              resetWantedEpollFds();
+              return; /* still hold the lock */
+          }
+      }
+
+      for (int i = 0; i < n; i++) {
+          EpollFdState *st = &epoll_fds[epoll_events[i].data.fd];
+          uint32_t events = epoll_events[i].events;
+          if (events & (EPOLLERR | EPOLLHUP)) {
+              // the next read or write will not block, but fail
+              st->ready = st->wanted;
+          } else {
+              st->ready |= ((events & EPOLLIN)  ? FD_WANT_READ  : 0)
+                         | ((events & EPOLLOUT) ? FD_WANT_WRITE : 0);
+          }
+      }
+
+      wakeUpEpollThreads();
+      resetWantedEpollFds();
+
+    } while (wait && sched_state == SCHED_RUNNING
+             && emptyRunQueue(&MainCapability));
+}
+
+static void createEpollInstance (void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        sysErrorBelch("epoll_create1");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+void
+awaitEvent(bool wait)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    if (epoll_fd >= 0) {
+        awaitEventEpoll(wait);
+        return;
+    }
+#endif
+    awaitEventSelect(wait);
+}
+
+void initIOPoller (void)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    if (RtsFlags.MiscFlags.ioPoller == IO_POLLER_EPOLL) {
+        createEpollInstance();
+    }
+#endif
+}
+
+void initIOPollerAfterFork (void)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    // See Note [awaitEvent with epoll]
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        createEpollInstance();
+        for (uint32_t i = 0; i < n_registered_fds; i++) {
+            epoll_fds[registered_fds[i]].registered = 0;
+        }
+        n_registered_fds = 0;
+    }
+#endif
+}
+
+void exitIOPoller (void)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+        stgFree(epoll_fds);
+        stgFree(registered_fds);
+        stgFree(wanted_fds);
+        epoll_fds = NULL;
+        registered_fds = NULL;
+        wanted_fds = NULL;
+        epoll_fds_size = 0;
+        n_registered_fds = 0;
+        n_wanted_fds = 0;
+    }
+#endif
+}
+
 #endif /* THREADED_RTS */
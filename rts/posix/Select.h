@@ -8,7 +8,30 @@
 
 #pragma once
 
+#include "sm/GC.h" // for evac_fn
+
 // An absolute time value in units of 10ms.
 typedef StgWord LowResTime;
 
 RTS_PRIVATE LowResTime getDelayTarget (HsInt us);
+
+#if !defined(THREADED_RTS)
+/* Threads blocked in threadDelay, see Note [Timer wheel for sleeping
+ * threads] in Select.c.
+ */
+RTS_PRIVATE void insertSleepingThread (Capability *cap, StgTSO *tso,
+                                       LowResTime target);
+RTS_PRIVATE void removeSleepingThread (Capability *cap, StgTSO *tso);
+RTS_PRIVATE bool emptySleepingQueue   (void);
+RTS_PRIVATE void initSleepingQueue    (void);
+RTS_PRIVATE void markSleepingThreads  (evac_fn evac, void *user);
+#endif
+
+#if !defined(THREADED_RTS)
+/* Set up, and tear down, the way awaitEvent waits for I/O, as selected by
+ * +RTS --io-poller. See Note [awaitEvent with epoll] in Select.c.
+ */
+RTS_PRIVATE void initIOPoller (void);
+RTS_PRIVATE void initIOPollerAfterFork (void);
+RTS_PRIVATE void exitIOPoller (void);
+#endif
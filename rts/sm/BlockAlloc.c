@@ -22,6 +22,8 @@
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
 #include "OSMem.h"
+#include "Task.h"
+#include "Capability.h"
 
 #include <string.h>
 
@@ -166,6 +168,47 @@ W_ hw_alloc_blocks;  // high-water allocated blocks
 
 W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
 
+/* Note [NUMA block allocation]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Each NUMA node has its own free lists, and with --numa the megablocks on a
+   node's lists are bound to that node.  Most of the RTS asks for blocks on a
+   particular node (nurseries and allocate() use the capability's node, the
+   GC's to-space blocks come from the GC thread's node, see GCUtils.c).
+   Requests which don't name a node (allocGroup, allocLargeChunk) go to the
+   node of the calling Task, so that e.g. the GC mark stack or the nonmoving
+   mark queues end up on the node that uses them, unless that node already
+   holds more than its share of the heap: then the least occupied node is
+   used instead, as before.
+
+   For every allocation we record whether the Task that made it runs on the
+   node the blocks came from (numa_local_blocks) or not
+   (numa_remote_blocks).  Remote allocations are those made on behalf of
+   another node (e.g. setting up the nurseries of the other capabilities) and
+   node-less requests which had to be rebalanced.  These counters, together
+   with the per-node occupancy, are reported by +RTS -s/-S when there is more
+   than one node.
+
+   returnMemoryToOS releases free megablocks from the node with the most of
+   them first, so that the free memory which is kept stays spread over the
+   nodes rather than concentrated on the highest-numbered ones.
+*/
+
+static W_ hw_alloc_blocks_by_node[MAX_NUMA_NODES];
+static StgWord64 numa_local_blocks[MAX_NUMA_NODES];
+static StgWord64 numa_remote_blocks[MAX_NUMA_NODES];
+
+// The node of the calling Task, or -1 if we don't know it.
+STATIC_INLINE
+int myTaskNode (void)
+{
+#if defined(THREADED_RTS)
+    Task *task = myTask();
+    return task == NULL ? -1 : (int) task->node;
+#else
+    return -1;
+#endif
+}
+
 /* -----------------------------------------------------------------------------
    Initialisation
    -------------------------------------------------------------------------- */
@@ -179,6 +222,9 @@ void initBlockAllocator(void)
         }
         free_mblock_list[node] = NULL;
         n_alloc_blocks_by_node[node] = 0;
+        hw_alloc_blocks_by_node[node] = 0;
+        numa_local_blocks[node] = 0;
+        numa_remote_blocks[node] = 0;
     }
     n_alloc_blocks = 0;
     hw_alloc_blocks = 0;
@@ -196,6 +242,18 @@ void recordAllocatedBlocks(uint32_t node, uint32_t n)
     if (n > 0 && n_alloc_blocks > hw_alloc_blocks) {
         hw_alloc_blocks = n_alloc_blocks;
     }
+    if (n_numa_nodes > 1) {
+        // See Note [NUMA block allocation]
+        int home = myTaskNode();
+        if (n_alloc_blocks_by_node[node] > hw_alloc_blocks_by_node[node]) {
+            hw_alloc_blocks_by_node[node] = n_alloc_blocks_by_node[node];
+        }
+        if (home < 0 || (uint32_t) home == node) {
+            numa_local_blocks[node] += n;
+        } else {
+            numa_remote_blocks[node] += n;
+        }
+    }
 }
 
 STATIC_INLINE
@@ -623,9 +681,31 @@ uint32_t nodeWithLeastBlocks (void)
     return node;
 }
 
+// The node for a request which doesn't name one: the calling Task's node,
+// unless it holds more than twice the blocks of the least occupied node.
+// See Note [NUMA block allocation].
+STATIC_INLINE
+uint32_t defaultAllocNode (void)
+{
+    int home;
+    uint32_t least;
+
+    if (n_numa_nodes == 1) {
+        return 0;
+    }
+    least = nodeWithLeastBlocks();
+    home = myTaskNode();
+    if (home < 0 ||
+        n_alloc_blocks_by_node[home] >
+            2 * n_alloc_blocks_by_node[least] + BLOCKS_PER_MBLOCK) {
+        return least;
+    }
+    return (uint32_t) home;
+}
+
 bdescr* allocGroup (W_ n)
 {
-    return allocGroupOnNode(nodeWithLeastBlocks(),n);
+    return allocGroupOnNode(defaultAllocNode(),n);
 }
 
 
@@ -686,7 +766,93 @@ bdescr* allocLargeChunkOnNode (uint32_t node, W_ min, W_ max)
 
 bdescr* allocLargeChunk (W_ min, W_ max)
 {
-    return allocLargeChunkOnNode(nodeWithLeastBlocks(), min, max);
+    return allocLargeChunkOnNode(defaultAllocNode(), min, max);
+}
+
+// Allocate a group of the n megablocks at addr on node, provided that they
+// are not in use; returns NULL otherwise.  Used to map a compact region back
+// to the address it was saved from, see Note [Mapped compact regions] in
+// CNF.c.
+bdescr *
+allocMBlockGroupAtOnNode (uint32_t node, void *addr, StgWord mblocks)
+{
+    bdescr *bd;
+    void *mblock;
+
+    mblock = getMBlocksAtOnNode(node, addr, mblocks);
+    if (mblock == NULL) {
+        return NULL;
+    }
+
+    recordAllocatedBlocks(node, mblocks * BLOCKS_PER_MBLOCK);
+    initMBlock(mblock, node);
+    bd = FIRST_BDESCR(mblock);
+    bd->blocks = MBLOCK_GROUP_BLOCKS(mblocks);
+    initGroup(bd);
+
+    IF_DEBUG(sanity, checkFreeListSanity());
+    return bd;
+}
+
+// On the node allocGroup would pick, so that the blocks are accounted to
+// the same node whether or not we get the address.
+bdescr *
+allocMBlockGroupAt (void *addr, StgWord mblocks)
+{
+    return allocMBlockGroupAtOnNode(defaultAllocNode(), addr, mblocks);
+}
+
+// Split the allocated group bd, which lies within a single megablock, at
+// block offset off: the first off blocks are freed, the next n blocks are
+// returned as a group, and whatever is left after them is returned in
+// *rest as another allocated group (NULL if nothing is left).
+bdescr *
+splitBlockGroupAt (bdescr *bd, W_ off, W_ n, bdescr **rest)
+{
+    bdescr *before;
+
+    bd = carveBlockGroup(bd, off, n, &before, rest);
+    if (before != NULL) {
+        freeGroup(before);
+    }
+    return bd;
+}
+
+// Like splitBlockGroupAt, but the first off blocks stay allocated too, and
+// are returned in *before (NULL if off is 0).
+bdescr *
+carveBlockGroup (bdescr *bd, W_ off, W_ n, bdescr **before, bdescr **rest)
+{
+    ASSERT(bd->blocks <= BLOCKS_PER_MBLOCK);
+    ASSERT(n > 0 && off + n <= bd->blocks);
+
+    if (off > 0) {
+        bdescr *mid = bd + off;
+        mid->blocks = bd->blocks - off;
+        mid->start = mid->free = bd->start + off * BLOCK_SIZE_W;
+        mid->link = NULL;
+        bd->blocks = off;
+        setup_tail(mid);
+        setup_tail(bd);
+        *before = bd;
+        bd = mid;
+    } else {
+        *before = NULL;
+    }
+
+    if (bd->blocks > n) {
+        bdescr *r = bd + n;
+        r->blocks = bd->blocks - n;
+        r->start = r->free = bd->start + n * BLOCK_SIZE_W;
+        r->link = NULL;
+        bd->blocks = n;
+        setup_tail(r);
+        setup_tail(bd);
+        *rest = r;
+    } else {
+        *rest = NULL;
+    }
+    return bd;
 }
 
 bdescr *
@@ -729,6 +895,132 @@ allocBlockOnNode_lock(uint32_t node)
     return bd;
 }
 
+/* Note [Per-capability block caches]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   Most requests to the block allocator are for a single block: the mutator
+   needs one when its nursery runs out (allocate()) or a mutable list fills
+   up (recordMutableCap), and the GC needs one for every to-space block
+   (alloc_todo_block).  The free lists are protected by sm_mutex, and by the
+   gc_alloc_block_sync spin lock while a GC is running, so with many
+   capabilities these requests all contend on one global lock.
+
+   Each capability therefore keeps a small cache of free single blocks on its
+   own NUMA node, cap->block_cache.  The cache is used by whoever owns the
+   capability: a mutator thread between GCs, or the capability's GC thread
+   during a GC.  The two never run at the same time, so the cache itself
+   needs no locking.
+
+   An empty cache is refilled with BLOCK_CACHE_BATCH blocks under a single
+   acquisition of the lock, carved out of one chunk by allocLargeChunkOnNode
+   so that they are contiguous where possible.  Empty to-space blocks which
+   the GC gives back go into the cache of the GC thread's capability, and
+   once a cache holds BLOCK_CACHE_SIZE blocks, BLOCK_CACHE_BATCH of them are
+   returned to the free lists in one go.
+
+   As far as the rest of the block allocator is concerned the cached blocks
+   are in use: they are counted by n_alloc_blocks and are never coalesced
+   with their neighbours.  memInventory accounts for them separately.
+   setNumCapabilities empties the cache of every capability it disables, so
+   that those blocks don't sit idle until the capability is enabled again.
+
+   With +RTS -s the threaded RTS reports the use of the caches, together with
+   how often block allocation took sm_mutex and gc_alloc_block_sync, and how
+   often the lock was already held by another thread.
+*/
+
+void
+initBlockCache (BlockCache *cache, uint32_t node)
+{
+    cache->blocks = NULL;
+    cache->n_blocks = 0;
+    cache->node = node;
+    memset(&cache->stats, 0, sizeof(BlockAllocStats));
+}
+
+void
+refillBlockCache (BlockCache *cache)
+{
+    bdescr *bd;
+    W_ i, n;
+
+    // NB. allocLargeChunk, rather than allocGroup(n), to allocate in a
+    // fragmentation-friendly way.
+    bd = allocLargeChunkOnNode(cache->node, 1, BLOCK_CACHE_BATCH);
+    n = bd->blocks;
+    for (i = 0; i < n; i++) {
+        bd[i].blocks = 1;
+        bd[i].link = &bd[i+1];
+        bd[i].free = bd[i].start;
+    }
+    // The caller must hold the lock until we've finished fiddling with the
+    // metadata, otherwise the block allocator can get confused.
+    bd[n-1].link = cache->blocks;
+    cache->blocks = bd;
+    cache->n_blocks += n;
+    cache->stats.refills++;
+}
+
+void
+flushBlockCache (BlockCache *cache, uint32_t n)
+{
+    bdescr *bd;
+
+    while (n > 0 && cache->blocks != NULL) {
+        bd = cache->blocks;
+        cache->blocks = bd->link;
+        cache->n_blocks--;
+        freeGroup(bd);
+        n--;
+    }
+    cache->stats.flushes++;
+}
+
+STATIC_INLINE void
+acquire_sm_lock_for (BlockCache *cache STG_UNUSED)
+{
+#if defined(THREADED_RTS)
+    if (TRY_ACQUIRE_LOCK(&sm_mutex) != 0) {
+        ACQUIRE_LOCK(&sm_mutex);
+        cache->stats.sm_contended++;
+    }
+    cache->stats.sm_locked++;
+#endif
+}
+
+// A single block for the mutator owning cap, taking sm_mutex only when the
+// capability's cache is empty.  See Note [Per-capability block caches].
+bdescr *
+allocBlockOnCap_lock (Capability *cap)
+{
+    BlockCache *cache = &cap->block_cache;
+
+    if (cache->n_blocks == 0) {
+        acquire_sm_lock_for(cache);
+        refillBlockCache(cache);
+        RELEASE_SM_LOCK;
+    }
+    return popBlockCache(cache);
+}
+
+void
+getBlockAllocStats (BlockAllocStats *stats)
+{
+    uint32_t i;
+
+    memset(stats, 0, sizeof(BlockAllocStats));
+    for (i = 0; i < n_capabilities; i++) {
+        const BlockAllocStats *s = &capabilities[i]->block_cache.stats;
+        stats->allocs       += s->allocs;
+        stats->frees        += s->frees;
+        stats->refills      += s->refills;
+        stats->flushes      += s->flushes;
+        stats->sm_locked    += s->sm_locked;
+        stats->sm_contended += s->sm_contended;
+        stats->gc_locked    += s->gc_locked;
+        stats->gc_contended += s->gc_contended;
+    }
+}
+
 /* -----------------------------------------------------------------------------
    De-Allocation
    -------------------------------------------------------------------------- */
@@ -984,36 +1276,88 @@ countAllocdBlocks(bdescr *bd)
     return n;
 }
 
+static W_
+countFreeMBlocksOnNode (uint32_t node)
+{
+    bdescr *bd;
+    W_ n = 0;
+    for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+        n += BLOCKS_TO_MBLOCKS(bd->blocks);
+    }
+    return n;
+}
+
+// Release up to n free megablocks of the given node, returning how many were
+// released.
+static uint32_t
+returnMemoryOfNode (uint32_t node, uint32_t n)
+{
+    bdescr *bd;
+    StgWord size;
+    uint32_t init_n = n;
+
+    bd = free_mblock_list[node];
+    while ((n > 0) && (bd != NULL)) {
+        size = BLOCKS_TO_MBLOCKS(bd->blocks);
+        if (size > n) {
+            StgWord newSize = size - n;
+            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            freeAddr += newSize * MBLOCK_SIZE;
+            bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+            freeMBlocks(freeAddr, n);
+            n = 0;
+        }
+        else {
+            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            n -= size;
+            bd = bd->link;
+            freeMBlocks(freeAddr, size);
+        }
+    }
+    free_mblock_list[node] = bd;
+    return init_n - n;
+}
+
 // Returns the number of blocks which were able to be freed
 uint32_t returnMemoryToOS(uint32_t n /* megablocks */)
 {
-    bdescr *bd;
     uint32_t node;
-    StgWord size;
     uint32_t init_n;
     init_n = n;
 
-    // ToDo: not fair, we free all the memory starting with node 0.
-    for (node = 0; n > 0 && node < n_numa_nodes; node++) {
-        bd = free_mblock_list[node];
-        while ((n > 0) && (bd != NULL)) {
-            size = BLOCKS_TO_MBLOCKS(bd->blocks);
-            if (size > n) {
-                StgWord newSize = size - n;
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-                freeAddr += newSize * MBLOCK_SIZE;
-                bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
-                freeMBlocks(freeAddr, n);
-                n = 0;
+    if (n_numa_nodes == 1) {
+        n -= returnMemoryOfNode(0, n);
+    } else {
+        // Take from the node with the most free megablocks, down to the level
+        // of the next one, until we have released enough.  See
+        // Note [NUMA block allocation].
+        W_ free_mblocks[MAX_NUMA_NODES];
+        for (node = 0; node < n_numa_nodes; node++) {
+            free_mblocks[node] = countFreeMBlocksOnNode(node);
+        }
+        while (n > 0) {
+            uint32_t most = 0;
+            W_ next = 0;
+            for (node = 1; node < n_numa_nodes; node++) {
+                if (free_mblocks[node] > free_mblocks[most]) {
+                    most = node;
+                }
             }
-            else {
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-                n -= size;
-                bd = bd->link;
-                freeMBlocks(freeAddr, size);
+            if (free_mblocks[most] == 0) break;
+            for (node = 0; node < n_numa_nodes; node++) {
+                if (node != most && free_mblocks[node] > next) {
+                    next = free_mblocks[node];
+                }
+            }
+            uint32_t want = (uint32_t) stg_min((W_) n,
+                                               stg_max(free_mblocks[most] - next, 1));
+            uint32_t got = returnMemoryOfNode(most, want);
+            free_mblocks[most] -= got;
+            n -= got;
+            if (got < want) {
+                free_mblocks[most] = 0;
             }
         }
-        free_mblock_list[node] = bd;
     }
 
     // Ask the OS to release any address space portion
@@ -1034,6 +1378,16 @@ uint32_t returnMemoryToOS(uint32_t n /* megablocks */)
     return (init_n - n);
 }
 
+void
+getNumaBlockStats (uint32_t node, NumaBlockStats *stats)
+{
+    stats->alloc_blocks    = n_alloc_blocks_by_node[node];
+    stats->hw_alloc_blocks = hw_alloc_blocks_by_node[node];
+    stats->free_mblocks    = countFreeMBlocksOnNode(node);
+    stats->local_blocks    = numa_local_blocks[node];
+    stats->remote_blocks   = numa_remote_blocks[node];
+}
+
 /* -----------------------------------------------------------------------------
    Debugging
    -------------------------------------------------------------------------- */
@@ -13,6 +13,88 @@
 bdescr *allocLargeChunk (W_ min, W_ max);
 bdescr *allocLargeChunkOnNode (uint32_t node, W_ min, W_ max);
 
+// Must hold sm_mutex
+bdescr *allocMBlockGroupAt (void *addr, StgWord mblocks);
+bdescr *allocMBlockGroupAtOnNode (uint32_t node, void *addr, StgWord mblocks);
+bdescr *splitBlockGroupAt  (bdescr *bd, W_ off, W_ n, bdescr **rest);
+bdescr *carveBlockGroup    (bdescr *bd, W_ off, W_ n, bdescr **before,
+                            bdescr **rest);
+
+/* Per-NUMA-node statistics, see Note [NUMA block allocation] -------------- */
+
+typedef struct {
+    W_ alloc_blocks;           // blocks currently allocated on the node
+    W_ hw_alloc_blocks;        // high-water mark of alloc_blocks
+    W_ free_mblocks;           // megablocks on the node's free list
+    StgWord64 local_blocks;    // blocks allocated by a Task on the node
+    StgWord64 remote_blocks;   // blocks allocated by a Task on another node
+} NumaBlockStats;
+
+// Must hold sm_mutex
+void getNumaBlockStats (uint32_t node, NumaBlockStats *stats);
+
+/* Per-capability block caches, see Note [Per-capability block caches] ---- */
+
+#define BLOCK_CACHE_BATCH 16                       // blocks per refill/flush
+#define BLOCK_CACHE_SIZE  (2 * BLOCK_CACHE_BATCH)  // most blocks kept
+
+typedef struct {
+    StgWord allocs;         // blocks handed out by the cache
+    StgWord frees;          // blocks given back to the cache
+    StgWord refills;        // batches taken from the free lists
+    StgWord flushes;        // batches returned to the free lists
+    StgWord sm_locked;      // acquisitions of sm_mutex by the mutator
+    StgWord sm_contended;   // ... which found it held by another thread
+    StgWord gc_locked;      // acquisitions of gc_alloc_block_sync
+    StgWord gc_contended;   // ... which found it held by another thread
+} BlockAllocStats;
+
+typedef struct {
+    bdescr *blocks;         // free single blocks, linked through ->link
+    uint32_t n_blocks;
+    uint32_t node;          // the NUMA node all of the blocks are on
+    BlockAllocStats stats;
+} BlockCache;
+
+void initBlockCache    (BlockCache *cache, uint32_t node);
+
+// Must hold sm_mutex, or gc_alloc_block_sync during GC
+void refillBlockCache  (BlockCache *cache);
+void flushBlockCache   (BlockCache *cache, uint32_t n);
+
+void getBlockAllocStats (BlockAllocStats *stats);
+
+INLINE_HEADER bdescr *
+popBlockCache (BlockCache *cache)
+{
+    bdescr *bd = cache->blocks;
+    cache->blocks = bd->link;
+    cache->n_blocks--;
+    cache->stats.allocs++;
+    bd->link = NULL;
+    return bd;
+}
+
+// Returns true if the cache took the block; otherwise the caller frees it.
+INLINE_HEADER bool
+pushBlockCache (BlockCache *cache, bdescr *bd)
+{
+    if (bd->blocks != 1 || bd->node != cache->node) {
+        return false;
+    }
+#if defined(DEBUG)
+    bd->flags = 0;
+#endif
+    bd->gen = NULL;
+    bd->gen_no = 0;
+    bd->free = bd->start;
+    bd->link = cache->blocks;
+    cache->blocks = bd;
+    cache->n_blocks++;
+    cache->stats.frees++;
+    return true;
+}
+
 /* Debugging  -------------------------------------------------------------- */
 
 extern W_ countBlocks       (bdescr *bd);
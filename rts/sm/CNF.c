@@ -23,8 +23,12 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "sm/ShouldCompact.h"
+#include "sm/OSMem.h"
 
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
@@ -32,6 +36,20 @@
 #if defined(HAVE_LIMITS_H)
 #include <limits.h>
 #endif
+#if defined(mingw32_HOST_OS)
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/uio.h>
+#endif
+
+#define XXH_NAMESPACE __rts_
+#define XXH_STATIC_LINKING_ONLY   /* for XXH3_state_t */
+#include "xxhash.h"
+
+#if !defined(O_BINARY)
+#define O_BINARY 0
+#endif
 
 /*
   Note [Compact Normal Forms]
@@ -110,10 +128,11 @@
   compactResize() call, which also adjust the size of automatically appended
   blocks.
 
-  Objects can be appended to the block currently marked to the nursery, or any
-  of the later blocks if the nursery block is too full to fit the entire
-  object. For each block in the chain (which can be multiple block allocator
-  blocks), we use the bdescr of its beginning to store how full it is.
+  Each capability appends objects to a block it has claimed (see Note
+  [Concurrent compactAdd]), or to any later block nobody has claimed if its
+  block is too full to fit the entire object. For each block in the chain
+  (which can be multiple block allocator blocks), we use the bdescr of its
+  beginning to store how full it is.
   After an object is appended, it is scavenged for any outgoing pointers,
   and all pointed to objects are appended, recursively, in a manner similar
   to copying GC (further discussion in the note [Appending to a Compact])
@@ -140,9 +159,10 @@
   Compacts are also suitable for network or disk serialization, and to
   that extent they support a pointer fixup operation, which adjusts pointers
   from a previous layout of the chain in memory to the new allocation.
-  This works by constructing a temporary binary search table (in the C heap)
-  of the old block addresses (which are known from the block header), and
-  then searching for each pointer in the table, and adjusting it.
+  This works by constructing a temporary translation table (in the C heap)
+  from the old block addresses (which are known from the block header) to
+  the new blocks, and then looking up each pointer in the table, and
+  adjusting it (see Note [Parallel compact fixup]).
   It relies on ABI compatibility and static linking (or no ASLR) because it
   does not attempt to reconstruct info tables, and uses info tables to detect
   pointers. In practice this means only the exact same binary should be
@@ -156,14 +176,76 @@ typedef enum {
     ALLOCATE_IMPORT_APPEND,
 } AllocateOp;
 
+// Account for the new compact block group block, of aligned_size bytes, in
+// generation g.  Must hold sm_mutex.
+static void
+compactLinkGroup(bdescr      *block,
+                 generation  *g,
+                 StgWord      aligned_size,
+                 AllocateOp   operation)
+{
+    switch (operation) {
+    case ALLOCATE_NEW:
+        ASSERT(g == g0);
+        dbl_link_onto(block, &g0->compact_objects);
+        g->n_compact_blocks += block->blocks;
+        g->n_new_large_words += aligned_size / sizeof(StgWord);
+        break;
+
+    case ALLOCATE_IMPORT_NEW:
+        dbl_link_onto(block, &g0->compact_blocks_in_import);
+        FALLTHROUGH;
+    case ALLOCATE_IMPORT_APPEND:
+        ASSERT(g == g0);
+        g->n_compact_blocks_in_import += block->blocks;
+        g->n_new_large_words += aligned_size / sizeof(StgWord);
+        break;
+
+    case ALLOCATE_APPEND:
+        g->n_compact_blocks += block->blocks;
+        if (g == g0)
+            g->n_new_large_words += aligned_size / sizeof(StgWord);
+        break;
+
+    default:
+        ASSERT(!"code should not be reached");
+#if !defined(DEBUG)
+        RTS_UNREACHABLE;
+#endif
+    }
+}
+
+// Set up the block descriptors of a new compact block group of n_blocks
+// blocks, and the StgCompactNFDataBlock at its start.
+static StgCompactNFDataBlock *
+compactInitGroup(bdescr *head, generation *g, uint32_t n_blocks)
+{
+    StgCompactNFDataBlock *self;
+    bdescr *block;
+
+    self = (StgCompactNFDataBlock*) head->start;
+    self->self = self;
+    self->next = NULL;
+
+    initBdescr(head, g, g);
+    head->flags = BF_COMPACT;
+    for (block = head + 1, n_blocks --; n_blocks > 0; block++, n_blocks--) {
+        initBdescr(block, g, g);
+        block->link = head;
+        block->blocks = 0;
+        block->flags = BF_COMPACT;
+    }
+
+    return self;
+}
+
 static StgCompactNFDataBlock *
 compactAllocateBlockInternal(Capability            *cap,
                              StgWord                aligned_size,
                              StgCompactNFDataBlock *first,
                              AllocateOp             operation)
 {
-    StgCompactNFDataBlock *self;
-    bdescr *block, *head;
+    bdescr *block;
     uint32_t n_blocks;
     generation *g;
 
@@ -200,56 +282,13 @@ compactAllocateBlockInternal(Capability            *cap,
 
     ACQUIRE_SM_LOCK;
     block = allocGroup(n_blocks);
-    switch (operation) {
-    case ALLOCATE_NEW:
-        ASSERT(first == NULL);
-        ASSERT(g == g0);
-        dbl_link_onto(block, &g0->compact_objects);
-        g->n_compact_blocks += block->blocks;
-        g->n_new_large_words += aligned_size / sizeof(StgWord);
-        break;
-
-    case ALLOCATE_IMPORT_NEW:
-        dbl_link_onto(block, &g0->compact_blocks_in_import);
-        FALLTHROUGH;
-    case ALLOCATE_IMPORT_APPEND:
-        ASSERT(first == NULL);
-        ASSERT(g == g0);
-        g->n_compact_blocks_in_import += block->blocks;
-        g->n_new_large_words += aligned_size / sizeof(StgWord);
-        break;
-
-    case ALLOCATE_APPEND:
-        g->n_compact_blocks += block->blocks;
-        if (g == g0)
-            g->n_new_large_words += aligned_size / sizeof(StgWord);
-        break;
-
-    default:
-        ASSERT(!"code should not be reached");
-#if !defined(DEBUG)
-        RTS_UNREACHABLE;
-#endif
-    }
+    ASSERT(first == NULL || operation == ALLOCATE_APPEND);
+    compactLinkGroup(block, g, aligned_size, operation);
     RELEASE_SM_LOCK;
 
     cap->total_allocated += aligned_size / sizeof(StgWord);
 
-    self = (StgCompactNFDataBlock*) block->start;
-    self->self = self;
-    self->next = NULL;
-
-    head = block;
-    initBdescr(head, g, g);
-    head->flags = BF_COMPACT;
-    for (block = head + 1, n_blocks --; n_blocks > 0; block++, n_blocks--) {
-        initBdescr(block, g, g);
-        block->link = head;
-        block->blocks = 0;
-        block->flags = BF_COMPACT;
-    }
-
-    return self;
+    return compactInitGroup(block, g, n_blocks);
 }
 
 static inline StgCompactNFDataBlock *
@@ -279,6 +318,13 @@ compactFree(StgCompactNFData *str)
             // When using the non-moving collector we leave compact object
             // evacuated to the oldset gen as BF_EVACUATED to avoid evacuating
             // objects in the non-moving heap.
+#if defined(USE_LARGE_ADDRESS_SPACE)
+        if (bd->flags & BF_MAPPED) {
+            // See Note [Mapped compact regions]
+            osUnmapFileMemory(bd->start, bd->blocks * BLOCK_SIZE);
+            bd->flags &= ~BF_MAPPED;
+        }
+#endif
         freeGroup(bd);
     }
 }
@@ -386,8 +432,6 @@ compactNew (Capability *cap, StgWord size)
 
     bd = Bdescr((P_)block);
     bd->free = (StgPtr)((W_)self + sizeof(StgCompactNFData));
-    self->hp = bd->free;
-    self->hpLim = bd->start + bd->blocks * BLOCK_SIZE_W;
 
     self->totalW = bd->blocks * BLOCK_SIZE_W;
 
@@ -396,10 +440,11 @@ compactNew (Capability *cap, StgWord size)
     return self;
 }
 
+// Allocate a new empty block for str, without linking it into the chain yet.
 static StgCompactNFDataBlock *
-compactAppendBlock (Capability       *cap,
-                    StgCompactNFData *str,
-                    StgWord           aligned_size)
+compactNewBlock (Capability       *cap,
+                 StgCompactNFData *str,
+                 StgWord           aligned_size)
 {
     StgCompactNFDataBlock *block;
     bdescr *bd;
@@ -410,23 +455,29 @@ compactAppendBlock (Capability       *cap,
     block->owner = str;
     block->next = NULL;
 
-    ASSERT(str->last->next == NULL);
-    str->last->next = block;
-    str->last = block;
-
     bd = Bdescr((P_)block);
     bd->free = (StgPtr)((W_)block + sizeof(StgCompactNFDataBlock));
     ASSERT(bd->free == (StgPtr)block + sizeofW(StgCompactNFDataBlock));
 
-    str->totalW += bd->blocks * BLOCK_SIZE_W;
-
     return block;
 }
 
+// Append a block from compactNewBlock to the chain.  Must hold sm_mutex.
+static void
+compactLinkBlock (StgCompactNFData *str, StgCompactNFDataBlock *block)
+{
+    ASSERT(str->last->next == NULL);
+    str->last->next = block;
+    str->last = block;
+
+    str->totalW += Bdescr((P_)block)->blocks * BLOCK_SIZE_W;
+}
+
 void
 compactResize (Capability *cap, StgCompactNFData *str, StgWord new_size)
 {
     StgWord aligned_size;
+    StgCompactNFDataBlock *block;
 
     aligned_size = BLOCK_ROUND_UP(new_size + sizeof(StgCompactNFDataBlock));
 
@@ -436,7 +487,11 @@ compactResize (Capability *cap, StgCompactNFData *str, StgWord new_size)
         aligned_size = BLOCK_SIZE * BLOCKS_PER_MBLOCK;
 
     str->autoBlockW = aligned_size / sizeof(StgWord);
-    compactAppendBlock(cap, str, aligned_size);
+    block = compactNewBlock(cap, str, aligned_size);
+
+    ACQUIRE_SM_LOCK;
+    compactLinkBlock(str, block);
+    RELEASE_SM_LOCK;
 }
 
 STATIC_INLINE bool
@@ -463,6 +518,65 @@ block_is_full (StgCompactNFDataBlock *block)
     return (!has_room_for(bd,7));
 }
 
+/* Note [Concurrent compactAdd]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   compactAdd# may be called on the same compact by threads running on
+   several capabilities at once, so that building one large region scales
+   with the number of cores. Each capability appends into a block of its
+   own: cap->compact_str is the compact it is appending to and
+   cap->compact_bd the block it claimed there, which is flagged BF_APPENDING
+   so that no other capability appends to it as well. The fast path in
+   stg_compactAddWorkerzh bumps cap->compact_bd->free without taking a lock.
+   As the free pointer of each block is always up to date, there is no
+   allocation pointer to merge back into the blocks before the compact is
+   serialized or checked.
+
+   allocateForCompact, the slow path, holds sm_mutex while it gives back a
+   full block and claims the next block with room that nobody is appending
+   to, places an object too large for the claimed block in another unclaimed
+   block, or links a new block into the chain. Objects are not ordered
+   across capabilities, which is fine as nothing depends on their order.
+   Blocks flagged BF_SEALED have already been written to a stream and are
+   never appended to (see Note [Streaming compact regions]).
+
+   A capability keeps its claim until it fills the block or appends to
+   another compact. At the start of each GC all claims are released
+   (compactReleaseCursor), so that a capability never refers to a compact
+   that has died, and blocks are not kept from other capabilities by one
+   that stopped appending.
+
+   compactAddWithSharing# runs on its own, with no plain adds alongside it:
+   GHC.Compact takes the lock of the compact exclusively around it (see
+   CompactLock there). str->hash maps the objects copied by the add in
+   progress to their copies, and an object enters the table before its
+   fields are copied, so a plain add running at the same time could copy
+   an object whose table entry points at a copy that is not finished yet.
+   The lock prefers exclusive operations: once one is waiting, new plain
+   adds wait behind it, so a steady stream of adds cannot starve it.
+*/
+
+// Give back the block cap is appending to.  Must hold sm_mutex, or be in
+// the GC.  See Note [Concurrent compactAdd].
+void
+compactReleaseCursor (Capability *cap)
+{
+    if (cap->compact_str != NULL) {
+        cap->compact_bd->flags &= ~BF_APPENDING;
+        cap->compact_str = NULL;
+        cap->compact_bd = NULL;
+        cap->compact_lim = NULL;
+    }
+}
+
+static void
+claim_block (Capability *cap, StgCompactNFData *str, bdescr *bd)
+{
+    bd->flags |= BF_APPENDING;
+    cap->compact_str = str;
+    cap->compact_bd = bd;
+    cap->compact_lim = bd->start + bd->blocks * BLOCK_SIZE_W;
+}
+
 void *
 allocateForCompact (Capability *cap,
                     StgCompactNFData *str,
@@ -473,56 +587,74 @@ allocateForCompact (Capability *cap,
     StgCompactNFDataBlock *block;
     bdescr *bd;
 
-    ASSERT(str->nursery != NULL);
-    ASSERT(str->hp > Bdescr((P_)str->nursery)->start);
-    ASSERT(str->hp <= Bdescr((P_)str->nursery)->start +
-           Bdescr((P_)str->nursery)->blocks * BLOCK_SIZE_W);
-
- retry:
-    if (str->hp + sizeW < str->hpLim) {
-        to = str->hp;
-        str->hp += sizeW;
+    // The fast path of stg_compactAddWorkerzh, in case we are called
+    // from elsewhere
+    if (cap->compact_str == str &&
+        cap->compact_bd->free + sizeW <= cap->compact_lim) {
+        to = cap->compact_bd->free;
+        cap->compact_bd->free += sizeW;
         return to;
     }
 
-    bd = Bdescr((P_)str->nursery);
-    bd->free = str->hp;
+    ACQUIRE_SM_LOCK;
+
+    if (cap->compact_str != str || !has_room_for(cap->compact_bd, 7)) {
+        compactReleaseCursor(cap);
 
-    // move the nursery past full blocks
-    if (block_is_full (str->nursery)) {
-        do {
+        // move the nursery past full blocks
+        while (str->nursery->next != NULL && block_is_full(str->nursery)) {
             str->nursery = str->nursery->next;
-        } while (str->nursery && block_is_full(str->nursery));
+        }
 
-        if (str->nursery == NULL) {
-            str->nursery = compactAppendBlock(cap, str,
-                                              str->autoBlockW * sizeof(W_));
+        // and claim the first block nobody else is appending to
+        for (block = str->nursery; block != NULL; block = block->next) {
+            bd = Bdescr((P_)block);
+            if (!(bd->flags & (BF_APPENDING | BF_SEALED)) &&
+                has_room_for(bd, 7)) {
+                claim_block(cap, str, bd);
+                if (bd->free + sizeW <= cap->compact_lim) {
+                    to = bd->free;
+                    bd->free += sizeW;
+                    RELEASE_SM_LOCK;
+                    return to;
+                }
+                break;
+            }
         }
-        bd = Bdescr((P_)str->nursery);
-        str->hp = bd->free;
-        str->hpLim = bd->start + bd->blocks * BLOCK_SIZE_W;
-        goto retry;
     }
 
-    // try subsequent blocks
-    for (block = str->nursery->next; block != NULL; block = block->next) {
+    // try the other blocks
+    for (block = str->nursery; block != NULL; block = block->next) {
         bd = Bdescr((P_)block);
-        if (has_room_for(bd,sizeW)) {
+        if (!(bd->flags & (BF_APPENDING | BF_SEALED)) &&
+            has_room_for(bd,sizeW)) {
             to = bd->free;
             bd->free += sizeW;
+            RELEASE_SM_LOCK;
             return to;
         }
     }
 
-    // If all else fails, allocate a new block of the right size.
+    RELEASE_SM_LOCK;
+
+    // If all else fails, allocate a new block of the right size, and append
+    // to it from now on if we have no block of our own.
     next_size = stg_max(str->autoBlockW * sizeof(StgWord),
                     BLOCK_ROUND_UP(sizeW * sizeof(StgWord)
                                    + sizeof(StgCompactNFDataBlock)));
 
-    block = compactAppendBlock(cap, str, next_size);
+    block = compactNewBlock(cap, str, next_size);
     bd = Bdescr((P_)block);
     to = bd->free;
     bd->free += sizeW;
+
+    ACQUIRE_SM_LOCK;
+    if (cap->compact_str == NULL && has_room_for(bd, 7)) {
+        claim_block(cap, str, bd);
+    }
+    compactLinkBlock(str, block);
+    RELEASE_SM_LOCK;
+
     return to;
 }
 
@@ -756,11 +888,6 @@ verify_consistency_loop (StgCompactNFData *str)
         block = block->next;
     } while (block && block->owner);
 }
-
-void verifyCompact (StgCompactNFData *str USED_IF_DEBUG)
-{
-    IF_DEBUG(sanity, verify_consistency_loop(str));
-}
 #endif // DEBUG
 
 /* -----------------------------------------------------------------------------
@@ -783,9 +910,46 @@ any_needs_fixup(StgCompactNFDataBlock *block)
     return false;
 }
 
+/* Note [Parallel compact fixup]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   When a compact is imported or mapped at a different address from the one
+   it was written at, every pointer in it has to be moved from the old block
+   to the new one. Each block remembers its old address in block->self, so
+   the fixup is a translation from old addresses to new blocks.
+
+   The translation table is a direct two-level index rather than a sorted
+   array that has to be searched: the first level is indexed by the old
+   megablock, counted from the lowest one the compact used, and the second
+   by the block within that megablock. Every old block of a group points at
+   the new group, so looking a pointer up costs two loads whatever the size
+   of the compact. The second levels are only allocated for the megablocks
+   the compact actually used.
+
+   Once the table is built it is only read, and each block's pointers are
+   rewritten independently of the others, so large compacts are fixed up by
+   several OS threads which claim blocks from a shared counter, like the
+   workers of the parallel compacting GC (see Note [Parallel compaction] in
+   Compact.c). We use as many threads as the parallel GC would (-qn, or one
+   per capability), but no more than one per FIXUP_WORDS_PER_THREAD words of
+   compact, since starting a thread costs more than fixing up a small
+   compact. The calling capability is held throughout.
+*/
+
+// Don't start a fixup thread for less than this many words of compact
+#define FIXUP_WORDS_PER_THREAD (1024 * 1024)
+
+#define FIXUP_BLOCKS_PER_MBLOCK (MBLOCK_SIZE / BLOCK_SIZE)
+
+typedef struct {
+    W_ base;                            // the lowest old megablock
+    W_ n_mblocks;
+    StgCompactNFDataBlock ***mblocks;   // n_mblocks entries, NULL if unused
+    StgCompactNFDataBlock *first;
+} FixupTable;
+
 #if defined(DEBUG)
 static void
-spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
+spew_failing_pointer(FixupTable *table, StgWord address)
 {
     uint32_t i;
     StgWord key, value;
@@ -796,70 +960,52 @@ spew_failing_pointer(StgWord *fixup_table, uint32_t count, StgWord address)
     debugBelch("Failed to adjust 0x%" FMT_HexWord ". Block dump follows...\n",
                address);
 
-    for (i  = 0; i < count; i++) {
-        key = fixup_table [2 * i];
-        value = fixup_table [2 * i + 1];
-
-        block = (StgCompactNFDataBlock*)value;
+    i = 0;
+    block = table->first;
+    do {
+        key = (W_)block->self;
+        value = (W_)block;
         bd = Bdescr((P_)block);
         size = (W_)bd->free - (W_)bd->start;
 
         debugBelch("%" FMT_Word32 ": was 0x%" FMT_HexWord "-0x%" FMT_HexWord
                    ", now 0x%" FMT_HexWord "-0x%" FMT_HexWord "\n", i, key,
                    key+size, value, value+size);
-    }
+        i++;
+        block = block->next;
+    } while (block && block->owner);
 }
 #endif
 
 STATIC_INLINE StgCompactNFDataBlock *
-find_pointer(StgWord *fixup_table, uint32_t count, StgClosure *q)
+find_pointer(FixupTable *table, StgClosure *q)
 {
     StgWord address = (W_)q;
-    uint32_t a, b, c;
-    StgWord key, value;
-    bdescr *bd;
-
-    a = 0;
-    b = count;
-    while (a < b-1) {
-        c = (a+b)/2;
-
-        key = fixup_table[c * 2];
-        value = fixup_table[c * 2 + 1];
-
-        if (key > address)
-            b = c;
-        else
-            a = c;
-    }
-
-    // three cases here: 0, 1 or 2 blocks to check
-    for ( ; a < b; a++) {
-        key = fixup_table[a * 2];
-        value = fixup_table[a * 2 + 1];
-
-        if (key > address)
-            goto fail;
-
-        bd = Bdescr((P_)value);
-
-        if (key + bd->blocks * BLOCK_SIZE <= address)
-            goto fail;
-
-        return (StgCompactNFDataBlock*)value;
+    StgCompactNFDataBlock **mblock;
+    StgCompactNFDataBlock *block;
+    W_ m;
+
+    m = (address - table->base) >> MBLOCK_SHIFT;
+    if (address >= table->base && m < table->n_mblocks) {
+        mblock = table->mblocks[m];
+        if (mblock != NULL) {
+            block = mblock[(address & MBLOCK_MASK) >> BLOCK_SHIFT];
+            if (block != NULL) {
+                return block;
+            }
+        }
     }
 
- fail:
     // We should never get here
 
 #if defined(DEBUG)
-    spew_failing_pointer(fixup_table, count, address);
+    spew_failing_pointer(table, address);
 #endif
     return NULL;
 }
 
 static bool
-fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
+fixup_one_pointer(FixupTable *table, StgClosure **p)
 {
     StgWord tag;
     StgClosure *q;
@@ -876,7 +1022,7 @@ fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
     if (!HEAP_ALLOCED(q))
         return true;
 
-    block = find_pointer(fixup_table, count, q);
+    block = find_pointer(table, q);
     if (block == NULL)
         return false;
     if (block == block->self)
@@ -889,16 +1035,14 @@ fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
 }
 
 static bool
-fixup_mut_arr_ptrs (StgWord          *fixup_table,
-                    uint32_t               count,
-                    StgMutArrPtrs    *a)
+fixup_mut_arr_ptrs (FixupTable *table, StgMutArrPtrs *a)
 {
     StgPtr p, q;
 
     p = (StgPtr)&a->payload[0];
     q = (StgPtr)&a->payload[a->ptrs];
     for (; p < q; p++) {
-        if (!fixup_one_pointer(fixup_table, count, (StgClosure**)p))
+        if (!fixup_one_pointer(table, (StgClosure**)p))
             return false;
     }
 
@@ -906,7 +1050,7 @@ fixup_mut_arr_ptrs (StgWord          *fixup_table,
 }
 
 static bool
-fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
+fixup_block(StgCompactNFDataBlock *block, FixupTable *table)
 {
     const StgInfoTable *info;
     bdescr *bd;
@@ -920,8 +1064,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
         switch (info->type) {
         case CONSTR_1_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[0]))
                 return false;
             FALLTHROUGH;
         case CONSTR_0_1:
@@ -929,13 +1072,11 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             break;
 
         case CONSTR_2_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[1]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[1]))
                 return false;
             FALLTHROUGH;
         case CONSTR_1_1:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fixup_one_pointer(table, &((StgClosure*)p)->payload[0]))
                 return false;
             FALLTHROUGH;
         case CONSTR_0_2:
@@ -950,7 +1091,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
             end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
             for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-                if (!fixup_one_pointer(fixup_table, count, (StgClosure **)p))
+                if (!fixup_one_pointer(table, (StgClosure **)p))
                     return false;
             }
             p += info->layout.payload.nptrs;
@@ -963,7 +1104,8 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
         case MUT_ARR_PTRS_FROZEN_CLEAN:
         case MUT_ARR_PTRS_FROZEN_DIRTY:
-            fixup_mut_arr_ptrs(fixup_table, count, (StgMutArrPtrs*)p);
+            if (!fixup_mut_arr_ptrs(table, (StgMutArrPtrs*)p))
+                return false;
             p += mut_arr_ptrs_sizeW((StgMutArrPtrs*)p);
             break;
 
@@ -974,8 +1116,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             StgSmallMutArrPtrs *arr = (StgSmallMutArrPtrs*)p;
 
             for (i = 0; i < arr->ptrs; i++) {
-                if (!fixup_one_pointer(fixup_table, count,
-                                       &arr->payload[i]))
+                if (!fixup_one_pointer(table, &arr->payload[i]))
                     return false;
             }
 
@@ -1003,68 +1144,187 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
     return true;
 }
 
-static int
-cmp_fixup_table_item (const void *e1, const void *e2)
-{
-    const StgWord *w1 = e1;
-    const StgWord *w2 = e2;
-    if (*w1 > *w2) return +1;
-    else if (*w1 < *w2) return -1;
-    else return 0;
-}
-
-static StgWord *
-build_fixup_table (StgCompactNFDataBlock *block, uint32_t *pcount)
+// Map every old block of every group in the chain to its new group.  See
+// Note [Parallel compact fixup].
+static void
+build_fixup_table (FixupTable *table, StgCompactNFDataBlock *block)
 {
-    uint32_t count;
     StgCompactNFDataBlock *tmp;
-    StgWord *table;
+    W_ lo, hi, start, end, addr, m;
 
-    count = 0;
+    lo = (W_)block->self;
+    hi = lo;
     tmp = block;
     do {
-        count++;
+        start = (W_)tmp->self;
+        end = start + Bdescr((P_)tmp)->blocks * BLOCK_SIZE;
+        if (start < lo) lo = start;
+        if (end > hi) hi = end;
         tmp = tmp->next;
     } while(tmp && tmp->owner);
 
-    table = stgMallocBytes(sizeof(StgWord) * 2 * count, "build_fixup_table");
+    table->base = (W_)MBLOCK_ROUND_DOWN(lo);
+    table->n_mblocks = ((W_)MBLOCK_ROUND_UP(hi) - table->base) >> MBLOCK_SHIFT;
+    table->mblocks = stgCallocBytes(table->n_mblocks,
+                                    sizeof(StgCompactNFDataBlock **),
+                                    "build_fixup_table");
+    table->first = block;
 
-    count = 0;
     do {
-        table[count * 2] = (W_)block->self;
-        table[count * 2 + 1] = (W_)block;
-        count++;
+        start = (W_)block->self;
+        end = start + Bdescr((P_)block)->blocks * BLOCK_SIZE;
+        for (addr = start; addr < end; addr += BLOCK_SIZE) {
+            m = (addr - table->base) >> MBLOCK_SHIFT;
+            if (table->mblocks[m] == NULL) {
+                table->mblocks[m] =
+                    stgCallocBytes(FIXUP_BLOCKS_PER_MBLOCK,
+                                   sizeof(StgCompactNFDataBlock *),
+                                   "build_fixup_table");
+            }
+            table->mblocks[m][(addr & MBLOCK_MASK) >> BLOCK_SHIFT] = block;
+        }
         block = block->next;
     } while(block && block->owner);
+}
+
+static void
+free_fixup_table (FixupTable *table)
+{
+    W_ m;
+
+    for (m = 0; m < table->n_mblocks; m++) {
+        stgFree(table->mblocks[m]);
+    }
+    stgFree(table->mblocks);
+}
+
+// The blocks of one fixup, shared by the threads working on it.
+typedef struct {
+    FixupTable *table;
+    StgCompactNFDataBlock **blocks;
+    uint32_t n_blocks;
+    StgWord next;           // the next block to claim
+    bool failed;
+} FixupWork;
+
+static void *
+fixup_worker (void *data)
+{
+    FixupWork *work = data;
+    StgWord i;
+
+    while (!RELAXED_LOAD(&work->failed)) {
+        i = atomic_inc(&work->next, 1) - 1;
+        if (i >= work->n_blocks)
+            break;
+        if (!fixup_block(work->blocks[i], work->table)) {
+            RELAXED_STORE(&work->failed, true);
+        }
+    }
+    return NULL;
+}
+
+// How many threads should fix up a compact of n_blocks block groups and
+// size_w words.  See Note [Parallel compact fixup].
+static uint32_t
+fixup_threads (uint32_t n_blocks USED_IF_THREADS, W_ size_w USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    uint32_t n;
+
+    if (!RtsFlags.ParFlags.parGcEnabled)
+        return 1;
+
+    n = RtsFlags.ParFlags.parGcThreads;
+    if (n == 0 || n > n_capabilities)
+        n = n_capabilities;
+    n = stg_min(n, size_w / FIXUP_WORDS_PER_THREAD);
+    n = stg_min(n, n_blocks);
+    return stg_max(n, 1);
+#else
+    return 1;
+#endif
+}
 
-    qsort(table, count, sizeof(StgWord) * 2, cmp_fixup_table_item);
+// Fix up the blocks of work on n_threads threads, including the calling one.
+// Only returns once every worker is done with work, which lives on the
+// caller's stack along with the blocks and the table it points to.
+static void
+run_fixup (FixupWork *work, uint32_t n_threads USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    if (n_threads > 1) {
+        OSThreadId *threads =
+            stgMallocBytes((n_threads - 1) * sizeof(OSThreadId), "run_fixup");
+        uint32_t i;
+        int r;
+
+        for (i = 0; i < n_threads - 1; i++) {
+            r = createAttachedOSThread(&threads[i], "compact fixup worker",
+                                       fixup_worker, work);
+            if (r != 0) {
+                barf("run_fixup: failed to spawn worker: %s", strerror(r));
+            }
+        }
+        fixup_worker(work);
 
-    *pcount = count;
-    return table;
+        // joining the workers also makes their writes to work->failed
+        // visible to us
+        for (i = 0; i < n_threads - 1; i++) {
+            joinOSThread(threads[i]);
+        }
+        stgFree(threads);
+        return;
+    }
+#endif
+    fixup_worker(work);
 }
 
 static bool
 fixup_loop(StgCompactNFDataBlock *block, StgClosure **proot)
 {
-    StgWord *table;
+    FixupTable table;
+    FixupWork work;
+    StgCompactNFDataBlock *tmp;
+    uint32_t n_blocks, n_threads, i;
+    W_ size_w;
     bool ok;
-    uint32_t count;
 
-    table = build_fixup_table (block, &count);
+    build_fixup_table(&table, block);
 
+    n_blocks = 0;
+    size_w = 0;
+    tmp = block;
     do {
-        if (!fixup_block(block, table, count)) {
-            ok = false;
-            goto out;
-        }
+        n_blocks++;
+        size_w += Bdescr((P_)tmp)->blocks * BLOCK_SIZE_W;
+        tmp = tmp->next;
+    } while(tmp && tmp->owner);
 
-        block = block->next;
-    } while(block && block->owner);
+    work.table = &table;
+    work.blocks = stgMallocBytes(n_blocks * sizeof(StgCompactNFDataBlock *),
+                                 "fixup_loop");
+    work.n_blocks = n_blocks;
+    work.next = 0;
+    work.failed = false;
+
+    tmp = block;
+    for (i = 0; i < n_blocks; i++) {
+        work.blocks[i] = tmp;
+        tmp = tmp->next;
+    }
 
-    ok = fixup_one_pointer(table, count, proot);
+    n_threads = fixup_threads(n_blocks, size_w);
+    IF_DEBUG(compact, debugBelch("Fixing up %" FMT_Word32 " compact blocks "
+                                 "on %" FMT_Word32 " threads\n",
+                                 n_blocks, n_threads));
 
- out:
-    stgFree(table);
+    run_fixup(&work, n_threads);
+
+    ok = !work.failed && fixup_one_pointer(&table, proot);
+
+    stgFree(work.blocks);
+    free_fixup_table(&table);
     return ok;
 }
 
@@ -1088,10 +1348,14 @@ fixup_late(StgCompactNFData *str, StgCompactNFDataBlock *block)
     bdescr *bd;
     StgWord totalW;
 
+    // Only write to the block headers where they change, so that a region
+    // mapped back at its old address keeps sharing its pages with the file
+    // (see Note [Mapped compact regions])
     nursery = block;
     totalW = 0;
     do {
-        block->self = block;
+        if (block->self != block)
+            block->self = block;
 
         bd = Bdescr((P_)block);
         totalW += bd->blocks * BLOCK_SIZE_W;
@@ -1099,17 +1363,14 @@ fixup_late(StgCompactNFData *str, StgCompactNFDataBlock *block)
         if (block->owner != NULL) {
             if (bd->free != bd->start)
                 nursery = block;
-            block->owner = str;
+            if (block->owner != str)
+                block->owner = str;
         }
 
         block = block->next;
     } while(block);
 
     str->nursery = nursery;
-    bd = Bdescr((P_)nursery);
-    str->hp = bd->free;
-    str->hpLim = bd->start + bd->blocks * BLOCK_SIZE_W;
-
     str->totalW = totalW;
 }
 
@@ -1177,3 +1438,1218 @@ compactFixupPointers(StgCompactNFData *str,
 
     return (StgPtr)root;
 }
+
+/* -----------------------------------------------------------------------------
+   Compact region files
+   -------------------------------------------------------------------------- */
+
+/*
+  Note [Mapped compact regions]
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  Importing a serialized compact region (importCompact in
+  GHC.Compact.Serialized) copies every block into freshly allocated memory,
+  and then fixes up the pointers of the blocks which did not land where
+  they were saved from.  For a region of several gigabytes that takes a
+  while, and each process which loads the region gets its own copy.
+
+  compactWriteFile saves a region to a file which compactMapFile can
+  instead map straight into the heap (writeCompactFile and mapCompactFile
+  in GHC.Compact.Serialized).  The file holds a CompactFileHeader, a
+  CompactFileBlock describing each block of the region in chain order, and
+  the contents of the blocks, each at a BLOCK_SIZE aligned offset.  It
+  writes a temporary file next to the target and renames it into place:
+  truncating a file which some region is still mapped from would make that
+  region's pages fault with SIGBUS, whereas a renamed-over file lives on for
+  as long as it is mapped.
+
+  compactMapFile gives each block a block group at the same offset within a
+  megablock as the one it was saved from, so that blocks which shared a
+  megablock share one again; the blocks around them go back to the block
+  allocator.  The megablock itself is the one at the old address if that is
+  free (allocMBlockGroupAt), and any other megablock otherwise.  The
+  contents of each block are then mapped from the file with a private,
+  copy-on-write mapping (osMapFileMemory), and the block is flagged
+  BF_MAPPED.  Finally compactFixupPointers (called by mapCompactFile)
+  links the region into the heap like any imported one.
+
+  If every block got its old address back, there is nothing to fix up:
+  the region is never read as a whole, its pages are faulted in from the
+  page cache as the program touches them, and processes mapping the same
+  file share those pages.  Only the page holding the StgCompactNFData, and
+  block headers that change, are copied on write (see fixup_late).  A
+  block which had to move costs a fix-up pass over the whole region, as
+  for importCompact, but still no copy.
+
+  mapCompactFile makes a safe call, so the GC may run while the file is
+  being loaded.  The blocks are linked up in chain order on the import list
+  as soon as they are allocated, and loading a block keeps that link rather
+  than the one saved in the file, so the list is always valid.
+
+  Where a file cannot be mapped (Windows, platforms without the large
+  address space, or pages larger than BLOCK_SIZE) the contents are read
+  into the blocks instead.
+
+  compactFree replaces the mapping of a BF_MAPPED block with ordinary
+  memory before freeing the block, so the block allocator never hands out
+  memory backed by the file, and the file is released along with the
+  region.
+
+  A region is only meaningful to the binary which wrote it (see Note
+  [Compact Normal Forms]).  The header records the address of
+  stg_COMPACT_NFDATA_CLEAN_info, and compactMapFile refuses files from a
+  binary whose info tables are somewhere else.
+*/
+
+#define COMPACT_FILE_MAGIC 0x31304e4643434847ULL /* "GHCCNF01" */
+
+typedef struct {
+    StgWord64 magic;        // COMPACT_FILE_MAGIC
+    StgWord64 block_size;   // BLOCK_SIZE of the writer
+    StgWord64 mblock_size;  // MBLOCK_SIZE of the writer
+    StgWord64 info;         // &stg_COMPACT_NFDATA_CLEAN_info in the writer
+    StgWord64 root;         // address of the root in the writer
+    StgWord64 n_blocks;
+} CompactFileHeader;
+
+typedef struct {
+    StgWord64 address;      // address of the block in the writer
+    StgWord64 size;         // bytes in use, including the block header
+    StgWord64 offset;       // of the contents in the file
+} CompactFileBlock;
+
+// A block being loaded by compactMapFile
+typedef struct {
+    W_ address;
+    W_ size;
+    StgWord64 offset;
+    uint32_t index;         // position in the chain of blocks
+    bdescr *bd;             // where the block is loaded to
+} LoadBlock;
+
+static bool
+read_at (int fd, void *buf, W_ size, StgWord64 offset)
+{
+    StgWord8 *p = buf;
+
+#if defined(mingw32_HOST_OS)
+    if (_lseeki64(fd, (__int64)offset, SEEK_SET) < 0) {
+        return false;
+    }
+#endif
+    while (size > 0) {
+        unsigned int chunk = (unsigned int)stg_min(size, (W_)1 << 30);
+#if defined(mingw32_HOST_OS)
+        ssize_t r = read(fd, p, chunk);
+#else
+        ssize_t r = pread(fd, p, chunk, (off_t)offset);
+#endif
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (r == 0) {
+            errno = EINVAL;     // the file is truncated
+            return false;
+        }
+        p += r;
+        size -= r;
+        offset += r;
+    }
+    return true;
+}
+
+static bool
+write_all (int fd, const void *buf, W_ size)
+{
+    const StgWord8 *p = buf;
+
+    while (size > 0) {
+        unsigned int chunk = (unsigned int)stg_min(size, (W_)1 << 30);
+        ssize_t r = write(fd, p, chunk);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+static bool
+write_zeros (int fd, W_ size)
+{
+    static const StgWord8 zeros[BLOCK_SIZE];
+
+    while (size > 0) {
+        W_ chunk = stg_min(size, (W_)BLOCK_SIZE);
+        if (!write_all(fd, zeros, chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+// Replace the file at path with the one at tmp_path.  Returns 0, or -1 with
+// errno set.
+static int
+replace_file (const char *tmp_path, const char *path)
+{
+#if defined(mingw32_HOST_OS)
+    // rename() does not replace an existing file on Windows
+    if (!MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+        errno = EACCES;
+        return -1;
+    }
+    return 0;
+#else
+    return rename(tmp_path, path);
+#endif
+}
+
+// Save the compact region starting with first_block, whose root is root, to
+// path.  Returns 0, or -1 with errno set.  The caller must make sure that
+// the region is not appended to meanwhile.
+// See Note [Mapped compact regions].
+int
+compactWriteFile (void *first_block, void *root, const char *path)
+{
+    static StgWord tmp_count = 0;
+    StgCompactNFDataBlock *first = first_block, *block;
+    CompactFileHeader hdr;
+    CompactFileBlock *table;
+    StgWord64 n, i, pos;
+    int fd, r = -1, saved_errno = 0;
+    const size_t tmp_path_len = strlen(path) + 48;
+    char *tmp_path;
+
+    n = 0;
+    for (block = first; block != NULL; block = block->next) {
+        n++;
+    }
+
+    table = stgMallocBytes(n * sizeof(CompactFileBlock), "compactWriteFile");
+    pos = BLOCK_ROUND_UP(sizeof(CompactFileHeader) +
+                         n * sizeof(CompactFileBlock));
+    for (block = first, i = 0; block != NULL; block = block->next, i++) {
+        bdescr *bd = Bdescr((P_)block);
+        table[i].address = (W_)block;
+        table[i].size = (W_)bd->free - (W_)bd->start;
+        table[i].offset = pos;
+        pos += BLOCK_ROUND_UP(table[i].size);
+    }
+
+    hdr.magic = COMPACT_FILE_MAGIC;
+    hdr.block_size = BLOCK_SIZE;
+    hdr.mblock_size = MBLOCK_SIZE;
+    hdr.info = (W_)&stg_COMPACT_NFDATA_CLEAN_info;
+    hdr.root = (W_)root;
+    hdr.n_blocks = n;
+
+    // Several threads may be writing the same file, hence the counter
+    tmp_path = stgMallocBytes(tmp_path_len, "compactWriteFile");
+    snprintf(tmp_path, tmp_path_len, "%s.%d.%" FMT_Word ".tmp",
+             path, (int)getpid(), atomic_inc(&tmp_count, 1));
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+    if (fd < 0) {
+        saved_errno = errno;
+        goto out;
+    }
+
+    if (!write_all(fd, &hdr, sizeof(hdr)) ||
+        !write_all(fd, table, n * sizeof(CompactFileBlock))) {
+        saved_errno = errno;
+        goto close;
+    }
+    pos = sizeof(hdr) + n * sizeof(CompactFileBlock);
+    for (i = 0; i < n; i++) {
+        if (!write_zeros(fd, table[i].offset - pos) ||
+            !write_all(fd, (void*)(W_)table[i].address, table[i].size)) {
+            saved_errno = errno;
+            goto close;
+        }
+        pos = table[i].offset + table[i].size;
+    }
+    // pad the last block too, so that all of its pages can be mapped
+    if (!write_zeros(fd, BLOCK_ROUND_UP(pos) - pos)) {
+        saved_errno = errno;
+        goto close;
+    }
+    r = 0;
+
+close:
+    if (close(fd) != 0 && r == 0) {
+        saved_errno = errno;
+        r = -1;
+    }
+    if (r == 0 && replace_file(tmp_path, path) != 0) {
+        saved_errno = errno;
+        r = -1;
+    }
+    if (r != 0) {
+        unlink(tmp_path);
+    }
+out:
+    stgFree(tmp_path);
+    stgFree(table);
+    errno = saved_errno;
+    return r;
+}
+
+static int
+cmp_load_block (const void *e1, const void *e2)
+{
+    const LoadBlock *b1 = e1;
+    const LoadBlock *b2 = e2;
+    if (b1->address > b2->address) return +1;
+    else if (b1->address < b2->address) return -1;
+    else return 0;
+}
+
+// Block offset of a block within its megablock
+STATIC_INLINE W_
+load_block_offset (LoadBlock *b)
+{
+    return (b->address - (W_)FIRST_BLOCK(MBLOCK_ROUND_DOWN(b->address)))
+        / BLOCK_SIZE;
+}
+
+STATIC_INLINE W_
+load_block_blocks (LoadBlock *b)
+{
+    return BLOCK_ROUND_UP(b->size) / BLOCK_SIZE;
+}
+
+// Check that block b could have been a block of a region: it starts on a
+// block boundary, it is large enough, and it lies within one megablock or
+// starts a megablock group.
+static bool
+check_load_block (LoadBlock *b)
+{
+    W_ min_size = sizeof(StgCompactNFDataBlock);
+    W_ mblock = (W_)MBLOCK_ROUND_DOWN(b->address);
+    W_ off, n_blocks;
+
+    if (b->index == 0) {
+        min_size += sizeof(StgCompactNFData);
+    }
+    if (b->address % BLOCK_SIZE != 0 ||
+        b->address < (W_)FIRST_BLOCK(mblock) ||
+        b->size < min_size ||
+        b->size > (W_)HS_INT32_MAX * BLOCK_SIZE) {
+        return false;
+    }
+
+    off = load_block_offset(b);
+    n_blocks = load_block_blocks(b);
+    if (n_blocks > BLOCKS_PER_MBLOCK) {
+        // a megablock group starts at the first block of a megablock
+        return off == 0;
+    } else {
+        return off + n_blocks <= BLOCKS_PER_MBLOCK;
+    }
+}
+
+// Check that the blocks, sorted by address, can be laid out again as they
+// were saved.
+static bool
+check_load_blocks (LoadBlock *blocks, uint32_t n)
+{
+    W_ mega_end = 0;    // end of the last megablock group
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        LoadBlock *b = &blocks[i];
+        W_ mblock = (W_)MBLOCK_ROUND_DOWN(b->address);
+        W_ n_blocks = load_block_blocks(b);
+
+        if (!check_load_block(b) || mblock < mega_end) {
+            return false;
+        }
+        if (n_blocks > BLOCKS_PER_MBLOCK) {
+            mega_end = mblock + BLOCKS_TO_MBLOCKS(n_blocks) * MBLOCK_SIZE;
+        }
+
+        if (i > 0 && b->address < blocks[i-1].address +
+                                  load_block_blocks(&blocks[i-1]) * BLOCK_SIZE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check that a file of file_size bytes holds the contents of the blocks,
+// which check_load_blocks has accepted.
+static bool
+check_load_offsets (LoadBlock *blocks, uint32_t n, StgWord64 file_size)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        LoadBlock *b = &blocks[i];
+        if (b->offset % BLOCK_SIZE != 0 ||
+            b->offset > file_size ||
+            file_size - b->offset < BLOCK_ROUND_UP(b->size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Make bd, of n_blocks blocks, the group of block b.  Must hold sm_mutex.
+static void
+load_block_group (LoadBlock *b, bdescr *bd, W_ n_blocks)
+{
+    b->bd = bd;
+    compactLinkGroup(bd, g0, n_blocks * BLOCK_SIZE,
+                     b->index == 0 ? ALLOCATE_IMPORT_NEW
+                                   : ALLOCATE_IMPORT_APPEND);
+    compactInitGroup(bd, g0, n_blocks);
+    bd->free = (P_)((W_)bd->start + b->size);
+}
+
+// Allocate the groups of the blocks, sorted by address, and link them up in
+// chain order, as compactAllocateBlock does, storing them in chain.  The
+// import list stays valid from here on, as the GC may walk it as soon as we
+// release sm_mutex.  Must hold sm_mutex.
+static void
+alloc_load_blocks (LoadBlock *blocks, uint32_t n,
+                   StgCompactNFDataBlock **chain)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < n; i = j) {
+        void *mblock = MBLOCK_ROUND_DOWN(blocks[i].address);
+        W_ n_blocks = load_block_blocks(&blocks[i]);
+        W_ pos;
+        bdescr *bd, *rest;
+
+        if (n_blocks > BLOCKS_PER_MBLOCK) {
+            bd = allocMBlockGroupAt(mblock, BLOCKS_TO_MBLOCKS(n_blocks));
+            if (bd == NULL) {
+                bd = allocGroup(n_blocks);
+            }
+            load_block_group(&blocks[i], bd, n_blocks);
+            j = i + 1;
+            continue;
+        }
+
+        // Carve the blocks saved from this megablock out of a new one
+        bd = allocMBlockGroupAt(mblock, 1);
+        if (bd == NULL) {
+            bd = allocGroup(BLOCKS_PER_MBLOCK);
+        }
+        pos = 0;
+        for (j = i; j < n && MBLOCK_ROUND_DOWN(blocks[j].address) == mblock;
+             j++) {
+            W_ off = load_block_offset(&blocks[j]);
+            n_blocks = load_block_blocks(&blocks[j]);
+            ASSERT(bd != NULL && off >= pos);
+            bd = splitBlockGroupAt(bd, off - pos, n_blocks, &rest);
+            load_block_group(&blocks[j], bd, n_blocks);
+            pos = off + n_blocks;
+            bd = rest;
+        }
+        if (bd != NULL) {
+            freeGroup(bd);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        chain[blocks[i].index] = (StgCompactNFDataBlock*)blocks[i].bd->start;
+    }
+    for (i = 0; i + 1 < n; i++) {
+        chain[i]->next = chain[i+1];
+    }
+}
+
+// Load the contents of block b, keeping the link to the next block which
+// alloc_load_blocks gave it: the saved one is the old address of the next
+// block, which the GC must not follow.
+static bool
+load_block_contents (int fd, LoadBlock *b)
+{
+    bdescr *bd = b->bd;
+    StgCompactNFDataBlock *block = (StgCompactNFDataBlock*)bd->start;
+    StgCompactNFDataBlock header;
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    if (BLOCK_SIZE % getPageSize() == 0) {
+        bool mapped;
+
+        // mapping the file replaces the header at once, so hold off the GC
+        // until the link is put back
+        ACQUIRE_SM_LOCK;
+        header.next = block->next;
+        mapped = osMapFileMemory(bd->start, roundUpToPage(b->size), fd,
+                                 b->offset);
+        if (mapped) {
+            // only write if it differs, to keep the page shared
+            if (block->next != header.next) {
+                block->next = header.next;
+            }
+            bd->flags |= BF_MAPPED;
+        }
+        RELEASE_SM_LOCK;
+        if (mapped) {
+            return true;
+        }
+    }
+#endif
+    // read the header aside, as read_stream_block does
+    if (!read_at(fd, &header, sizeof(header), b->offset) ||
+        !read_at(fd, (StgWord8*)block + sizeof(header),
+                 b->size - sizeof(header), b->offset + sizeof(header))) {
+        return false;
+    }
+    block->self = header.self;
+    block->owner = header.owner;
+    return true;
+}
+
+// Give back the blocks of a region we failed to load.
+static void
+free_load_blocks (LoadBlock *blocks, uint32_t n)
+{
+    uint32_t i;
+
+    ACQUIRE_SM_LOCK;
+    for (i = 0; i < n; i++) {
+        bdescr *bd = blocks[i].bd;
+#if defined(USE_LARGE_ADDRESS_SPACE)
+        if (bd->flags & BF_MAPPED) {
+            osUnmapFileMemory(bd->start, bd->blocks * BLOCK_SIZE);
+        }
+#endif
+        bd->flags = 0;
+        if (blocks[i].index == 0) {
+            dbl_link_remove(bd, &g0->compact_blocks_in_import);
+        }
+        g0->n_compact_blocks_in_import -= bd->blocks;
+        freeGroup(bd);
+    }
+    RELEASE_SM_LOCK;
+}
+
+// Load the compact region saved by compactWriteFile to path.  Returns its
+// first block, ready for compactFixupPointers, and stores the address its
+// root had when it was saved in *root.  Returns NULL with errno set if
+// the file cannot be read, or EINVAL if it does not hold a region saved
+// by this binary.  See Note [Mapped compact regions].
+void *
+compactMapFile (const char *path, void **root)
+{
+    CompactFileHeader hdr;
+    CompactFileBlock *table = NULL;
+    LoadBlock *blocks = NULL;
+    StgCompactNFDataBlock **chain = NULL;
+    StgCompactNFDataBlock *first = NULL;
+    struct stat st;
+    uint32_t n = 0, i, n_mapped = 0, n_moved = 0;
+    int fd, saved_errno = 0;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || !read_at(fd, &hdr, sizeof(hdr), 0)) {
+        saved_errno = errno;
+        goto out;
+    }
+    if (hdr.magic != COMPACT_FILE_MAGIC ||
+        hdr.block_size != BLOCK_SIZE ||
+        hdr.mblock_size != MBLOCK_SIZE ||
+        hdr.info != (W_)&stg_COMPACT_NFDATA_CLEAN_info ||
+        hdr.n_blocks == 0 ||
+        hdr.n_blocks > (StgWord64)st.st_size / sizeof(CompactFileBlock)) {
+        saved_errno = EINVAL;
+        goto out;
+    }
+    n = (uint32_t)hdr.n_blocks;
+
+    table = stgMallocBytes(n * sizeof(CompactFileBlock), "compactMapFile");
+    if (!read_at(fd, table, n * sizeof(CompactFileBlock), sizeof(hdr))) {
+        saved_errno = errno;
+        goto out;
+    }
+
+    blocks = stgMallocBytes(n * sizeof(LoadBlock), "compactMapFile");
+    for (i = 0; i < n; i++) {
+        blocks[i].address = (W_)table[i].address;
+        blocks[i].size = (W_)table[i].size;
+        blocks[i].offset = table[i].offset;
+        blocks[i].index = i;
+        blocks[i].bd = NULL;
+    }
+    qsort(blocks, n, sizeof(LoadBlock), cmp_load_block);
+    if (!check_load_blocks(blocks, n) ||
+        !check_load_offsets(blocks, n, st.st_size)) {
+        saved_errno = EINVAL;
+        goto out;
+    }
+
+    chain = stgMallocBytes(n * sizeof(StgCompactNFDataBlock *),
+                           "compactMapFile");
+    ACQUIRE_SM_LOCK;
+    alloc_load_blocks(blocks, n, chain);
+    RELEASE_SM_LOCK;
+
+    for (i = 0; i < n; i++) {
+        if (!load_block_contents(fd, &blocks[i])) {
+            saved_errno = errno;
+            free_load_blocks(blocks, n);
+            goto out;
+        }
+        if (blocks[i].bd->flags & BF_MAPPED) {
+            n_mapped++;
+        }
+        if ((W_)blocks[i].bd->start != blocks[i].address) {
+            n_moved++;
+        }
+    }
+
+    first = chain[0];
+    *root = (void*)(W_)hdr.root;
+
+    debugTrace(DEBUG_compact, "compactMapFile: %s: %" FMT_Word32 " blocks, "
+               "%" FMT_Word32 " mapped, %" FMT_Word32 " moved",
+               path, n, n_mapped, n_moved);
+
+out:
+    close(fd);
+    stgFree(chain);
+    stgFree(blocks);
+    stgFree(table);
+    errno = saved_errno;
+    return first;
+}
+
+/* -----------------------------------------------------------------------------
+   Compact region streams
+   -------------------------------------------------------------------------- */
+
+/*
+  Note [Streaming compact regions]
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  withSerializedCompact hands the blocks of a region to Haskell code one at
+  a time, so sending a region down a pipe or a socket meant copying each
+  block into a buffer first, and importCompact on the other side copies it
+  again from wherever it was received.
+
+  The functions here write a region to a file descriptor themselves, and
+  compactReadStream (readCompactFd in GHC.Compact.Serialized) reads it
+  back.  The stream describes itself a block at a time.  It holds
+
+    * a CompactStreamHeader, ending with a checksum of the header,
+    * for each block of the region, in any order, a CompactStreamRecord
+      giving the address and size of the block in the writer and a checksum
+      of its contents, followed by the contents,
+    * a final CompactStreamRecord giving the address of the root and the
+      number of blocks.
+
+  Each record ends with a checksum of its own fields.  The checksums are
+  XXH3 64-bit hashes (see xxhash.h).  The stream has no padding and is
+  never seeked, so it works on pipes and sockets.
+
+  Writing.  A CompactStreamWriter remembers which blocks are in the stream
+  already.  compactStreamFlush writes the blocks which have filled up since
+  the last flush, so a region can be sent while compactAdd is still
+  building it (flushCompactStream), and compactStreamFinish writes the rest
+  followed by the root record.  compactWriteStream (writeCompactFd) does
+  all of it at once.  Each block goes out straight from the heap, with a
+  single writev() for its record and its contents.
+
+  A block may only be written once nothing will be added to it again.  The
+  Haskell side holds the lock of the Compact exclusively while it calls us,
+  so no compactAdd# is half way through copying an object, but a capability
+  may still have claimed a block (BF_APPENDING) and go on bumping its free
+  pointer later.  compactStreamFlush therefore leaves claimed blocks alone,
+  and takes the others which are full (block_is_full) and flags them
+  BF_SEALED, so that allocateForCompact does not put even a small object in
+  their last few words.  The first block holds the StgCompactNFData, which
+  every add changes, so only compactStreamFinish writes it, last.
+
+  Reading.  compactReadStream rebuilds the region a record at a time.  It
+  allocates each block at the address it was written from if that is free,
+  and anywhere otherwise, and reads the contents straight into place.  As
+  in compactMapFile, blocks which shared a megablock share one again: the
+  first block from a megablock gets a whole megablock, and the blocks
+  around it are kept aside (StreamReader.spare) for the blocks from that
+  megablock which are still to come.  Whatever is left over at the end goes
+  back to the block allocator; until then memInventory counts it
+  (countCompactStreamSpareBlocks).
+
+  The blocks go on the import list of generation 0 as soon as they are
+  allocated, as the GC may run while we wait for data (readCompactFd makes
+  a safe call).  The first block of the region must head the chain, so
+  when its record comes it is linked in front of the blocks read so far.
+  The header of each block is read aside, and only its self and owner
+  fields are copied in once the checksum of the block is known to be right,
+  so the links of the chain stay valid.  If a checksum does not match, or
+  the stream ends early, all the blocks are given back and we fail with
+  EINVAL (or the error from read()).  compactFixupPointers then moves the
+  pointers into the blocks which did not get their old address, as for
+  importCompact.  The reader stops at the root record, so whatever follows
+  the region in the stream is left for the caller.
+
+  The checksums guard against a stream damaged in transit or storage, not
+  against a malicious writer: like any serialized region, a stream is only
+  meant to be read by the binary that wrote it (see Note [Compact Normal
+  Forms]).
+*/
+
+#define COMPACT_STREAM_MAGIC 0x32304e5343434847ULL /* "GHCCSN02" */
+
+typedef struct {
+    StgWord64 magic;        // COMPACT_STREAM_MAGIC
+    StgWord64 block_size;   // BLOCK_SIZE of the writer
+    StgWord64 mblock_size;  // MBLOCK_SIZE of the writer
+    StgWord64 info;         // &stg_COMPACT_NFDATA_CLEAN_info in the writer
+    StgWord64 checksum;     // of the fields above
+} CompactStreamHeader;
+
+typedef enum {
+    STREAM_BLOCK = 1,       // a block of the region
+    STREAM_FIRST_BLOCK,     // the block holding the StgCompactNFData
+    STREAM_ROOT,            // the end of the region
+} CompactStreamRecordKind;
+
+typedef struct {
+    StgWord64 kind;         // CompactStreamRecordKind
+    StgWord64 address;      // of the block, or of the root, in the writer
+    StgWord64 size;         // bytes in use, or the number of blocks
+    StgWord64 contents;     // checksum of the block, 0 for the root
+    StgWord64 checksum;     // of the fields above
+} CompactStreamRecord;
+
+struct CompactStreamWriter_ {
+    int fd;
+    HashTable *written;     // the blocks in the stream so far
+    StgWord64 n_blocks;     // how many there are
+};
+
+// The blocks of a megablock of the writer which compactReadStream has not
+// received yet, see Note [Streaming compact regions].
+typedef struct {
+    StgPtr start;           // where the first block of the megablock goes
+    bdescr *spare;          // groups still free for them, linked by ->link
+} StreamMBlock;
+
+typedef struct {
+    int fd;
+    HashTable *mblocks;     // megablock of the writer -> StreamMBlock
+    StgCompactNFDataBlock *first;   // of the chain, once its record came
+    StgCompactNFDataBlock *head;    // of the chain on the import list
+    StgCompactNFDataBlock *tail;
+    StgWord64 n_blocks;
+    uint32_t n_moved;
+} StreamReader;
+
+// Blocks kept aside by compactReadStream, for memInventory.  Protected by
+// sm_mutex.
+static W_ stream_spare_blocks = 0;
+
+W_
+countCompactStreamSpareBlocks (void)
+{
+    return stream_spare_blocks;
+}
+
+STATIC_INLINE StgWord64
+stream_header_checksum (CompactStreamHeader *hdr)
+{
+    return XXH3_64bits(hdr, offsetof(CompactStreamHeader, checksum));
+}
+
+STATIC_INLINE StgWord64
+stream_record_checksum (CompactStreamRecord *rec)
+{
+    return XXH3_64bits(rec, offsetof(CompactStreamRecord, checksum));
+}
+
+static bool
+read_all (int fd, void *buf, W_ size)
+{
+    StgWord8 *p = buf;
+
+    while (size > 0) {
+        unsigned int chunk = (unsigned int)stg_min(size, (W_)1 << 30);
+        ssize_t r = read(fd, p, chunk);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (r == 0) {
+            errno = EINVAL;     // the stream ended early
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+// Write a record, followed by the size bytes of block unless it is NULL.
+static bool
+write_stream_record (int fd, StgWord64 kind, StgWord64 address,
+                     StgWord64 size, void *block)
+{
+    CompactStreamRecord rec;
+
+    rec.kind = kind;
+    rec.address = address;
+    rec.size = size;
+    rec.contents = block != NULL ? XXH3_64bits(block, size) : 0;
+    rec.checksum = stream_record_checksum(&rec);
+
+#if defined(mingw32_HOST_OS)
+    return write_all(fd, &rec, sizeof(rec)) &&
+        (block == NULL || write_all(fd, block, size));
+#else
+    struct iovec iov[2], *v = iov;
+    int n = block != NULL ? 2 : 1;
+
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = block;
+    iov[1].iov_len = size;
+    while (n > 0) {
+        ssize_t r = writev(fd, v, n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // skip what was written, which may end part way through a vector
+        while (n > 0 && (size_t)r >= v->iov_len) {
+            r -= v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (StgWord8*)v->iov_base + r;
+            v->iov_len -= r;
+        }
+    }
+    return true;
+#endif
+}
+
+// Start a stream on fd, writing its header.  Returns NULL with errno set
+// if the header cannot be written.  See Note [Streaming compact regions].
+CompactStreamWriter *
+compactStreamOpen (int fd)
+{
+    CompactStreamWriter *w;
+    CompactStreamHeader hdr;
+
+    hdr.magic = COMPACT_STREAM_MAGIC;
+    hdr.block_size = BLOCK_SIZE;
+    hdr.mblock_size = MBLOCK_SIZE;
+    hdr.info = (W_)&stg_COMPACT_NFDATA_CLEAN_info;
+    hdr.checksum = stream_header_checksum(&hdr);
+    if (!write_all(fd, &hdr, sizeof(hdr))) {
+        return NULL;
+    }
+
+    w = stgMallocBytes(sizeof(CompactStreamWriter), "compactStreamOpen");
+    w->fd = fd;
+    w->written = allocHashTable();
+    w->n_blocks = 0;
+    return w;
+}
+
+void
+compactStreamFree (CompactStreamWriter *w)
+{
+    freeHashTable(w->written, NULL);
+    stgFree(w);
+}
+
+// Write the blocks of the region starting with first which are not in the
+// stream yet: those which are full and unclaimed, sealing them, or all of
+// them if finish, the first block last.  Returns 0, or -1 with errno set.
+static int
+write_stream_blocks (CompactStreamWriter *w, StgCompactNFDataBlock *first,
+                     bool finish)
+{
+    StgCompactNFDataBlock *block, **blocks;
+    uint32_t n = 0, size = 16, i;
+    int r = 0;
+
+    blocks = stgMallocBytes(size * sizeof(StgCompactNFDataBlock *),
+                            "write_stream_blocks");
+
+    // sm_mutex keeps the GC from releasing claims while we look at them
+    ACQUIRE_SM_LOCK;
+    for (block = first->next; block != NULL; block = block->next) {
+        bdescr *bd = Bdescr((P_)block);
+
+        if (lookupHashTable(w->written, (W_)block) != NULL) {
+            continue;
+        }
+        if (!finish) {
+            if ((bd->flags & BF_APPENDING) || !block_is_full(block)) {
+                continue;
+            }
+            bd->flags |= BF_SEALED;
+        }
+        if (n == size) {
+            size *= 2;
+            blocks = stgReallocBytes(blocks,
+                                     size * sizeof(StgCompactNFDataBlock *),
+                                     "write_stream_blocks");
+        }
+        blocks[n++] = block;
+    }
+    RELEASE_SM_LOCK;
+
+    for (i = 0; i < n; i++) {
+        bdescr *bd = Bdescr((P_)blocks[i]);
+
+        if (!write_stream_record(w->fd, STREAM_BLOCK, (W_)blocks[i],
+                                 (W_)bd->free - (W_)bd->start, blocks[i])) {
+            r = -1;
+            goto out;
+        }
+        insertHashTable(w->written, (W_)blocks[i], blocks[i]);
+        w->n_blocks++;
+    }
+
+    if (finish && lookupHashTable(w->written, (W_)first) == NULL) {
+        bdescr *bd = Bdescr((P_)first);
+
+        if (!write_stream_record(w->fd, STREAM_FIRST_BLOCK, (W_)first,
+                                 (W_)bd->free - (W_)bd->start, first)) {
+            r = -1;
+            goto out;
+        }
+        insertHashTable(w->written, (W_)first, first);
+        w->n_blocks++;
+    }
+
+out:
+    stgFree(blocks);
+    return r;
+}
+
+// Write the blocks of the region starting with first_block which have
+// filled up since they were last flushed.  Returns 0, or -1 with errno set.
+// The caller must make sure that no compactAdd# is in progress.
+int
+compactStreamFlush (CompactStreamWriter *w, void *first_block)
+{
+    int r = write_stream_blocks(w, first_block, false);
+
+    debugTrace(DEBUG_compact, "compactStreamFlush: %" FMT_Word64
+               " blocks written", w->n_blocks);
+    return r;
+}
+
+// Write the rest of the region starting with first_block, and end the
+// stream with root.  Returns 0, or -1 with errno set.  The caller must make
+// sure that no compactAdd# is in progress.
+int
+compactStreamFinish (CompactStreamWriter *w, void *first_block, void *root)
+{
+    if (write_stream_blocks(w, first_block, true) != 0 ||
+        !write_stream_record(w->fd, STREAM_ROOT, (W_)root, w->n_blocks,
+                             NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Write the compact region starting with first_block, whose root is root,
+// to fd.  Returns 0, or -1 with errno set.  The caller must make sure that
+// the region is not appended to meanwhile.
+int
+compactWriteStream (void *first_block, void *root, int fd)
+{
+    CompactStreamWriter *w;
+    int r, saved_errno;
+
+    w = compactStreamOpen(fd);
+    if (w == NULL) {
+        return -1;
+    }
+    r = compactStreamFinish(w, first_block, root);
+    saved_errno = errno;
+    compactStreamFree(w);
+    errno = saved_errno;
+    return r;
+}
+
+// Keep group bd aside for more blocks of m.  Must hold sm_mutex.
+static void
+keep_spare_group (StreamMBlock *m, bdescr *bd)
+{
+    if (bd != NULL) {
+        bd->link = m->spare;
+        m->spare = bd;
+        stream_spare_blocks += bd->blocks;
+    }
+}
+
+static void
+free_stream_mblock (void *data)
+{
+    StreamMBlock *m = data;
+    bdescr *bd, *next;
+
+    for (bd = m->spare; bd != NULL; bd = next) {
+        next = bd->link;
+        stream_spare_blocks -= bd->blocks;
+        freeGroup(bd);
+    }
+    stgFree(m);
+}
+
+// Allocate a group for block b, at its old address if we can.  Returns
+// NULL if b overlaps a block we have already had.  Must hold sm_mutex.
+static bdescr *
+alloc_stream_group (StreamReader *r, LoadBlock *b)
+{
+    void *mblock = MBLOCK_ROUND_DOWN(b->address);
+    W_ n_blocks = load_block_blocks(b);
+    StreamMBlock *m = lookupHashTable(r->mblocks, (W_)mblock);
+    bdescr *bd, **prev, *before, *rest;
+    StgPtr start;
+
+    if (n_blocks > BLOCKS_PER_MBLOCK) {
+        if (m != NULL) {
+            return NULL;
+        }
+        m = stgMallocBytes(sizeof(StreamMBlock), "alloc_stream_group");
+        m->start = NULL;
+        m->spare = NULL;
+        insertHashTable(r->mblocks, (W_)mblock, m);
+
+        bd = allocMBlockGroupAt(mblock, BLOCKS_TO_MBLOCKS(n_blocks));
+        if (bd == NULL) {
+            bd = allocGroup(n_blocks);
+        }
+        return bd;
+    }
+
+    if (m == NULL) {
+        m = stgMallocBytes(sizeof(StreamMBlock), "alloc_stream_group");
+        bd = allocMBlockGroupAt(mblock, 1);
+        if (bd == NULL) {
+            bd = allocGroup(BLOCKS_PER_MBLOCK);
+        }
+        m->start = bd->start;
+        m->spare = NULL;
+        keep_spare_group(m, bd);
+        insertHashTable(r->mblocks, (W_)mblock, m);
+    }
+    if (m->start == NULL) {
+        return NULL;        // within a megablock group
+    }
+
+    // carve the block out of the spare group it falls in
+    start = m->start + load_block_offset(b) * BLOCK_SIZE_W;
+    for (prev = &m->spare; *prev != NULL; prev = &(*prev)->link) {
+        bd = *prev;
+        if (bd->start <= start &&
+            start + n_blocks * BLOCK_SIZE_W <=
+                bd->start + bd->blocks * BLOCK_SIZE_W) {
+            *prev = bd->link;
+            stream_spare_blocks -= bd->blocks;
+            bd = carveBlockGroup(bd, (start - bd->start) / BLOCK_SIZE_W,
+                                 n_blocks, &before, &rest);
+            keep_spare_group(m, before);
+            keep_spare_group(m, rest);
+            return bd;
+        }
+    }
+    return NULL;
+}
+
+// Make bd, of n_blocks blocks, the group of block b, and link it into the
+// chain on the import list.  Must hold sm_mutex.
+static StgCompactNFDataBlock *
+link_stream_group (StreamReader *r, LoadBlock *b, bdescr *bd)
+{
+    W_ n_blocks = load_block_blocks(b);
+    StgCompactNFDataBlock *block;
+
+    if (b->index == 0 && r->head != NULL) {
+        // the first block goes in front of the blocks we have so far
+        dbl_link_remove(Bdescr((P_)r->head), &g0->compact_blocks_in_import);
+    }
+    compactLinkGroup(bd, g0, n_blocks * BLOCK_SIZE,
+                     b->index == 0 || r->head == NULL
+                         ? ALLOCATE_IMPORT_NEW : ALLOCATE_IMPORT_APPEND);
+    block = compactInitGroup(bd, g0, n_blocks);
+    bd->free = (P_)((W_)bd->start + b->size);
+
+    if (b->index == 0) {
+        block->next = r->head;
+        r->head = block;
+        r->first = block;
+        if (r->tail == NULL) {
+            r->tail = block;
+        }
+    } else if (r->head == NULL) {
+        r->head = r->tail = block;
+    } else {
+        r->tail->next = block;
+        r->tail = block;
+    }
+    return block;
+}
+
+// Read the contents of the block described by rec into a new block, and
+// check them against the checksum in rec.  The block header is read aside,
+// see Note [Streaming compact regions].
+static bool
+read_stream_block (StreamReader *r, CompactStreamRecord *rec)
+{
+    LoadBlock b;
+    bdescr *bd;
+    StgCompactNFDataBlock *block = NULL, header;
+    StgWord8 *rest;
+    XXH3_state_t state;
+
+    b.address = (W_)rec->address;
+    b.size = (W_)rec->size;
+    b.offset = 0;
+    b.index = rec->kind == STREAM_FIRST_BLOCK ? 0 : 1;
+    b.bd = NULL;
+    if (b.address != rec->address || b.size != rec->size ||
+        !check_load_block(&b)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    ACQUIRE_SM_LOCK;
+    bd = alloc_stream_group(r, &b);
+    if (bd != NULL) {
+        block = link_stream_group(r, &b, bd);
+    }
+    RELEASE_SM_LOCK;
+    if (block == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+
+    rest = (StgWord8*)block + sizeof(header);
+    if (!read_all(r->fd, &header, sizeof(header)) ||
+        !read_all(r->fd, rest, b.size - sizeof(header))) {
+        return false;
+    }
+
+    XXH3_64bits_reset(&state);
+    XXH3_64bits_update(&state, &header, sizeof(header));
+    XXH3_64bits_update(&state, rest, b.size - sizeof(header));
+    if (XXH3_64bits_digest(&state) != rec->contents) {
+        errno = EINVAL;
+        return false;
+    }
+
+    block->self = header.self;
+    block->owner = header.owner;
+    r->n_blocks++;
+    if ((W_)block != b.address) {
+        r->n_moved++;
+    }
+    return true;
+}
+
+// Give back the blocks of a region we failed to read.  Must hold sm_mutex.
+static void
+free_stream_blocks (StreamReader *r)
+{
+    StgCompactNFDataBlock *block, *next;
+
+    for (block = r->head; block != NULL; block = next) {
+        bdescr *bd = Bdescr((P_)block);
+
+        next = block->next;
+        if (block == r->head) {
+            dbl_link_remove(bd, &g0->compact_blocks_in_import);
+        }
+        g0->n_compact_blocks_in_import -= bd->blocks;
+        bd->flags = 0;
+        freeGroup(bd);
+    }
+    r->head = r->tail = r->first = NULL;
+}
+
+// Read a compact region written to fd by compactWriteStream or a
+// CompactStreamWriter.  Returns its first block, ready for
+// compactFixupPointers, and stores the address its root had when it was
+// written in *root.  Returns NULL with errno set if the stream cannot be
+// read, or EINVAL if it is damaged or was not written by this binary.
+// See Note [Streaming compact regions].
+void *
+compactReadStream (int fd, void **root)
+{
+    CompactStreamHeader hdr;
+    CompactStreamRecord rec;
+    StreamReader r;
+    int saved_errno = 0;
+
+    if (!read_all(fd, &hdr, sizeof(hdr))) {
+        return NULL;
+    }
+    if (hdr.magic != COMPACT_STREAM_MAGIC ||
+        hdr.checksum != stream_header_checksum(&hdr) ||
+        hdr.block_size != BLOCK_SIZE ||
+        hdr.mblock_size != MBLOCK_SIZE ||
+        hdr.info != (W_)&stg_COMPACT_NFDATA_CLEAN_info) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r.fd = fd;
+    r.mblocks = allocHashTable();
+    r.first = r.head = r.tail = NULL;
+    r.n_blocks = 0;
+    r.n_moved = 0;
+
+    for (;;) {
+        if (!read_all(fd, &rec, sizeof(rec))) {
+            saved_errno = errno;
+            break;
+        }
+        if (rec.checksum != stream_record_checksum(&rec)) {
+            saved_errno = EINVAL;
+            break;
+        }
+        if (rec.kind == STREAM_ROOT) {
+            if (r.first == NULL || rec.size != r.n_blocks) {
+                saved_errno = EINVAL;
+            }
+            break;
+        }
+        if ((rec.kind != STREAM_BLOCK && rec.kind != STREAM_FIRST_BLOCK) ||
+            (rec.kind == STREAM_FIRST_BLOCK && r.first != NULL)) {
+            saved_errno = EINVAL;
+            break;
+        }
+        if (!read_stream_block(&r, &rec)) {
+            saved_errno = errno;
+            break;
+        }
+    }
+
+    ACQUIRE_SM_LOCK;
+    if (saved_errno != 0) {
+        free_stream_blocks(&r);
+    }
+    freeHashTable(r.mblocks, free_stream_mblock);
+    RELEASE_SM_LOCK;
+
+    if (saved_errno != 0) {
+        errno = saved_errno;
+        return NULL;
+    }
+
+    *root = (void*)(W_)rec.address;
+    debugTrace(DEBUG_compact, "compactReadStream: %" FMT_Word64 " blocks, "
+               "%" FMT_Word32 " moved", r.n_blocks, r.n_moved);
+    return r.first;
+}
@@ -25,6 +25,7 @@ void              compactMarkKnown(StgCompactNFData *str);
 StgWord           compactContains(StgCompactNFData *str,
                                   StgPtr            what);
 StgWord           countCompactBlocks(bdescr *outer);
+W_                countCompactStreamSpareBlocks(void);
 
 #if defined(DEBUG)
 StgWord           countAllocdCompactBlocks(bdescr *outer);
@@ -70,10 +71,10 @@ extern void *allocateForCompact (Capability *cap,
                                  StgCompactNFData *str,
                                  StgWord sizeW);
 
+void compactReleaseCursor (Capability *cap);
+
 extern void insertCompactHash (Capability *cap,
                                StgCompactNFData *str,
                                StgClosure *p, StgClosure *to);
 
-extern void verifyCompact (StgCompactNFData *str);
-
 #include "EndPrivate.h"
@@ -69,6 +69,12 @@
     pointer.
    ------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+// Set while several threads are threading pointers at once, see
+// Note [Parallel compaction].
+static bool compact_par = false;
+#endif
+
 STATIC_INLINE W_
 UNTAG_PTR(W_ p)
 {
@@ -135,11 +141,23 @@ thread (StgClosure **p)
     // ptr is possibly threaded:
     // ASSERT(LOOKS_LIKE_CLOSURE_PTR(q));
 
-    if (HEAP_ALLOCED(q)) {
+    if (HEAP_ALLOCED_GC(q)) {
         bdescr *bd = Bdescr(q);
 
         if (bd->flags & BF_MARKED)
         {
+#if defined(THREADED_RTS)
+            if (compact_par) {
+                // Other threads may be adding fields to the same chain.
+                W_ iptr;
+                do {
+                    iptr = RELAXED_LOAD(q);
+                    *p = (StgClosure *)iptr;
+                } while (cas((StgVolatilePtr)q, iptr,
+                             (W_)p + 1 + (q0_tagged ? 1 : 0)) != iptr);
+                return;
+            }
+#endif
             W_ iptr = *q;
             *p = (StgClosure *)iptr;
             *q = (W_)p + 1 + (q0_tagged ? 1 : 0);
@@ -196,7 +214,8 @@ loop:
 STATIC_INLINE StgInfoTable*
 get_threaded_info( P_ p )
 {
-    W_ q = (W_)GET_INFO(UNTAG_CLOSURE((StgClosure *)p));
+    // Pairs with the cas() in thread(), which may be adding to the chain.
+    W_ q = (W_)ACQUIRE_LOAD(&UNTAG_CLOSURE((StgClosure *)p)->header.info);
 
 loop:
     switch (GET_PTR_TAG(q))
@@ -537,13 +556,11 @@ update_fwd_cnf( bdescr *bd )
 }
 
 static void
-update_fwd_large( bdescr *bd )
+update_fwd_large_block( bdescr *bd )
 {
-  for (; bd != NULL; bd = bd->link) {
-
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
-    if (bd->flags & BF_PINNED) continue;
+    if (bd->flags & BF_PINNED) return;
 
     P_ p = bd->start;
     const StgInfoTable *info = get_itbl((StgClosure *)p);
@@ -552,7 +569,7 @@ update_fwd_large( bdescr *bd )
 
     case ARR_WORDS:
       // nothing to follow
-      continue;
+      return;
 
     case MUT_ARR_PTRS_CLEAN:
     case MUT_ARR_PTRS_DIRTY:
@@ -566,7 +583,7 @@ update_fwd_large( bdescr *bd )
           for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
               thread((StgClosure **)p);
           }
-          continue;
+          return;
       }
 
     case SMALL_MUT_ARR_PTRS_CLEAN:
@@ -579,23 +596,23 @@ update_fwd_large( bdescr *bd )
           for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
               thread((StgClosure **)p);
           }
-          continue;
+          return;
       }
 
     case STACK:
     {
         StgStack *stack = (StgStack*)p;
         thread_stack(stack->sp, stack->stack + stack->stack_size);
-        continue;
+        return;
     }
 
     case AP_STACK:
         thread_AP_STACK((StgAP_STACK *)p);
-        continue;
+        return;
 
     case PAP:
         thread_PAP((StgPAP *)p);
-        continue;
+        return;
 
     case TREC_CHUNK:
     {
@@ -607,12 +624,19 @@ update_fwd_large( bdescr *bd )
           thread(&e->expected_value);
           thread(&e->new_value);
         }
-        continue;
+        return;
     }
 
     default:
       barf("update_fwd_large: unknown/strange object  %d", (int)(info->type));
     }
+}
+
+static void
+update_fwd_large( bdescr *bd )
+{
+  for (; bd != NULL; bd = bd->link) {
+      update_fwd_large_block(bd);
   }
 }
 
@@ -802,6 +826,19 @@ thread_obj (const StgInfoTable *info, P_ p)
     }
 }
 
+static void
+update_fwd_block( bdescr *bd )
+{
+    P_ p = bd->start;
+
+    // linearly scan the objects in this block
+    while (p < bd->free) {
+        ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
+        const StgInfoTable *info = get_itbl((StgClosure *)p);
+        p = thread_obj(info, p);
+    }
+}
+
 static void
 update_fwd( bdescr *blocks )
 {
@@ -809,14 +846,7 @@ update_fwd( bdescr *blocks )
 
     // cycle through all the blocks in the step
     for (; bd != NULL; bd = bd->link) {
-        P_ p = bd->start;
-
-        // linearly scan the objects in this block
-        while (p < bd->free) {
-            ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
-            const StgInfoTable *info = get_itbl((StgClosure *)p);
-            p = thread_obj(info, p);
-        }
+        update_fwd_block(bd);
     }
 }
 
@@ -955,6 +985,513 @@ update_bkwd_compact( generation *gen )
     return free_blocks;
 }
 
+#if defined(THREADED_RTS)
+/* ----------------------------------------------------------------------------
+   Note [Parallel compaction]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   With --compact-workers=<n> the compaction of the oldest generation runs on
+   n threads. (Marking still runs on the GC thread alone: the mark stack is
+   not thread-safe, which is why a GC of a marked generation is never a
+   parallel GC, see scheduleDoGC.)
+
+   The sequential algorithm above relies on visiting the heap in address
+   order: update_fwd_compact unthreads the pointers to an object found so
+   far, and update_bkwd_compact unthreads the rest while it moves objects,
+   writing through fields that have not been moved yet. That order does not
+   hold across threads, so the parallel version separates the steps with a
+   barrier between each:
+
+   1. Thread: every pointer field of every live object is threaded, in
+      chunks of COMPACT_CHUNK_BLOCKS blocks handed out to the threads.
+      thread() pushes onto the chains with cas(), as other threads may be
+      threading fields pointing to the same object. Chains only ever grow at
+      the head, so get_threaded_info() can walk them meanwhile.
+
+   2. Plan: old_blocks is cut into partitions of consecutive blocks, and
+      each partition is compacted into itself. A thread takes a partition,
+      walks its live objects in address order, computes their new addresses
+      and unthreads their chains. The chains are complete, and all the fields
+      on them are still at their old addresses, so the fields may belong to
+      objects of other partitions. As in update_fwd_compact, an object that
+      has to start a new block is flagged in the mark bitmap.
+
+   3. Move: each thread slides the objects of a partition down to their new
+      addresses. Partitions are disjoint, so this needs no synchronisation.
+
+   The n-1 helper threads are started once per compaction and run each step
+   when the GC thread starts it (run_compact_step). The GC thread waits for
+   all of them to report the step done before it starts the next one, and
+   joins them at the end.
+
+   Each step returns whether its thread took any work, and +RTS -s reports
+   how many threads took some work in the busiest parallel compaction
+   (getParallelCompactStats).
+
+   Finally the partitions' surviving blocks are linked back together and the
+   blocks they emptied are freed. Each partition leaves at most one partly
+   used block behind, which is why there are only
+   COMPACT_PARTITIONS_PER_WORKER partitions per thread.
+   ------------------------------------------------------------------------- */
+
+#define COMPACT_CHUNK_BLOCKS          64
+#define COMPACT_PARTITIONS_PER_WORKER 4
+
+typedef enum {
+    THREAD_FWD,        // objects in a block that is not compacted
+    THREAD_LARGE,      // a large object
+    THREAD_COMPACT,    // marked objects in a block that is compacted
+} ThreadWorkKind;
+
+typedef struct {
+    bdescr *bd;               // first block of the chunk
+    uint32_t n_blocks;
+    ThreadWorkKind kind;
+} ThreadWork;
+
+typedef struct {
+    bdescr *first;            // first block of the partition
+    bdescr *last;             // last block of the partition
+    uint32_t n_blocks;
+    bdescr *free_bd;          // after compaction: last block in use
+    W_ n_used;                // after compaction: number of blocks in use
+} CompactPartition;
+
+static ThreadWork *thread_work = NULL;
+static uint32_t n_thread_work = 0;
+static uint32_t max_thread_work = 0;
+
+static CompactPartition *partitions = NULL;
+static uint32_t n_partitions = 0;
+
+// index of the next unit of work of the current step
+static StgWord next_compact_work;
+
+// Synchronisation between the GC thread and the helper threads
+static Mutex compact_mutex;
+static Condition compact_start_cond;  // a step was started
+static Condition compact_done_cond;   // a helper finished its step
+static StgWord compact_steps_started; // protected by compact_mutex
+static uint32_t compact_busy;         // helpers still in the current step
+// the step run by the helper threads, NULL when they should exit. A step
+// returns whether the thread running it took any work.
+static bool (*compact_step)(void);
+// threads that took some work during the current compaction
+static uint32_t compact_workers_used; // protected by compact_mutex
+
+// For +RTS -s: the number of parallel compactions, and the most threads any
+// of them kept busy.
+static uint32_t parallel_compactions = 0;
+static uint32_t max_compact_workers_used = 0;
+
+static void
+add_thread_work (bdescr *bd, ThreadWorkKind kind)
+{
+    while (bd != NULL) {
+        if (n_thread_work == max_thread_work) {
+            max_thread_work = stg_max(2 * max_thread_work, 64u);
+            thread_work = stgReallocBytes(thread_work,
+                                          max_thread_work * sizeof(ThreadWork),
+                                          "add_thread_work");
+        }
+        ThreadWork *w = &thread_work[n_thread_work++];
+        w->bd = bd;
+        w->kind = kind;
+        w->n_blocks = 0;
+        while (bd != NULL && w->n_blocks < COMPACT_CHUNK_BLOCKS) {
+            bd = bd->link;
+            w->n_blocks++;
+        }
+    }
+}
+
+STATIC_INLINE bool
+next_work_item (uint32_t n_items, uint32_t *i)
+{
+    *i = atomic_inc(&next_compact_work, 1) - 1;
+    return *i < n_items;
+}
+
+static void
+thread_compact_block (bdescr *bd)
+{
+    P_ p = bd->start;
+
+    while (p < bd->free) {
+        while (p < bd->free && !is_marked(p,bd)) {
+            p++;
+        }
+        if (p >= bd->free) {
+            break;
+        }
+        StgInfoTable *iptr = get_threaded_info(p);
+        p = thread_obj(INFO_PTR_TO_STRUCT(iptr), p);
+    }
+}
+
+static bool
+thread_step (void)
+{
+    uint32_t i;
+    bool worked = false;
+
+    while (next_work_item(n_thread_work, &i)) {
+        ThreadWork *w = &thread_work[i];
+        worked = true;
+        bdescr *bd = w->bd;
+        for (uint32_t n = 0; n < w->n_blocks; n++, bd = bd->link) {
+            switch (w->kind) {
+            case THREAD_FWD:
+                update_fwd_block(bd);
+                break;
+            case THREAD_LARGE:
+                update_fwd_large_block(bd);
+                break;
+            case THREAD_COMPACT:
+                thread_compact_block(bd);
+                break;
+            }
+        }
+    }
+    return worked;
+}
+
+static void
+plan_partition (CompactPartition *part)
+{
+    bdescr *bd = part->first;
+    bdescr *free_bd = part->first;
+    P_ free = free_bd->start;
+
+    for (uint32_t n = 0; n < part->n_blocks; n++, bd = bd->link) {
+        P_ p = bd->start;
+
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+
+            StgInfoTable *iptr = get_threaded_info(p);
+            W_ size = closure_sizeW_((StgClosure *)p, INFO_PTR_TO_STRUCT(iptr));
+
+            if (free + size > free_bd->start + BLOCK_SIZE_W) {
+                // See Note [Mark bits in mark-compact collector] in Compact.h
+                mark(p+1,bd);
+                free_bd = free_bd->link;
+                free = free_bd->start;
+            } else {
+                ASSERT(!is_marked(p+1,bd));
+            }
+
+            unthread(p, (W_)free, get_iptr_tag(iptr));
+            free += size;
+            p += size;
+        }
+    }
+}
+
+static void
+move_partition (CompactPartition *part)
+{
+    bdescr *bd = part->first;
+    bdescr *free_bd = part->first;
+    P_ free = free_bd->start;
+    W_ n_used = 1;
+
+    for (uint32_t n = 0; n < part->n_blocks; n++, bd = bd->link) {
+        P_ p = bd->start;
+
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+
+            if (is_marked(p+1,bd)) {
+                free_bd->free = free;
+                IF_DEBUG(zero_on_gc, {
+                    memset(free_bd->free, 0xaa,
+                           BLOCK_SIZE - ((W_)(free_bd->free - free_bd->start) * sizeof(W_)));
+                });
+                free_bd = free_bd->link;
+                free = free_bd->start;
+                n_used++;
+            }
+
+            ASSERT(LOOKS_LIKE_INFO_PTR((W_)((StgClosure *)p)->header.info));
+            const StgInfoTable *info = get_itbl((StgClosure *)p);
+            W_ size = closure_sizeW_((StgClosure *)p, info);
+
+            if (free != p) {
+                move(free,p,size);
+            }
+
+            // relocate TSOs
+            if (info->type == STACK) {
+                move_STACK((StgStack *)p, (StgStack *)free);
+            }
+
+            free += size;
+            p += size;
+        }
+    }
+
+    free_bd->free = free;
+    IF_DEBUG(zero_on_gc, {
+        memset(free_bd->free, 0xaa,
+               BLOCK_SIZE - ((W_)(free_bd->free - free_bd->start) * sizeof(W_)));
+    });
+    part->free_bd = free_bd;
+    part->n_used = n_used;
+}
+
+static bool
+plan_step (void)
+{
+    uint32_t i;
+    bool worked = false;
+
+    while (next_work_item(n_partitions, &i)) {
+        plan_partition(&partitions[i]);
+        worked = true;
+    }
+    return worked;
+}
+
+static bool
+move_step (void)
+{
+    uint32_t i;
+    bool worked = false;
+
+    while (next_work_item(n_partitions, &i)) {
+        move_partition(&partitions[i]);
+        worked = true;
+    }
+    return worked;
+}
+
+static void *
+compact_worker_thread (void *data STG_UNUSED)
+{
+    StgWord seen = 0;
+    bool worked = false;
+
+    ACQUIRE_LOCK(&compact_mutex);
+    while (true) {
+        while (compact_steps_started == seen) {
+            waitCondition(&compact_start_cond, &compact_mutex);
+        }
+        seen = compact_steps_started;
+        bool (*step)(void) = compact_step;
+        if (step == NULL) {
+            break;
+        }
+        RELEASE_LOCK(&compact_mutex);
+        worked = step() || worked;
+        ACQUIRE_LOCK(&compact_mutex);
+        if (--compact_busy == 0) {
+            signalCondition(&compact_done_cond);
+        }
+    }
+    if (worked) {
+        compact_workers_used++;
+    }
+    RELEASE_LOCK(&compact_mutex);
+    return NULL;
+}
+
+static OSThreadId *
+start_compact_workers (uint32_t n_workers)
+{
+    OSThreadId *threads =
+        stgMallocBytes((n_workers - 1) * sizeof(OSThreadId),
+                       "start_compact_workers");
+
+    initMutex(&compact_mutex);
+    initCondition(&compact_start_cond);
+    initCondition(&compact_done_cond);
+    compact_steps_started = 0;
+    compact_busy = 0;
+    compact_workers_used = 0;
+    for (uint32_t i = 0; i < n_workers - 1; i++) {
+        int r = createAttachedOSThread(&threads[i], "compacting GC worker",
+                                       compact_worker_thread, NULL);
+        if (r != 0) {
+            barf("compact: failed to spawn worker: %s", strerror(r));
+        }
+    }
+    return threads;
+}
+
+// Run one step of the parallel compaction on the calling thread and the
+// n_workers-1 helpers, and wait for all of them to finish it. Returns
+// whether the calling thread took any work.
+static bool
+run_compact_step (uint32_t n_workers, bool (*step)(void))
+{
+    ACQUIRE_LOCK(&compact_mutex);
+    ASSERT(compact_busy == 0);
+    compact_step = step;
+    next_compact_work = 0;
+    compact_busy = n_workers - 1;
+    compact_steps_started++;
+    broadcastCondition(&compact_start_cond);
+    RELEASE_LOCK(&compact_mutex);
+
+    bool worked = step();
+
+    ACQUIRE_LOCK(&compact_mutex);
+    while (compact_busy > 0) {
+        waitCondition(&compact_done_cond, &compact_mutex);
+    }
+    RELEASE_LOCK(&compact_mutex);
+    return worked;
+}
+
+// Stop the helpers and return the number of threads, the calling thread
+// included, that took some work during the compaction.
+static uint32_t
+stop_compact_workers (uint32_t n_workers, OSThreadId *threads, bool worked)
+{
+    ACQUIRE_LOCK(&compact_mutex);
+    compact_step = NULL;
+    compact_steps_started++;
+    broadcastCondition(&compact_start_cond);
+    RELEASE_LOCK(&compact_mutex);
+
+    for (uint32_t i = 0; i < n_workers - 1; i++) {
+        joinOSThread(threads[i]);
+    }
+    stgFree(threads);
+    closeCondition(&compact_done_cond);
+    closeCondition(&compact_start_cond);
+    closeMutex(&compact_mutex);
+    return compact_workers_used + (worked ? 1 : 0);
+}
+
+static void
+make_partitions (bdescr *blocks, uint32_t max_partitions)
+{
+    uint32_t n_blocks = 0;
+
+    for (bdescr *bd = blocks; bd != NULL; bd = bd->link) {
+        n_blocks++;
+    }
+
+    n_partitions = stg_min(max_partitions, n_blocks);
+    partitions = stgMallocBytes(n_partitions * sizeof(CompactPartition),
+                                "make_partitions");
+
+    bdescr *bd = blocks;
+    for (uint32_t i = 0; i < n_partitions; i++) {
+        // spread the remainder over the first partitions
+        uint32_t size = n_blocks / n_partitions
+            + (i < n_blocks % n_partitions ? 1 : 0);
+        CompactPartition *part = &partitions[i];
+        part->first = bd;
+        part->n_blocks = size;
+        for (uint32_t n = 1; n < size; n++) {
+            bd = bd->link;
+        }
+        part->last = bd;
+        bd = bd->link;
+    }
+}
+
+// Link the blocks that the partitions still use back into a single list,
+// free the rest, and return the number of blocks in use.
+static W_
+join_partitions (void)
+{
+    bdescr *tail = NULL;
+    W_ n_used = 0;
+
+    for (uint32_t i = 0; i < n_partitions; i++) {
+        CompactPartition *part = &partitions[i];
+        bdescr *unused = part->free_bd == part->last ? NULL : part->free_bd->link;
+
+        part->last->link = NULL;
+        if (unused != NULL) {
+            freeChain(unused);
+        }
+        part->free_bd->link = NULL;
+        if (tail != NULL) {
+            tail->link = part->first;
+        }
+        tail = part->free_bd;
+        n_used += part->n_used;
+    }
+
+    stgFree(partitions);
+    partitions = NULL;
+    n_partitions = 0;
+    return n_used;
+}
+
+static void
+compact_parallel (uint32_t n_workers)
+{
+    // 2. thread all the pointers in the heap
+    n_thread_work = 0;
+    for (W_ g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        generation *gen = &generations[g];
+
+        add_thread_work(gen->blocks, THREAD_FWD);
+        for (W_ n = 0; n < n_capabilities; n++) {
+            add_thread_work(gc_threads[n]->gens[g].todo_bd, THREAD_FWD);
+            add_thread_work(gc_threads[n]->gens[g].part_list, THREAD_FWD);
+        }
+        add_thread_work(gen->scavenged_large_objects, THREAD_LARGE);
+        // modifies nfdata_chain, so not done in parallel
+        update_fwd_cnf(gen->live_compact_objects);
+    }
+    add_thread_work(oldest_gen->old_blocks, THREAD_COMPACT);
+
+    debugTrace(DEBUG_gc, "compact: threading %u chunks on %u threads",
+               n_thread_work, n_workers);
+    OSThreadId *threads = start_compact_workers(n_workers);
+    compact_par = true;
+    bool worked = run_compact_step(n_workers, thread_step);
+    compact_par = false;
+
+    // the chunks are only needed while threading
+    stgFree(thread_work);
+    thread_work = NULL;
+    n_thread_work = 0;
+    max_thread_work = 0;
+
+    // 3. compute the new addresses and unthread
+    make_partitions(oldest_gen->old_blocks,
+                    n_workers * COMPACT_PARTITIONS_PER_WORKER);
+    worked = run_compact_step(n_workers, plan_step) || worked;
+
+    // 4. move the objects
+    worked = run_compact_step(n_workers, move_step) || worked;
+    uint32_t used = stop_compact_workers(n_workers, threads, worked);
+    parallel_compactions++;
+    max_compact_workers_used = stg_max(max_compact_workers_used, used);
+
+    W_ blocks = join_partitions();
+    debugTrace(DEBUG_gc,
+               "compact: %d (old: %d blocks, now %d blocks)",
+               oldest_gen->no, oldest_gen->n_old_blocks, blocks);
+    oldest_gen->n_old_blocks = blocks;
+}
+
+void
+getParallelCompactStats (uint32_t *compactions, uint32_t *max_workers)
+{
+    *compactions = parallel_compactions;
+    *max_workers = max_compact_workers_used;
+}
+#endif /* THREADED_RTS */
+
 void
 compact(StgClosure *static_objects,
         StgWeak **dead_weak_ptr_list,
@@ -1018,6 +1555,15 @@ compact(StgClosure *static_objects,
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
 
+#if defined(THREADED_RTS)
+    // See Note [Parallel compaction]
+    if (RtsFlags.ParFlags.compactWorkers > 1 && oldest_gen->old_blocks != NULL) {
+        compact_parallel(RtsFlags.ParFlags.compactWorkers);
+        rehash_CNFs();
+        return;
+    }
+#endif
+
     // 2. update forward ptrs
     for (W_ g = 0; g < RtsFlags.GcFlags.generations; g++) {
         generation *gen = &generations[g];
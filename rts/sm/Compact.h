@@ -78,4 +78,8 @@ void compact (StgClosure *static_objects,
               StgWeak **dead_weak_ptr_list,
               StgTSO **resurrected_threads);
 
+#if defined(THREADED_RTS)
+void getParallelCompactStats (uint32_t *compactions, uint32_t *max_workers);
+#endif
+
 #include "EndPrivate.h"
@@ -28,6 +28,7 @@
 #include "CNF.h"
 #include "Scav.h"
 #include "NonMoving.h"
+#include "Pretenure.h"
 #include "CheckUnload.h" // n_unloaded_objects and markObjectCode
 
 #if defined(THREADED_RTS) && !defined(PARALLEL_GC)
@@ -140,12 +141,18 @@ alloc_for_copy_nonmoving (uint32_t size, uint32_t gen_no)
     }
 }
 
-/* size is in words */
+/* size is in words; info and src describe the object being copied */
 STATIC_INLINE StgPtr
-alloc_for_copy (uint32_t size, uint32_t gen_no)
+alloc_for_copy (uint32_t size, uint32_t gen_no,
+                const StgInfoTable *info, StgClosure *src)
 {
     ASSERT(gen_no < RtsFlags.GcFlags.generations);
 
+    /* See Note [Pretenuring by allocation site] in Pretenure.c */
+    if (RTS_UNLIKELY(RtsFlags.GcFlags.pretenureSurvival != 0)) {
+        gen_no = pretenureDest(info, src, gen_no);
+    }
+
     if (RTS_UNLIKELY(RtsFlags.GcFlags.useNonmoving)) {
         return alloc_for_copy_nonmoving(size, gen_no);
     }
@@ -228,7 +235,7 @@ copy_tag(StgClosure **p, const StgInfoTable *info,
     StgPtr to, from;
     uint32_t i;
 
-    to = alloc_for_copy(size,gen_no);
+    to = alloc_for_copy(size,gen_no,info,src);
 
     from = (StgPtr)src;
     to[0] = (W_)info;
@@ -287,7 +294,7 @@ copy_tag_nolock(StgClosure **p, const StgInfoTable *info,
     StgPtr to, from;
     uint32_t i;
 
-    to = alloc_for_copy(size,gen_no);
+    to = alloc_for_copy(size,gen_no,info,src);
 
     from = (StgPtr)src;
     to[0] = (W_)info;
@@ -344,7 +351,8 @@ spin:
     info = (W_)src->header.info;
 #endif /* PARALLEL_GC */
 
-    to = alloc_for_copy(size_to_reserve, gen_no);
+    to = alloc_for_copy(size_to_reserve, gen_no,
+                        (const StgInfoTable *)info, src);
 
     from = (StgPtr)src;
     to[0] = info;
@@ -53,6 +53,7 @@
 #include "CNF.h"
 #include "RtsFlags.h"
 #include "NonMoving.h"
+#include "Pretenure.h"
 #include "Ticky.h"
 
 #include <string.h> // for memset()
@@ -141,6 +142,9 @@ static StgWord gc_running_threads;
 static Mutex gc_running_mutex;
 static Condition gc_running_cv;
 
+ArrayScavWork *array_scav_work = NULL;
+SpinLock array_scav_work_sync;
+
 static Mutex gc_entry_mutex;
 static StgInt n_gc_entered = 0;
 static Condition gc_entry_arrived_cv;
@@ -180,6 +184,7 @@ static bool is_par_gc(void);
 uint32_t n_gc_threads;
 static uint32_t n_gc_idle_threads;
 bool work_stealing;
+StgWord scav_prefetched_objects = 0;
 
 static bool is_par_gc() {
 #if defined(THREADED_RTS)
@@ -214,7 +219,7 @@ static void mark_root               (void *user, StgClosure **root);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
 static void init_gc_thread          (gc_thread *t);
-static void resize_nursery          (void);
+static void resize_nursery          (Capability *cap);
 static void scavenge_until_all_done (void);
 static StgWord inc_running          (void);
 static StgWord dec_running          (void);
@@ -452,6 +457,12 @@ GarbageCollect (uint32_t collect_gen,
   // and put them on the g0->large_object list.
   collect_pinned_object_blocks();
 
+  // release the compact blocks the capabilities were appending to, see
+  // Note [Concurrent compactAdd] in CNF.c
+  for (n = 0; n < n_capabilities; n++) {
+      compactReleaseCursor(capabilities[n]);
+  }
+
   // Initialise all the generations that we're collecting.
   for (g = 0; g <= N; g++) {
       prepare_collected_gen(&generations[g]);
@@ -651,6 +662,11 @@ GarbageCollect (uint32_t collect_gen,
       }
   }
 
+  // See Note [Pretenuring by allocation site] in Pretenure.c
+  if (RtsFlags.GcFlags.pretenureSurvival != 0) {
+      pretenureEndGC();
+  }
+
   // Run through all the generations and tidy up.
   // We're going to:
   //   - count the amount of "live" data (live_words, live_blocks)
@@ -900,7 +916,7 @@ GarbageCollect (uint32_t collect_gen,
       }
   }
 
-  resize_nursery();
+  resize_nursery(cap);
 
   resetNurseries();
 
@@ -1115,10 +1131,10 @@ new_gc_thread (uint32_t n, gc_thread *t)
 #endif
 
     t->thread_index = n;
-    t->free_blocks = NULL;
     t->gc_count = 0;
 
     init_gc_thread(t);
+    initPretenureSamples(t);
 
     for (g = 0; g < RtsFlags.GcFlags.generations; g++)
     {
@@ -1180,6 +1196,7 @@ initGcThreads (uint32_t from USED_IF_THREADS, uint32_t to USED_IF_THREADS)
         initCondition(&gc_exit_leave_now_cv);
         initMutex(&gc_running_mutex);
         initCondition(&gc_running_cv);
+        initSpinLock(&array_scav_work_sync);
     }
 
     for (i = from; i < to; i++) {
@@ -1210,6 +1227,7 @@ freeGcThreads (void)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
+            freePretenureSamples(gc_threads[i]);
             stgFree (gc_threads[i]);
         }
         closeCondition(&gc_running_cv);
@@ -1226,6 +1244,7 @@ freeGcThreads (void)
         {
             freeWSDeque(gc_threads[0]->gens[g].todo_q);
         }
+        freePretenureSamples(gc_threads[0]);
         stgFree (gc_threads);
 #endif
         gc_threads = NULL;
@@ -2006,12 +2025,104 @@ resizeGenerations (void)
     }
 }
 
+/* Note [GC pause target]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   With --gc-pause-target=<t> the nursery is no longer a fixed -A per
+   capability: after every GC we re-derive it from the rates which Stats.c
+   measures for us (see stat_getGcRates()):
+
+     copy_rate    bytes evacuated per second of minor GC
+     alloc_rate   bytes allocated per second of mutator time
+     survival     fraction of the nursery which survives a minor GC
+
+   A minor GC copies roughly survival * nursery bytes, so the nursery which
+   meets the target is
+
+     nursery = t * copy_rate / survival
+
+   We bound the result from below by the -A size and by the amount
+   allocated in t (a smaller nursery would make us spend more than half of
+   the time in the GC), from above by half of the -M limit, and let it at
+   most halve or double from one GC to the next so that a single outlier
+   does not throw the controller off.
+
+   The intermediate generations (with -G3 or more) are collected by copying
+   too, so their size is capped at t * copy_rate, which bounds the pause of
+   collecting one of them in the same way. The oldest generation is still
+   sized by resizeGenerations(): its pauses depend on the total residency,
+   which the target cannot bound.
+
+   The measurements necessarily describe the previous cycle, so the
+   controller lags one GC behind a change in the program's behaviour. Each
+   decision is emitted as a GC_PAUSE_CONTROL event.
+*/
+
+/* Nursery size chosen by the previous decision, in blocks. */
+static W_ pause_target_nursery = 0;
+
+static void
+resize_nursery_for_pause_target (Capability *cap, StgWord min_nursery)
+{
+    GcRates rates;
+    W_ blocks, budget_blocks, alloc_blocks, gen_max = 0;
+    double target, survival;
+    uint32_t g;
+
+    stat_getGcRates(&rates);
+
+    if (rates.copy_rate == 0) {
+        // no minor GC to learn from yet
+        resizeNurseriesFixed();
+        pause_target_nursery = min_nursery;
+        return;
+    }
+
+    if (pause_target_nursery == 0) {
+        pause_target_nursery = min_nursery;
+    }
+
+    target = TimeToSecondsDbl(RtsFlags.GcFlags.pauseTarget);
+    survival = stg_max(rates.survival, 0.01);
+
+    budget_blocks = (W_)(target * rates.copy_rate / BLOCK_SIZE);
+    blocks = (W_)(budget_blocks / survival);
+    blocks = stg_min(blocks, pause_target_nursery * 2);
+    blocks = stg_max(blocks, pause_target_nursery / 2);
+
+    alloc_blocks = (W_)(target * rates.alloc_rate / BLOCK_SIZE);
+    blocks = stg_max(blocks, stg_max(alloc_blocks, min_nursery));
+
+    if (RtsFlags.GcFlags.maxHeapSize != 0) {
+        blocks = stg_min(blocks,
+                         stg_max(RtsFlags.GcFlags.maxHeapSize / 2, min_nursery));
+    }
+
+    pause_target_nursery = blocks;
+    resizeNurseries(blocks);
+
+    if (RtsFlags.GcFlags.generations > 2) {
+        gen_max = stg_max(budget_blocks, RtsFlags.GcFlags.minOldGenSize);
+        if (oldest_gen->max_blocks != 0) {
+            gen_max = stg_min(gen_max, oldest_gen->max_blocks);
+        }
+        for (g = 1; g < RtsFlags.GcFlags.generations - 1; g++) {
+            generations[g].max_blocks = gen_max;
+        }
+    }
+
+    traceEventGcPauseControl(cap, RtsFlags.GcFlags.pauseTarget,
+                             rates.minor_pause,
+                             (W_)rates.copy_rate, (W_)rates.alloc_rate,
+                             (uint32_t)(rates.survival * 1000),
+                             blocks * BLOCK_SIZE, gen_max * BLOCK_SIZE);
+}
+
 /* -----------------------------------------------------------------------------
    Calculate the new size of the nursery, and resize it.
    -------------------------------------------------------------------------- */
 
 static void
-resize_nursery (void)
+resize_nursery (Capability *cap)
 {
     const StgWord min_nursery =
       RtsFlags.GcFlags.minAllocAreaSize * (StgWord)n_capabilities;
@@ -2115,6 +2226,11 @@ resize_nursery (void)
 
             resizeNurseries((W_)blocks);
         }
+        else if (RtsFlags.GcFlags.pauseTarget != 0)
+        {
+            // See Note [GC pause target]
+            resize_nursery_for_pause_target(cap, min_nursery);
+        }
         else
         {
             // we might have added extra blocks to the nursery, so
@@ -44,6 +44,10 @@ extern StgPtr mark_sp;
 
 extern bool work_stealing;
 
+// Objects which entered scavenge_block's prefetch window, reported by
+// +RTS -s.  See Note [Scavenge prefetching] in Scav.c.
+extern StgWord scav_prefetched_objects;
+
 #if defined(PROF_SPIN) && defined(THREADED_RTS)
 extern volatile StgWord64 whitehole_gc_spin;
 extern volatile StgWord64 waitForGcThreads_spin;
@@ -77,6 +81,24 @@ void freeGcThreads (void);
 void resizeGenerations (void);
 
 #if defined(THREADED_RTS)
+// A large array whose cards are being scavenged in chunks by several GC
+// threads. See Note [Splitting large arrays] in Scav.c.
+typedef struct ArrayScavWork_ {
+    StgMutArrPtrs *arr;
+    uint32_t gen_no;            // generation the array lives in
+    bool is_mutable;            // MUT_ARR_PTRS rather than a frozen array
+    bool marked_only;           // only scavenge marked cards (mutable list)
+    StgWord n_cards;
+    StgWord next_card;          // first card not yet handed out
+    volatile StgWord chunks_left;  // chunks not yet scavenged
+    volatile StgWord any_failed;   // a chunk points into a younger generation
+    struct ArrayScavWork_ *link;
+} ArrayScavWork;
+
+// Arrays with cards still to be handed out, protected by array_scav_work_sync
+extern ArrayScavWork *array_scav_work;
+extern SpinLock array_scav_work_sync;
+
 void notifyTodoBlock (void);
 void waitForGcThreads (Capability *cap, bool idle_cap[]);
 void releaseGCThreads (Capability *cap, bool idle_cap[]);
@@ -129,10 +129,6 @@ typedef struct gc_thread_ {
 #endif
     uint32_t thread_index;         // a zero based index identifying the thread
 
-    bdescr * free_blocks;          // a buffer of free blocks for this thread
-                                   //  during GC without accessing the block
-                                   //   allocators spin lock.
-
     // These two lists are chained through the STATIC_LINK() fields of static
     // objects.  Pointers are tagged with the current static_flag, so before
     // following a pointer, untag it with UNTAG_STATIC_LIST_PTR().
@@ -190,6 +186,14 @@ typedef struct gc_thread_ {
     Time gc_end_elapsed;           // process elapsed time
     W_ gc_start_faults;
 
+    // -------------------
+    // pretenuring, see Note [Pretenuring by allocation site] in Pretenure.c
+
+    struct PretenureSample_ *pretenure_samples;
+    uint32_t n_pretenure_samples;
+    uint32_t pretenure_countdown;
+    W_ pretenured_copies;       // objects sent straight to the oldest gen
+
     // -------------------
     // workspaces
 
@@ -32,11 +32,26 @@ SpinLock gc_alloc_block_sync;
 
 static void push_todo_block(bdescr *bd, gen_workspace *ws);
 
+// Take gc_alloc_block_sync, counting how often it was held by another GC
+// thread; see Note [Per-capability block caches] in BlockAlloc.c.
+STATIC_INLINE void
+acquire_alloc_block_sync (void)
+{
+#if defined(THREADED_RTS)
+    BlockAllocStats *stats = &gct->cap->block_cache.stats;
+    if (!TRY_ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync)) {
+        ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+        stats->gc_contended++;
+    }
+    stats->gc_locked++;
+#endif
+}
+
 bdescr* allocGroup_sync(uint32_t n)
 {
     bdescr *bd;
     uint32_t node = capNoToNumaNode(gct->thread_index);
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+    acquire_alloc_block_sync();
     bd = allocGroupOnNode(node,n);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
@@ -45,40 +60,44 @@ bdescr* allocGroup_sync(uint32_t n)
 bdescr* allocGroupOnNode_sync(uint32_t node, uint32_t n)
 {
     bdescr *bd;
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+    acquire_alloc_block_sync();
     bd = allocGroupOnNode(node,n);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
 }
 
-static uint32_t
-allocBlocks_sync(uint32_t n, bdescr **hd)
+// A single block from the cache of the GC thread's capability.
+static bdescr *
+allocBlockCached_sync (void)
 {
-    bdescr *bd;
-    uint32_t i;
-    uint32_t node = capNoToNumaNode(gct->thread_index);
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocLargeChunkOnNode(node,1,n);
-    // NB. allocLargeChunk, rather than allocGroup(n), to allocate in a
-    // fragmentation-friendly way.
-    n = bd->blocks;
-    for (i = 0; i < n; i++) {
-        bd[i].blocks = 1;
-        bd[i].link = &bd[i+1];
-        bd[i].free = bd[i].start;
+    BlockCache *cache = &gct->cap->block_cache;
+    if (cache->n_blocks == 0) {
+        acquire_alloc_block_sync();
+        refillBlockCache(cache);
+        RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
+    }
+    return popBlockCache(cache);
+}
+
+// Give a block back to the cache of the GC thread's capability, returning
+// a batch to the free lists if the cache is full.
+static void
+freeBlockCached_sync (bdescr *bd)
+{
+    BlockCache *cache = &gct->cap->block_cache;
+    if (!pushBlockCache(cache, bd)) {
+        freeGroup_sync(bd);
+    } else if (cache->n_blocks >= BLOCK_CACHE_SIZE) {
+        acquire_alloc_block_sync();
+        flushBlockCache(cache, BLOCK_CACHE_BATCH);
+        RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     }
-    bd[n-1].link = NULL;
-    // We have to hold the lock until we've finished fiddling with the metadata,
-    // otherwise the block allocator can get confused.
-    RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
-    *hd = bd;
-    return n;
 }
 
 void
 freeChain_sync(bdescr *bd)
 {
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+    acquire_alloc_block_sync();
     freeChain(bd);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
 }
@@ -86,7 +105,7 @@ freeChain_sync(bdescr *bd)
 void
 freeGroup_sync(bdescr *bd)
 {
-    ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+    acquire_alloc_block_sync();
     freeGroup(bd);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
 }
@@ -303,7 +322,7 @@ todo_block_full (uint32_t size, gen_workspace *ws)
                 // object.  However, if the object we're copying is
                 // larger than a block, then we might have an empty
                 // block here.
-                freeGroup_sync(bd);
+                freeBlockCached_sync(bd);
             } else {
                 push_scanned_block(bd, ws);
             }
@@ -346,13 +365,7 @@ alloc_todo_block (gen_workspace *ws, uint32_t size)
             bd = allocGroup_sync((W_)BLOCK_ROUND_UP(size*sizeof(W_))
                                  / BLOCK_SIZE);
         } else {
-            if (gct->free_blocks) {
-                bd = gct->free_blocks;
-                gct->free_blocks = bd->link;
-            } else {
-                allocBlocks_sync(16, &bd);
-                gct->free_blocks = bd->link;
-            }
+            bd = allocBlockCached_sync();
         }
         initBdescr(bd, ws->gen, ws->gen->to);
         RELAXED_STORE(&bd->u.scan, RELAXED_LOAD(&bd->start));
@@ -13,6 +13,7 @@
 
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
+#include "Storage.h"
 #include "Trace.h"
 #include "OSMem.h"
 
@@ -22,6 +23,9 @@ W_ peak_mblocks_allocated = 0;
 W_ mblocks_allocated = 0;
 W_ mpc_misses = 0;
 
+// bytes returned to the OS so far; protected by sm_mutex
+static StgWord64 mblocks_released_bytes = 0;
+
 /* -----------------------------------------------------------------------------
    The MBlock Map: provides our implementation of HEAP_ALLOCED() and the
    utilities to walk the really allocated (thus accessible without risk of
@@ -96,6 +100,286 @@ typedef struct free_list {
 
 static free_list *free_list_head;
 static W_ mblock_high_watermark;
+
+/* Note [Huge page backed megablocks]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A megablock spans 256 ordinary 4kB pages, so a heap of a few gigabytes
+ * needs far more dTLB entries than any CPU has, and mutator and GC alike
+ * spend a noticeable fraction of their time walking page tables. With
+ * +RTS --huge-pages the heap is instead backed by huge pages, 2MB on
+ * x86-64 and AArch64 (osHugePageSize()):
+ *
+ *  - --huge-pages=transparent (the default) commits memory as usual and
+ *    marks it with madvise(MADV_HUGEPAGE), so that the kernel backs it
+ *    with transparent huge pages whenever it can;
+ *
+ *  - --huge-pages=explicit maps pages from the hugetlbfs pool with
+ *    MAP_HUGETLB. The pool has to be set up by the administrator
+ *    (vm.nr_hugepages); once it runs dry we fall back to transparent
+ *    huge pages.
+ *
+ * Either way the kernel can only use a huge page for a range that is
+ * aligned to the huge page size and mapped in one piece, while the block
+ * allocator commits and decommits single megablocks, so the two-step
+ * allocator below changes as follows when huge_page_size is non-zero:
+ *
+ *  - osReserveHeapMemory() aligns the reserved space to the huge page
+ *    size;
+ *
+ *  - getFreshMBlocks() commits the space above mblock_committed_end in
+ *    whole huge pages. Everything below mblock_committed_end stays
+ *    mapped from then on;
+ *
+ *  - decommitMBlocks() releases only the huge pages that are entirely
+ *    free, after the freed megablocks have been merged into the free
+ *    list. A megablock sharing a huge page with a live one keeps its
+ *    memory until its neighbour is freed as well;
+ *
+ *  - getReusableMBlocks() does not commit anything: decommitted memory
+ *    is still mapped, and the kernel hands out fresh pages for it when
+ *    it is touched again.
+ *
+ * In other words memory is returned to the OS at huge page granularity.
+ * That is the price of the much smaller page tables: a heap fragmented
+ * at megablock granularity may keep up to twice as much memory resident.
+ */
+static W_ huge_page_size;        // 0 unless --huge-pages
+static W_ mblock_committed_end;  // only maintained if huge_page_size != 0
+
+#if defined(THREADED_RTS)
+/* Note [Background decommit]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * After a major GC returnMemoryToOS (BlockAlloc.c) hands the megablocks
+ * that the heap no longer needs back to this layer, and decommitMBlocks
+ * releases them with madvise(). This happens in the middle of the GC, so
+ * after a load spike the next major GC pays for releasing gigabytes of
+ * memory.
+ *
+ * With +RTS --decommit-rate=<size>, decommitMBlocks instead puts the
+ * megablocks on decommit_list, and a background thread releases them at no
+ * more than <size> bytes per second. The thread earns budget for the time
+ * that passes, up to a DECOMMIT_TICK's worth, and sleeps for a tick when
+ * it has used it up. It takes a range of at most its budget off
+ * decommit_list, decommits it without holding any lock, and only then adds
+ * it to the free list, from which getReusableMBlocks commits memory again.
+ *
+ * decommit_list is protected by sm_mutex, like the free list. A range the
+ * thread is working on stays on decommit_list, marked busy, so that
+ *
+ *  - getFirstMBlock/getNextMBlock skip every range on decommit_list, busy
+ *    or not, as none of them is allocated;
+ *
+ *  - getCommittedMBlocks takes memory from ranges that are not busy before
+ *    anything else. Their memory is still committed, so a heap that grows
+ *    again soon after shrinking gets it back without any system call.
+ *
+ * The memory on decommit_list and the total released so far are reported
+ * by getRTSStats (mem_retained_bytes and mem_released_bytes).
+ *
+ * This is not done with --huge-pages, where what can be released depends
+ * on the neighbouring megablocks on the free list (see Note [Huge page
+ * backed megablocks]).
+ */
+
+typedef struct decommit_range_ {
+    struct decommit_range_ *next;
+    W_ address;
+    W_ size;
+    bool busy;                 // being decommitted by the decommit thread
+} decommit_range;
+
+#define DECOMMIT_TICKS_PER_SECOND 10
+#define DECOMMIT_TICK (TIME_RESOLUTION / DECOMMIT_TICKS_PER_SECOND)
+
+static decommit_range *decommit_list = NULL;  // protected by sm_mutex
+static W_ decommit_pending_bytes = 0;         // protected by sm_mutex
+static bool decommit_running = false;         // protected by sm_mutex
+static OSThreadId decommit_thread;
+static Mutex decommit_mutex;
+static Condition decommit_wakeup;             // work was added, or stop
+static bool decommit_work;                    // protected by decommit_mutex
+static bool decommit_stop;                    // protected by decommit_mutex
+
+static void addFreeMBlocks(W_ address, W_ size);
+
+// If p lies in a range on decommit_list, the end of that range, otherwise 0.
+static W_ decommitRangeEnd(W_ p)
+{
+    decommit_range *r;
+
+    for (r = decommit_list; r != NULL; r = r->next) {
+        if (r->address <= p && p < r->address + r->size) {
+            return r->address + r->size;
+        }
+    }
+    return 0;
+}
+
+// Take n megablocks from a range that is waiting to be decommitted. The
+// memory is still committed.
+static void *getDecommitMBlocks(uint32_t n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+    decommit_range **prev, *r;
+    void *addr;
+
+    for (prev = &decommit_list; (r = *prev) != NULL; prev = &r->next) {
+        if (r->busy || r->size < size) {
+            continue;
+        }
+        addr = (void*)r->address;
+        r->address += size;
+        r->size -= size;
+        if (r->size == 0) {
+            *prev = r->next;
+            stgFree(r);
+        }
+        RELAXED_STORE(&decommit_pending_bytes, decommit_pending_bytes - size);
+        return addr;
+    }
+    return NULL;
+}
+
+// Decommit one range of at most budget bytes from decommit_list, and return
+// its size, or 0 if there is nothing left to do.
+static W_ decommitOneRange(W_ budget)
+{
+    decommit_range **prev, *r, *rest;
+    W_ address, size;
+
+    ACQUIRE_SM_LOCK;
+    for (r = decommit_list; r != NULL && r->busy; r = r->next) {}
+    if (r == NULL) {
+        RELEASE_SM_LOCK;
+        return 0;
+    }
+    size = stg_min(r->size, budget & ~(W_)MBLOCK_MASK);
+    if (size < r->size) {
+        rest = stgMallocBytes(sizeof(decommit_range), "decommitOneRange");
+        rest->address = r->address + size;
+        rest->size = r->size - size;
+        rest->busy = false;
+        rest->next = r->next;
+        r->next = rest;
+        r->size = size;
+    }
+    r->busy = true;
+    address = r->address;
+    RELEASE_SM_LOCK;
+
+    osDecommitMemory((void*)address, size);
+
+    ACQUIRE_SM_LOCK;
+    for (prev = &decommit_list; *prev != r; prev = &(*prev)->next) {}
+    *prev = r->next;
+    stgFree(r);
+    addFreeMBlocks(address, size);
+    RELAXED_STORE(&decommit_pending_bytes, decommit_pending_bytes - size);
+    RELAXED_STORE(&mblocks_released_bytes, mblocks_released_bytes + size);
+    RELEASE_SM_LOCK;
+
+    debugTrace(DEBUG_gc, "decommitted %" FMT_Word " megablock(s) at %p",
+               size / MBLOCK_SIZE, (void*)address);
+    return size;
+}
+
+static void * OSThreadProcAttr
+decommitThreadBody(void *arg STG_UNUSED)
+{
+    const W_ per_tick =
+        stg_max(RtsFlags.GcFlags.decommitRate / DECOMMIT_TICKS_PER_SECOND, 1);
+    const W_ max_budget = stg_max(per_tick, (W_)MBLOCK_SIZE);
+    W_ budget = max_budget;
+    W_ done;
+    Time last = NSToTime(getMonotonicNSec());
+
+    for (;;) {
+        while (budget >= MBLOCK_SIZE) {
+            done = decommitOneRange(budget);
+            if (done == 0) {
+                break;
+            }
+            budget -= done;
+        }
+
+        ACQUIRE_LOCK(&decommit_mutex);
+        if (decommit_stop) {
+            RELEASE_LOCK(&decommit_mutex);
+            break;
+        }
+        if (budget < MBLOCK_SIZE) {
+            // out of budget: wait for the next tick
+            timedWaitCondition(&decommit_wakeup, &decommit_mutex,
+                               DECOMMIT_TICK);
+        } else {
+            while (!decommit_work && !decommit_stop) {
+                waitCondition(&decommit_wakeup, &decommit_mutex);
+            }
+        }
+        decommit_work = false;
+        RELEASE_LOCK(&decommit_mutex);
+
+        // We may have been woken up early by deferDecommit, so earn budget
+        // for the time that has actually passed.
+        Time now = NSToTime(getMonotonicNSec());
+        double earned =
+            TimeToSecondsDbl(now - last) * RtsFlags.GcFlags.decommitRate;
+        if (earned >= (double)(max_budget - budget)) {
+            budget = max_budget;
+        } else {
+            budget += (W_)earned;
+        }
+        last = now;
+    }
+    return NULL;
+}
+
+// Must hold sm_mutex.
+static void startDecommitThread(void)
+{
+    initMutex(&decommit_mutex);
+    initCondition(&decommit_wakeup);
+    decommit_work = false;
+    decommit_stop = false;
+    int r = createAttachedOSThread(&decommit_thread, "ghc_decommit",
+                                   decommitThreadBody, NULL);
+    if (r != 0) {
+        barf("startDecommitThread: could not create the decommit thread: %s",
+             strerror(r));
+    }
+    decommit_running = true;
+}
+
+// Must hold sm_mutex. See Note [Background decommit].
+static void deferDecommit(W_ address, W_ size)
+{
+    decommit_range *r = decommit_list;
+
+    // returnMemoryToOS frees adjacent groups one after the other
+    if (r != NULL && !r->busy && r->address + r->size == address) {
+        r->size += size;
+    } else if (r != NULL && !r->busy && address + size == r->address) {
+        r->address = address;
+        r->size += size;
+    } else {
+        r = stgMallocBytes(sizeof(decommit_range), "deferDecommit");
+        r->address = address;
+        r->size = size;
+        r->busy = false;
+        r->next = decommit_list;
+        decommit_list = r;
+    }
+    RELAXED_STORE(&decommit_pending_bytes, decommit_pending_bytes + size);
+
+    if (!decommit_running) {
+        startDecommitThread();
+    }
+    ACQUIRE_LOCK(&decommit_mutex);
+    decommit_work = true;
+    signalCondition(&decommit_wakeup);
+    RELEASE_LOCK(&decommit_mutex);
+}
+#endif /* THREADED_RTS */
 /*
  * it is quite important that these are in the same cache line as they
  * are both needed by HEAP_ALLOCED. Moreover, we need to ensure that they
@@ -105,16 +389,28 @@ struct mblock_address_range mblock_address_space = { 0, 0, {} };
 
 static void *getAllocatedMBlock(free_list **start_iter, W_ startingAt)
 {
-    free_list *iter;
+    free_list *iter = *start_iter;
     W_ p = startingAt;
 
-    for (iter = *start_iter; iter != NULL; iter = iter->next)
-    {
-        if (p < iter->address)
-            break;
+    for (;;) {
+        for (; iter != NULL; iter = iter->next)
+        {
+            if (p < iter->address)
+                break;
 
-        if (p == iter->address)
-            p += iter->size;
+            if (p == iter->address)
+                p += iter->size;
+        }
+#if defined(THREADED_RTS)
+        // Nor are megablocks waiting to be decommitted allocated, see
+        // Note [Background decommit]
+        W_ end = decommitRangeEnd(p);
+        if (end != 0) {
+            p = end;
+            continue;
+        }
+#endif
+        break;
     }
 
     *start_iter = iter;
@@ -183,7 +479,10 @@ static void *getReusableMBlocks(uint32_t n)
             stgFree(iter);
         }
 
-        osCommitMemory(addr, size);
+        // See Note [Huge page backed megablocks]
+        if (huge_page_size == 0) {
+            osCommitMemory(addr, size);
+        }
         return addr;
     }
 
@@ -194,24 +493,47 @@ static void *getFreshMBlocks(uint32_t n)
 {
     W_ size = MBLOCK_SIZE * (W_)n;
     void *addr = (void*)mblock_high_watermark;
+    W_ limit = mblock_address_space.end;
 
-    if (mblock_high_watermark + size > mblock_address_space.end)
+    if (huge_page_size != 0) {
+        // Huge pages are committed whole, see Note [Huge page backed
+        // megablocks], so we cannot use a partial one at the end.
+        limit &= ~(huge_page_size - 1);
+    }
+
+    if (mblock_high_watermark + size > limit)
     {
         // whoa, 1 TB of heap?
         errorBelch("out of memory");
         stg_exit(EXIT_HEAPOVERFLOW);
     }
 
-    osCommitMemory(addr, size);
+    if (huge_page_size == 0) {
+        osCommitMemory(addr, size);
+    } else if (mblock_high_watermark + size > mblock_committed_end) {
+        // See Note [Huge page backed megablocks]
+        W_ end = stg_min(roundUpToAlign(mblock_high_watermark + size,
+                                        huge_page_size),
+                         limit);
+        osCommitMemory((void*)mblock_committed_end,
+                       end - mblock_committed_end);
+        mblock_committed_end = end;
+    }
     mblock_high_watermark += size;
     return addr;
 }
 
 static void *getCommittedMBlocks(uint32_t n)
 {
-    void *p;
+    void *p = NULL;
 
-    p = getReusableMBlocks(n);
+#if defined(THREADED_RTS)
+    // See Note [Background decommit]
+    p = getDecommitMBlocks(n);
+#endif
+    if (p == NULL) {
+        p = getReusableMBlocks(n);
+    }
     if (p == NULL) {
         p = getFreshMBlocks(n);
     }
@@ -220,13 +542,10 @@ static void *getCommittedMBlocks(uint32_t n)
     return p;
 }
 
-static void decommitMBlocks(char *addr, uint32_t n)
+// Add the given range to the free list, or lower the high watermark.
+static void addFreeMBlocks(W_ address, W_ size)
 {
     struct free_list *iter, *prev;
-    W_ size = MBLOCK_SIZE * (W_)n;
-    W_ address = (W_)addr;
-
-    osDecommitMemory(addr, size);
 
     prev = NULL;
     for (iter = free_list_head; iter != NULL; iter = iter->next)
@@ -328,6 +647,127 @@ static void decommitMBlocks(char *addr, uint32_t n)
     }
 }
 
+// Commit the n megablocks at address, provided that none of them is in use.
+static void *getCommittedMBlocksAt(W_ address, uint32_t n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+    struct free_list *iter;
+
+    // See Note [Huge page backed megablocks]
+    if (huge_page_size != 0 ||
+        address < mblock_address_space.begin ||
+        address > mblock_address_space.end - size) {
+        return NULL;
+    }
+
+    if (address >= mblock_high_watermark) {
+        W_ old_watermark = mblock_high_watermark;
+
+        mblock_high_watermark = address + size;
+        if (address > old_watermark) {
+            addFreeMBlocks(old_watermark, address - old_watermark);
+        }
+        osCommitMemory((void*)address, size);
+        return (void*)address;
+    }
+
+    for (iter = free_list_head; iter != NULL; iter = iter->next) {
+        if (iter->address <= address &&
+            address + size <= iter->address + iter->size) {
+            break;
+        }
+    }
+    if (iter == NULL) {
+        return NULL;
+    }
+
+    if (address + size < iter->address + iter->size) {
+        struct free_list *rest;
+
+        rest = stgMallocBytes(sizeof(struct free_list),
+                              "getCommittedMBlocksAt");
+        rest->address = address + size;
+        rest->size = iter->address + iter->size - rest->address;
+        rest->prev = iter;
+        rest->next = iter->next;
+        if (rest->next != NULL) {
+            rest->next->prev = rest;
+        }
+        iter->next = rest;
+    }
+
+    if (address > iter->address) {
+        iter->size = address - iter->address;
+    } else {
+        if (iter->prev == NULL) {
+            ASSERT(free_list_head == iter);
+            free_list_head = iter->next;
+        } else {
+            iter->prev->next = iter->next;
+        }
+        if (iter->next != NULL) {
+            iter->next->prev = iter->prev;
+        }
+        stgFree(iter);
+    }
+
+    osCommitMemory((void*)address, size);
+    return (void*)address;
+}
+
+// Release the huge pages which became free when the range at address was
+// added to the free list. See Note [Huge page backed megablocks].
+static void decommitHugePages(W_ address, W_ size)
+{
+    struct free_list *iter;
+    W_ free_start, free_end, start, end;
+
+    if (address >= mblock_high_watermark) {
+        free_start = mblock_high_watermark;
+        free_end = mblock_committed_end;
+    } else {
+        for (iter = free_list_head; iter != NULL; iter = iter->next) {
+            if (iter->address <= address &&
+                address < iter->address + iter->size) {
+                break;
+            }
+        }
+        ASSERT(iter != NULL);
+        free_start = iter->address;
+        free_end = iter->address + iter->size;
+    }
+
+    // Only the huge pages touching the freed range can have become free.
+    start = stg_max(roundUpToAlign(free_start, huge_page_size),
+                    address & ~(huge_page_size - 1));
+    end = stg_min(free_end & ~(huge_page_size - 1),
+                  roundUpToAlign(address + size, huge_page_size));
+    if (start < end) {
+        osDecommitMemory((void*)start, end - start);
+    }
+}
+
+static void decommitMBlocks(char *addr, uint32_t n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+
+#if defined(THREADED_RTS)
+    if (RtsFlags.GcFlags.decommitRate != 0 && huge_page_size == 0) {
+        deferDecommit((W_)addr, size);
+        return;
+    }
+#endif
+
+    RELAXED_STORE(&mblocks_released_bytes, mblocks_released_bytes + size);
+    if (huge_page_size == 0) {
+        osDecommitMemory(addr, size);
+        addFreeMBlocks((W_)addr, size);
+    } else {
+        addFreeMBlocks((W_)addr, size);
+        decommitHugePages((W_)addr, size);
+    }
+}
+
 void releaseFreeMemory(void)
 {
     // This function exists for releasing address space
@@ -542,8 +982,17 @@ static void *getCommittedMBlocks(uint32_t n)
     return ret;
 }
 
+static void *getCommittedMBlocksAt(W_ address STG_UNUSED,
+                                   uint32_t n STG_UNUSED)
+{
+    // The OS chooses where our megablocks go
+    return NULL;
+}
+
 static void decommitMBlocks(void *p, uint32_t n)
 {
+    RELAXED_STORE(&mblocks_released_bytes,
+                  mblocks_released_bytes + MBLOCK_SIZE * (W_)n);
     osFreeMBlocks(p, n);
     uint32_t i;
 
@@ -587,6 +1036,41 @@ getMBlocks(uint32_t n)
     return ret;
 }
 
+// Allocate the 'n' mblocks at 'addr', if they are not in use.  Returns
+// NULL otherwise, or if the platform does not let us choose the address.
+
+void *
+getMBlocksAt(void *addr, uint32_t n)
+{
+    void *ret;
+
+    ret = getCommittedMBlocksAt((W_)addr, n);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    debugTrace(DEBUG_gc, "allocated %d megablock(s) at %p",n,ret);
+
+    mblocks_allocated += n;
+    peak_mblocks_allocated = stg_max(peak_mblocks_allocated, mblocks_allocated);
+
+    return ret;
+}
+
+void *
+getMBlocksAtOnNode(uint32_t node, void *addr, uint32_t n)
+{
+    void *ret = getMBlocksAt(addr, n);
+    if (ret == NULL) {
+        return NULL;
+    }
+#if defined(DEBUG)
+    if (RtsFlags.DebugFlags.numa) return ret; // faking NUMA
+#endif
+    osBindMBlocksToNode(ret, n * MBLOCK_SIZE, numa_map[node]);
+    return ret;
+}
+
 void *
 getMBlocksOnNode(uint32_t node, uint32_t n)
 {
@@ -629,6 +1113,17 @@ freeAllMBlocks(void)
             stgFree(iter);
         }
     }
+#if defined(THREADED_RTS)
+    {
+        decommit_range *r, *next;
+
+        for (r = decommit_list; r != NULL; r = next) {
+            next = r->next;
+            stgFree(r);
+        }
+        decommit_list = NULL;
+    }
+#endif
 
     osReleaseHeapMemory();
 
@@ -649,6 +1144,67 @@ freeAllMBlocks(void)
 #endif
 }
 
+/* Stop the background decommit thread, see Note [Background decommit].
+ * Called on shutdown, before sm_mutex goes away; the memory it had yet to
+ * decommit is released with the rest of the heap. */
+void
+stopDecommitThread(void)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE) && defined(THREADED_RTS)
+    if (!decommit_running) {
+        return;
+    }
+    ACQUIRE_LOCK(&decommit_mutex);
+    decommit_stop = true;
+    signalCondition(&decommit_wakeup);
+    RELEASE_LOCK(&decommit_mutex);
+
+    joinOSThread(decommit_thread);
+    closeCondition(&decommit_wakeup);
+    closeMutex(&decommit_mutex);
+    decommit_running = false;
+#endif
+}
+
+/* In the child of forkProcess: the decommit thread is gone. Whatever it was
+ * decommitting may or may not have been released; it goes onto the free
+ * list either way, and the remaining ranges wait for a new thread. */
+void
+resetDecommitThread(void)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE) && defined(THREADED_RTS)
+    decommit_range **prev = &decommit_list, *r;
+
+    while ((r = *prev) != NULL) {
+        if (r->busy) {
+            *prev = r->next;
+            addFreeMBlocks(r->address, r->size);
+            decommit_pending_bytes -= r->size;
+            stgFree(r);
+        } else {
+            prev = &r->next;
+        }
+    }
+    if (decommit_running) {
+        decommit_running = false;
+        if (decommit_list != NULL) {
+            startDecommitThread();
+        }
+    }
+#endif
+}
+
+void
+getMBlockReleaseStats(StgWord64 *retained, StgWord64 *released)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE) && defined(THREADED_RTS)
+    *retained = RELAXED_LOAD(&decommit_pending_bytes);
+#else
+    *retained = 0;
+#endif
+    *released = RELAXED_LOAD(&mblocks_released_bytes);
+}
+
 void
 initMBlocks(void)
 {
@@ -671,6 +1227,10 @@ initMBlocks(void)
         mblock_address_space.begin = (W_)addr;
         mblock_address_space.end = (W_)addr + size;
         mblock_high_watermark = (W_)addr;
+
+        huge_page_size = osHugePageSize();
+        mblock_committed_end = (W_)addr;
+        ASSERT(((W_)addr & (stg_max(huge_page_size, (W_)MBLOCK_SIZE) - 1)) == 0);
     }
 #elif SIZEOF_VOID_P == 8
     memset(mblock_cache,0xff,sizeof(mblock_cache));
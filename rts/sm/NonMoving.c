@@ -106,8 +106,10 @@ Mutex concurrent_coll_finished_lock;
  * segment to make current from a few sources:
  *
  *  1. the allocator's active list (see pop_active_segment)
- *  2. the nonmoving heap's free block pool (see nonmovingPopFreeSegment)
- *  3. allocate a new segment from the block allocator (see
+ *  2. the segments the last collection hasn't swept yet (see
+ *     nonmovingSweepOnDemand)
+ *  3. the nonmoving heap's free block pool (see nonmovingPopFreeSegment)
+ *  4. allocate a new segment from the block allocator (see
  *     nonmovingAllocSegment)
  *
  * Note that allocation does *not* involve modifying the bitmap. The bitmap is
@@ -165,7 +167,9 @@ Mutex concurrent_coll_finished_lock;
  *
  *  6. [CONC] Sweep: Here we walk over the nonmoving segments on sweep_list
  *     and place them back on either the active, current, or filled list,
- *     depending upon how much live data they contain.
+ *     depending upon how much live data they contain. The allocator may
+ *     sweep segments itself during this phase (see Note [Parallel and lazy
+ *     nonmoving sweep] in NonMovingSweep.c).
  *
  *
  * === Marking ===
@@ -686,6 +690,16 @@ void *nonmovingAllocate(Capability *cap, StgWord sz)
         // first look for a new segment in the active list
         struct NonmovingSegment *new_current = pop_active_segment(alloca);
 
+        // then try sweeping a segment left over by the last collection.
+        // See Note [Parallel and lazy nonmoving sweep] in NonMovingSweep.c.
+        if (new_current == NULL) {
+            new_current = nonmovingSweepOnDemand(log_block_size);
+            if (new_current != NULL
+                && nonmovingSegmentLogBlockSize(new_current) != log_block_size) {
+                nonmovingInitSegment(new_current, log_block_size);
+            }
+        }
+
         // there are no active segments, allocate new segment
         if (new_current == NULL) {
             new_current = nonmovingAllocSegment(cap->node);
@@ -810,8 +824,19 @@ static void nonmovingPrepareMark(void)
     static_flag =
         static_flag == STATIC_FLAG_A ? STATIC_FLAG_B : STATIC_FLAG_A;
 
-    // Should have been cleared by the last sweep
-    ASSERT(nonmovingHeap.sweep_list == NULL);
+    // With --nonmoving-lazy-sweep the last collection may have left segments
+    // unswept. Their bitmaps refer to the current epoch, so sweep them before
+    // bumping it. See Note [Parallel and lazy nonmoving sweep].
+    if (nonmovingHeap.sweep_list != NULL) {
+        ASSERT(RtsFlags.GcFlags.nonmovingLazySweep);
+        nonmovingSweep();
+        debugTrace(DEBUG_nonmoving_gc, "Finished lazy sweep.");
+#if defined(DEBUG)
+        if (RtsFlags.DebugFlags.nonmoving_gc)
+            nonmovingPrintSweepCensus();
+#endif
+    }
+    nonmovingEndSweep();
 
     nonmovingBumpEpoch();
     for (int alloca_idx = 0; alloca_idx < NONMOVING_ALLOCA_CNT; ++alloca_idx) {
@@ -1213,13 +1238,20 @@ static void nonmovingMark_(MarkQueue *mark_queue, StgWeak **dead_weaks, StgTSO *
     nonmovingSweepCompactObjects();
     nonmovingSweepStableNameTable();
 
-    nonmovingSweep();
-    ASSERT(nonmovingHeap.sweep_list == NULL);
-    debugTrace(DEBUG_nonmoving_gc, "Finished sweeping.");
+    // From here on the allocator may sweep segments itself. With
+    // --nonmoving-lazy-sweep we leave all of the segments to it.
+    nonmovingBeginSweep();
+    if (!RtsFlags.GcFlags.nonmovingLazySweep) {
+        nonmovingSweep();
+        ASSERT(nonmovingHeap.sweep_list == NULL);
+        debugTrace(DEBUG_nonmoving_gc, "Finished sweeping.");
+    }
     traceConcSweepEnd();
 #if defined(DEBUG)
-    if (RtsFlags.DebugFlags.nonmoving_gc)
+    if (RtsFlags.DebugFlags.nonmoving_gc) {
         nonmovingPrintAllocatorCensus();
+        nonmovingPrintSweepCensus();
+    }
 #endif
 #if defined(TRACING)
     if (RtsFlags.TraceFlags.nonmoving_gc)
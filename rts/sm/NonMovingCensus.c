@@ -12,6 +12,7 @@
 #include "Rts.h"
 #include "NonMoving.h"
 #include "Trace.h"
+#include "NonMovingSweep.h"
 #include "NonMovingCensus.h"
 
 // N.B. This may miss segments in the event of concurrent mutation (e.g. if a
@@ -113,6 +114,26 @@ void nonmovingPrintAllocatorCensus()
     }
 }
 
+// Report the time spent sweeping each size class during the current sweep.
+// See Note [Parallel and lazy nonmoving sweep] in NonMovingSweep.c.
+void nonmovingPrintSweepCensus()
+{
+    if (!RtsFlags.GcFlags.useNonmoving)
+        return;
+
+    for (int i=0; i < NONMOVING_ALLOCA_CNT; i++) {
+        const struct NonmovingSweepStats *stats = &nonmovingSweepStats[i];
+        double us_per_seg = stats->n_segs == 0 ? 0 :
+            stats->sweep_ns / 1000.0 / stats->n_segs;
+        (void) us_per_seg; // silence warning if !DEBUG
+        debugTrace(DEBUG_nonmoving_gc, "Allocator %d (%d bytes - %d bytes): "
+                   "swept %" FMT_Word " segs in %" FMT_Word " us "
+                   "(%.2f us/seg)",
+                   i, 1 << (i + NONMOVING_ALLOCA0 - 1), 1 << (i + NONMOVING_ALLOCA0),
+                   stats->n_segs, stats->sweep_ns / 1000, us_per_seg);
+    }
+}
+
 void nonmovingTraceAllocatorCensus()
 {
 #if defined(TRACING)
@@ -25,4 +25,5 @@ struct NonmovingAllocCensus
 nonmovingAllocatorCensus(struct NonmovingAllocator *alloc);
 
 void nonmovingPrintAllocatorCensus(void);
+void nonmovingPrintSweepCensus(void);
 void nonmovingTraceAllocatorCensus(void);
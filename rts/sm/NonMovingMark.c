@@ -26,6 +26,9 @@
 #include "MarkWeak.h"
 #include "sm/Storage.h"
 #include "CNF.h"
+#include "RtsUtils.h"
+
+#include <string.h>
 
 static bool check_in_nonmoving_heap(StgClosure *p);
 static void mark_closure (MarkQueue *queue, const StgClosure *p, StgClosure **origin);
@@ -90,9 +93,10 @@ memcount n_nonmoving_marked_compact_blocks = 0;
  * move the same large object to nonmoving_marked_large_objects more than once.
  */
 static Mutex nonmoving_large_objects_mutex;
-// Note that we don't need a similar lock for compact objects because we never
-// mark a compact object eagerly in a write barrier; all compact objects are
-// marked by the mark thread, so there can't be any races here.
+// Compact objects are never marked eagerly in a write barrier, but with
+// parallel marking (see Note [Parallel nonmoving mark]) two mark workers may
+// race to mark the same compact object, so their lists are protected by this
+// lock as well.
 #endif
 
 /*
@@ -247,12 +251,75 @@ StgWord nonmoving_write_barrier_enabled = false;
  */
 MarkQueue *current_mark_queue = NULL;
 
+#if defined(THREADED_RTS)
+/* Note [Parallel nonmoving mark]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * With +RTS --nonmoving-mark-workers=N (N > 1) every nonmovingMark pass is
+ * shared by N mark workers: the thread calling nonmovingMark (usually the
+ * concurrent mark thread) and N-1 helper OS threads which live for the
+ * duration of the pass. Each worker drains a private MarkQueue; work moves
+ * between workers a mark queue block group at a time:
+ *
+ *  - A worker whose queue has grown beyond its top block and which sees
+ *    that another worker is idle (mark_pool_idle > 0) moves every block
+ *    group below its top one to the shared nonmoving_mark_pool.
+ *
+ *  - A worker whose queue has run dry takes one block group from the pool
+ *    or, failing that, the whole update remembered set, as the sequential
+ *    mark does. If neither has anything it goes idle and polls them.
+ *
+ *  - The pass is over once no worker is active and the pool is empty.
+ *    Only active workers add to the pool and every worker looks at the pool
+ *    before it leaves, so no block is left behind. Update remembered set
+ *    blocks flushed after that are left for the next pass, again as in the
+ *    sequential mark.
+ *
+ * Marking itself tolerates several workers tracing the same object. An
+ * object in a nonmoving segment which two workers both find unmarked is
+ * traced twice, which wastes a little time but is otherwise harmless; the
+ * worker which actually sets the mark bit (with a CAS) is the one which
+ * counts its size. Static objects are claimed with bump_static_flag, stacks
+ * with stack->marking, and large and compact objects are moved to the marked
+ * lists under nonmoving_large_objects_mutex. Live words are counted in each
+ * worker's queue and added to nonmoving_live_words at the end of the pass.
+ *
+ * Every worker brackets its part of a pass with CONC_MARK_WORKER_BEGIN and
+ * CONC_MARK_WORKER_END events, the latter carrying the number of entries it
+ * marked and the number of block groups it took from the pool.
+ */
+typedef struct {
+    MarkQueue *queue;
+    uint32_t id;            // 0 is the thread which called nonmovingMark
+    OSThreadId thread;
+    StgWord32 count;        // mark queue entries processed
+    StgWord32 steals;       // block groups taken from nonmoving_mark_pool
+} MarkWorker;
+
+static SpinLock mark_pool_lock;
+
+// Block groups up for grabs, linked through bd->link.
+// Protected by mark_pool_lock.
+bdescr *nonmoving_mark_pool = NULL;
+
+// The number of workers with work. Protected by mark_pool_lock.
+static uint32_t mark_pool_active = 0;
+
+// The number of workers looking for work. Updated under mark_pool_lock, but
+// read without it by workers deciding whether to share theirs.
+static volatile StgWord mark_pool_idle = 0;
+
+// The queues of the helper workers, see NonMovingMark.h.
+MarkQueue **nonmoving_mark_queues = NULL;
+uint32_t n_nonmoving_mark_queues = 0;
+#endif
+
 /* Initialise update remembered set data structures */
 void nonmovingMarkInitUpdRemSet() {
 #if defined(THREADED_RTS)
     initMutex(&upd_rem_set_lock);
     initCondition(&upd_rem_set_flushed_cond);
     initMutex(&nonmoving_large_objects_mutex);
+    initSpinLock(&mark_pool_lock);
 #endif
 }
 
@@ -894,6 +961,7 @@ static void init_mark_queue_ (MarkQueue *queue)
     queue->blocks = bd;
     queue->top = (MarkQueueBlock *) bd->start;
     queue->top->head = 0;
+    queue->live_words = 0;
 #if MARK_PREFETCH_QUEUE_DEPTH > 0
     memset(&queue->prefetch_queue, 0, sizeof(queue->prefetch_queue));
     queue->prefetch_head = 0;
@@ -1195,6 +1263,23 @@ bump_static_flag(StgClosure **link_field, StgClosure *q STG_UNUSED)
     }
 }
 
+/* Set the mark bit of a block in a segment. Returns false if another mark
+ * worker beat us to it. See Note [Parallel nonmoving mark].
+ */
+STATIC_INLINE bool
+mark_segment_block (struct NonmovingSegment *seg, nonmoving_block_idx i)
+{
+#if defined(THREADED_RTS)
+    if (RtsFlags.ParFlags.nonmovingMarkWorkers > 1) {
+        uint8_t mark = nonmovingGetMark(seg, i);
+        return mark != nonmovingMarkEpoch
+            && cas_word8(&seg->bitmap[i], mark, nonmovingMarkEpoch) == mark;
+    }
+#endif
+    nonmovingSetMark(seg, i);
+    return true;
+}
+
 /* N.B. p0 may be tagged */
 static GNUC_ATTR_HOT void
 mark_closure (MarkQueue *queue, const StgClosure *p0, StgClosure **origin)
@@ -1307,12 +1392,16 @@ mark_closure (MarkQueue *queue, const StgClosure *p0, StgClosure **origin)
             }
 
             if (! (bd->flags & BF_MARKED)) {
-                dbl_link_remove(bd, &nonmoving_compact_objects);
-                dbl_link_onto(bd, &nonmoving_marked_compact_objects);
-                StgWord blocks = str->totalW / BLOCK_SIZE_W;
-                n_nonmoving_compact_blocks -= blocks;
-                n_nonmoving_marked_compact_blocks += blocks;
-                bd->flags |= BF_MARKED;
+                ACQUIRE_LOCK(&nonmoving_large_objects_mutex);
+                if (! (bd->flags & BF_MARKED)) {
+                    dbl_link_remove(bd, &nonmoving_compact_objects);
+                    dbl_link_onto(bd, &nonmoving_marked_compact_objects);
+                    StgWord blocks = str->totalW / BLOCK_SIZE_W;
+                    n_nonmoving_compact_blocks -= blocks;
+                    n_nonmoving_marked_compact_blocks += blocks;
+                    bd->flags |= BF_MARKED;
+                }
+                RELEASE_LOCK(&nonmoving_large_objects_mutex);
             }
 
             // N.B. the object being marked is in a compact region so by
@@ -1656,8 +1745,9 @@ mark_closure (MarkQueue *queue, const StgClosure *p0, StgClosure **origin)
         // TODO: Kill repetition
         struct NonmovingSegment *seg = nonmovingGetSegment((StgPtr) p);
         nonmoving_block_idx block_idx = nonmovingGetBlockIdx((StgPtr) p);
-        nonmovingSetMark(seg, block_idx);
-        nonmoving_live_words += nonmovingSegmentBlockSize(seg) / sizeof(W_);
+        if (mark_segment_block(seg, block_idx)) {
+            queue->live_words += nonmovingSegmentBlockSize(seg) / sizeof(W_);
+        }
     }
 
     // If we found a indirection to shortcut keep going.
@@ -1676,6 +1766,236 @@ done:
     }
 }
 
+/* Trace a single mark queue entry, which must not be a NULL_ENTRY. */
+STATIC_INLINE void
+mark_entry (MarkQueue *queue, MarkQueueEnt *ent)
+{
+    switch (nonmovingMarkQueueEntryType(ent)) {
+    case MARK_CLOSURE:
+        mark_closure(queue, ent->mark_closure.p, ent->mark_closure.origin);
+        break;
+    case MARK_ARRAY: {
+        const StgMutArrPtrs *arr = (const StgMutArrPtrs *)
+            UNTAG_CLOSURE((StgClosure *) ent->mark_array.array);
+        StgWord start = ent->mark_array.start_index;
+        StgWord end = start + MARK_ARRAY_CHUNK_LENGTH;
+        if (end < arr->ptrs) {
+            // There is more to be marked after this chunk.
+            markQueuePushArray(queue, arr, end);
+        } else {
+            end = arr->ptrs;
+        }
+        for (StgWord i = start; i < end; i++) {
+            markQueuePushClosure_(queue, arr->payload[i]);
+        }
+        break;
+    }
+    case NULL_ENTRY:
+        barf("mark_entry: NULL_ENTRY");
+    }
+}
+
+/* Replace the blocks of an empty mark queue with the given chain. */
+static void
+mark_queue_take_blocks (MarkQueue *queue, bdescr *blocks)
+{
+    bdescr *old = queue->blocks;
+    queue->blocks = blocks;
+    queue->top = (MarkQueueBlock *) blocks->start;
+
+    ACQUIRE_SM_LOCK;
+    freeGroup(old);
+    RELEASE_SM_LOCK;
+}
+
+/* Move the update remembered set into an empty mark queue. Returns false if
+ * there was nothing to move.
+ */
+static bool
+take_upd_rem_set (MarkQueue *queue)
+{
+    if (upd_rem_set_block_list == NULL) {
+        return false;
+    }
+
+    ACQUIRE_LOCK(&upd_rem_set_lock);
+    bdescr *blocks = upd_rem_set_block_list;
+    upd_rem_set_block_list = NULL;
+    RELEASE_LOCK(&upd_rem_set_lock);
+
+    // Another mark worker may have taken it in the meantime.
+    if (blocks == NULL) {
+        return false;
+    }
+    mark_queue_take_blocks(queue, blocks);
+    return true;
+}
+
+#if defined(THREADED_RTS)
+/* Move all but the top block group of a mark queue to nonmoving_mark_pool.
+ * See Note [Parallel nonmoving mark].
+ */
+static void
+share_mark_work (MarkQueue *queue)
+{
+    bdescr *blocks = queue->blocks->link;
+    bdescr *last = blocks;
+    while (last->link != NULL) {
+        last = last->link;
+    }
+    queue->blocks->link = NULL;
+
+    ACQUIRE_SPIN_LOCK(&mark_pool_lock);
+    last->link = nonmoving_mark_pool;
+    nonmoving_mark_pool = blocks;
+    RELEASE_SPIN_LOCK(&mark_pool_lock);
+}
+
+/* Find more work for a mark worker whose queue has run dry. Returns false
+ * once the pass is over. See Note [Parallel nonmoving mark].
+ */
+static bool
+find_mark_work (MarkWorker *w, bool *active)
+{
+    while (true) {
+        ACQUIRE_SPIN_LOCK(&mark_pool_lock);
+        bdescr *bd = nonmoving_mark_pool;
+        if (bd != NULL) {
+            nonmoving_mark_pool = bd->link;
+            bd->link = NULL;
+            if (!*active) {
+                mark_pool_active++;
+                atomic_dec(&mark_pool_idle);
+                *active = true;
+            }
+        } else if (*active) {
+            mark_pool_active--;
+            atomic_inc(&mark_pool_idle, 1);
+            *active = false;
+        }
+        bool done = bd == NULL && mark_pool_active == 0;
+        RELEASE_SPIN_LOCK(&mark_pool_lock);
+
+        if (bd != NULL) {
+            mark_queue_take_blocks(w->queue, bd);
+            w->steals++;
+            return true;
+        }
+
+        if (take_upd_rem_set(w->queue)) {
+            ACQUIRE_SPIN_LOCK(&mark_pool_lock);
+            mark_pool_active++;
+            atomic_dec(&mark_pool_idle);
+            *active = true;
+            RELEASE_SPIN_LOCK(&mark_pool_lock);
+            return true;
+        }
+
+        if (done) {
+            return false;
+        }
+        yieldThread();
+    }
+}
+
+static void
+mark_worker (MarkWorker *w)
+{
+    MarkQueue *queue = w->queue;
+    // Only the worker which called nonmovingMark starts out with work.
+    bool active = w->id == 0;
+
+    traceConcMarkWorkerBegin(w->id);
+    while (true) {
+        MarkQueueEnt ent = markQueuePop(queue);
+        if (nonmovingMarkQueueEntryType(&ent) != NULL_ENTRY) {
+            mark_entry(queue, &ent);
+            w->count++;
+            if (queue->blocks->link != NULL
+                && RELAXED_LOAD(&mark_pool_idle) > 0) {
+                share_mark_work(queue);
+            }
+        } else if (!find_mark_work(w, &active)) {
+            break;
+        }
+    }
+    traceConcMarkWorkerEnd(w->id, w->count, w->steals);
+}
+
+static void *
+mark_worker_thread (void *data)
+{
+    mark_worker((MarkWorker *) data);
+    return NULL;
+}
+
+/* Drain the mark queue with RtsFlags.ParFlags.nonmovingMarkWorkers workers,
+ * returning the number of entries marked.
+ */
+static unsigned int
+parallel_mark (MarkQueue *queue)
+{
+    uint32_t n = RtsFlags.ParFlags.nonmovingMarkWorkers;
+    MarkWorker *workers =
+        stgMallocBytes(n * sizeof(MarkWorker), "parallel_mark");
+    MarkQueue **queues =
+        stgMallocBytes((n - 1) * sizeof(MarkQueue *), "parallel_mark");
+
+    ACQUIRE_SM_LOCK;
+    for (uint32_t i = 0; i < n - 1; i++) {
+        queues[i] = stgMallocBytes(sizeof(MarkQueue), "parallel_mark");
+        initMarkQueue(queues[i]);
+    }
+    RELEASE_SM_LOCK;
+
+    ASSERT(nonmoving_mark_pool == NULL);
+    mark_pool_active = 1;
+    mark_pool_idle = n - 1;
+    nonmoving_mark_queues = queues;
+    n_nonmoving_mark_queues = n - 1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        workers[i] = (MarkWorker) {
+            .queue = i == 0 ? queue : queues[i - 1],
+            .id = i,
+            .count = 0,
+            .steals = 0,
+        };
+    }
+    for (uint32_t i = 1; i < n; i++) {
+        int r = createAttachedOSThread(&workers[i].thread,
+                                       "nonmoving mark worker",
+                                       mark_worker_thread, &workers[i]);
+        if (r != 0) {
+            barf("nonmovingMark: failed to spawn mark worker: %s",
+                 strerror(r));
+        }
+    }
+
+    mark_worker(&workers[0]);
+
+    unsigned int count = workers[0].count;
+    for (uint32_t i = 1; i < n; i++) {
+        joinOSThread(workers[i].thread);
+        count += workers[i].count;
+        queue->live_words += workers[i].queue->live_words;
+        ASSERT(markQueueIsEmpty(workers[i].queue));
+    }
+    ASSERT(nonmoving_mark_pool == NULL);
+    ASSERT(mark_pool_active == 0);
+
+    n_nonmoving_mark_queues = 0;
+    nonmoving_mark_queues = NULL;
+    for (uint32_t i = 0; i < n - 1; i++) {
+        freeMarkQueue(queues[i]);
+        stgFree(queues[i]);
+    }
+    stgFree(queues);
+    stgFree(workers);
+    return count;
+}
+#endif
+
 /* This is the main mark loop.
  * Invariants:
  *
@@ -1690,51 +2010,28 @@ nonmovingMark (MarkQueue *queue)
     traceConcMarkBegin();
     debugTrace(DEBUG_nonmoving_gc, "Starting mark pass");
     unsigned int count = 0;
-    while (true) {
-        count++;
-        MarkQueueEnt ent = markQueuePop(queue);
-
-        switch (nonmovingMarkQueueEntryType(&ent)) {
-        case MARK_CLOSURE:
-            mark_closure(queue, ent.mark_closure.p, ent.mark_closure.origin);
-            break;
-        case MARK_ARRAY: {
-            const StgMutArrPtrs *arr = (const StgMutArrPtrs *)
-                UNTAG_CLOSURE((StgClosure *) ent.mark_array.array);
-            StgWord start = ent.mark_array.start_index;
-            StgWord end = start + MARK_ARRAY_CHUNK_LENGTH;
-            if (end < arr->ptrs) {
-                // There is more to be marked after this chunk.
-                markQueuePushArray(queue, arr, end);
-            } else {
-                end = arr->ptrs;
-            }
-            for (StgWord i = start; i < end; i++) {
-                markQueuePushClosure_(queue, arr->payload[i]);
-            }
-            break;
-        }
-        case NULL_ENTRY:
-            // Perhaps the update remembered set has more to mark...
-            if (upd_rem_set_block_list) {
-                ACQUIRE_LOCK(&upd_rem_set_lock);
-                bdescr *old = queue->blocks;
-                queue->blocks = upd_rem_set_block_list;
-                queue->top = (MarkQueueBlock *) queue->blocks->start;
-                upd_rem_set_block_list = NULL;
-                RELEASE_LOCK(&upd_rem_set_lock);
-
-                ACQUIRE_SM_LOCK;
-                freeGroup(old);
-                RELEASE_SM_LOCK;
-            } else {
+#if defined(THREADED_RTS)
+    if (RtsFlags.ParFlags.nonmovingMarkWorkers > 1) {
+        count = parallel_mark(queue);
+    } else
+#endif
+    {
+        while (true) {
+            MarkQueueEnt ent = markQueuePop(queue);
+            if (nonmovingMarkQueueEntryType(&ent) != NULL_ENTRY) {
+                mark_entry(queue, &ent);
+                count++;
+            } else if (!take_upd_rem_set(queue)) {
                 // Nothing more to do
-                debugTrace(DEBUG_nonmoving_gc, "Finished mark pass: %d", count);
-                traceConcMarkEnd(count);
-                return;
+                break;
             }
         }
     }
+
+    nonmoving_live_words += queue->live_words;
+    queue->live_words = 0;
+    debugTrace(DEBUG_nonmoving_gc, "Finished mark pass: %d", count);
+    traceConcMarkEnd(count);
 }
 
 // A variant of `isAlive` that works for non-moving heap. Used for:
@@ -94,6 +94,10 @@ typedef struct MarkQueue_ {
     // Is this a mark queue or a capability-local update remembered set?
     bool is_upd_rem_set;
 
+    // Words marked through this queue during the current nonmovingMark pass.
+    // See Note [Parallel nonmoving mark] in NonMovingMark.c.
+    memcount live_words;
+
 #if MARK_PREFETCH_QUEUE_DEPTH > 0
     // A ring-buffer of entries which we will mark next
     MarkQueueEnt prefetch_queue[MARK_PREFETCH_QUEUE_DEPTH];
@@ -134,6 +138,14 @@ extern StgIndStatic *debug_caf_list_snapshot;
 extern MarkQueue *current_mark_queue;
 extern bdescr *upd_rem_set_block_list;
 
+#if defined(THREADED_RTS)
+// Mark queue blocks of a parallel mark pass, for the sanity checker.
+// See Note [Parallel nonmoving mark] in NonMovingMark.c.
+extern bdescr *nonmoving_mark_pool;
+extern MarkQueue **nonmoving_mark_queues;
+extern uint32_t n_nonmoving_mark_queues;
+#endif
+
 
 void nonmovingMarkInitUpdRemSet(void);
 
@@ -17,6 +17,9 @@
 #include "Trace.h"
 #include "StableName.h"
 #include "CNF.h" // compactFree
+#include "RtsUtils.h"
+
+#include <string.h>
 
 // On which list should a particular segment be placed?
 enum SweepResult {
@@ -127,33 +130,198 @@ clear_segment_free_blocks(struct NonmovingSegment* seg)
 
 #endif
 
-GNUC_ATTR_HOT void nonmovingSweep(void)
+/* Note [Parallel and lazy nonmoving sweep]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * Once marking has finished every segment on nonmovingHeap.sweep_list must be
+ * swept before it can be allocated into again. Left to the mark thread alone
+ * this is a serial walk of the whole list, during which the allocator keeps
+ * taking fresh segments even though plenty of the old ones may be empty. We
+ * shorten this window in two ways:
+ *
+ *  - With +RTS --nonmoving-sweep-workers=N (N > 1) nonmovingSweep spawns N-1
+ *    helper threads. The sweepers pop segments off sweep_list with a CAS and
+ *    push them onto the free/active/filled lists exactly as the single
+ *    threaded sweep does, so no further coordination is needed. A segment
+ *    never goes back onto sweep_list during a sweep, which rules out ABA on
+ *    the pop.
+ *
+ *  - From the moment nonmovingBeginSweep opens the sweep, nonmovingAllocate
+ *    itself may take segments off sweep_list when its allocator's active list
+ *    is empty (see nonmovingSweepOnDemand). It sweeps up to
+ *    NONMOVING_SWEEP_ON_DEMAND_BUDGET segments, keeping the first one it can
+ *    allocate into and putting the others where they belong.
+ *
+ * With +RTS --nonmoving-lazy-sweep the mark thread does not sweep at all and
+ * sweeping happens only on demand. Whatever is still unswept when the next
+ * collection starts is swept by nonmovingPrepareMark before it bumps the mark
+ * epoch, since the bitmaps of unswept segments are only meaningful relative
+ * to the epoch of the mark which produced them.
+ *
+ * The time spent sweeping is accounted per allocator in nonmovingSweepStats,
+ * reported for each sweep by nonmovingPrintSweepCensus (-Dn) and summed over
+ * all sweeps in the +RTS -s summary.
+ */
+
+#define NONMOVING_SWEEP_ON_DEMAND_BUDGET 8
+
+struct NonmovingSweepStats nonmovingSweepStats[NONMOVING_ALLOCA_CNT];
+
+// The sweeps before the current one
+static struct NonmovingSweepTotals sweep_totals[NONMOVING_ALLOCA_CNT];
+
+// Set by nonmovingBeginSweep once sweep_list may be swept by the allocator.
+static volatile bool nonmoving_sweep_open = false;
+
+static struct NonmovingSegment *pop_sweep_segment(void)
+{
+    while (true) {
+        struct NonmovingSegment *seg =
+            (struct NonmovingSegment *) VOLATILE_LOAD(&nonmovingHeap.sweep_list);
+        if (seg == NULL) {
+            return NULL;
+        }
+        if (cas((StgVolatilePtr) &nonmovingHeap.sweep_list,
+                (StgWord) seg,
+                (StgWord) seg->link) == (StgWord) seg) {
+            return seg;
+        }
+    }
+}
+
+static enum SweepResult sweep_segment(struct NonmovingSegment *seg)
 {
-    while (nonmovingHeap.sweep_list) {
-        struct NonmovingSegment *seg = nonmovingHeap.sweep_list;
+    struct NonmovingSweepStats *stats =
+        &nonmovingSweepStats[nonmovingSegmentLogBlockSize(seg) - NONMOVING_ALLOCA0];
+    StgWord64 start = getMonotonicNSec();
+    enum SweepResult ret = nonmovingSweepSegment(seg);
+    atomic_inc(&stats->sweep_ns, getMonotonicNSec() - start);
+    atomic_inc(&stats->n_segs, 1);
+    return ret;
+}
 
+static void place_segment(struct NonmovingSegment *seg, enum SweepResult ret)
+{
+    switch (ret) {
+    case SEGMENT_FREE:
+        IF_DEBUG(sanity, clear_segment(seg));
+        nonmovingPushFreeSegment(seg);
+        break;
+    case SEGMENT_PARTIAL:
+        IF_DEBUG(sanity, clear_segment_free_blocks(seg));
+        nonmovingPushActiveSegment(seg);
+        break;
+    case SEGMENT_FILLED:
+        nonmovingPushFilledSegment(seg);
+        break;
+    default:
+        barf("nonmovingSweep: weird sweep return: %d\n", ret);
+    }
+}
+
+static void sweep_segments(void)
+{
+    struct NonmovingSegment *seg;
+    while ((seg = pop_sweep_segment()) != NULL) {
         // Pushing the segment to one of the free/active/filled segments
-        // updates the link field, so update sweep_list here
-        nonmovingHeap.sweep_list = seg->link;
+        // updates the link field, which is why we pop it first.
+        place_segment(seg, sweep_segment(seg));
+    }
+}
 
-        enum SweepResult ret = nonmovingSweepSegment(seg);
+#if defined(THREADED_RTS)
+static void *
+sweep_worker_thread (void *data STG_UNUSED)
+{
+    sweep_segments();
+    return NULL;
+}
+#endif
+
+void nonmovingBeginSweep(void)
+{
+    // The previous sweep has finished, see nonmovingPrepareMark
+    for (int i = 0; i < NONMOVING_ALLOCA_CNT; i++) {
+        sweep_totals[i].n_segs += nonmovingSweepStats[i].n_segs;
+        sweep_totals[i].sweep_time += NSToTime(nonmovingSweepStats[i].sweep_ns);
+        nonmovingSweepStats[i] = (struct NonmovingSweepStats) { 0, 0 };
+    }
+    RELEASE_STORE(&nonmoving_sweep_open, true);
+}
+
+void nonmovingEndSweep(void)
+{
+    ASSERT(nonmovingHeap.sweep_list == NULL);
+    RELEASE_STORE(&nonmoving_sweep_open, false);
+}
 
-        switch (ret) {
-        case SEGMENT_FREE:
+// Must not be called while a sweep may be in progress.
+void getNonmovingSweepTotals(struct NonmovingSweepTotals *totals)
+{
+    for (int i = 0; i < NONMOVING_ALLOCA_CNT; i++) {
+        totals[i].n_segs =
+            sweep_totals[i].n_segs + nonmovingSweepStats[i].n_segs;
+        totals[i].sweep_time =
+            sweep_totals[i].sweep_time + NSToTime(nonmovingSweepStats[i].sweep_ns);
+    }
+}
+
+GNUC_ATTR_HOT void nonmovingSweep(void)
+{
+#if defined(THREADED_RTS)
+    uint32_t n = RtsFlags.ParFlags.nonmovingSweepWorkers;
+    if (n > 1 && nonmovingHeap.sweep_list != NULL) {
+        OSThreadId *threads =
+            stgMallocBytes((n - 1) * sizeof(OSThreadId), "nonmovingSweep");
+        for (uint32_t i = 0; i < n - 1; i++) {
+            int r = createAttachedOSThread(&threads[i],
+                                           "nonmoving sweep worker",
+                                           sweep_worker_thread, NULL);
+            if (r != 0) {
+                barf("nonmovingSweep: failed to spawn sweep worker: %s",
+                     strerror(r));
+            }
+        }
+        sweep_segments();
+        for (uint32_t i = 0; i < n - 1; i++) {
+            joinOSThread(threads[i]);
+        }
+        stgFree(threads);
+        return;
+    }
+#endif
+    sweep_segments();
+}
+
+/* Find a segment of the given block size to allocate into by sweeping
+ * segments off sweep_list. Returns NULL if the sweep is not open or nothing
+ * suitable was found within the budget. A free segment of a different size
+ * class may be returned; the caller must reinitialise it.
+ */
+struct NonmovingSegment *nonmovingSweepOnDemand(uint8_t log_block_size)
+{
+    if (!ACQUIRE_LOAD(&nonmoving_sweep_open)) {
+        return NULL;
+    }
+
+    for (int i = 0; i < NONMOVING_SWEEP_ON_DEMAND_BUDGET; i++) {
+        struct NonmovingSegment *seg = pop_sweep_segment();
+        if (seg == NULL) {
+            return NULL;
+        }
+
+        enum SweepResult ret = sweep_segment(seg);
+        if (ret == SEGMENT_FREE) {
             IF_DEBUG(sanity, clear_segment(seg));
-            nonmovingPushFreeSegment(seg);
-            break;
-        case SEGMENT_PARTIAL:
+            return seg;
+        } else if (ret == SEGMENT_PARTIAL
+                   && nonmovingSegmentLogBlockSize(seg) == log_block_size) {
             IF_DEBUG(sanity, clear_segment_free_blocks(seg));
-            nonmovingPushActiveSegment(seg);
-            break;
-        case SEGMENT_FILLED:
-            nonmovingPushFilledSegment(seg);
-            break;
-        default:
-            barf("nonmovingSweep: weird sweep return: %d\n", ret);
+            return seg;
+        } else {
+            place_segment(seg, ret);
         }
     }
+    return NULL;
 }
 
 /* Must a closure remain on the mutable list?
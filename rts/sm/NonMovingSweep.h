@@ -10,8 +10,33 @@
 
 #include "NonMoving.h"
 
+// Time spent sweeping the segments of one allocator during the current sweep.
+// See Note [Parallel and lazy nonmoving sweep] in NonMovingSweep.c.
+struct NonmovingSweepStats {
+    StgWord n_segs;      // segments swept
+    StgWord sweep_ns;    // nanoseconds spent sweeping them
+};
+
+// The same, summed over all sweeps so far, for +RTS -s
+struct NonmovingSweepTotals {
+    StgWord64 n_segs;
+    Time sweep_time;
+};
+
+extern struct NonmovingSweepStats nonmovingSweepStats[NONMOVING_ALLOCA_CNT];
+
+// Fill in the totals of each of the NONMOVING_ALLOCA_CNT allocators
+void getNonmovingSweepTotals(struct NonmovingSweepTotals *totals);
+
+// Open/close nonmovingHeap.sweep_list to sweeping by the allocator
+void nonmovingBeginSweep(void);
+void nonmovingEndSweep(void);
+
 GNUC_ATTR_HOT void nonmovingSweep(void);
 
+// Sweep segments off sweep_list until one can be allocated into
+struct NonmovingSegment *nonmovingSweepOnDemand(uint8_t log_block_size);
+
 // Remove unmarked entries in oldest generation mut_lists
 void nonmovingSweepMutLists(void);
 
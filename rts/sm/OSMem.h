@@ -24,6 +24,12 @@ uint32_t osNumaNodes(void);
 uint64_t osNumaMask(void);
 void osBindMBlocksToNode(void *addr, StgWord size, uint32_t node);
 
+// Huge pages, see Note [Huge page backed megablocks] in sm/MBlock.c.
+// osHugePageSize() is the size of the pages backing the heap when
+// RtsFlags.GcFlags.hugePages is set (at least MBLOCK_SIZE), and 0 otherwise.
+bool osHugePagesSupported(HUGE_PAGES kind);
+W_ osHugePageSize(void);
+
 INLINE_HEADER size_t
 roundDownToPage (size_t x)
 {
@@ -85,6 +91,17 @@ void osCommitMemory(void *p, W_ len);
 // from top are concerned).
 void osDecommitMemory(void *p, W_ len);
 
+// Map @len bytes of the open file @fd, starting at offset @off, over a
+// piece of committed address space. The mapping is private: writes to
+// it are not carried through to the file. @p and @off must be aligned
+// to the page size. Returns false, leaving the memory as it was, if the
+// file cannot be mapped.
+bool osMapFileMemory(void *p, W_ len, int fd, StgWord64 off);
+
+// Replace memory mapped with osMapFileMemory() by ordinary committed
+// memory again.
+void osUnmapFileMemory(void *p, W_ len);
+
 // Release the address space previously obtained and undo the effects of
 // osReserveHeapMemory
 //
@@ -0,0 +1,279 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2022
+ *
+ * Pretenuring of long-lived objects by allocation site.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "rts/PosixSource.h"
+#include "Rts.h"
+
+#include "Pretenure.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "Hash.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+/* Note [Pretenuring by allocation site]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   An object which survives its first GC is copied out of the nursery into
+   generation 1, and with three or more generations it is copied once more
+   into each older generation before it settles in the oldest one. For
+   objects that are going to live for the rest of the run (the contents of
+   a long-lived cache, say) all of this copying is wasted.
+
+   With --pretenure-survival=<pct> the collector learns which allocation
+   sites produce such objects. An allocation site is identified by the info
+   table of the objects it allocates; with -fdistinct-constructor-tables
+   each site gets its own info table, and -finfo-table-map gives it an IPE
+   entry (see Note [The Info Table Provenance Entry (IPE) Map] in IPE.c).
+   Only info tables which have an IPE entry are considered, so that
+   RTS-internal and library closures shared between many sites are never
+   pretenured.
+
+   Every PRETENURE_SAMPLE_PERIOD-th copy out of a younger generation is
+   recorded in the copying GC thread's sample buffer (pretenureDest, called
+   by alloc_for_copy in Evac.c). A sample is either
+
+     first  the object was copied out of generation 0, i.e. it survived
+            its first GC, or
+     again  the object was copied out of an intermediate generation, i.e.
+            it survived a further GC after being promoted.
+
+   At the end of the GC the samples are folded into a table of sites
+   (pretenureEndGC). The ratio again/first estimates how many of a site's
+   survivors go on to survive again; once it reaches <pct> percent over at
+   least PRETENURE_MIN_SAMPLES samples the site is pretenured, and
+   alloc_for_copy sends its objects straight from generation 0 to the
+   oldest generation. Pretenured sites live in a small open-addressing set
+   which is only rebuilt between GCs, so the GC threads can consult it
+   without synchronisation.
+
+   Pretenured objects no longer pass through the intermediate generations
+   and stop producing samples, so a site stays pretenured for the rest of
+   the run. The counts of other sites are halved every
+   PRETENURE_DECAY_SAMPLES samples so that a change of phase is noticed.
+
+   Each GC thread counts the objects it pretenures, and pretenureEndGC adds
+   them up for the +RTS -s report (getPretenureTotals).
+
+   With two generations objects are already copied straight into the
+   oldest one, so there are no "again" samples and the flag requires -G3 or
+   more.
+*/
+
+#define PRETENURE_MIN_SAMPLES   64
+#define PRETENURE_DECAY_SAMPLES 4096
+
+typedef struct {
+    const InfoProvEnt *ipe;    // NULL: not an allocation site we track
+    StgWord first;
+    StgWord again;
+    bool pretenured;
+} PretenureSite;
+
+// info pointer -> PretenureSite; only touched between GCs
+static HashTable *pretenure_sites = NULL;
+
+// the pretenured info pointers, read-only while the GC runs
+static const StgInfoTable **pretenured_set = NULL;
+static StgWord pretenured_mask = 0;
+static uint32_t n_pretenured = 0;
+
+// objects copied straight to the oldest generation, over the whole run
+static W_ total_pretenured_copies = 0;
+
+STATIC_INLINE StgWord
+info_hash (const StgInfoTable *info)
+{
+    StgWord w = (StgWord)info;
+    return (w >> 3) ^ (w >> 11);
+}
+
+static bool
+is_pretenured (const StgInfoTable *info)
+{
+    StgWord i;
+
+    if (pretenured_set == NULL) {
+        return false;
+    }
+    i = info_hash(info) & pretenured_mask;
+    while (pretenured_set[i] != NULL) {
+        if (pretenured_set[i] == info) {
+            return true;
+        }
+        i = (i + 1) & pretenured_mask;
+    }
+    return false;
+}
+
+/* Pick the generation to copy src to, given the generation alloc_for_copy
+ * was going to use, and sample the copy.  Called by the GC threads. */
+uint32_t
+pretenureDest (const StgInfoTable *info, StgClosure *src, uint32_t gen_no)
+{
+    uint32_t src_gen = Bdescr((StgPtr)src)->gen_no;
+
+    if (src_gen == 0) {
+        if (is_pretenured(info)) {
+            gct->pretenured_copies++;
+            return oldest_gen->no;
+        }
+    } else if (src_gen == oldest_gen->no) {
+        return gen_no;
+    }
+
+    if (--gct->pretenure_countdown != 0) {
+        return gen_no;
+    }
+    gct->pretenure_countdown = PRETENURE_SAMPLE_PERIOD;
+
+    if (gct->n_pretenure_samples < PRETENURE_SAMPLES) {
+        PretenureSample *s =
+            &gct->pretenure_samples[gct->n_pretenure_samples++];
+        s->info = info;
+        s->again = src_gen != 0;
+    }
+    return gen_no;
+}
+
+static void
+insert_pretenured (void *data STG_UNUSED, StgWord key, const void *value)
+{
+    const PretenureSite *site = value;
+    StgWord i;
+
+    if (!site->pretenured) {
+        return;
+    }
+    i = info_hash((const StgInfoTable *)key) & pretenured_mask;
+    while (pretenured_set[i] != NULL) {
+        i = (i + 1) & pretenured_mask;
+    }
+    pretenured_set[i] = (const StgInfoTable *)key;
+}
+
+static void
+rebuild_pretenured_set (void)
+{
+    StgWord size = 16;
+
+    while (size < 2 * (StgWord)n_pretenured) {
+        size *= 2;
+    }
+    stgFree(pretenured_set);
+    pretenured_set = stgCallocBytes(size, sizeof(StgInfoTable *),
+                                    "rebuild_pretenured_set");
+    pretenured_mask = size - 1;
+    mapHashTable(pretenure_sites, NULL, insert_pretenured);
+}
+
+static void
+add_sample (const PretenureSample *s)
+{
+    PretenureSite *site = lookupHashTable(pretenure_sites, (StgWord)s->info);
+
+    if (site == NULL) {
+        site = stgMallocBytes(sizeof(PretenureSite), "add_sample");
+        site->ipe = lookupIPE(s->info);
+        site->first = 0;
+        site->again = 0;
+        site->pretenured = false;
+        insertHashTable(pretenure_sites, (StgWord)s->info, site);
+    }
+
+    if (site->ipe == NULL || site->pretenured) {
+        return;
+    }
+
+    if (s->again) {
+        site->again++;
+    } else {
+        site->first++;
+    }
+
+    if (site->first >= PRETENURE_MIN_SAMPLES &&
+        site->again * 100 >=
+            (StgWord)RtsFlags.GcFlags.pretenureSurvival * site->first) {
+        site->pretenured = true;
+        n_pretenured++;
+        debugTrace(DEBUG_gc, "pretenuring %s (%s, %s): %" FMT_Word "/%"
+                   FMT_Word " survived again",
+                   site->ipe->prov.table_name, site->ipe->prov.module,
+                   site->ipe->prov.srcloc, site->again, site->first);
+    } else if (site->first >= PRETENURE_DECAY_SAMPLES) {
+        site->first /= 2;
+        site->again /= 2;
+    }
+}
+
+/* Fold the samples taken by all GC threads into the site table.  Called by
+ * the GC leader once the other GC threads have stopped copying. */
+void
+pretenureEndGC (void)
+{
+    uint32_t n, i, old_n_pretenured = n_pretenured;
+
+    if (pretenure_sites == NULL) {
+        pretenure_sites = allocHashTable();
+    }
+
+    for (n = 0; n < n_capabilities; n++) {
+        gc_thread *t = gc_threads[n];
+        for (i = 0; i < t->n_pretenure_samples; i++) {
+            add_sample(&t->pretenure_samples[i]);
+        }
+        t->n_pretenure_samples = 0;
+        total_pretenured_copies += t->pretenured_copies;
+        t->pretenured_copies = 0;
+    }
+
+    if (n_pretenured != old_n_pretenured) {
+        rebuild_pretenured_set();
+    }
+}
+
+void
+initPretenureSamples (gc_thread *t)
+{
+    t->n_pretenure_samples = 0;
+    t->pretenure_countdown = PRETENURE_SAMPLE_PERIOD;
+    t->pretenured_copies = 0;
+    if (RtsFlags.GcFlags.pretenureSurvival != 0) {
+        t->pretenure_samples =
+            stgMallocBytes(PRETENURE_SAMPLES * sizeof(PretenureSample),
+                           "initPretenureSamples");
+    } else {
+        t->pretenure_samples = NULL;
+    }
+}
+
+void
+freePretenureSamples (gc_thread *t)
+{
+    stgFree(t->pretenure_samples);
+    t->pretenure_samples = NULL;
+}
+
+void
+exitPretenure (void)
+{
+    if (pretenure_sites != NULL) {
+        freeHashTable(pretenure_sites, stgFree);
+        pretenure_sites = NULL;
+    }
+    stgFree(pretenured_set);
+    pretenured_set = NULL;
+    n_pretenured = 0;
+}
+
+void
+getPretenureTotals (W_ *objects, uint32_t *sites)
+{
+    *objects = total_pretenured_copies;
+    *sites = n_pretenured;
+}
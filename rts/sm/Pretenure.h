@@ -0,0 +1,32 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2022
+ *
+ * Pretenuring of long-lived objects by allocation site.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "BeginPrivate.h"
+
+struct gc_thread_;
+
+/* One sampled evacuation; see Note [Pretenuring by allocation site]. */
+typedef struct PretenureSample_ {
+    const StgInfoTable *info;
+    bool again;             // copied out of an intermediate generation
+} PretenureSample;
+
+#define PRETENURE_SAMPLES       1024   // per GC thread and GC
+#define PRETENURE_SAMPLE_PERIOD 16     // sample every n-th copy
+
+uint32_t pretenureDest    (const StgInfoTable *info, StgClosure *src,
+                           uint32_t gen_no);
+void     pretenureEndGC   (void);
+void     initPretenureSamples (struct gc_thread_ *t);
+void     freePretenureSamples (struct gc_thread_ *t);
+void     exitPretenure    (void);
+void     getPretenureTotals (W_ *objects, uint32_t *sites);
+
+#include "EndPrivate.h"
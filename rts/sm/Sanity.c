@@ -676,12 +676,7 @@ checkCompactObjects(bdescr *bd)
             totalW += Bdescr((P_)block)->blocks * BLOCK_SIZE_W;
 
             StgPtr start = Bdescr((P_)block)->start + sizeofW(StgCompactNFDataBlock);
-            StgPtr free;
-            if (Bdescr((P_)block)->start == (P_)str->nursery) {
-                free = str->hp;
-            } else {
-                free = Bdescr((P_)block)->free;
-            }
+            StgPtr free = Bdescr((P_)block)->free;
             StgPtr p = start;
             while (p < free)  {
                 // We can't use checkClosure() here because in
@@ -1034,7 +1029,7 @@ findMemoryLeak (void)
     }
 
     for (i = 0; i < n_capabilities; i++) {
-        markBlocks(gc_threads[i]->free_blocks);
+        markBlocks(capabilities[i]->block_cache.blocks);
         markBlocks(capabilities[i]->pinned_object_block);
         markBlocks(capabilities[i]->upd_rem_set.queue.blocks);
     }
@@ -1057,6 +1052,12 @@ findMemoryLeak (void)
         markNonMovingSegments(nonmovingHeap.free);
         if (current_mark_queue)
             markBlocks(current_mark_queue->blocks);
+#if defined(THREADED_RTS)
+        markBlocks(nonmoving_mark_pool);
+        for (j = 0; j < n_nonmoving_mark_queues; j++) {
+            markBlocks(nonmoving_mark_queues[j]->blocks);
+        }
+#endif
     }
 
 #if defined(PROFILING)
@@ -1128,6 +1129,12 @@ genBlocks (generation *gen)
         ret += countNonMovingHeap(&nonmovingHeap);
         if (current_mark_queue)
             ret += countBlocks(current_mark_queue->blocks);
+#if defined(THREADED_RTS)
+        ret += countBlocks(nonmoving_mark_pool);
+        for (uint32_t i = 0; i < n_nonmoving_mark_queues; i++) {
+            ret += countBlocks(nonmoving_mark_queues[i]->blocks);
+        }
+#endif
     } else {
         ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
         ASSERT(countCompactBlocks(gen->compact_objects) == gen->n_compact_blocks);
@@ -1184,8 +1191,8 @@ memInventory (bool show)
   uint32_t g, i;
   W_ gen_blocks[RtsFlags.GcFlags.generations];
   W_ nursery_blocks = 0, free_pinned_blocks = 0, retainer_blocks = 0,
-      arena_blocks = 0, exec_blocks = 0, gc_free_blocks = 0,
-      upd_rem_set_blocks = 0;
+      arena_blocks = 0, exec_blocks = 0, cached_blocks = 0,
+      upd_rem_set_blocks = 0, stream_blocks = 0;
   W_ live_blocks = 0, free_blocks = 0;
   bool leak;
 
@@ -1215,8 +1222,9 @@ memInventory (bool show)
       nursery_blocks += nurseries[i].n_blocks;
   }
   for (i = 0; i < n_capabilities; i++) {
-      W_ n = countBlocks(gc_threads[i]->free_blocks);
-      gc_free_blocks += n;
+      ASSERT(countBlocks(capabilities[i]->block_cache.blocks) ==
+             capabilities[i]->block_cache.n_blocks);
+      cached_blocks += capabilities[i]->block_cache.n_blocks;
       if (capabilities[i]->pinned_object_block != NULL) {
           nursery_blocks += capabilities[i]->pinned_object_block->blocks;
       }
@@ -1245,13 +1253,16 @@ memInventory (bool show)
   }
   upd_rem_set_blocks += countBlocks(upd_rem_set_block_list);
 
+  // count the blocks kept aside while reading compact regions
+  stream_blocks = countCompactStreamSpareBlocks();
+
   live_blocks = 0;
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
       live_blocks += gen_blocks[g];
   }
   live_blocks += nursery_blocks +
-               + retainer_blocks + arena_blocks + exec_blocks + gc_free_blocks
-               + upd_rem_set_blocks + free_pinned_blocks;
+               + retainer_blocks + arena_blocks + exec_blocks + cached_blocks
+               + upd_rem_set_blocks + free_pinned_blocks + stream_blocks;
 
 #define MB(n) (((double)(n) * BLOCK_SIZE_W) / ((1024*1024)/sizeof(W_)))
 
@@ -1278,12 +1289,14 @@ memInventory (bool show)
                  arena_blocks, MB(arena_blocks));
       debugBelch("  exec         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  exec_blocks, MB(exec_blocks));
-      debugBelch("  GC free pool : %5" FMT_Word " blocks (%6.1lf MB)\n",
-                 gc_free_blocks, MB(gc_free_blocks));
+      debugBelch("  block caches : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 cached_blocks, MB(cached_blocks));
       debugBelch("  free         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  free_blocks, MB(free_blocks));
       debugBelch("  UpdRemSet    : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  upd_rem_set_blocks, MB(upd_rem_set_blocks));
+      debugBelch("  compact read : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 stream_blocks, MB(stream_blocks));
       debugBelch("  total        : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  live_blocks + free_blocks, MB(live_blocks+free_blocks));
       if (leak) {
@@ -60,6 +60,7 @@
 #include "LdvProfile.h"
 #include "HeapUtils.h"
 #include "Hash.h"
+#include "RtsUtils.h"
 
 #include "sm/MarkWeak.h"
 #include "sm/NonMoving.h" // for nonmoving_set_closure_mark_bit
@@ -212,17 +213,21 @@ scavenge_compact(StgCompactNFData *str)
    Mutable arrays of pointers
    -------------------------------------------------------------------------- */
 
-StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
+// Scavenge cards [start, end) of a MUT_ARR_PTRS, setting the card table as we
+// go. Returns whether any of them still points into a younger generation.
+static bool
+scavenge_mut_arr_ptrs_cards (StgMutArrPtrs *a, W_ start, W_ end)
 {
     W_ m;
     bool any_failed;
     StgPtr p, q;
 
     any_failed = false;
-    p = (StgPtr)&a->payload[0];
-    for (m = 0; (int)m < (int)mutArrPtrsCards(a->ptrs) - 1; m++)
+    p = (StgPtr)&a->payload[start << MUT_ARR_PTRS_CARD_BITS];
+    for (m = start; m < end; m++)
     {
-        q = p + (1 << MUT_ARR_PTRS_CARD_BITS);
+        q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
+                    (StgPtr)&a->payload[a->ptrs]);
         for (; p < q; p++) {
             evacuate((StgClosure**)p);
         }
@@ -235,51 +240,56 @@ StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
         }
     }
 
-    q = (StgPtr)&a->payload[a->ptrs];
-    if (p < q) {
-        for (; p < q; p++) {
-            evacuate((StgClosure**)p);
-        }
-        if (gct->failed_to_evac) {
-            any_failed = true;
-            *mutArrPtrsCard(a,m) = 1;
-            gct->failed_to_evac = false;
-        } else {
-            *mutArrPtrsCard(a,m) = 0;
-        }
-    }
+    return any_failed;
+}
 
-    gct->failed_to_evac = any_failed;
+StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
+{
+    gct->failed_to_evac =
+        scavenge_mut_arr_ptrs_cards(a, 0, mutArrPtrsCards(a->ptrs));
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
 
-// scavenge only the marked areas of a MUT_ARR_PTRS
-static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
+// scavenge the marked cards in [start_card, end_card) of a MUT_ARR_PTRS,
+// returning true if any of them still points into a younger generation.
+//
+// Writes to a large array are usually sparse, so most of its card table is
+// clear. We test the table a word (sizeof(W_) cards) at a time and only look
+// at the individual cards of words that have some card set. The table starts
+// on a word boundary directly after the payload; any padding after the last
+// card is never scavenged. start_card must be a multiple of sizeof(W_).
+static bool scavenge_mut_arr_ptrs_marked_cards (StgMutArrPtrs *a,
+                                                W_ start_card, W_ end_card)
 {
-    W_ m;
-    StgPtr p, q;
+    const StgWord *card_words = (StgWord *)mutArrPtrsCard(a,0);
+    W_ m, w, end;
     bool any_failed;
 
+    ASSERT(start_card % sizeof(W_) == 0);
+
     any_failed = false;
-    for (m = 0; m < mutArrPtrsCards(a->ptrs); m++)
+    for (w = start_card / sizeof(W_); w * sizeof(W_) < end_card; w++)
     {
-        if (*mutArrPtrsCard(a,m) != 0) {
-            p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
-            q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
-                        (StgPtr)&a->payload[a->ptrs]);
-            for (; p < q; p++) {
-                evacuate((StgClosure**)p);
-            }
-            if (gct->failed_to_evac) {
+        if (card_words[w] == 0) {
+            continue;
+        }
+        end = stg_min((w + 1) * sizeof(W_), end_card);
+        for (m = w * sizeof(W_); m < end; m++) {
+            if (*mutArrPtrsCard(a,m) != 0 &&
+                scavenge_mut_arr_ptrs_cards(a, m, m + 1)) {
                 any_failed = true;
-                gct->failed_to_evac = false;
-            } else {
-                *mutArrPtrsCard(a,m) = 0;
             }
         }
     }
 
-    gct->failed_to_evac = any_failed;
+    return any_failed;
+}
+
+// scavenge only the marked areas of a MUT_ARR_PTRS
+static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
+{
+    gct->failed_to_evac =
+        scavenge_mut_arr_ptrs_marked_cards(a, 0, mutArrPtrsCards(a->ptrs));
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
 
@@ -409,6 +419,92 @@ scavenge_fun_srt(const StgInfoTable *info)
     }
 }
 
+/* Note [Scavenge prefetching]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   scavenge_block walks the objects of a to-space block in order and
+   evacuates what each of them points to. On large pointer-heavy heaps nearly
+   every one of those evacuations starts with a cache miss on the referenced
+   object's header (and on its block descriptor), and the misses are taken
+   one at a time.
+
+   With +RTS --scav-prefetch-depth=N (N > 0) scavenge_block keeps a window of
+   the next N objects of the block, [p, ahead). Each object entering the
+   window has the headers and block descriptors of the objects it points to
+   prefetched (see prefetch_closure_referents), so that by the time the
+   scavenger reaches it the misses have been overlapped with the work on the
+   objects before it. This is the same idea as the nonmoving marker's
+   MARK_PREFETCH_QUEUE_DEPTH queue, except that to-space is already in the
+   order we want to visit it, so the window needs no storage of its own.
+
+   Only the objects up to the current end of the block can enter the window;
+   objects copied into the block while we scavenge it enter as the window
+   slides forward. Evacuation itself is not reordered, so failed_to_evac and
+   eager promotion behave exactly as without prefetching.
+
+   +RTS -s reports how many objects entered the window over the run
+   (scav_prefetched_objects).
+   -------------------------------------------------------------------------- */
+
+// The most referents of a single object that we prefetch.
+#define SCAV_PREFETCH_PTRS 4
+
+STATIC_INLINE void
+prefetch_referent (StgClosure *q)
+{
+    q = UNTAG_CLOSURE(q);
+    prefetchForRead(&q->header.info);
+    prefetchForRead(Bdescr((StgPtr) q));
+}
+
+STATIC_INLINE void
+prefetch_closure_referents (const StgClosure *p, const StgInfoTable *info)
+{
+    StgClosure * const *payload;
+    uint32_t ptrs;
+
+    switch (info->type) {
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_2_0:
+    case FUN_1_1:
+    case FUN_0_2:
+    case CONSTR:
+    case CONSTR_NOCAF:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+        payload = p->payload;
+        ptrs = info->layout.payload.ptrs;
+        break;
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_2_0:
+    case THUNK_1_1:
+    case THUNK_0_2:
+        payload = ((StgThunk *) p)->payload;
+        ptrs = info->layout.payload.ptrs;
+        break;
+    case IND:
+    case BLACKHOLE:
+        prefetch_referent(((StgInd *) p)->indirectee);
+        return;
+    case MUT_VAR_CLEAN:
+    case MUT_VAR_DIRTY:
+        prefetch_referent(((StgMutVar *) p)->var);
+        return;
+    default:
+        return;
+    }
+
+    for (uint32_t i = 0; i < ptrs && i < SCAV_PREFETCH_PTRS; i++) {
+        prefetch_referent(payload[i]);
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Scavenge a block from the given scan pointer up to bd->free.
 
@@ -428,6 +524,10 @@ scavenge_block (bdescr *bd)
   const StgInfoTable *info;
   bool saved_eager_promotion;
   gen_workspace *ws;
+  StgPtr ahead;        // end of the prefetch window
+  uint32_t n_ahead;    // objects in [p, ahead)
+  StgWord n_prefetched = 0;
+  const uint32_t prefetch_depth = RtsFlags.GcFlags.scavPrefetchDepth;
 
   debugTrace(DEBUG_gc, "scavenging block %p (gen %d) @ %p",
              bd->start, bd->gen_no, bd->u.scan);
@@ -440,6 +540,8 @@ scavenge_block (bdescr *bd)
   ws = &gct->gens[bd->gen_no];
 
   p = bd->u.scan;
+  ahead = p;
+  n_ahead = 0;
 
   // Sanity check: See Note [Deadlock detection under nonmoving collector].
 #if defined(DEBUG)
@@ -456,6 +558,24 @@ scavenge_block (bdescr *bd)
 
     ASSERT(bd->link == NULL);
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
+
+    // Slide the prefetch window; see Note [Scavenge prefetching].
+    if (prefetch_depth > 0) {
+        StgPtr limit = bd->free;
+        if (bd == ws->todo_bd && ws->todo_free > limit) {
+            limit = ws->todo_free;
+        }
+        while (n_ahead < prefetch_depth && ahead < limit) {
+            const StgInfoTable *ahead_info = get_itbl((StgClosure *)ahead);
+            prefetch_closure_referents((StgClosure *)ahead, ahead_info);
+            ahead += closure_sizeW_((StgClosure *)ahead, ahead_info);
+            n_ahead++;
+            n_prefetched++;
+        }
+        ASSERT(n_ahead > 0);
+        n_ahead--;
+    }
+
     info = get_itbl((StgClosure *)p);
 
     ASSERT(gct->thunk_selector_depth == 0);
@@ -853,6 +973,9 @@ scavenge_block (bdescr *bd)
   // update stats: this is a block that has been scavenged
   gct->scanned += bd->free - bd->u.scan;
   bd->u.scan = bd->free;
+  if (n_prefetched > 0) {
+      atomic_inc(&scav_prefetched_objects, n_prefetched);
+  }
 
   if (bd != ws->todo_bd) {
       // we're not going to evac any more objects into
@@ -1581,6 +1704,166 @@ scavenge_one(StgPtr p)
     return (no_luck);
 }
 
+#if defined(PARALLEL_GC)
+/* Note [Splitting large arrays]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A large object is normally scavenged in one go by the GC thread that
+   evacuated it. For a MUT_ARR_PTRS of many millions of elements that can
+   keep one thread busy long after all of the others have run out of work.
+
+   So when work stealing is enabled, scavenge_large doesn't scavenge arrays
+   of at least ARRAY_SPLIT_MIN_CARDS cards itself. Instead it pushes them
+   onto array_scav_work and wakes up an idle GC thread. Any GC thread
+   (including the one that pushed it) can then take ARRAY_CHUNK_CARDS cards
+   at a time from the array at the head of the list in scavenge_find_work.
+   It does this once it has run out of local work and before it tries to
+   steal blocks. Each chunk updates its own cards of the card table, exactly
+   as scavenge_mut_arr_ptrs would.
+
+   A dirty MUT_ARR_PTRS in an older generation reaches the GC through the
+   mutable list instead, and scavenge_mutable_list only looks at its marked
+   cards. Large arrays found there are split in the same way, with
+   marked_only set so that each chunk skips its clear cards just as
+   scavenge_mut_arr_ptrs_marked does. ARRAY_CHUNK_CARDS is a multiple of
+   sizeof(W_), so every chunk starts on a word of the card table.
+
+   The header (clean or dirty) and the array's place on the mutable list
+   depend on all of the chunks. Every chunk that fails to evacuate something
+   sets any_failed. The thread that finishes the last chunk, as counted by
+   chunks_left, then fixes up the header, records the array if
+   scavenge_one would have done so, and frees the ArrayScavWork.
+
+   A GC thread only goes idle once it has finished every chunk it took, and
+   a chunk is only taken while its thread is running, so
+   Note [Synchronising work stealing] needs no changes: a GC can't end while
+   a chunk is outstanding.
+   -------------------------------------------------------------------------- */
+
+#define ARRAY_CHUNK_CARDS 64
+#define ARRAY_SPLIT_MIN_CARDS (4 * ARRAY_CHUNK_CARDS)
+
+// Hand a large array in generation gen_no over to array_scav_work, if it is
+// worth splitting. If marked_only is set only its marked cards will be
+// scavenged. Returns false if the caller should scavenge it itself.
+static bool
+split_large_array (StgPtr p, uint32_t gen_no, bool marked_only)
+{
+    StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+    const StgInfoTable *info = get_itbl((StgClosure *)p);
+    bool is_mutable;
+
+    switch (info->type) {
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+        is_mutable = true;
+        break;
+    case MUT_ARR_PTRS_FROZEN_CLEAN:
+    case MUT_ARR_PTRS_FROZEN_DIRTY:
+        is_mutable = false;
+        break;
+    default:
+        return false;
+    }
+
+    if (!work_stealing || mutArrPtrsCards(a->ptrs) < ARRAY_SPLIT_MIN_CARDS) {
+        return false;
+    }
+
+    ArrayScavWork *w = stgMallocBytes(sizeof(ArrayScavWork),
+                                      "split_large_array");
+    w->arr = a;
+    w->gen_no = gen_no;
+    w->is_mutable = is_mutable;
+    w->marked_only = marked_only;
+    w->n_cards = mutArrPtrsCards(a->ptrs);
+    w->next_card = 0;
+    w->chunks_left = (w->n_cards + ARRAY_CHUNK_CARDS - 1) / ARRAY_CHUNK_CARDS;
+    w->any_failed = 0;
+
+    ACQUIRE_SPIN_LOCK(&array_scav_work_sync);
+    w->link = array_scav_work;
+    array_scav_work = w;
+    RELEASE_SPIN_LOCK(&array_scav_work_sync);
+
+    debugTrace(DEBUG_gc, "splitting array %p (%" FMT_Word " cards)",
+               a, w->n_cards);
+    notifyTodoBlock();
+    return true;
+}
+
+// Take a chunk of cards from array_scav_work and scavenge it. Returns false
+// if there was nothing to take.
+static bool
+scavenge_array_chunk (void)
+{
+    ArrayScavWork *w;
+    W_ start, end;
+    bool more;
+
+    if (RELAXED_LOAD(&array_scav_work) == NULL) {
+        return false;
+    }
+
+    ACQUIRE_SPIN_LOCK(&array_scav_work_sync);
+    w = array_scav_work;
+    if (w == NULL) {
+        RELEASE_SPIN_LOCK(&array_scav_work_sync);
+        return false;
+    }
+    start = w->next_card;
+    end = stg_min(start + ARRAY_CHUNK_CARDS, w->n_cards);
+    w->next_card = end;
+    if (end == w->n_cards) {
+        // every chunk of this array has been handed out
+        array_scav_work = w->link;
+    }
+    more = array_scav_work != NULL;
+    RELEASE_SPIN_LOCK(&array_scav_work_sync);
+
+    if (more) {
+        notifyTodoBlock();
+    }
+
+    // We don't eagerly promote objects pointed to by a mutable array; see
+    // the MUT_ARR_PTRS case of scavenge_one.
+    bool saved_eager_promotion = gct->eager_promotion;
+    gct->evac_gen_no = w->gen_no;
+    if (w->is_mutable) {
+        gct->eager_promotion = false;
+    }
+    bool chunk_failed = w->marked_only
+        ? scavenge_mut_arr_ptrs_marked_cards(w->arr, start, end)
+        : scavenge_mut_arr_ptrs_cards(w->arr, start, end);
+    if (chunk_failed) {
+        RELAXED_STORE(&w->any_failed, 1);
+    }
+    gct->eager_promotion = saved_eager_promotion;
+
+    // atomic_dec is a full barrier, so the last thread sees every any_failed
+    if (atomic_dec(&w->chunks_left) == 0) {
+        StgClosure *arr = (StgClosure *)w->arr;
+        bool failed = RELAXED_LOAD(&w->any_failed) != 0;
+        bool record;
+        if (w->is_mutable) {
+            RELEASE_STORE(&arr->header.info, failed
+                          ? &stg_MUT_ARR_PTRS_DIRTY_info
+                          : &stg_MUT_ARR_PTRS_CLEAN_info);
+            record = true;
+        } else {
+            RELEASE_STORE(&arr->header.info, failed
+                          ? &stg_MUT_ARR_PTRS_FROZEN_DIRTY_info
+                          : &stg_MUT_ARR_PTRS_FROZEN_CLEAN_info);
+            record = failed;
+        }
+        if (record && w->gen_no > 0) {
+            recordMutableGen_GC(arr, w->gen_no);
+        }
+        stgFree(w);
+    }
+    return true;
+}
+#endif
+
 /* -----------------------------------------------------------------------------
    Scavenging mutable lists.
 
@@ -1654,6 +1937,12 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
                 continue;
             case MUT_ARR_PTRS_DIRTY:
             {
+#if defined(PARALLEL_GC)
+                // See Note [Splitting large arrays].
+                if (split_large_array(p, gen_no, true)) {
+                    continue;
+                }
+#endif
                 bool saved_eager_promotion;
                 saved_eager_promotion = gct->eager_promotion;
                 gct->eager_promotion = false;
@@ -2036,6 +2325,14 @@ scavenge_large (gen_workspace *ws)
         }
         RELEASE_SPIN_LOCK(&ws->gen->sync);
 
+#if defined(PARALLEL_GC)
+        // See Note [Splitting large arrays].
+        if (!(bd->flags & BF_COMPACT) && split_large_array(p, ws->gen->no, false)) {
+            gct->scanned += closure_sizeW((StgClosure*)p);
+            continue;
+        }
+#endif
+
         if (scavenge_one(p)) {
             if (ws->gen->no > 0) {
                 recordMutableGen_GC((StgClosure *)p, ws->gen->no);
@@ -2123,6 +2420,14 @@ loop:
         goto loop;
     }
 
+#if defined(PARALLEL_GC)
+    // See Note [Splitting large arrays].
+    if (scavenge_array_chunk()) {
+        did_anything = true;
+        goto loop;
+    }
+#endif
+
 #if defined(THREADED_RTS)
     if (work_stealing) {
         // look for work to steal
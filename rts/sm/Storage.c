@@ -42,6 +42,7 @@
 #include "GC.h"
 #include "Evac.h"
 #include "NonMoving.h"
+#include "Pretenure.h"
 #if defined(ios_HOST_OS) || defined(darwin_HOST_OS)
 #include "Hash.h"
 #endif
@@ -349,6 +350,7 @@ void
 freeStorage (bool free_heap)
 {
     stgFree(generations);
+    stopDecommitThread();
     if (free_heap) freeAllMBlocks();
 #if defined(THREADED_RTS)
     closeMutex(&sm_mutex);
@@ -358,6 +360,7 @@ freeStorage (bool free_heap)
     freeThreadLocalKey(&gctKey);
 #endif
     freeGcThreads();
+    exitPretenure();
 }
 
 static void
@@ -1143,10 +1146,8 @@ allocateMightFail (Capability *cap, W_ n)
         if (bd == NULL) {
             // The nursery is empty: allocate a fresh block (we can't
             // fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlockOnNode(cap->node);
+            bd = allocBlockOnCap_lock(cap);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
@@ -487,6 +487,19 @@ void osDecommitMemory (void *at, W_ size)
     }
 }
 
+bool osMapFileMemory (void *at STG_UNUSED, W_ size STG_UNUSED,
+                      int fd STG_UNUSED, StgWord64 off STG_UNUSED)
+{
+    // MapViewOfFileEx cannot map into address space we have already
+    // reserved, so the caller has to read the file instead.
+    return false;
+}
+
+void osUnmapFileMemory (void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+    barf("osUnmapFileMemory: no file is mapped on Windows");
+}
+
 void osReleaseHeapMemory (void)
 {
     VirtualFree(heap_base, 0, MEM_RELEASE);
@@ -494,6 +507,18 @@ void osReleaseHeapMemory (void)
 
 #endif
 
+bool osHugePagesSupported(HUGE_PAGES kind)
+{
+    // Large pages need SeLockMemoryPrivilege on Windows, which we
+    // cannot expect programs to hold.
+    return kind == HUGE_PAGES_NONE;
+}
+
+W_ osHugePageSize(void)
+{
+    return 0;
+}
+
 bool osBuiltWithNumaSupport(void)
 {
     return true;
@@ -64,6 +64,46 @@ createOSThread (OSThreadId* pId, char *name STG_UNUSED,
     }
 }
 
+/* The threads created by createAttachedOSThread, with the handles that
+ * joinOSThread waits on. */
+typedef struct AttachedThread_ {
+    OSThreadId id;
+    HANDLE handle;
+    struct AttachedThread_ *next;
+} AttachedThread;
+
+static AttachedThread *attached_threads = NULL;
+static SRWLOCK attached_threads_lock = SRWLOCK_INIT;
+
+int
+createAttachedOSThread (OSThreadId* pId, char *name STG_UNUSED,
+                        OSThreadProc *startProc, void *param)
+{
+    AttachedThread *t;
+    HANDLE h;
+
+    t = stgMallocBytes(sizeof(AttachedThread), "createAttachedOSThread");
+    h = CreateThread ( NULL,  /* default security attributes */
+                       0,
+                       (LPTHREAD_START_ROUTINE)(void*)startProc,
+                       param,
+                       0,
+                       pId);
+
+    if (h == 0) {
+        stgFree(t);
+        return 1;
+    }
+
+    t->id = *pId;
+    t->handle = h;
+    AcquireSRWLockExclusive(&attached_threads_lock);
+    t->next = attached_threads;
+    attached_threads = t;
+    ReleaseSRWLockExclusive(&attached_threads_lock);
+    return 0;
+}
+
 OSThreadId
 osThreadId()
 {
@@ -447,15 +487,31 @@ interruptOSThread (OSThreadId id)
 void
 joinOSThread (OSThreadId id)
 {
+    AttachedThread **p, *t = NULL;
     HANDLE hdl;
-    if (!(hdl = OpenThread(SYNCHRONIZE,FALSE,id))) {
-        sysErrorBelch("interruptOSThread: OpenThread");
+
+    AcquireSRWLockExclusive(&attached_threads_lock);
+    for (p = &attached_threads; *p != NULL; p = &(*p)->next) {
+        if ((*p)->id == id) {
+            t = *p;
+            *p = t->next;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&attached_threads_lock);
+
+    if (t != NULL) {
+        hdl = t->handle;
+        stgFree(t);
+    } else if (!(hdl = OpenThread(SYNCHRONIZE,FALSE,id))) {
+        sysErrorBelch("joinOSThread: OpenThread");
         stg_exit(EXIT_FAILURE);
     }
     int ret = WaitForSingleObject(hdl, INFINITE);
     if (ret != WAIT_OBJECT_0) {
         sysErrorBelch("joinOSThread: error %d", ret);
     }
+    CloseHandle(hdl);
 }
 
 void setThreadNode (uint32_t node)
@@ -0,0 +1,19 @@
+-- Capabilities emit events concurrently while the eventlog is written by the
+-- writer thread (--eventlog-async). The test only checks that the program
+-- survives both back-pressure policies with very small rings; see all.T.
+import Control.Concurrent
+import Control.Monad
+import Debug.Trace
+
+main :: IO ()
+main = do
+  n <- getNumCapabilities
+  dones <- forM [1 .. n * 2] $ \i -> do
+    done <- newEmptyMVar
+    _ <- forkOn i $ do
+      forM_ [1 .. 20000 :: Int] $ \j ->
+        traceEventIO ("worker " ++ show i ++ " event " ++ show j)
+      putMVar done ()
+    return done
+  mapM_ takeMVar dones
+  putStrLn "done"
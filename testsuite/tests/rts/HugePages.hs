@@ -0,0 +1,12 @@
+import Control.Monad
+import Data.List (foldl')
+import System.Mem
+
+-- Grow and shrink the heap a few times, so that megablocks are committed,
+-- decommitted and reused with --huge-pages.
+main :: IO ()
+main = forM_ [1 .. 4 :: Int] $ \i -> do
+  let n = 500000 * i
+      xs = [1 .. n]
+  print (foldl' (+) 0 xs + length xs == n * (n + 3) `div` 2)
+  performMajorGC
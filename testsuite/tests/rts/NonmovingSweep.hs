@@ -0,0 +1,30 @@
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+data Small = Small !Int
+data Big = Big !Int !Int !Int !Int !Int !Int !Int !Int
+
+-- Fill the nonmoving heap with objects of a few size classes, drop most of
+-- them and keep allocating, so that the allocator has to reuse swept (or, with
+-- --nonmoving-lazy-sweep, not yet swept) segments while the survivors must
+-- stay intact.
+main :: IO ()
+main = do
+  smalls <- newIORef []
+  bigs <- newIORef []
+  forM_ [1 .. 8 :: Int] $ \r -> do
+    forM_ [1 .. 20000 :: Int] $ \i -> do
+      modifyIORef' smalls (Small i :)
+      modifyIORef' bigs (Big i i i i i i i r :)
+    performMajorGC
+    modifyIORef' smalls (everyNth 16)
+    modifyIORef' bigs (everyNth 16)
+    performMajorGC
+  ss <- readIORef smalls
+  bs <- readIORef bigs
+  print (sum [ n | Small n <- ss ])
+  print (sum [ a + h | Big a _ _ _ _ _ _ h <- bs ])
+
+everyNth :: Int -> [a] -> [a]
+everyNth n xs = [ x | (k, x) <- zip [0 :: Int ..] xs, k `mod` n == 0 ]
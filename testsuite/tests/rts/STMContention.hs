@@ -0,0 +1,30 @@
+-- One long transaction competing with many short ones which keep updating
+-- a TVar it reads. Under any --stm-contention policy all of them must
+-- eventually commit, and the counts must add up.
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+nShort, nShortTxs, nLong, nVars :: Int
+nShort    = 4
+nShortTxs = 5000
+nLong     = 200
+nVars     = 100
+
+main :: IO ()
+main = do
+  counter <- newTVarIO (0 :: Int)
+  vars <- replicateM nVars (newTVarIO (0 :: Int))
+  done <- newEmptyMVar
+  forM_ [1 .. nShort] $ \_ -> forkIO $ do
+    replicateM_ nShortTxs $ atomically $ readTVar counter >>= writeTVar counter . (+ 1)
+    putMVar done ()
+  forkIO $ do
+    replicateM_ nLong $ atomically $ do
+      _ <- readTVar counter
+      forM_ vars $ \v -> readTVar v >>= writeTVar v . (+ 1)
+    putMVar done ()
+  replicateM_ (nShort + 1) (takeMVar done)
+  c <- readTVarIO counter
+  vs <- mapM readTVarIO vars
+  print (c == nShort * nShortTxs, all (== nLong) vs)
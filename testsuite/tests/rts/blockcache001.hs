@@ -0,0 +1,26 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+-- Several threads write to IORefs that live in the old generation, which
+-- fills their capabilities' mutable lists, while allocating enough to GC
+-- often.  New mutable list blocks, nursery blocks and to-space blocks all
+-- come from the per-capability block caches.
+
+worker :: Int -> IO Int
+worker w = do
+  refs <- forM [1 .. 5000] newIORef
+  performGC
+  forM_ [1 .. 50] $ \r -> do
+    forM_ refs $ \ref -> modifyIORef' ref (+ (w + r))
+    when (r `mod` 10 == 0) performMinorGC
+  sum <$> mapM readIORef refs
+
+main :: IO ()
+main = do
+  results <- forM [1 .. 8] $ \w -> do
+    mv <- newEmptyMVar
+    _ <- forkIO (worker w >>= putMVar mv)
+    return mv
+  mapM takeMVar results >>= print
@@ -0,0 +1,25 @@
+import Control.Monad
+import Data.Array.IO
+import System.Environment
+import System.Mem
+
+-- Sparse writes to a large boxed array that lives in the old generation,
+-- each round followed by a minor GC, which has to find the few dirty cards.
+-- The array size, the distance between two writes and the number of rounds
+-- may be given on the command line; run with +RTS -s to compare the GC time
+-- for different sizes and write densities.
+main :: IO ()
+main = do
+  args <- getArgs
+  let (n, stride, rounds) = case map read args of
+        [a, b, c] -> (a, b, c)
+        _         -> (1000000, 997, 100)
+  arr <- newArray (0, n - 1) 0 :: IO (IOArray Int Int)
+  performMajorGC
+  forM_ [1 .. rounds] $ \r -> do
+    forM_ [0 .. n `div` stride - 1] $ \k ->
+      writeArray arr ((k * stride + r) `mod` n) (r * k + 1)
+    performMinorGC
+  xs <- getElems arr
+  print (sum xs `mod` 1000000007)
+  print (length (filter (/= 0) xs))
@@ -0,0 +1,32 @@
+import Control.Monad
+import Data.IORef
+import Data.List (foldl')
+import System.Mem
+
+data Tree = Leaf | Node Tree !Int Tree
+
+build :: Int -> Int -> Tree
+build lo hi
+  | lo > hi   = Leaf
+  | otherwise = let m = (lo + hi) `div` 2
+                in Node (build lo (m - 1)) m (build (m + 1) hi)
+
+total :: Tree -> Int
+total Leaf = 0
+total (Node l n r) = total l + n + total r
+
+-- Keeps a large tree and a set of mutable references alive across major
+-- collections, dropping half of the references between them, so that the
+-- compacting collector has to slide live data past garbage in many blocks.
+main :: IO ()
+main = do
+  let t = build 1 200000
+  refs <- forM [1..50000 :: Int] $ \i -> newIORef (show i)
+  print (total t)
+  live <- forM (zip [1..] refs) $ \(i, r) ->
+    if even (i :: Int) then return (Just r) else return Nothing
+  let kept = [ r | Just r <- live ]
+  replicateM_ 3 performMajorGC
+  xs <- mapM readIORef kept
+  print (foldl' (\acc s -> acc + length s) 0 xs)
+  print (total t `mod` 1000003)
@@ -0,0 +1,27 @@
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import GHC.Stats
+import System.Mem
+
+-- Grow the heap, drop the data and collect. The memory that the heap no
+-- longer needs must then be retained, as --decommit-rate limits how fast the
+-- background thread may return it to the OS, and eventually all of it must
+-- have been released.
+
+waitDrained :: Int -> IO Bool
+waitDrained 0 = return False
+waitDrained n = do
+  s <- getRTSStats
+  if mem_retained_bytes s == 0
+    then return (mem_released_bytes s > 0)
+    else threadDelay 100000 >> waitDrained (n - 1)
+
+main :: IO ()
+main = do
+  let xs = [1 .. 4000000] :: [Int]
+  _ <- evaluate (sum (reverse xs))
+  replicateM_ 4 performMajorGC
+  s <- getRTSStats
+  print (mem_retained_bytes s > 0)
+  waitDrained 600 >>= print
@@ -0,0 +1,59 @@
+-- Lots of threads sleeping in threadDelay at once, some of them cancelled by
+-- timeout, which stresses the sleeping threads of the non-threaded RTS (see
+-- Note [Timer wheel for sleeping threads] in rts/posix/Select.c). Checks
+-- that no thread wakes up before its delay is over.
+--
+-- Run with an argument "bench <threads>" to time it.
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Clock
+import System.Environment
+import System.Timeout
+import Text.Printf
+
+rounds :: Int
+rounds = 5
+
+-- A delay in microseconds, up to 50ms
+delayFor :: Int -> Int -> Int
+delayFor i r = (i * 7919 + r * 104729) `mod` 50000
+
+sleeper :: IORef Int -> MVar () -> Int -> IO ()
+sleeper early done i = do
+    forM_ [1 .. rounds] $ \r -> do
+      let d = delayFor i r
+      start <- getMonotonicTimeNSec
+      if even (i + r)
+        then threadDelay d
+        -- the timeout fires first, and cancels the longer delay
+        else void $ timeout d (threadDelay (d + 1000000))
+      end <- getMonotonicTimeNSec
+      when (fromIntegral (end - start) < d * 1000) $
+        atomicModifyIORef' early (\n -> (n + 1, ()))
+    putMVar done ()
+
+run :: Int -> IO Int
+run n = do
+    early <- newIORef 0
+    done <- newEmptyMVar
+    forM_ [1 .. n] $ forkIO . sleeper early done
+    replicateM_ n (takeMVar done)
+    readIORef early
+
+main :: IO ()
+main = do
+    args <- getArgs
+    case args of
+      ["bench", threads] -> do
+        let n = read threads
+        start <- getMonotonicTime
+        _ <- run n
+        end <- getMonotonicTime
+        printf "%d threads: %.3f s\n" n (end - start)
+      _ -> do
+        early <- run 20000
+        if early == 0
+          then putStrLn "ok"
+          else printf "%d threads woke up early\n" early
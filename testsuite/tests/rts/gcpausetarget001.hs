@@ -0,0 +1,12 @@
+import Data.List (foldl')
+
+-- Allocates steadily while keeping a list alive, so that the pause target
+-- controller resizes the allocation area (and, with -G3, the intermediate
+-- generation) many times over the run.
+main :: IO ()
+main = do
+  let live = [ (i * 7919) `mod` 100003 | i <- [1..100000 :: Int] ]
+  print (sum live)
+  let churn = foldl' (+) 0 [ length (show i) | i <- [1..1000000 :: Int] ]
+  print churn
+  print (maximum live)
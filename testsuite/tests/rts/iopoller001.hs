@@ -0,0 +1,64 @@
+-- Many threads block reading from pipes and are woken up one at a time, so
+-- that every wakeup is a separate call of awaitEvent. With enough pipes the
+-- file descriptors go beyond FD_SETSIZE, which only --io-poller=epoll
+-- supports.
+--
+-- To compare the pollers, run with an argument "bench <readers>" and
+-- +RTS --io-poller=select or +RTS --io-poller=epoll.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.C
+import Foreign.Marshal.Array
+import Foreign.Storable
+import GHC.Clock
+import System.Environment
+import System.Posix.Resource
+import System.Posix.Types
+import Text.Printf
+import qualified System.Posix.Internals as SPI
+
+pipe :: IO (CInt, CInt)
+pipe = allocaArray 2 $ \fds -> do
+    throwErrnoIfMinus1_ "pipe" $ SPI.c_pipe fds
+    rd <- peekElemOff fds 0
+    wr <- peekElemOff fds 1
+    return (rd, wr)
+
+-- Allow as many open files as we can, and return how many that is.
+raiseFdLimit :: IO Integer
+raiseFdLimit = do
+    lims <- getResourceLimit ResourceOpenFiles
+    let wanted = case hardLimit lims of
+                   ResourceLimit n -> min n 8192
+                   _               -> 8192
+    setResourceLimit ResourceOpenFiles lims { softLimit = ResourceLimit wanted }
+    return wanted
+
+wakeReaders :: Int -> IO Double
+wakeReaders n = do
+    pipes <- replicateM n pipe
+    done <- newEmptyMVar
+    forM_ pipes $ \(rd, _) ->
+      forkIO $ threadWaitRead (Fd rd) >> putMVar done ()
+    threadDelay 10000 -- let them all block
+    start <- getMonotonicTime
+    forM_ pipes $ \(_, wr) -> do
+      _ <- withArray [42] $ \buf -> SPI.c_write wr buf 1
+      takeMVar done
+    end <- getMonotonicTime
+    forM_ pipes $ \(rd, wr) -> SPI.c_close rd >> SPI.c_close wr
+    return (end - start)
+
+main :: IO ()
+main = do
+    limit <- raiseFdLimit
+    args <- getArgs
+    case args of
+      ["bench", readers] -> do
+        let n = read readers
+        t <- wakeReaders n
+        printf "%d readers: %.1f us per wakeup\n" n (t * 1e6 / fromIntegral n)
+      _ -> do
+        _ <- wakeReaders (fromInteger (min 1500 ((limit - 64) `div` 2)))
+        putStrLn "ok"
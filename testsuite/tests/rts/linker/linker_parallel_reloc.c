@@ -0,0 +1,46 @@
+#include "ghcconfig.h"
+#include "Rts.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Load and resolve more objects than PARALLEL_RELOC_MIN_OBJECTS in
+// rts/Linker.c, so that they are relocated on several threads, and check
+// that every relocation was applied.
+
+#define NUM_OBJS 12
+
+int main (int argc, char *argv[])
+{
+    char obj[64];
+    long (*f)(void);
+    int i, r;
+
+    hs_init(&argc, &argv);
+
+    initLinker_(0);
+
+    for (i = 0; i < NUM_OBJS; i++) {
+        snprintf(obj, sizeof(obj), "linker_parallel_reloc_%d.o", i);
+        r = loadObj(obj);
+        if (!r) {
+            errorBelch("loadObj(%s) failed", obj);
+            exit(1);
+        }
+    }
+
+    r = resolveObjs();
+    if (!r) {
+        errorBelch("resolveObjs failed");
+        exit(1);
+    }
+
+    f = lookupSymbol("reloc_obj_11");
+    if (!f) {
+        errorBelch("lookupSymbol failed");
+        exit(1);
+    }
+    printf("%ld\n", f());
+
+    hs_exit();
+    return 0;
+}
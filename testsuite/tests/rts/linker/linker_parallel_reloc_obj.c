@@ -0,0 +1,20 @@
+/* Compiled once per object by the linker_parallel_reloc test, with
+ * -DSELF=reloc_obj_<n> -DVALUE=<n>, and -DPREV=reloc_obj_<n-1> for all but
+ * the first, so that every object has code and data relocations, and
+ * relocations against a symbol of the object before it. */
+
+static long value = VALUE;
+static long *value_ptr = &value;
+
+#if defined(PREV)
+extern long PREV(void);
+#endif
+
+long SELF(void)
+{
+#if defined(PREV)
+    return *value_ptr + PREV();
+#else
+    return *value_ptr;
+#endif
+}
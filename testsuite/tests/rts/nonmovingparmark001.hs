@@ -0,0 +1,32 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import System.Mem
+
+data Tree = Leaf | Node Tree !Int Tree
+
+build :: Int -> Int -> Tree
+build 0 _ = Leaf
+build d n = Node (build (d - 1) (2 * n)) n (build (d - 1) (2 * n + 1))
+
+total :: Tree -> Int
+total Leaf = 0
+total (Node l n r) = total l + n + total r
+
+-- Keep a large tree live in the nonmoving heap while other threads mutate
+-- references into it, so that parallel mark workers race with the write
+-- barrier.
+main :: IO ()
+main = do
+  let t = build 18 1
+  print (total t)
+  refs <- forM [1 .. 64 :: Int] $ \i -> newIORef (build 8 i)
+  done <- newEmptyMVar
+  forM_ [1 .. 2 :: Int] $ \k -> forkIO $ do
+    forM_ [1 .. 20000 :: Int] $ \i ->
+      writeIORef (refs !! (i `mod` 64)) (build 6 (i + k))
+    putMVar done ()
+  replicateM_ 5 performMajorGC
+  replicateM_ 2 (takeMVar done)
+  performMajorGC
+  print (total t)
@@ -0,0 +1,17 @@
+-- Allocate from several capabilities on different (pretend) NUMA nodes, so
+-- that the per-node block accounting is exercised and reported by -S.
+import Control.Concurrent
+import Control.Monad
+import Data.List (foldl')
+
+main :: IO ()
+main = do
+  n <- getNumCapabilities
+  dones <- forM [0 .. n - 1] $ \i -> do
+    done <- newEmptyMVar
+    _ <- forkOn i $ do
+      let xs = [1 .. 200000 + i] :: [Int]
+      putMVar done $! foldl' (+) 0 (map (* 2) (reverse xs))
+    return done
+  rs <- mapM takeMVar dones
+  print (length rs)
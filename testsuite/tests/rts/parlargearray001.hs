@@ -0,0 +1,22 @@
+import Control.Monad
+import Data.Array
+import Data.Array.IO
+import System.Mem
+
+-- Large boxed arrays whose elements live in the young generation, so that
+-- parallel GC splits their scavenging across GC threads (see Note [Splitting
+-- large arrays] in rts/sm/Scav.c). After each GC every element must still be
+-- there.
+main :: IO ()
+main = do
+  let n = 2000000
+  marr <- newArray (0, n - 1) Nothing :: IO (IOArray Int (Maybe Int))
+  forM_ [1 .. 4 :: Int] $ \r -> do
+    forM_ [0, 3 .. n - 1] $ \i -> writeArray marr i (Just (i * r))
+    performMinorGC
+    performMajorGC
+    s <- foldM (\acc i -> maybe acc (+ acc) <$> readArray marr i) 0 [0 .. n - 1]
+    print s
+  let farr = listArray (0, n - 1) [ Just i | i <- [0 .. n - 1] ] :: Array Int (Maybe Int)
+  performMajorGC
+  print (sum [ x | Just x <- elems farr ])
@@ -0,0 +1,17 @@
+import Control.Monad
+import Data.IORef
+import Data.List (foldl')
+
+data Entry = Entry !Int !Int
+
+-- A cache that keeps growing while the program allocates plenty of
+-- short-lived data, so that its entries survive many GCs.
+main :: IO ()
+main = do
+  cache <- newIORef []
+  forM_ [1..20000 :: Int] $ \i -> do
+    let junk = foldl' (+) 0 [ j * i `mod` 7 | j <- [1..50] ]
+    modifyIORef' cache (Entry i junk :)
+  es <- readIORef cache
+  print (length es)
+  print (foldl' (\acc (Entry k v) -> (acc + k * v) `mod` 1000000007) 0 es)
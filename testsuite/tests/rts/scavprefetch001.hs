@@ -0,0 +1,29 @@
+import Control.Monad
+import System.Mem
+
+data Tree = Leaf | Node Tree !Int Tree
+
+insert :: Int -> Tree -> Tree
+insert x Leaf = Node Leaf x Leaf
+insert x t@(Node l y r)
+  | x < y     = Node (insert x l) y r
+  | x > y     = Node l y (insert x r)
+  | otherwise = t
+
+total :: Tree -> Int
+total Leaf = 0
+total (Node l n r) = total l + n + total r
+
+size :: Tree -> Int
+size Leaf = 0
+size (Node l _ r) = size l + 1 + size r
+
+-- A large search tree built from scattered keys, so that the copying
+-- collector's evacuations are spread all over the heap.
+main :: IO ()
+main = do
+  let keys = take 200000 (iterate (\k -> (k * 1103515245 + 12345) `mod` 2147483648) 42)
+      t = foldr insert Leaf keys
+  print (size t)
+  replicateM_ 3 performMajorGC
+  print (total t `mod` 1000000007)
@@ -0,0 +1,17 @@
+-- Run a spark-heavy workload under a non-default --spark-steal policy.
+-- The policy only affects which pools are raided, never the result.
+import GHC.Conc (par, pseq)
+
+pfib :: Int -> Int
+pfib n
+  | n < 15    = sfib n
+  | otherwise = a `par` (b `pseq` (a + b + 1))
+  where
+    a = pfib (n - 1)
+    b = pfib (n - 2)
+
+sfib :: Int -> Int
+sfib n = if n < 2 then 1 else sfib (n - 1) + sfib (n - 2) + 1
+
+main :: IO ()
+main = print (pfib 27)
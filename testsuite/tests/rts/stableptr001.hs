@@ -0,0 +1,36 @@
+import Control.Concurrent
+import Control.Monad
+import Foreign.StablePtr
+import System.Mem
+
+-- Create, dereference and free stable pointers from several threads at once,
+-- so that capabilities refill and return their caches of free stable pointer
+-- table entries while the table is being enlarged.
+
+worker :: Int -> IO Bool
+worker w = and <$> forM [1 .. 200] (\r -> do
+    let vals = [w * 1000000 + r * 1000 + i | i <- [1 .. 300]] :: [Int]
+    sps <- mapM newStablePtr vals
+    when (r `mod` 50 == 0) performGC
+    vals' <- mapM deRefStablePtr sps
+    mapM_ freeStablePtr sps
+    return (vals == vals'))
+
+-- Then disable some capabilities, which gives back the entries they have
+-- cached, and carry on from the ones that are left.
+
+runWorkers :: IO Bool
+runWorkers = do
+  results <- forM [1 .. 8] $ \w -> do
+    mv <- newEmptyMVar
+    _ <- forkIO (worker w >>= putMVar mv)
+    return mv
+  and <$> mapM takeMVar results
+
+main :: IO ()
+main = do
+  setNumCapabilities 4
+  ok1 <- runWorkers
+  setNumCapabilities 1
+  ok2 <- runWorkers
+  print (ok1 && ok2)
@@ -0,0 +1,32 @@
+-- Many read-only transactions racing against transfers between TVars.
+-- Read-only transactions may commit from their snapshot without
+-- revalidation (Note [STM version clock]); the sum they see must still be
+-- consistent.
+import Control.Concurrent
+import GHC.Conc
+import Control.Monad
+
+nAccounts, nTransfers, nReaders, nReads :: Int
+nAccounts  = 64
+nTransfers = 20000
+nReaders   = 4
+nReads     = 2000
+
+main :: IO ()
+main = do
+  accounts <- replicateM nAccounts (newTVarIO (100 :: Int))
+  let total = 100 * nAccounts
+  done <- newEmptyMVar
+  forkIO $ do
+    forM_ [1 .. nTransfers] $ \i -> atomically $ do
+      let from = accounts !! (i `mod` nAccounts)
+          to   = accounts !! ((i * 7) `mod` nAccounts)
+      readTVar from >>= writeTVar from . subtract 1
+      readTVar to >>= writeTVar to . (+ 1)
+    putMVar done True
+  forM_ [1 .. nReaders] $ \_ -> forkIO $ do
+    sums <- replicateM nReads (atomically (sum <$> mapM readTVar accounts))
+    putMVar done (all (== total) sums)
+  oks <- replicateM (nReaders + 1) (takeMVar done)
+  final <- atomically (sum <$> mapM readTVar accounts)
+  print (and oks, final == total)
@@ -0,0 +1,258 @@
+// Tests for the RTS hash tables (rts/Hash.c).
+//
+// Run with an argument "bench" to also time lookups on workloads shaped like
+// the linker's symbol table (string keys) and the stable name table (pointer
+// keys).
+
+#include "Rts.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct hashtable HashTable;
+typedef struct strhashtable StrHashTable;
+
+extern HashTable *allocHashTable(void);
+extern HashTable *allocConcurrentHashTable(void);
+extern void insertHashTable(HashTable *table, StgWord key, const void *data);
+extern void *lookupHashTable(const HashTable *table, StgWord key);
+extern void *lookupHashTableConcurrent(const HashTable *table, StgWord key);
+extern void *removeHashTable(HashTable *table, StgWord key, const void *data);
+extern int keyCountHashTable(HashTable *table);
+extern void freeHashTable(HashTable *table, void (*freeDataFun)(void *));
+extern void insertStrHashTable(StrHashTable *table, const char *key,
+                               const void *data);
+extern void *lookupStrHashTable(const StrHashTable *table, const char *key);
+extern void *removeStrHashTable(StrHashTable *table, const char *key,
+                                const void *data);
+
+#define WORDS    100000
+#define SYMBOLS  20000
+
+#define BENCH_WORDS    1000000
+#define BENCH_SYMBOLS  200000
+#define BENCH_ROUNDS   10
+
+static StgWord key_of(StgWord i)
+{
+    // pointer-like keys: word aligned, mostly increasing
+    return 0x42000000 + i * sizeof(StgWord) * 3;
+}
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        exit(1);
+    }
+}
+
+static void test_words(HashTable *t, void *(*lookup)(const HashTable*, StgWord))
+{
+    for (StgWord i = 0; i < WORDS; i++) {
+        insertHashTable(t, key_of(i), (void*) (i + 1));
+    }
+    check(keyCountHashTable(t) == WORDS, "word count");
+
+    for (StgWord i = 0; i < WORDS; i++) {
+        check(lookup(t, key_of(i)) == (void*) (i + 1), "word lookup");
+    }
+    check(lookup(t, key_of(WORDS)) == NULL, "word lookup missing");
+
+    // remove every other key
+    for (StgWord i = 0; i < WORDS; i += 2) {
+        check(removeHashTable(t, key_of(i), NULL) == (void*) (i + 1),
+              "word remove");
+    }
+    check(keyCountHashTable(t) == WORDS / 2, "word count after remove");
+
+    for (StgWord i = 0; i < WORDS; i++) {
+        void *expected = i % 2 == 0 ? NULL : (void*) (i + 1);
+        check(lookup(t, key_of(i)) == expected, "word lookup after remove");
+    }
+}
+
+static void test_duplicates(void)
+{
+    HashTable *t = allocHashTable();
+
+    // A newer entry for the same key shadows the older one, and removing a
+    // (key, data) pair uncovers the other entry again.
+    insertHashTable(t, 7, (void*) 1);
+    insertHashTable(t, 7, (void*) 2);
+    insertHashTable(t, 7, (void*) 3);
+    check(keyCountHashTable(t) == 3, "duplicate count");
+    check(lookupHashTable(t, 7) == (void*) 3, "newest duplicate");
+
+    // force the table to grow, which must preserve the order
+    for (StgWord i = 0; i < 1000; i++) {
+        insertHashTable(t, key_of(i), (void*) i);
+    }
+    check(lookupHashTable(t, 7) == (void*) 3, "newest duplicate after grow");
+
+    check(removeHashTable(t, 7, (void*) 2) == (void*) 2, "remove pair");
+    check(lookupHashTable(t, 7) == (void*) 3, "remove pair keeps newest");
+    check(removeHashTable(t, 7, NULL) == (void*) 3, "remove newest");
+    check(lookupHashTable(t, 7) == (void*) 1, "oldest duplicate");
+    check(removeHashTable(t, 7, NULL) == (void*) 1, "remove oldest");
+    check(lookupHashTable(t, 7) == NULL, "all duplicates removed");
+
+    freeHashTable(t, NULL);
+}
+
+static char **make_symbols(int n)
+{
+    char **syms = malloc(n * sizeof(char*));
+    for (int i = 0; i < n; i++) {
+        syms[i] = malloc(64);
+        snprintf(syms[i], 64, "base_GHCziBase_zdfFunctor%d_closure", i);
+    }
+    return syms;
+}
+
+static void free_symbols(char **syms, int n)
+{
+    for (int i = 0; i < n; i++) {
+        free(syms[i]);
+    }
+    free(syms);
+}
+
+static void test_strings(void)
+{
+    StrHashTable *t = (StrHashTable*) allocHashTable();
+    char **syms = make_symbols(SYMBOLS);
+    char buf[64];
+
+    for (int i = 0; i < SYMBOLS; i++) {
+        insertStrHashTable(t, syms[i], syms[i]);
+    }
+    for (int i = 0; i < SYMBOLS; i++) {
+        // look up with a different pointer to the same string
+        strcpy(buf, syms[i]);
+        check(lookupStrHashTable(t, buf) == syms[i], "string lookup");
+    }
+    check(lookupStrHashTable(t, "no_such_symbol") == NULL,
+          "string lookup missing");
+    for (int i = 0; i < SYMBOLS; i++) {
+        check(removeStrHashTable(t, syms[i], NULL) == syms[i],
+              "string remove");
+    }
+    check(keyCountHashTable((HashTable*) t) == 0, "string count");
+
+    freeHashTable((HashTable*) t, NULL);
+    free_symbols(syms, SYMBOLS);
+}
+
+// A random permutation of [0, n), so that lookups do not simply walk memory
+static StgWord *shuffled(StgWord n)
+{
+    StgWord *perm = malloc(n * sizeof(StgWord));
+    uint32_t seed = 0xf00f00;
+    for (StgWord i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (StgWord i = n - 1; i > 0; i--) {
+        seed = seed * 1664525 + 1013904223;
+        StgWord j = seed % (i + 1);
+        StgWord tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    return perm;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void)
+{
+    StrHashTable *st = (StrHashTable*) allocHashTable();
+    char **syms = make_symbols(BENCH_SYMBOLS);
+    StgWord *perm = shuffled(BENCH_SYMBOLS);
+    double t0, t1;
+    StgWord hits = 0;
+
+    t0 = now();
+    for (int i = 0; i < BENCH_SYMBOLS; i++) {
+        insertStrHashTable(st, syms[i], syms[i]);
+    }
+    t1 = now();
+    printf("symbols: insert %.1f ns/op\n", (t1 - t0) * 1e9 / BENCH_SYMBOLS);
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < BENCH_SYMBOLS; i++) {
+            hits += lookupStrHashTable(st, syms[perm[i]]) != NULL;
+        }
+    }
+    t1 = now();
+    printf("symbols: lookup %.1f ns/op\n",
+           (t1 - t0) * 1e9 / ((double) BENCH_SYMBOLS * BENCH_ROUNDS));
+    freeHashTable((HashTable*) st, NULL);
+    free_symbols(syms, BENCH_SYMBOLS);
+    free(perm);
+
+    perm = shuffled(BENCH_WORDS);
+
+    HashTable *wt = allocConcurrentHashTable();
+    t0 = now();
+    for (StgWord i = 0; i < BENCH_WORDS; i++) {
+        insertHashTable(wt, key_of(i), (void*) i);
+    }
+    t1 = now();
+    printf("pointers: insert %.1f ns/op\n", (t1 - t0) * 1e9 / BENCH_WORDS);
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (StgWord i = 0; i < BENCH_WORDS; i++) {
+            hits += lookupHashTable(wt, key_of(perm[i])) != NULL;
+        }
+    }
+    t1 = now();
+    printf("pointers: lookup %.1f ns/op\n",
+           (t1 - t0) * 1e9 / ((double) BENCH_WORDS * BENCH_ROUNDS));
+
+    t0 = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (StgWord i = 0; i < BENCH_WORDS; i++) {
+            hits += lookupHashTableConcurrent(wt, key_of(perm[i])) != NULL;
+        }
+    }
+    t1 = now();
+    printf("pointers: concurrent lookup %.1f ns/op\n",
+           (t1 - t0) * 1e9 / ((double) BENCH_WORDS * BENCH_ROUNDS));
+    freeHashTable(wt, NULL);
+    free(perm);
+
+    printf("hits: %" FMT_Word "\n", hits);
+}
+
+int main (int argc, char *argv[])
+{
+    hs_init(&argc, &argv);
+
+    HashTable *t = allocHashTable();
+    test_words(t, lookupHashTable);
+    freeHashTable(t, NULL);
+
+    t = allocConcurrentHashTable();
+    test_words(t, lookupHashTableConcurrent);
+    freeHashTable(t, NULL);
+
+    test_duplicates();
+    test_strings();
+    printf("ok\n");
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+    }
+
+    hs_exit();
+    return 0;
+}
@@ -383,6 +383,9 @@ wanteds os = concat
           ,structField C    "Capability" "total_allocated"
           ,structField C    "Capability" "weak_ptr_list_hd"
           ,structField C    "Capability" "weak_ptr_list_tl"
+          ,structField C    "Capability" "compact_str"
+          ,structField C    "Capability" "compact_bd"
+          ,structField C    "Capability" "compact_lim"
 
           ,structField Both "bdescr" "start"
           ,structField Both "bdescr" "free"
@@ -559,10 +562,7 @@ wanteds os = concat
           ,closureField C "StgCompactNFData" "autoBlockW"
           ,closureField C "StgCompactNFData" "nursery"
           ,closureField C "StgCompactNFData" "last"
-          ,closureField C "StgCompactNFData" "hp"
-          ,closureField C "StgCompactNFData" "hpLim"
           ,closureField C "StgCompactNFData" "hash"
-          ,closureField C "StgCompactNFData" "result"
 
           ,structSize   C "StgCompactNFDataBlock"
           ,structField  C "StgCompactNFDataBlock" "self"